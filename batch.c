@@ -0,0 +1,478 @@
+/*----------------------------------------------------------------------------
+ *
+ * batch.c
+ *
+ * One-vs-many alignment kernels
+ *
+ * When one query is scored against many candidates, the candidates are packed
+ * into PGS_BATCH_LANES lanes and their dynamic programming matrices are filled
+ * in lockstep, that is, cell (i, j) of every lane is computed by the same
+ * instructions (inter-sequence vectorization). The innermost loop runs over
+ * the lanes and has no dependency between iterations, so the compiler turns
+ * it into SIMD code (this file is built with CFLAGS_VECTORIZE).
+ *
+ * Candidates are stored interleaved: character j of lane l is at
+ * packed[j * PGS_BATCH_LANES + l]. Lanes are filled with candidates of similar
+ * length (they are sorted by length first) so that short candidates don't
+ * waste too many padding columns. Columns beyond a candidate's length are
+ * computed but never read for that lane.
+ *
+ * The recurrences (and the degenerated cases) are the same ones used by
+ * _lev(), _nwunsch() and _smithwaterman(); the query is the first argument.
+ *
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "similarity.h"
+
+
+/*
+ * sort candidates by length; ties keep the original order
+ */
+static int
+batch_len_cmp(const void *a, const void *b, void *arg)
+{
+	int		*lens = (int *) arg;
+	int		ia = *(const int *) a;
+	int		ib = *(const int *) b;
+
+	if (lens[ia] != lens[ib])
+		return (lens[ia] < lens[ib]) ? -1 : 1;
+	return (ia < ib) ? -1 : ((ia > ib) ? 1 : 0);
+}
+
+/*
+ * Build the processing order of the candidates. Also returns the longest
+ * candidate so the caller can size the lane buffers once.
+ */
+static int *
+batch_order(char **c, int n, int *lens, int *maxlen)
+{
+	int		*order;
+	int		i;
+
+	order = (int *) palloc(n * sizeof(int));
+
+	*maxlen = 0;
+	for (i = 0; i < n; i++)
+	{
+		lens[i] = strlen(c[i]);
+		if (lens[i] > *maxlen)
+			*maxlen = lens[i];
+		order[i] = i;
+	}
+
+	qsort_arg(order, n, sizeof(int), batch_len_cmp, lens);
+
+	return order;
+}
+
+/*
+ * Interleave up to PGS_BATCH_LANES candidates (starting at order[first]) into
+ * packed. Unused lanes and columns are zero-filled. Returns the longest
+ * candidate of this group.
+ */
+static int
+batch_pack(char **c, int *lens, int *order, int first, int n, char *packed,
+		   int *lanelen)
+{
+	int		l, j;
+	int		maxlen = 0;
+
+	for (l = 0; l < PGS_BATCH_LANES; l++)
+	{
+		if (first + l < n)
+			lanelen[l] = lens[order[first + l]];
+		else
+			lanelen[l] = 0;
+
+		if (lanelen[l] > maxlen)
+			maxlen = lanelen[l];
+	}
+
+	memset(packed, 0, (maxlen + 1) * PGS_BATCH_LANES);
+
+	for (l = 0; l < PGS_BATCH_LANES && first + l < n; l++)
+	{
+		char	*s = c[order[first + l]];
+
+		for (j = 0; j < lanelen[l]; j++)
+		{
+#ifdef PGS_IGNORE_CASE
+			packed[j * PGS_BATCH_LANES + l] = tolower(s[j]);
+#else
+			packed[j * PGS_BATCH_LANES + l] = s[j];
+#endif
+		}
+	}
+
+	return maxlen;
+}
+
+/*
+ * Levenshtein distance between q and each of c[0..n); see _lev().
+ */
+void _lev_batch(char *q, char **c, int n, int icost, int dcost, int *res)
+{
+	int		qlen;
+	int		*lens, *order;
+	int		maxlen;
+	int		*arow, *brow, *trow;
+	char	*packed;
+	int		lanelen[PGS_BATCH_LANES];
+	int		first;
+	int		i, j, l;
+
+	if (n <= 0)
+		return;
+
+	qlen = strlen(q);
+
+#ifdef PGS_IGNORE_CASE
+	for (i = 0; i < qlen; i++)
+		q[i] = tolower(q[i]);
+#endif
+
+	lens = (int *) palloc(n * sizeof(int));
+	order = batch_order(c, n, lens, &maxlen);
+
+	arow = (int *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(int));
+	brow = (int *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(int));
+	packed = (char *) palloc((maxlen + 1) * PGS_BATCH_LANES);
+
+	for (first = 0; first < n; first += PGS_BATCH_LANES)
+	{
+		int		glen = batch_pack(c, lens, order, first, n, packed, lanelen);
+
+		elog(DEBUG2, "lev batch: lanes %d .. %d; longest candidate: %d",
+			 first, Min(first + PGS_BATCH_LANES, n) - 1, glen);
+
+		/* initial values */
+		for (j = 0; j <= glen; j++)
+			for (l = 0; l < PGS_BATCH_LANES; l++)
+				arow[j * PGS_BATCH_LANES + l] = j;
+
+		for (i = 1; i <= qlen; i++)
+		{
+			char	qc = q[i - 1];
+
+			/* first value is 'i' */
+			for (l = 0; l < PGS_BATCH_LANES; l++)
+				brow[l] = i;
+
+			for (j = 1; j <= glen; j++)
+			{
+				const char	*cj = packed + (j - 1) * PGS_BATCH_LANES;
+				const int	*up = arow + j * PGS_BATCH_LANES;
+				const int	*diag = arow + (j - 1) * PGS_BATCH_LANES;
+				const int	*left = brow + (j - 1) * PGS_BATCH_LANES;
+				int			*cur = brow + j * PGS_BATCH_LANES;
+
+				for (l = 0; l < PGS_BATCH_LANES; l++)
+				{
+					int	s = diag[l] + ((cj[l] == qc) ? PGS_LEV_MIN_COST : PGS_LEV_MAX_COST);
+					int	d = up[l] + dcost;
+					int	ins = left[l] + icost;
+
+					s = (d < s) ? d : s;
+					cur[l] = (ins < s) ? ins : s;
+				}
+			}
+
+			trow = arow;
+			arow = brow;
+			brow = trow;
+		}
+
+		for (l = 0; l < PGS_BATCH_LANES && first + l < n; l++)
+		{
+			int		k = order[first + l];
+
+			if (qlen == 0)
+				res[k] = lanelen[l];
+			else if (lanelen[l] == 0)
+				res[k] = qlen;
+			else
+				res[k] = arow[lanelen[l] * PGS_BATCH_LANES + l];
+		}
+	}
+
+	pfree(arow);
+	pfree(brow);
+	pfree(packed);
+	pfree(order);
+	pfree(lens);
+}
+
+/*
+ * Needleman-Wunsch score between q and each of c[0..n); see _nwunsch().
+ *
+ * The substitution cost of a query row is looked up in a query profile (the
+ * cost of the query character against every possible character) instead of
+ * calling nwcost() per cell.
+ */
+void _nwunsch_batch(char *q, char **c, int n, int gap, int *res)
+{
+	int		qlen;
+	int		*lens, *order;
+	int		maxlen;
+	int		*arow, *brow, *trow;
+	char	*packed;
+	int		profile[256];
+	int		lanelen[PGS_BATCH_LANES];
+	int		first;
+	int		i, j, l;
+
+	if (n <= 0)
+		return;
+
+	qlen = strlen(q);
+
+#ifdef PGS_IGNORE_CASE
+	for (i = 0; i < qlen; i++)
+		q[i] = tolower(q[i]);
+#endif
+
+	lens = (int *) palloc(n * sizeof(int));
+	order = batch_order(c, n, lens, &maxlen);
+
+	arow = (int *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(int));
+	brow = (int *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(int));
+	packed = (char *) palloc((maxlen + 1) * PGS_BATCH_LANES);
+
+	for (first = 0; first < n; first += PGS_BATCH_LANES)
+	{
+		int		glen = batch_pack(c, lens, order, first, n, packed, lanelen);
+
+		elog(DEBUG2, "nw batch: lanes %d .. %d; longest candidate: %d",
+			 first, Min(first + PGS_BATCH_LANES, n) - 1, glen);
+
+		/* initial values */
+		for (j = 0; j <= glen; j++)
+			for (l = 0; l < PGS_BATCH_LANES; l++)
+				arow[j * PGS_BATCH_LANES + l] = gap * j;
+
+		for (i = 1; i <= qlen; i++)
+		{
+			int		k;
+
+			for (k = 0; k < 256; k++)
+				profile[k] = nwcost(q[i - 1], (char) k);
+
+			/* first value is 'gap * i' */
+			for (l = 0; l < PGS_BATCH_LANES; l++)
+				brow[l] = gap * i;
+
+			for (j = 1; j <= glen; j++)
+			{
+				const unsigned char	*cj = (unsigned char *) packed + (j - 1) * PGS_BATCH_LANES;
+				const int	*up = arow + j * PGS_BATCH_LANES;
+				const int	*diag = arow + (j - 1) * PGS_BATCH_LANES;
+				const int	*left = brow + (j - 1) * PGS_BATCH_LANES;
+				int			*cur = brow + j * PGS_BATCH_LANES;
+
+				for (l = 0; l < PGS_BATCH_LANES; l++)
+				{
+					int	s = diag[l] + profile[cj[l]];
+					int	d = up[l] + gap;
+					int	ins = left[l] + gap;
+
+					s = (d > s) ? d : s;
+					cur[l] = (ins > s) ? ins : s;
+				}
+			}
+
+			trow = arow;
+			arow = brow;
+			brow = trow;
+		}
+
+		for (l = 0; l < PGS_BATCH_LANES && first + l < n; l++)
+		{
+			int		k = order[first + l];
+
+			if (qlen == 0)
+				res[k] = lanelen[l];
+			else if (lanelen[l] == 0)
+				res[k] = qlen;
+			else
+				res[k] = arow[lanelen[l] * PGS_BATCH_LANES + l];
+		}
+	}
+
+	pfree(arow);
+	pfree(brow);
+	pfree(packed);
+	pfree(order);
+	pfree(lens);
+}
+
+/*
+ * Smith-Waterman score between q and each of c[0..n); see _smithwaterman().
+ *
+ * Every lane keeps its own running maximum; cells beyond the lane's candidate
+ * length are masked out of it.
+ */
+void _smithwaterman_batch(char *q, char **c, int n, double *res)
+{
+	int		qlen;
+	int		*lens, *order;
+	int		maxlen;
+	float	*arow, *brow, *trow;
+	char	*packed;
+	float	maxvalue[PGS_BATCH_LANES];
+	int		lanelen[PGS_BATCH_LANES];
+	int		first;
+	int		i, j, l;
+
+	if (n <= 0)
+		return;
+
+	qlen = strlen(q);
+
+#ifdef PGS_IGNORE_CASE
+	for (i = 0; i < qlen; i++)
+		q[i] = tolower(q[i]);
+#endif
+
+	lens = (int *) palloc(n * sizeof(int));
+	order = batch_order(c, n, lens, &maxlen);
+
+	arow = (float *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(float));
+	brow = (float *) palloc((maxlen + 1) * PGS_BATCH_LANES * sizeof(float));
+	packed = (char *) palloc((maxlen + 1) * PGS_BATCH_LANES);
+
+	for (first = 0; first < n; first += PGS_BATCH_LANES)
+	{
+		int		glen = batch_pack(c, lens, order, first, n, packed, lanelen);
+
+		elog(DEBUG2, "sw batch: lanes %d .. %d; longest candidate: %d",
+			 first, Min(first + PGS_BATCH_LANES, n) - 1, glen);
+
+		/* initial values */
+		for (j = 0; j < (glen + 1) * PGS_BATCH_LANES; j++)
+			arow[j] = 0.0;
+		for (l = 0; l < PGS_BATCH_LANES; l++)
+			maxvalue[l] = 0.0;
+
+		for (i = 1; i <= qlen; i++)
+		{
+			char	qc = q[i - 1];
+
+			for (l = 0; l < PGS_BATCH_LANES; l++)
+				brow[l] = 0.0;
+
+			for (j = 1; j <= glen; j++)
+			{
+				const char	*cj = packed + (j - 1) * PGS_BATCH_LANES;
+				const float	*up = arow + j * PGS_BATCH_LANES;
+				const float	*diag = arow + (j - 1) * PGS_BATCH_LANES;
+				const float	*left = brow + (j - 1) * PGS_BATCH_LANES;
+				float		*cur = brow + j * PGS_BATCH_LANES;
+
+				for (l = 0; l < PGS_BATCH_LANES; l++)
+				{
+					float	s = diag[l] + ((cj[l] == qc) ? PGS_SW_MAX_COST : PGS_SW_MIN_COST);
+					float	d = up[l] + PGS_SW_GAP_COST;
+					float	ins = left[l] + PGS_SW_GAP_COST;
+					float	m;
+
+					s = (d > s) ? d : s;
+					s = (ins > s) ? ins : s;
+					s = (s > 0.0f) ? s : 0.0f;
+					cur[l] = s;
+
+					/* padding columns don't count */
+					m = (j <= lanelen[l]) ? s : 0.0f;
+					maxvalue[l] = (m > maxvalue[l]) ? m : maxvalue[l];
+				}
+			}
+
+			trow = arow;
+			arow = brow;
+			brow = trow;
+		}
+
+		for (l = 0; l < PGS_BATCH_LANES && first + l < n; l++)
+		{
+			int		k = order[first + l];
+
+			if (qlen == 0)
+				res[k] = lanelen[l];
+			else if (lanelen[l] == 0)
+				res[k] = qlen;
+			else
+				res[k] = maxvalue[l];
+		}
+	}
+
+	pfree(arow);
+	pfree(brow);
+	pfree(packed);
+	pfree(order);
+	pfree(lens);
+}
+
+/*
+ * Detoast the candidate array of a *_batch() function. Returns the non-null
+ * candidates as C strings (*ncand of them) and the null flags of the
+ * *nelems array elements.
+ */
+char **batchcandidates(ArrayType *arr, int *nelems, bool **nulls, int *ncand)
+{
+	Datum	*elems;
+	char	**c;
+	int		i;
+
+	if (ARR_NDIM(arr) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("candidates must be a one-dimensional array")));
+
+	deconstruct_array(arr, TEXTOID, -1, false, 'i', &elems, nulls, nelems);
+
+	c = (char **) palloc((*nelems + 1) * sizeof(char *));
+	*ncand = 0;
+
+	for (i = 0; i < *nelems; i++)
+	{
+		if ((*nulls)[i])
+			continue;
+
+		c[*ncand] = text_to_cstring(DatumGetTextPP(elems[i]));
+
+		if (strlen(c[*ncand]) > PGS_MAX_STR_LEN)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("argument exceeds the maximum length of %d bytes",
+							PGS_MAX_STR_LEN)));
+
+		(*ncand)++;
+	}
+
+	pfree(elems);
+
+	return c;
+}
+
+/*
+ * Build the float8[] result of a *_batch() function. It has the same bounds
+ * as the candidate array; null candidates give null scores.
+ */
+ArrayType *batchresult(ArrayType *arr, Datum *values, bool *nulls, int nelems)
+{
+	int		lbs[1];
+	int		dims[1];
+
+	if (nelems == 0)
+		return construct_empty_array(FLOAT8OID);
+
+	dims[0] = nelems;
+	lbs[0] = ARR_LBOUND(arr)[0];
+
+	return construct_md_array(values, nulls, 1, dims, lbs, FLOAT8OID,
+							  sizeof(float8), FLOAT8PASSBYVAL, 'd');
+}
@@ -189,3 +189,49 @@ Datum block_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_block_threshold);
 }
+
+PG_FUNCTION_INFO_V1(block_query_op);
+
+/*
+ * a ~++ ROW(b, c)::pgs_query is block(a, b) >= c; the measure is
+ * not normalized if pgs_block_is_normalized is off.
+ */
+Datum block_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 block,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(block_distance);
+
+/*
+ * block(a, b) not normalized: the L1 distance of the token counts; distance
+ * operator <++> (see vptree_block_ops)
+ */
+Datum block_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+	bool	tmp = pgs_block_is_normalized;
+
+	pgs_block_is_normalized = false;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 block,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	pgs_block_is_normalized = tmp;
+
+	PG_RETURN_FLOAT8(res);
+}
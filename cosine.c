@@ -141,3 +141,46 @@ Datum cosine_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_cosine_threshold);
 }
+
+PG_FUNCTION_INFO_V1(cosine_query_op);
+
+/*
+ * a ~## ROW(b, c)::pgs_query is cosine(a, b) >= c.
+ */
+Datum cosine_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 cosine,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(cosine_distance);
+
+/*
+ * 1 - cosine(a, b); distance operator <##> (see gist_similarity_ops)
+ */
+Datum cosine_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 cosine,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	/* no tokens at all: nothing in common */
+	if (isnan(res))
+		res = 0.0;
+
+	PG_RETURN_FLOAT8(1.0 - res);
+}
@@ -31,6 +31,8 @@
 #include "similarity.h"
 #include "tokenizer.h"
 
+#include <math.h>
+
 
 /* GUC variables */
 int		pgs_dice_tokenizer = PGS_UNIT_ALNUM;
@@ -154,3 +156,46 @@ Datum dice_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_dice_threshold);
 }
+
+PG_FUNCTION_INFO_V1(dice_query_op);
+
+/*
+ * a ~-~ ROW(b, c)::pgs_query is dice(a, b) >= c.
+ */
+Datum dice_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 dice,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(dice_distance);
+
+/*
+ * 1 - dice(a, b); distance operator <-~> (see gist_similarity_ops)
+ */
+Datum dice_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 dice,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	/* no tokens at all: nothing in common */
+	if (isnan(res))
+		res = 0.0;
+
+	PG_RETURN_FLOAT8(1.0 - res);
+}
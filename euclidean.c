@@ -196,3 +196,26 @@ Datum euclidean_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_euclidean_threshold);
 }
+
+PG_FUNCTION_INFO_V1(euclidean_distance);
+
+/*
+ * euclidean(a, b) not normalized: the L2 distance of the token sets;
+ * distance operator <!!> (see vptree_euclidean_ops)
+ */
+Datum euclidean_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+	bool	tmp = pgs_euclidean_is_normalized;
+
+	pgs_euclidean_is_normalized = false;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 euclidean,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	pgs_euclidean_is_normalized = tmp;
+
+	PG_RETURN_FLOAT8(res);
+}
@@ -0,0 +1,346 @@
+/*----------------------------------------------------------------------------
+ *
+ * hash64.c
+ *
+ * hash64 is a 64-bit binary code (e.g. a perceptual hash) stored by value.
+ * It has the same Hamming semantics as bit varying (see hamming.c) but the
+ * distance is just a popcount of two words: no varlena header and no detoast.
+ *
+ * The text representation is 16 hexadecimal digits.
+ *
+ * Radius search uses multi-index hashing (Norouzi, Punjani and Fleet, "Fast
+ * Search in Hamming Space with Multi-Index Hashing"). The code is split into
+ * m disjoint substrings; if two codes are within distance r then at least
+ * one pair of substrings is within floor(r / m). Each substring is indexed
+ * with a plain btree or hash index on hash64_chunk() and looked up exactly
+ * against the (few) values hash64_mih_keys() enumerates:
+ *
+ * SELECT * FROM t
+ * WHERE (hash64_chunk(h, 4, 0) = ANY (hash64_mih_keys(q, 4, 7, 0)) OR
+ *        hash64_chunk(h, 4, 1) = ANY (hash64_mih_keys(q, 4, 7, 1)) OR
+ *        hash64_chunk(h, 4, 2) = ANY (hash64_mih_keys(q, 4, 7, 2)) OR
+ *        hash64_chunk(h, 4, 3) = ANY (hash64_mih_keys(q, 4, 7, 3)))
+ *   AND h <~@~> q <= 7;
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "similarity.h"
+
+#include "libpq/pqformat.h"
+#include "utils/varbit.h"
+
+/* substrings are returned as int4 */
+#define	PGS_HASH64_MIN_CHUNKS	2
+#define	PGS_HASH64_MAX_CHUNKS	64
+
+/* upper limit of keys enumerated per substring */
+#define	PGS_HASH64_MAX_KEYS		100000
+
+PG_FUNCTION_INFO_V1(hash64_in);
+PG_FUNCTION_INFO_V1(hash64_out);
+PG_FUNCTION_INFO_V1(hash64_recv);
+PG_FUNCTION_INFO_V1(hash64_send);
+PG_FUNCTION_INFO_V1(hash64_from_varbit);
+PG_FUNCTION_INFO_V1(hash64_to_varbit);
+PG_FUNCTION_INFO_V1(hash64_eq);
+PG_FUNCTION_INFO_V1(hash64_ne);
+PG_FUNCTION_INFO_V1(hash64_hash);
+PG_FUNCTION_INFO_V1(hamming_hash64);
+PG_FUNCTION_INFO_V1(hamming_hash64_op);
+PG_FUNCTION_INFO_V1(hamming_hash64_distance);
+PG_FUNCTION_INFO_V1(hash64_chunk);
+PG_FUNCTION_INFO_V1(hash64_mih_keys);
+
+Datum
+hash64_in(PG_FUNCTION_ARGS)
+{
+	char	*str = PG_GETARG_CSTRING(0);
+	char	*p;
+	hash64	res = 0;
+
+	for (p = str; *p != '\0'; p++)
+	{
+		int		d;
+
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			d = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F')
+			d = *p - 'A' + 10;
+		else
+			break;
+
+		res = (res << 4) | d;
+	}
+
+	if (p == str || *p != '\0' || p - str > 2 * sizeof(hash64))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type hash64: \"%s\"", str)));
+
+	PG_RETURN_HASH64(res);
+}
+
+Datum
+hash64_out(PG_FUNCTION_ARGS)
+{
+	hash64	h = PG_GETARG_HASH64(0);
+
+	PG_RETURN_CSTRING(psprintf("%016" INT64_MODIFIER "x", h));
+}
+
+Datum
+hash64_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+
+	PG_RETURN_HASH64((hash64) pq_getmsgint64(buf));
+}
+
+Datum
+hash64_send(PG_FUNCTION_ARGS)
+{
+	hash64			h = PG_GETARG_HASH64(0);
+	StringInfoData	buf;
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, (int64) h);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * The first bit of the bit string is the most significant bit of the code,
+ * so B'1' || 63 zeros is 8000000000000000.
+ */
+Datum
+hash64_from_varbit(PG_FUNCTION_ARGS)
+{
+	VarBit	*v = PG_GETARG_VARBIT_P(0);
+	bits8	*p = VARBITS(v);
+	hash64	res = 0;
+	int		i;
+
+	if (VARBITLEN(v) != 64)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bit string length %d does not match type hash64",
+						VARBITLEN(v))));
+
+	for (i = 0; i < sizeof(hash64); i++)
+		res = (res << BITS_PER_BYTE) | p[i];
+
+	PG_RETURN_HASH64(res);
+}
+
+Datum
+hash64_to_varbit(PG_FUNCTION_ARGS)
+{
+	hash64	h = PG_GETARG_HASH64(0);
+	VarBit	*res;
+	int		len = VARBITTOTALLEN(64);
+	int		i;
+
+	res = (VarBit *) palloc0(len);
+	SET_VARSIZE(res, len);
+	VARBITLEN(res) = 64;
+
+	for (i = sizeof(hash64) - 1; i >= 0; i--)
+	{
+		VARBITS(res)[i] = (bits8) (h & 0xff);
+		h >>= BITS_PER_BYTE;
+	}
+
+	PG_RETURN_VARBIT_P(res);
+}
+
+Datum
+hash64_eq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(PG_GETARG_HASH64(0) == PG_GETARG_HASH64(1));
+}
+
+Datum
+hash64_ne(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(PG_GETARG_HASH64(0) != PG_GETARG_HASH64(1));
+}
+
+/* same as int8 */
+Datum
+hash64_hash(PG_FUNCTION_ARGS)
+{
+	return DirectFunctionCall1(hashint8, PG_GETARG_DATUM(0));
+}
+
+/*
+ * Same semantics as hamming(bit varying, bit varying).
+ */
+Datum
+hamming_hash64(PG_FUNCTION_ARGS)
+{
+	hash64	a = PG_GETARG_HASH64(0);
+	hash64	b = PG_GETARG_HASH64(1);
+	float8	res;
+
+	res = (float8) pgs_popcount64(a ^ b);
+
+	elog(DEBUG1, "is normalized: %d", pgs_hamming_is_normalized);
+	elog(DEBUG1, "hammingdistance(%016" INT64_MODIFIER "x, %016" INT64_MODIFIER "x) = %.3f",
+		 a, b, res);
+
+	if (pgs_hamming_is_normalized)
+		res = 1.0 - (res / 64);
+
+	PG_RETURN_FLOAT8(res);
+}
+
+Datum
+hamming_hash64_op(PG_FUNCTION_ARGS)
+{
+	float8	res;
+
+	/*
+	 * store *_is_normalized value temporarily 'cause
+	 * threshold (we're comparing against) is normalized
+	 */
+	bool	tmp = pgs_hamming_is_normalized;
+	pgs_hamming_is_normalized = true;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 hamming_hash64,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	/* we're done; back to the previous value */
+	pgs_hamming_is_normalized = tmp;
+
+	PG_RETURN_BOOL(res >= pgs_hamming_threshold);
+}
+
+Datum
+hamming_hash64_distance(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8((float8) pgs_popcount64(PG_GETARG_HASH64(0) ^ PG_GETARG_HASH64(1)));
+}
+
+/*
+ * Bits [lo, lo + width) of substring i (counting from the least significant
+ * bit) when the code is split into m substrings.
+ */
+static void
+hash64_chunk_bounds(int m, int i, int *lo, int *width)
+{
+	if (m < PGS_HASH64_MIN_CHUNKS || m > PGS_HASH64_MAX_CHUNKS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of substrings must be between %d and %d",
+						PGS_HASH64_MIN_CHUNKS, PGS_HASH64_MAX_CHUNKS)));
+	if (i < 0 || i >= m)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("substring %d is out of range (0 .. %d)", i, m - 1)));
+
+	*lo = (i * 64) / m;
+	*width = ((i + 1) * 64) / m - *lo;
+}
+
+static int32
+hash64_chunk_value(hash64 h, int lo, int width)
+{
+	return (int32) (uint32) ((h >> lo) & ((UINT64CONST(1) << width) - 1));
+}
+
+Datum
+hash64_chunk(PG_FUNCTION_ARGS)
+{
+	hash64	h = PG_GETARG_HASH64(0);
+	int32	m = PG_GETARG_INT32(1);
+	int32	i = PG_GETARG_INT32(2);
+	int		lo, width;
+
+	hash64_chunk_bounds(m, i, &lo, &width);
+
+	PG_RETURN_INT32(hash64_chunk_value(h, lo, width));
+}
+
+/*
+ * Every value of substring i that is within floor(r / m) bits of the query
+ * substring. Values with k different bits are enumerated as the k-subsets
+ * of the substring bits (Gosper's hack), nearest first.
+ */
+Datum
+hash64_mih_keys(PG_FUNCTION_ARGS)
+{
+	hash64		h = PG_GETARG_HASH64(0);
+	int32		m = PG_GETARG_INT32(1);
+	int32		r = PG_GETARG_INT32(2);
+	int32		i = PG_GETARG_INT32(3);
+	int			lo, width;
+	int			radius;
+	uint64		limit;
+	uint64		nkeys = 0;
+	uint64		binom = 1;
+	uint32		q;
+	Datum		*keys;
+	int			n = 0;
+	int			k;
+
+	hash64_chunk_bounds(m, i, &lo, &width);
+
+	if (r < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("radius must not be negative")));
+
+	radius = Min(r / m, width);
+	limit = UINT64CONST(1) << width;
+	q = (uint32) hash64_chunk_value(h, lo, width);
+
+	/* sum of binomial coefficients C(width, k) for k = 0 .. radius */
+	for (k = 0; k <= radius; k++)
+	{
+		nkeys += binom;
+		binom = binom * (width - k) / (k + 1);
+	}
+
+	elog(DEBUG1, "substring %d: bits [%d, %d); radius: %d; keys: " UINT64_FORMAT,
+		 i, lo, lo + width, radius, nkeys);
+
+	if (nkeys > PGS_HASH64_MAX_KEYS)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many keys (" UINT64_FORMAT ") for substring radius %d",
+						nkeys, radius),
+				 errhint("Split the code into more substrings.")));
+
+	keys = (Datum *) palloc(nkeys * sizeof(Datum));
+
+	for (k = 0; k <= radius; k++)
+	{
+		uint64	mask = (UINT64CONST(1) << k) - 1;
+
+		while (mask < limit)
+		{
+			uint64	c, t;
+
+			keys[n++] = Int32GetDatum((int32) (q ^ (uint32) mask));
+
+			if (mask == 0)
+				break;
+
+			/* next mask with the same number of bits set */
+			c = mask & -mask;
+			t = mask + c;
+			mask = (((t ^ mask) >> 2) / c) | t;
+		}
+	}
+
+	Assert(n == nkeys);
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(keys, n, INT4OID, sizeof(int32), true, 'i'));
+}
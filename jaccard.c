@@ -31,6 +31,8 @@
 #include "similarity.h"
 #include "tokenizer.h"
 
+#include <math.h>
+
 
 /* GUC variables */
 int		pgs_jaccard_tokenizer = PGS_UNIT_ALNUM;
@@ -154,3 +156,46 @@ Datum jaccard_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_jaccard_threshold);
 }
+
+PG_FUNCTION_INFO_V1(jaccard_query_op);
+
+/*
+ * a ~?? ROW(b, c)::pgs_query is jaccard(a, b) >= c.
+ */
+Datum jaccard_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 jaccard,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(jaccard_distance);
+
+/*
+ * 1 - jaccard(a, b); distance operator <??> (see gist_similarity_ops)
+ */
+Datum jaccard_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 jaccard,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	/* no tokens at all: nothing in common */
+	if (isnan(res))
+		res = 0.0;
+
+	PG_RETURN_FLOAT8(1.0 - res);
+}
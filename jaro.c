@@ -216,6 +216,21 @@ static double _jaro(char *a, char *b)
 	return res;
 }
 
+/*
+ * Upper bound of jaro(a, b) from the sketches of a and b (nonempty)
+ */
+static float8 _jaro_bound(PgsSketch *sa, int alen, PgsSketch *sb, int blen)
+{
+	int		m = pgs_sketch_common_bound(sa, alen, sb, blen);
+
+	if (m == 0)
+		return 0.0;
+
+	/* no transpositions; leave room for rounding */
+	return PGS_JARO_W1 * m / alen + PGS_JARO_W2 * m / blen + PGS_JARO_WT +
+		   PGS_JARO_BOUND_SLACK;
+}
+
 PG_FUNCTION_INFO_V1(jaro);
 
 Datum
@@ -242,19 +257,31 @@ PG_FUNCTION_INFO_V1(jaro_op);
 
 Datum jaro_op(PG_FUNCTION_ARGS)
 {
-	float8	res;
+	text		*a = PG_GETARG_TEXT_PP(0);
+	text		*b = PG_GETARG_TEXT_PP(1);
+	PgsSketch	sa, sb;
+	int			alen, blen;
+	float8		res;
+	bool		tmp;
+
+	/* too few common characters according to the character counts? */
+	if (pgs_sketch_args(a, b, &sa, &alen, &sb, &blen) && alen > 0 && blen > 0)
+	{
+		if (_jaro_bound(&sa, alen, &sb, blen) < pgs_jaro_threshold)
+			PG_RETURN_BOOL(false);
+	}
 
 	/*
 	 * store *_is_normalized value temporarily 'cause
 	 * threshold (we're comparing against) is normalized
 	 */
-	bool	tmp = pgs_jaro_is_normalized;
+	tmp = pgs_jaro_is_normalized;
 	pgs_jaro_is_normalized = true;
 
 	res = DatumGetFloat8(DirectFunctionCall2(
 							 jaro,
-							 PG_GETARG_DATUM(0),
-							 PG_GETARG_DATUM(1)));
+							 PointerGetDatum(a),
+							 PointerGetDatum(b)));
 
 	/* we're done; back to the previous value */
 	pgs_jaro_is_normalized = tmp;
@@ -310,19 +337,36 @@ PG_FUNCTION_INFO_V1(jarowinkler_op);
 
 Datum jarowinkler_op(PG_FUNCTION_ARGS)
 {
-	float8	res;
+	text		*a = PG_GETARG_TEXT_PP(0);
+	text		*b = PG_GETARG_TEXT_PP(1);
+	PgsSketch	sa, sb;
+	int			alen, blen;
+	float8		res;
+	bool		tmp;
+
+	/* even the longest common prefix can't make it? */
+	if (pgs_sketch_args(a, b, &sa, &alen, &sb, &blen) && alen > 0 && blen > 0)
+	{
+		float8	ub = _jaro_bound(&sa, alen, &sb, blen);
+
+		if (ub < 1.0)
+			ub += PGS_JARO_SCALING_FACTOR * PGS_JARO_PREFIX_SIZE * (1.0 - ub);
+
+		if (ub < pgs_jarowinkler_threshold)
+			PG_RETURN_BOOL(false);
+	}
 
 	/*
 	 * store *_is_normalized value temporarily 'cause
 	 * threshold (we're comparing against) is normalized
 	 */
-	bool	tmp = pgs_jarowinkler_is_normalized;
+	tmp = pgs_jarowinkler_is_normalized;
 	pgs_jarowinkler_is_normalized = true;
 
 	res = DatumGetFloat8(DirectFunctionCall2(
 							 jarowinkler,
-							 PG_GETARG_DATUM(0),
-							 PG_GETARG_DATUM(1)));
+							 PointerGetDatum(a),
+							 PointerGetDatum(b)));
 
 	/* we're done; back to the previous value */
 	pgs_jarowinkler_is_normalized = tmp;
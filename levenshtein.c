@@ -248,19 +248,33 @@ PG_FUNCTION_INFO_V1(lev_op);
 
 Datum lev_op(PG_FUNCTION_ARGS)
 {
-	float8	res;
+	text		*a = PG_GETARG_TEXT_PP(0);
+	text		*b = PG_GETARG_TEXT_PP(1);
+	PgsSketch	sa, sb;
+	int			alen, blen;
+	float8		res;
+	bool		tmp;
+
+	/* too many edits according to the character counts? */
+	if (pgs_sketch_args(a, b, &sa, &alen, &sb, &blen) && max2(alen, blen) > 0)
+	{
+		int		lb = max2(pgs_sketch_lev_bound(&sa, &sb), abs(alen - blen));
+
+		if (1.0 - ((float8) lb / max2(alen, blen)) < pgs_levenshtein_threshold)
+			PG_RETURN_BOOL(false);
+	}
 
 	/*
 	 * store *_is_normalized value temporarily 'cause
 	 * threshold (we're comparing against) is normalized
 	 */
-	bool	tmp = pgs_levenshtein_is_normalized;
+	tmp = pgs_levenshtein_is_normalized;
 	pgs_levenshtein_is_normalized = true;
 
 	res = DatumGetFloat8(DirectFunctionCall2(
 							 lev,
-							 PG_GETARG_DATUM(0),
-							 PG_GETARG_DATUM(1)));
+							 PointerGetDatum(a),
+							 PointerGetDatum(b)));
 
 	/* we're done; back to the previous value */
 	pgs_levenshtein_is_normalized = tmp;
@@ -268,6 +282,115 @@ Datum lev_op(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(res >= pgs_levenshtein_threshold);
 }
 
+PG_FUNCTION_INFO_V1(lev_query_op);
+
+/*
+ * a ~== ROW(b, c)::pgs_query is lev(a, b) >= c; the measure is not
+ * normalized if pgs_levenshtein_is_normalized is off.
+ */
+Datum lev_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 lev,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(lev_distance);
+
+/*
+ * Edit distance of a and b (lev() not normalized, and 0 for two empty
+ * strings); distance operator <==> (see vptree_lev_ops)
+ */
+Datum lev_distance(PG_FUNCTION_ARGS)
+{
+	char		*a, *b;
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+	b = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+
+	if (strlen(a) > PGS_MAX_STR_LEN || strlen(b) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	PG_RETURN_FLOAT8((float8) _lev(a, b, PGS_LEV_MAX_COST, PGS_LEV_MAX_COST));
+}
+
+PG_FUNCTION_INFO_V1(lev_batch);
+
+Datum
+lev_batch(PG_FUNCTION_ARGS)
+{
+	char		*a;
+	char		**b;
+	bool		*nulls;
+	int			nelems, ncand;
+	int			*dist;
+	Datum		*values;
+	int			alen;
+	int			i, k;
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+
+	alen = strlen(a);
+
+	if (alen > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	b = batchcandidates(PG_GETARG_ARRAYTYPE_P(1), &nelems, &nulls, &ncand);
+
+	dist = (int *) palloc((ncand + 1) * sizeof(int));
+	_lev_batch(a, b, ncand, PGS_LEV_MAX_COST, PGS_LEV_MAX_COST, dist);
+
+	elog(DEBUG1, "is normalized: %d", pgs_levenshtein_is_normalized);
+
+	values = (Datum *) palloc((nelems + 1) * sizeof(Datum));
+	for (i = 0, k = 0; i < nelems; i++)
+	{
+		int		maxlen;
+		float8	res;
+
+		if (nulls[i])
+		{
+			values[i] = (Datum) 0;
+			continue;
+		}
+
+		maxlen = max2(alen, (int) strlen(b[k]));
+		res = (float8) dist[k];
+
+		elog(DEBUG1, "levdistance(%s, %s) = %.3f", a, b[k], res);
+
+		if (maxlen == 0)
+			res = 1.0;
+		else if (pgs_levenshtein_is_normalized)
+			res = 1.0 - (res / maxlen);
+
+		values[i] = Float8GetDatum(res);
+		k++;
+	}
+
+	PG_RETURN_ARRAYTYPE_P(batchresult(PG_GETARG_ARRAYTYPE_P(1), values, nulls,
+									  nelems));
+}
+
 PG_FUNCTION_INFO_V1(levslow);
 
 Datum
@@ -162,3 +162,25 @@ Datum matchingcoefficient_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_matching_threshold);
 }
+
+PG_FUNCTION_INFO_V1(matchingcoefficient_query_op);
+
+/*
+ * a ~^^ ROW(b, c)::pgs_query is matchingcoefficient(a, b) >= c.
+ */
+Datum matchingcoefficient_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 matchingcoefficient,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
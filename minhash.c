@@ -0,0 +1,513 @@
+/*----------------------------------------------------------------------------
+ *
+ * minhash.c
+ *
+ * minhash is a MinHash signature of the token set of a string (Broder, "On
+ * the resemblance and containment of documents"): for each of k hash
+ * functions, the smallest hash of any token. Two signatures agree in a slot
+ * with probability jaccard(a, b), so the fraction of equal slots estimates
+ * Jaccard without the strings and in time linear in k.
+ *
+ * Locality-sensitive hashing splits the k slots into b bands of r rows and
+ * hashes each band to a key. Strings of similarity s share at least one key
+ * with probability 1 - (1 - s^r)^b, which is close to 1 above (1 / b)^(1 / r)
+ * and close to 0 below it. minhash_bands() returns the b keys for a GIN
+ * index on int4[] (&&) and minhash_band() one of them for a btree index per
+ * band; gin_minhash_ops indexes the keys of a text column directly and
+ * answers ~?~ with them, rechecking each candidate with jaccard(). ~?~ is
+ * jaccard >= threshold like ~??, but an index scan is approximate: a similar
+ * pair whose bands all differ is missed. The exact ~?? is left to the
+ * lossless operator classes.
+ *
+ * The tokens are those of jaccard() (pg_similarity.jaccard_tokenizer); the
+ * k hash functions are h1 + i * h2 of two hashes of the token, mixed.
+ *
+ * The text representation is 8 hexadecimal digits per slot.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/gin.h"
+#include "access/skey.h"
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+#include "libpq/pqformat.h"
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+/* defaults of minhash(text) and gin_minhash_ops */
+#define	PGS_MINHASH_DEFAULT_PERMS	128
+#define	PGS_MINHASH_DEFAULT_BANDS	20
+#define	PGS_MINHASH_DEFAULT_ROWS	5
+
+/* hexadecimal digits per slot */
+#define	PGS_MINHASH_DIGITS			(2 * sizeof(uint32))
+
+/* ~?~ strategy numbers (jaccard's in gin_similarity_ops) */
+#define	PGS_MINHASH_JACCARD			5
+#define	PGS_MINHASH_JACCARD_QUERY	45
+
+/*
+ * How gin_minhash_ops tokenizes and splits the signature. On PostgreSQL 13
+ * or later it is chosen per index:
+ *
+ * CREATE INDEX ... USING gin (col gin_minhash_ops (bands = 32, rows = 4));
+ */
+typedef struct GinMinhashOptions
+{
+	int32			vl_len_;	/* varlena header (do not touch directly!) */
+	PgsTokenOptions	tok;
+	int				bands;
+	int				rows;
+} GinMinhashOptions;
+
+static const GinMinhashOptions gin_minhash_default_options =
+{
+	0,
+	{PGS_UNIT_ALNUM, PGS_GRAM_LEN, false},
+	PGS_MINHASH_DEFAULT_BANDS,
+	PGS_MINHASH_DEFAULT_ROWS
+};
+
+PG_FUNCTION_INFO_V1(minhash_in);
+PG_FUNCTION_INFO_V1(minhash_out);
+PG_FUNCTION_INFO_V1(minhash_recv);
+PG_FUNCTION_INFO_V1(minhash_send);
+PG_FUNCTION_INFO_V1(minhash);
+PG_FUNCTION_INFO_V1(minhash_default);
+PG_FUNCTION_INFO_V1(minhash_jaccard);
+PG_FUNCTION_INFO_V1(minhash_bands);
+PG_FUNCTION_INFO_V1(minhash_band);
+PG_FUNCTION_INFO_V1(gin_extract_value_minhash);
+PG_FUNCTION_INFO_V1(gin_extract_query_minhash);
+PG_FUNCTION_INFO_V1(gin_minhash_consistent);
+PG_FUNCTION_INFO_V1(gin_minhash_options);
+
+static MinHash *
+minhash_alloc(int nperms)
+{
+	MinHash	*res;
+	int		len = MINHASH_SIZE(nperms);
+
+	res = (MinHash *) palloc(len);
+	SET_VARSIZE(res, len);
+
+	return res;
+}
+
+static void
+minhash_check_perms(int nperms)
+{
+	if (nperms < 1 || nperms > PGS_MINHASH_MAX_PERMS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of permutations must be between 1 and %d",
+						PGS_MINHASH_MAX_PERMS)));
+}
+
+/* murmur3 finalizer */
+static uint32
+minhash_mix(uint32 h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/*
+ * Signature of the tokens of buf (it is modified)
+ */
+static MinHash *
+minhash_tokens(const PgsTokenOptions *opts, char *buf, int nperms)
+{
+	MinHash		*res = minhash_alloc(nperms);
+	TokenList	*tlist;
+	Token		*t;
+	int			i;
+
+	for (i = 0; i < nperms; i++)
+		res->h[i] = PG_UINT32_MAX;
+
+	tlist = pgs_tokenize(opts, buf);
+
+	for (t = tlist->head; t != NULL; t = t->next)
+	{
+		uint32	h1 = DatumGetUInt32(hash_any((const unsigned char *) t->data,
+											 strlen(t->data)));
+		/* odd, so every i gives another function */
+		uint32	h2 = minhash_mix(h1 ^ 0x9e3779b9) | 1;
+
+		for (i = 0; i < nperms; i++)
+		{
+			uint32	v = minhash_mix(h1 + (uint32) i * h2);
+
+			if (v < res->h[i])
+				res->h[i] = v;
+		}
+	}
+
+	destroyTokenList(tlist);
+
+	return res;
+}
+
+static MinHash *
+minhash_text(text *t, int nperms)
+{
+	PgsTokenOptions	opts;
+	char	*buf = text_to_cstring(t);
+
+	if (strlen(buf) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	/* the tokens jaccard() sees */
+	opts.tokenizer = pgs_jaccard_tokenizer;
+	opts.gramlen = PGS_GRAM_LEN;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	return minhash_tokens(&opts, buf, nperms);
+}
+
+/*
+ * Rows of band i when nperms slots are split into nbands bands
+ */
+static int
+minhash_rows(int nperms, int nbands)
+{
+	if (nbands < 1 || nbands > nperms || nperms % nbands != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of bands must divide the number of permutations (%d)",
+						nperms)));
+
+	return nperms / nbands;
+}
+
+/*
+ * Key of band i: a hash of the band number and its rows, so equal rows in
+ * different bands are different keys.
+ */
+static int32
+minhash_band_key(const MinHash *m, int rows, int i)
+{
+	uint32	h = DatumGetUInt32(hash_any((const unsigned char *) &m->h[i * rows],
+										rows * sizeof(uint32)));
+
+	return (int32) minhash_mix(h + (uint32) i * 0x9e3779b9);
+}
+
+Datum
+minhash_in(PG_FUNCTION_ARGS)
+{
+	char	*str = PG_GETARG_CSTRING(0);
+	int		len = strlen(str);
+	MinHash	*res;
+	int		nperms;
+	int		i;
+
+	if (len == 0 || len % PGS_MINHASH_DIGITS != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type minhash: \"%s\"", str)));
+
+	nperms = len / PGS_MINHASH_DIGITS;
+	minhash_check_perms(nperms);
+	res = minhash_alloc(nperms);
+	memset(res->h, 0, nperms * sizeof(uint32));
+
+	for (i = 0; i < len; i++)
+	{
+		char	c = str[i];
+		int		d;
+
+		if (c >= '0' && c <= '9')
+			d = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			d = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			d = c - 'A' + 10;
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type minhash: \"%s\"", str)));
+
+		res->h[i / PGS_MINHASH_DIGITS] = (res->h[i / PGS_MINHASH_DIGITS] << 4) | d;
+	}
+
+	PG_RETURN_MINHASH_P(res);
+}
+
+Datum
+minhash_out(PG_FUNCTION_ARGS)
+{
+	MinHash	*m = PG_GETARG_MINHASH_P(0);
+	int		nperms = MINHASH_NPERMS(m);
+	char	*res = palloc(nperms * PGS_MINHASH_DIGITS + 1);
+	int		i;
+
+	for (i = 0; i < nperms; i++)
+		sprintf(res + i * PGS_MINHASH_DIGITS, "%08x", m->h[i]);
+
+	PG_RETURN_CSTRING(res);
+}
+
+Datum
+minhash_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int			nperms = pq_getmsgint(buf, sizeof(int32));
+	MinHash		*res;
+	int			i;
+
+	minhash_check_perms(nperms);
+	res = minhash_alloc(nperms);
+
+	for (i = 0; i < nperms; i++)
+		res->h[i] = (uint32) pq_getmsgint(buf, sizeof(uint32));
+
+	PG_RETURN_MINHASH_P(res);
+}
+
+Datum
+minhash_send(PG_FUNCTION_ARGS)
+{
+	MinHash			*m = PG_GETARG_MINHASH_P(0);
+	int				nperms = MINHASH_NPERMS(m);
+	StringInfoData	buf;
+	int				i;
+
+	pq_begintypsend(&buf);
+	pq_sendint32(&buf, nperms);
+	for (i = 0; i < nperms; i++)
+		pq_sendint32(&buf, m->h[i]);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+minhash(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	int32	nperms = PG_GETARG_INT32(1);
+
+	minhash_check_perms(nperms);
+
+	PG_RETURN_MINHASH_P(minhash_text(t, nperms));
+}
+
+Datum
+minhash_default(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_MINHASH_P(minhash_text(PG_GETARG_TEXT_PP(0), PGS_MINHASH_DEFAULT_PERMS));
+}
+
+/*
+ * Fraction of equal slots: an estimate of jaccard()
+ */
+Datum
+minhash_jaccard(PG_FUNCTION_ARGS)
+{
+	MinHash	*a = PG_GETARG_MINHASH_P(0);
+	MinHash	*b = PG_GETARG_MINHASH_P(1);
+	int		nperms = MINHASH_NPERMS(a);
+	int		nequal = 0;
+	int		i;
+
+	if (MINHASH_NPERMS(b) != nperms)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("minhash signatures have different numbers of permutations (%d and %d)",
+						nperms, MINHASH_NPERMS(b))));
+
+	for (i = 0; i < nperms; i++)
+	{
+		if (a->h[i] == b->h[i])
+			nequal++;
+	}
+
+	PG_RETURN_FLOAT8((float8) nequal / nperms);
+}
+
+Datum
+minhash_bands(PG_FUNCTION_ARGS)
+{
+	MinHash	*m = PG_GETARG_MINHASH_P(0);
+	int32	nbands = PG_GETARG_INT32(1);
+	int		rows = minhash_rows(MINHASH_NPERMS(m), nbands);
+	Datum	*keys;
+	int		i;
+
+	keys = (Datum *) palloc(nbands * sizeof(Datum));
+	for (i = 0; i < nbands; i++)
+		keys[i] = Int32GetDatum(minhash_band_key(m, rows, i));
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(keys, nbands, INT4OID, sizeof(int32), true, 'i'));
+}
+
+Datum
+minhash_band(PG_FUNCTION_ARGS)
+{
+	MinHash	*m = PG_GETARG_MINHASH_P(0);
+	int32	nbands = PG_GETARG_INT32(1);
+	int32	i = PG_GETARG_INT32(2);
+	int		rows = minhash_rows(MINHASH_NPERMS(m), nbands);
+
+	if (i < 0 || i >= nbands)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("band %d is out of range (0 .. %d)", i, nbands - 1)));
+
+	PG_RETURN_INT32(minhash_band_key(m, rows, i));
+}
+
+/*
+ * Opclass options (support function 7). Only called on PostgreSQL 13 or
+ * later.
+ */
+Datum
+gin_minhash_options(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 130000
+	local_relopts	*relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+	init_local_reloptions(relopts, sizeof(GinMinhashOptions));
+	pgs_add_token_reloptions(relopts, offsetof(GinMinhashOptions, tok),
+							 PGS_UNIT_ALNUM);
+	add_local_int_reloption(relopts, "bands",
+							"number of LSH bands (index keys per value)",
+							PGS_MINHASH_DEFAULT_BANDS, 1, 64,
+							offsetof(GinMinhashOptions, bands));
+	add_local_int_reloption(relopts, "rows",
+							"signature slots per band",
+							PGS_MINHASH_DEFAULT_ROWS, 1, 16,
+							offsetof(GinMinhashOptions, rows));
+#endif
+
+	PG_RETURN_VOID();
+}
+
+static const GinMinhashOptions *
+gin_minhash_get_options(FunctionCallInfo fcinfo)
+{
+#if PG_VERSION_NUM >= 130000
+	if (PG_HAS_OPCLASS_OPTIONS())
+		return (const GinMinhashOptions *) PG_GET_OPCLASS_OPTIONS();
+#endif
+
+	return &gin_minhash_default_options;
+}
+
+/*
+ * Band keys of a value: minhash_bands(minhash(value, bands * rows), bands)
+ * with the index tokens
+ */
+static Datum *
+gin_minhash_keys(const GinMinhashOptions *opts, text *value, int32 *nkeys)
+{
+	MinHash	*m;
+	Datum	*keys;
+	char	*buf = text_to_cstring(value);
+	int		i;
+
+	m = minhash_tokens(&opts->tok, buf, opts->bands * opts->rows);
+
+	keys = (Datum *) palloc(opts->bands * sizeof(Datum));
+	for (i = 0; i < opts->bands; i++)
+		keys[i] = Int32GetDatum(minhash_band_key(m, opts->rows, i));
+
+	*nkeys = opts->bands;
+
+	return keys;
+}
+
+Datum
+gin_extract_value_minhash(PG_FUNCTION_ARGS)
+{
+	text	*value = PG_GETARG_TEXT_PP(0);
+	int32	*nkeys = (int32 *) PG_GETARG_POINTER(1);
+
+	PG_RETURN_POINTER(gin_minhash_keys(gin_minhash_get_options(fcinfo), value, nkeys));
+}
+
+Datum
+gin_extract_query_minhash(PG_FUNCTION_ARGS)
+{
+	int32			*nkeys = (int32 *) PG_GETARG_POINTER(1);
+	StrategyNumber	strategy = PG_GETARG_UINT16(2);
+#if	PG_VERSION_NUM >= 90100
+	int32			*search_mode = (int32 *) PG_GETARG_POINTER(6);
+#endif
+	const GinMinhashOptions	*opts = gin_minhash_get_options(fcinfo);
+	text			*value;
+	float8			threshold;
+
+	*nkeys = 0;
+
+	if (strategy == PGS_MINHASH_JACCARD_QUERY)
+	{
+		/* a NULL query or threshold matches nothing */
+		if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(0), &value, &threshold))
+			PG_RETURN_POINTER(NULL);
+	}
+	else
+	{
+		value = PG_GETARG_TEXT_PP(0);
+		threshold = pgs_jaccard_threshold;
+	}
+
+	/*
+	 * Other tokens than jaccard()'s say nothing about it, and every row
+	 * satisfies a threshold of 0 (even the ones without a common band).
+	 */
+#if	PG_VERSION_NUM >= 90100
+	if (!pgs_token_compatible(&opts->tok, pgs_jaccard_tokenizer) || !(threshold > 0.0))
+	{
+		elog(DEBUG1, "index can't prune strategy %d (threshold: %.3f)",
+			 strategy, threshold);
+		*search_mode = GIN_SEARCH_MODE_ALL;
+		PG_RETURN_POINTER(NULL);
+	}
+#endif
+
+	PG_RETURN_POINTER(gin_minhash_keys(opts, value, nkeys));
+}
+
+/*
+ * A candidate shares a band with the query; jaccard() decides.
+ */
+Datum
+gin_minhash_consistent(PG_FUNCTION_ARGS)
+{
+	bool	*check = (bool *) PG_GETARG_POINTER(0);
+	int32	nkeys = PG_GETARG_INT32(3);
+	bool	*recheck = (bool *) PG_GETARG_POINTER(5);
+	bool	res = (nkeys == 0);
+	int		i;
+
+	for (i = 0; i < nkeys && !res; i++)
+	{
+		if (check[i])
+			res = true;
+	}
+
+	*recheck = true;
+
+	PG_RETURN_BOOL(res);
+}
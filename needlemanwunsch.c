@@ -59,6 +59,12 @@
 
 #include "similarity.h"
 
+#include "funcapi.h"
+#if	PG_VERSION_NUM >= 90300
+#include "access/htup_details.h"
+#endif
+#include "lib/stringinfo.h"
+
 
 /* GUC variables */
 double	pgs_nw_threshold = 0.7f;
@@ -143,36 +149,152 @@ static int _nwunsch(char *a, char *b, int gap)
 	return res;
 }
 
-PG_FUNCTION_INFO_V1(needlemanwunsch);
+/*
+ * Last row of the Needleman-Wunsch matrix for a[0..alen) x b[0..blen) using
+ * only two rows. If reverse is true, both strings are read backwards (that is
+ * the score of the suffixes, needed by Hirschberg's algorithm). The result is
+ * stored in row (blen + 1 elements); tmp is scratch space of the same size.
+ */
+static void _nwlastrow(const char *a, int alen, const char *b, int blen,
+					   int gap, bool reverse, int *row, int *tmp)
+{
+	int	*arow = row, *brow = tmp, *trow;
+	int	i, j;
 
-Datum
-needlemanwunsch(PG_FUNCTION_ARGS)
+	for (j = 0; j <= blen; j++)
+		arow[j] = gap * j;
+
+	for (i = 1; i <= alen; i++)
+	{
+		char	ca = reverse ? a[alen - i] : a[i - 1];
+
+		brow[0] = gap * i;
+
+		for (j = 1; j <= blen; j++)
+		{
+			char	cb = reverse ? b[blen - j] : b[j - 1];
+			int		scost = nwcost(ca, cb);
+
+			brow[j] = max3(brow[j - 1] + gap,
+						   arow[j] + gap,
+						   arow[j - 1] + scost);
+		}
+
+		trow = arow;
+		arow = brow;
+		brow = trow;
+	}
+
+	/* make sure the last row is in the caller's buffer */
+	if (arow != row)
+		memcpy(row, arow, (blen + 1) * sizeof(int));
+}
+
+/*
+ * Hirschberg's divide and conquer: split a in half, find where the optimal
+ * path crosses the middle row using a forward and a reverse score pass, and
+ * solve both halves recursively. Only O(alen + blen) memory is alive at any
+ * time (plus O(log alen) stack frames).
+ */
+static void _nwhirschberg(const char *a, int alen, const char *b, int blen,
+						  int gap, StringInfo ra, StringInfo rb)
 {
-	char		*a, *b;
-	double		minvalue, maxvalue;
-	float8		res;
+	int		i, j;
 
-	a = DatumGetPointer(DirectFunctionCall1(textout,
-											PointerGetDatum(PG_GETARG_TEXT_P(0))));
-	b = DatumGetPointer(DirectFunctionCall1(textout,
-											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+	if (alen == 0)
+	{
+		for (j = 0; j < blen; j++)
+		{
+			appendStringInfoChar(ra, '-');
+			appendStringInfoChar(rb, b[j]);
+		}
+	}
+	else if (blen == 0)
+	{
+		for (i = 0; i < alen; i++)
+		{
+			appendStringInfoChar(ra, a[i]);
+			appendStringInfoChar(rb, '-');
+		}
+	}
+	else if (alen == 1)
+	{
+		/*
+		 * either a[0] is aligned with some b[k] or a[0] is a gap too; pick
+		 * the best one
+		 */
+		int		best = gap * (blen + 1);
+		int		bestk = -1;
+		int		k;
 
-	if (strlen(a) > PGS_MAX_STR_LEN || strlen(b) > PGS_MAX_STR_LEN)
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("argument exceeds the maximum length of %d bytes",
-						PGS_MAX_STR_LEN)));
+		for (k = 0; k < blen; k++)
+		{
+			int	s = nwcost(a[0], b[k]) + gap * (blen - 1);
 
-	maxvalue = (float8) max2(strlen(a), strlen(b));
+			if (s > best)
+			{
+				best = s;
+				bestk = k;
+			}
+		}
 
-	res = (float8) _nwunsch(a, b, pgs_nw_gap_penalty);
+		if (bestk < 0)
+		{
+			appendStringInfoChar(ra, a[0]);
+			appendStringInfoChar(rb, '-');
+		}
 
-	elog(DEBUG1, "is normalized: %d", pgs_nw_is_normalized);
-	elog(DEBUG1, "maximum length: %.3f", maxvalue);
-	elog(DEBUG1, "nwdistance(%s, %s) = %.3f", a, b, res);
+		for (k = 0; k < blen; k++)
+		{
+			appendStringInfoChar(ra, (k == bestk) ? a[0] : '-');
+			appendStringInfoChar(rb, b[k]);
+		}
+	}
+	else
+	{
+		int		amid = alen / 2;
+		int		*left, *right, *tmp;
+		int		best = 0;
+		int		bmid = 0;
+
+		left = (int *) palloc((blen + 1) * sizeof(int));
+		right = (int *) palloc((blen + 1) * sizeof(int));
+		tmp = (int *) palloc((blen + 1) * sizeof(int));
+
+		_nwlastrow(a, amid, b, blen, gap, false, left, tmp);
+		_nwlastrow(a + amid, alen - amid, b, blen, gap, true, right, tmp);
+
+		for (j = 0; j <= blen; j++)
+		{
+			int	s = left[j] + right[blen - j];
+
+			if (j == 0 || s > best)
+			{
+				best = s;
+				bmid = j;
+			}
+		}
+
+		pfree(left);
+		pfree(right);
+		pfree(tmp);
+
+		elog(DEBUG2, "split a at %d and b at %d (score %d)", amid, bmid, best);
+
+		_nwhirschberg(a, amid, b, bmid, gap, ra, rb);
+		_nwhirschberg(a + amid, alen - amid, b + bmid, blen - bmid, gap, ra, rb);
+	}
+}
+
+/*
+ * normalize a Needleman-Wunsch score; maxvalue is the longest string length
+ */
+static float8 _nwnormalize(float8 res, double maxvalue)
+{
+	double		minvalue;
 
 	if (maxvalue == 0.0)
-		PG_RETURN_FLOAT8(1.0);
+		return 1.0;
 	else if (pgs_nw_is_normalized)
 	{
 		/* FIXME normalize nw result */
@@ -195,23 +317,116 @@ needlemanwunsch(PG_FUNCTION_ARGS)
 
 		/* paranoia ? */
 		if (maxvalue == 0.0)
-			PG_RETURN_FLOAT8(0.0);
+			return 0.0;
 		else
+			return 1.0 - (res / maxvalue);
+	}
+	else
+		return res;
+}
+
+PG_FUNCTION_INFO_V1(needlemanwunsch);
+
+Datum
+needlemanwunsch(PG_FUNCTION_ARGS)
+{
+	char		*a, *b;
+	double		maxvalue;
+	float8		res;
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+	b = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+
+	if (strlen(a) > PGS_MAX_STR_LEN || strlen(b) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	maxvalue = (float8) max2(strlen(a), strlen(b));
+
+	res = (float8) _nwunsch(a, b, pgs_nw_gap_penalty);
+
+	elog(DEBUG1, "is normalized: %d", pgs_nw_is_normalized);
+	elog(DEBUG1, "maximum length: %.3f", maxvalue);
+	elog(DEBUG1, "nwdistance(%s, %s) = %.3f", a, b, res);
+
+	res = _nwnormalize(res, maxvalue);
+
+	elog(DEBUG1, "nw(%s, %s) = %.3f", a, b, res);
+
+	PG_RETURN_FLOAT8(res);
+}
+
+PG_FUNCTION_INFO_V1(needlemanwunsch_batch);
+
+Datum
+needlemanwunsch_batch(PG_FUNCTION_ARGS)
+{
+	char		*a;
+	char		**b;
+	bool		*nulls;
+	int			nelems, ncand;
+	int			*score;
+	Datum		*values;
+	int			alen;
+	int			i, k;
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+
+	alen = strlen(a);
+
+	if (alen > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	b = batchcandidates(PG_GETARG_ARRAYTYPE_P(1), &nelems, &nulls, &ncand);
+
+	score = (int *) palloc((ncand + 1) * sizeof(int));
+	_nwunsch_batch(a, b, ncand, pgs_nw_gap_penalty, score);
+
+	elog(DEBUG1, "is normalized: %d", pgs_nw_is_normalized);
+
+	values = (Datum *) palloc((nelems + 1) * sizeof(Datum));
+	for (i = 0, k = 0; i < nelems; i++)
+	{
+		float8	res;
+
+		if (nulls[i])
 		{
-			res = 1.0 - (res / maxvalue);
-			elog(DEBUG1, "nw(%s, %s) = %.3f", a, b, res);
-			PG_RETURN_FLOAT8(res);
+			values[i] = (Datum) 0;
+			continue;
 		}
+
+		res = (float8) score[k];
+
+		elog(DEBUG1, "nwdistance(%s, %s) = %.3f", a, b[k], res);
+
+		res = _nwnormalize(res, (double) max2(alen, (int) strlen(b[k])));
+
+		values[i] = Float8GetDatum(res);
+		k++;
 	}
-	else
-		PG_RETURN_FLOAT8(res);
+
+	PG_RETURN_ARRAYTYPE_P(batchresult(PG_GETARG_ARRAYTYPE_P(1), values, nulls,
+									  nelems));
 }
 
 PG_FUNCTION_INFO_V1(needlemanwunsch_op);
 
 Datum needlemanwunsch_op(PG_FUNCTION_ARGS)
 {
-	float8	res;
+	text		*a = PG_GETARG_TEXT_PP(0);
+	text		*b = PG_GETARG_TEXT_PP(1);
+	PgsSketch	sa, sb;
+	int			alen, blen;
+	int			gap = pgs_nw_gap_penalty;
+	float8		res;
 
 	/*
 	 * store *_is_normalized value temporarily 'cause
@@ -220,13 +435,95 @@ Datum needlemanwunsch_op(PG_FUNCTION_ARGS)
 	bool	tmp = pgs_nw_is_normalized;
 	pgs_nw_is_normalized = true;
 
+	/*
+	 * The normalized value decreases as the score grows, so an upper bound
+	 * of the score is a lower bound of the result: if even the best score
+	 * the character counts allow passes, the real one does too.
+	 */
+	if (gap <= 0 && pgs_sketch_args(a, b, &sa, &alen, &sb, &blen) &&
+		alen > 0 && blen > 0)
+	{
+		int		ub = pgs_sketch_nw_bound(&sa, alen, &sb, blen, gap);
+
+		if (_nwnormalize((float8) ub, (double) max2(alen, blen)) >= pgs_nw_threshold)
+		{
+			pgs_nw_is_normalized = tmp;
+			PG_RETURN_BOOL(true);
+		}
+	}
+
 	res = DatumGetFloat8(DirectFunctionCall2(
 							 needlemanwunsch,
-							 PG_GETARG_DATUM(0),
-							 PG_GETARG_DATUM(1)));
+							 PointerGetDatum(a),
+							 PointerGetDatum(b)));
 
 	/* we're done; back to the previous value */
 	pgs_nw_is_normalized = tmp;
 
 	PG_RETURN_BOOL(res >= pgs_nw_threshold);
 }
+
+PG_FUNCTION_INFO_V1(needlemanwunsch_align);
+
+Datum
+needlemanwunsch_align(PG_FUNCTION_ARGS)
+{
+	char			*a, *b;
+	int				alen, blen;
+	int				gap = pgs_nw_gap_penalty;
+	int				*row, *tmp;
+	int				i;
+	float8			res;
+	StringInfoData	ra, rb;
+	TupleDesc		tupdesc;
+	Datum			values[3];
+	bool			nulls[3];
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+	b = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+
+	alen = strlen(a);
+	blen = strlen(b);
+
+	if (alen > PGS_MAX_STR_LEN || blen > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+#ifdef PGS_IGNORE_CASE
+	elog(DEBUG2, "case-sensitive turns off");
+	for (i = 0; i < alen; i++)
+		a[i] = tolower(a[i]);
+	for (i = 0; i < blen; i++)
+		b[i] = tolower(b[i]);
+#endif
+
+	/* global alignment score */
+	row = (int *) palloc((blen + 1) * sizeof(int));
+	tmp = (int *) palloc((blen + 1) * sizeof(int));
+	_nwlastrow(a, alen, b, blen, gap, false, row, tmp);
+	res = (float8) row[blen];
+	pfree(row);
+	pfree(tmp);
+
+	initStringInfo(&ra);
+	initStringInfo(&rb);
+
+	_nwhirschberg(a, alen, b, blen, gap, &ra, &rb);
+
+	elog(DEBUG1, "nwalign(%s, %s) = (%s, %s, %.3f)", a, b, ra.data, rb.data, res);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = PointerGetDatum(cstring_to_text_with_len(ra.data, ra.len));
+	values[1] = PointerGetDatum(cstring_to_text_with_len(rb.data, rb.len));
+	values[2] = Float8GetDatum(res);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
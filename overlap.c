@@ -158,3 +158,25 @@ Datum overlapcoefficient_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_overlap_threshold);
 }
+
+PG_FUNCTION_INFO_V1(overlapcoefficient_query_op);
+
+/*
+ * a ~** ROW(b, c)::pgs_query is overlapcoefficient(a, b) >= c.
+ */
+Datum overlapcoefficient_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 overlapcoefficient,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
@@ -1,176 +1,472 @@
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION pg_similarity" to load this file. \quit
 
+-- selectivity estimators of the similarity operators
+CREATE FUNCTION pgs_similarity_sel (internal, oid, internal, int4) RETURNS float8
+AS 'MODULE_PATHNAME', 'pgs_similarity_sel'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION pgs_similarity_joinsel (internal, oid, internal, int2, internal) RETURNS float8
+AS 'MODULE_PATHNAME', 'pgs_similarity_joinsel'
+LANGUAGE C STABLE STRICT;
+
 -- Block
 CREATE FUNCTION block (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'block'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION block_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'block_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~++ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = block_op,
 	COMMUTATOR = '~++',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION block_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'block_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <++> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = block_distance,
+	COMMUTATOR = '<++>'
 );
 
 -- Cosine
 CREATE FUNCTION cosine (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'cosine'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION cosine_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'cosine_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~## (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = cosine_op,
 	COMMUTATOR = '~##',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION cosine_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'cosine_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <##> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = cosine_distance,
+	COMMUTATOR = '<##>'
 );
 
 -- Dice
 CREATE FUNCTION dice (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'dice'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION dice_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'dice_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~-~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = dice_op,
 	COMMUTATOR = '~-~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION dice_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'dice_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <-~> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = dice_distance,
+	COMMUTATOR = '<-~>'
 );
 
 -- Euclidean
 CREATE FUNCTION euclidean (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'euclidean'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION euclidean_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'euclidean_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~!! (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = euclidean_op,
 	COMMUTATOR = '~!!',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION euclidean_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'euclidean_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <!!> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = euclidean_distance,
+	COMMUTATOR = '<!!>'
 );
 
 -- Hamming
 CREATE FUNCTION hamming (varbit, varbit) RETURNS float8
 AS 'MODULE_PATHNAME','hamming'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 5;
 
 CREATE FUNCTION hamming_op (varbit, varbit) RETURNS bool
 AS 'MODULE_PATHNAME', 'hamming_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 5;
 
 CREATE FUNCTION hamming_text (text, text) RETURNS float8
 AS 'MODULE_PATHNAME','hamming_text'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 5;
 
 CREATE FUNCTION hamming_text_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'hamming_text_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 5;
 
 CREATE OPERATOR ~@~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = hamming_text_op,
 	COMMUTATOR = '~@~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE OPERATOR ~@~ (
+	LEFTARG = varbit,
+	RIGHTARG = varbit,
+	PROCEDURE = hamming_op,
+	COMMUTATOR = '~@~',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION hamming_distance (varbit, varbit) RETURNS float8
+AS 'MODULE_PATHNAME', 'hamming_distance'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE OPERATOR <~@~> (
+	LEFTARG = varbit,
+	RIGHTARG = varbit,
+	PROCEDURE = hamming_distance,
+	COMMUTATOR = '<~@~>'
+);
+
+-- hash64: 64-bit codes (passed by value)
+CREATE TYPE hash64;
+
+CREATE FUNCTION hash64_in (cstring) RETURNS hash64
+AS 'MODULE_PATHNAME', 'hash64_in'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_out (hash64) RETURNS cstring
+AS 'MODULE_PATHNAME', 'hash64_out'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_recv (internal) RETURNS hash64
+AS 'MODULE_PATHNAME', 'hash64_recv'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_send (hash64) RETURNS bytea
+AS 'MODULE_PATHNAME', 'hash64_send'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE hash64 (
+	INPUT = hash64_in,
+	OUTPUT = hash64_out,
+	RECEIVE = hash64_recv,
+	SEND = hash64_send,
+	LIKE = int8
+);
+
+CREATE FUNCTION hash64 (varbit) RETURNS hash64
+AS 'MODULE_PATHNAME', 'hash64_from_varbit'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION varbit (hash64) RETURNS varbit
+AS 'MODULE_PATHNAME', 'hash64_to_varbit'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE CAST (varbit AS hash64) WITH FUNCTION hash64(varbit);
+CREATE CAST (bit AS hash64) WITH FUNCTION hash64(varbit);
+CREATE CAST (hash64 AS varbit) WITH FUNCTION varbit(hash64);
+CREATE CAST (int8 AS hash64) WITHOUT FUNCTION;
+CREATE CAST (hash64 AS int8) WITHOUT FUNCTION;
+
+CREATE FUNCTION hash64_eq (hash64, hash64) RETURNS bool
+AS 'MODULE_PATHNAME', 'hash64_eq'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_ne (hash64, hash64) RETURNS bool
+AS 'MODULE_PATHNAME', 'hash64_ne'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_hash (hash64) RETURNS int4
+AS 'MODULE_PATHNAME', 'hash64_hash'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR = (
+	LEFTARG = hash64,
+	RIGHTARG = hash64,
+	PROCEDURE = hash64_eq,
+	COMMUTATOR = '=',
+	NEGATOR = '<>',
+	RESTRICT = eqsel,
+	JOIN = eqjoinsel,
+	HASHES
+);
+
+CREATE OPERATOR <> (
+	LEFTARG = hash64,
+	RIGHTARG = hash64,
+	PROCEDURE = hash64_ne,
+	COMMUTATOR = '<>',
+	NEGATOR = '=',
+	RESTRICT = neqsel,
+	JOIN = neqjoinsel
+);
+
+CREATE OPERATOR CLASS hash64_ops
+DEFAULT FOR TYPE hash64 USING hash
+AS
+    OPERATOR    1   =,
+    FUNCTION    1   hash64_hash(hash64);
+
+CREATE FUNCTION hamming (hash64, hash64) RETURNS float8
+AS 'MODULE_PATHNAME', 'hamming_hash64'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hamming_op (hash64, hash64) RETURNS bool
+AS 'MODULE_PATHNAME', 'hamming_hash64_op'
+LANGUAGE C STABLE STRICT;
+
+CREATE OPERATOR ~@~ (
+	LEFTARG = hash64,
+	RIGHTARG = hash64,
+	PROCEDURE = hamming_op,
+	COMMUTATOR = '~@~',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION hamming_distance (hash64, hash64) RETURNS float8
+AS 'MODULE_PATHNAME', 'hamming_hash64_distance'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR <~@~> (
+	LEFTARG = hash64,
+	RIGHTARG = hash64,
+	PROCEDURE = hamming_distance,
+	COMMUTATOR = '<~@~>'
 );
 
+-- multi-index hashing
+CREATE FUNCTION hash64_chunk (hash64, int4, int4) RETURNS int4
+AS 'MODULE_PATHNAME', 'hash64_chunk'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION hash64_mih_keys (hash64, int4, int4, int4) RETURNS int4[]
+AS 'MODULE_PATHNAME', 'hash64_mih_keys'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- SimHash codes (estimated cosine from the Hamming distance)
+CREATE FUNCTION simhash (text) RETURNS hash64
+AS 'MODULE_PATHNAME', 'simhash'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION simhash (text, int4) RETURNS varbit
+AS 'MODULE_PATHNAME', 'simhash_bits'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION simhash_cosine (hash64, hash64) RETURNS float8
+AS 'MODULE_PATHNAME', 'simhash_cosine_hash64'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION simhash_cosine (varbit, varbit) RETURNS float8
+AS 'MODULE_PATHNAME', 'simhash_cosine'
+LANGUAGE C IMMUTABLE STRICT;
+
 -- Jaccard
 CREATE FUNCTION jaccard (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'jaccard'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION jaccard_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'jaccard_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~?? (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = jaccard_op,
 	COMMUTATOR = '~??',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION jaccard_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'jaccard_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <??> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = jaccard_distance,
+	COMMUTATOR = '<??>'
+);
+
+-- MinHash signatures (estimated Jaccard and LSH band keys)
+CREATE TYPE minhash;
+
+CREATE FUNCTION minhash_in (cstring) RETURNS minhash
+AS 'MODULE_PATHNAME', 'minhash_in'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION minhash_out (minhash) RETURNS cstring
+AS 'MODULE_PATHNAME', 'minhash_out'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION minhash_recv (internal) RETURNS minhash
+AS 'MODULE_PATHNAME', 'minhash_recv'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION minhash_send (minhash) RETURNS bytea
+AS 'MODULE_PATHNAME', 'minhash_send'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE minhash (
+	INPUT = minhash_in,
+	OUTPUT = minhash_out,
+	RECEIVE = minhash_recv,
+	SEND = minhash_send,
+	INTERNALLENGTH = VARIABLE,
+	ALIGNMENT = int4,
+	STORAGE = external
+);
+
+CREATE FUNCTION minhash (text, int4) RETURNS minhash
+AS 'MODULE_PATHNAME', 'minhash'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION minhash (text) RETURNS minhash
+AS 'MODULE_PATHNAME', 'minhash_default'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION minhash_jaccard (minhash, minhash) RETURNS float8
+AS 'MODULE_PATHNAME', 'minhash_jaccard'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION minhash_bands (minhash, int4) RETURNS int4[]
+AS 'MODULE_PATHNAME', 'minhash_bands'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION minhash_band (minhash, int4, int4) RETURNS int4
+AS 'MODULE_PATHNAME', 'minhash_band'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- jaccard >= threshold, like ~??, but gin_minhash_ops answers it approximately
+CREATE FUNCTION minhash_op (text, text) RETURNS bool
+AS 'MODULE_PATHNAME', 'jaccard_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~?~ (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = minhash_op,
+	COMMUTATOR = '~?~',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Jaro
 CREATE FUNCTION jaro (text, text) RETURNS float8
 AS 'MODULE_PATHNAME','jaro'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION jaro_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'jaro_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~%% (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = jaro_op,
 	COMMUTATOR = '~%%',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Jaro-Winkler
 CREATE FUNCTION jarowinkler (text, text) RETURNS float8
 AS 'MODULE_PATHNAME','jarowinkler'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION jarowinkler_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'jarowinkler_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~@@ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = jarowinkler_op,
 	COMMUTATOR = '~@@',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Levenshtein
 CREATE FUNCTION lev (text, text) RETURNS float8
 AS 'MODULE_PATHNAME','lev'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 100;
 
 CREATE FUNCTION lev_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'lev_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 100;
 
 CREATE OPERATOR ~== (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = lev_op,
 	COMMUTATOR = '~==',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION lev_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'lev_distance'
+LANGUAGE C STABLE STRICT COST 100;
+
+CREATE OPERATOR <==> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = lev_distance,
+	COMMUTATOR = '<==>'
 );
 
+CREATE FUNCTION lev_batch (text, text[]) RETURNS float8[]
+AS 'MODULE_PATHNAME','lev_batch'
+LANGUAGE C IMMUTABLE STRICT COST 1000;
+
 -- Those functions are here just for academic purposes
 --CREATE FUNCTION levslow (text, text) RETURNS float8
 --AS 'MODULE_PATHNAME','levslow'
@@ -185,194 +481,1161 @@ CREATE OPERATOR ~== (
 --	RIGHTARG = text,
 --	PROCEDURE = levslow_op,
 --	COMMUTATOR = '~@@',
---	RESTRICT = contsel,
---	JOIN = contjoinsel
+--	RESTRICT = pgs_similarity_sel,
+--	JOIN = pgs_similarity_joinsel
 --);
 
 -- Matching Coefficient
 CREATE FUNCTION matchingcoefficient (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'matchingcoefficient'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION matchingcoefficient_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'matchingcoefficient_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~^^ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = matchingcoefficient_op,
 	COMMUTATOR = '~^^',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Monge-Elkan
 CREATE FUNCTION mongeelkan (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'mongeelkan'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 1000;
 
 CREATE FUNCTION mongeelkan_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'mongeelkan_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 1000;
 
 CREATE OPERATOR ~|| (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = mongeelkan_op,
 	COMMUTATOR = '~||',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Needleman-Wunsch
 CREATE FUNCTION needlemanwunsch (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'needlemanwunsch'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 200;
 
 CREATE FUNCTION needlemanwunsch_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'needlemanwunsch_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 200;
 
 CREATE OPERATOR ~#~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = needlemanwunsch_op,
 	COMMUTATOR = '~#~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
+CREATE FUNCTION needlemanwunsch_align (text, text,
+	OUT a_aligned text, OUT b_aligned text, OUT score float8)
+RETURNS record
+AS 'MODULE_PATHNAME', 'needlemanwunsch_align'
+LANGUAGE C IMMUTABLE STRICT COST 400;
+
+CREATE FUNCTION needlemanwunsch_batch (text, text[]) RETURNS float8[]
+AS 'MODULE_PATHNAME', 'needlemanwunsch_batch'
+LANGUAGE C IMMUTABLE STRICT COST 2000;
+
 -- Overlap Coefficient
 CREATE FUNCTION overlapcoefficient (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'overlapcoefficient'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION overlapcoefficient_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'overlapcoefficient_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~** (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = overlapcoefficient_op,
 	COMMUTATOR = '~**',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Q-Gram
 CREATE FUNCTION qgram (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'qgram'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 50;
 
 CREATE FUNCTION qgram_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'qgram_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 50;
 
 CREATE OPERATOR ~~~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = qgram_op,
 	COMMUTATOR = '~~~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION qgram_distance (text, text) RETURNS float8
+AS 'MODULE_PATHNAME', 'qgram_distance'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR <~~> (
+	LEFTARG = text,
+	RIGHTARG = text,
+	PROCEDURE = qgram_distance,
+	COMMUTATOR = '<~~>'
 );
 
+-- character sketches: pgs_sketch_distance is a lower bound of the edit distance
+CREATE FUNCTION pgs_sketch (text) RETURNS bytea
+AS 'MODULE_PATHNAME', 'pgs_sketch'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pgs_sketch_distance (bytea, bytea) RETURNS int4
+AS 'MODULE_PATHNAME', 'pgs_sketch_distance'
+LANGUAGE C IMMUTABLE STRICT;
+
 -- Smith-Waterman
 CREATE FUNCTION smithwaterman (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'smithwaterman'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 200;
 
 CREATE FUNCTION smithwaterman_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'smithwaterman_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 200;
 
 CREATE OPERATOR ~=~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = smithwaterman_op,
 	COMMUTATOR = '~=~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
+CREATE FUNCTION smithwaterman_locate (text, text,
+	OUT a_start int4, OUT a_end int4, OUT b_start int4, OUT b_end int4,
+	OUT score float8)
+RETURNS record
+AS 'MODULE_PATHNAME', 'smithwaterman_locate'
+LANGUAGE C IMMUTABLE STRICT COST 400;
+
+CREATE FUNCTION smithwaterman_batch (text, text[]) RETURNS float8[]
+AS 'MODULE_PATHNAME', 'smithwaterman_batch'
+LANGUAGE C IMMUTABLE STRICT COST 2000;
+
 -- Smith-Waterman-Gotoh
 CREATE FUNCTION smithwatermangotoh (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'smithwatermangotoh'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 1000;
 
 CREATE FUNCTION smithwatermangotoh_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'smithwatermangotoh_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 1000;
 
 CREATE OPERATOR ~!~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = smithwatermangotoh_op,
 	COMMUTATOR = '~!~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
 );
 
 -- Soundex
 CREATE FUNCTION soundex (text, text) RETURNS float8
 AS 'MODULE_PATHNAME', 'soundex'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT COST 5;
 
 CREATE FUNCTION soundex_op (text, text) RETURNS bool
 AS 'MODULE_PATHNAME', 'soundex_op'
-LANGUAGE C STABLE STRICT;
+LANGUAGE C STABLE STRICT COST 5;
 
 CREATE OPERATOR ~*~ (
 	LEFTARG = text,
 	RIGHTARG = text,
 	PROCEDURE = soundex_op,
 	COMMUTATOR = '~*~',
-	RESTRICT = contsel,
-	JOIN = contjoinsel
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel,
+	HASHES
 );
 
---
--- GIN support
---
+CREATE FUNCTION soundex_code (text) RETURNS text
+AS 'MODULE_PATHNAME', 'soundex_code'
+LANGUAGE C IMMUTABLE STRICT;
 
-CREATE FUNCTION gin_extract_value_token(internal, internal, internal)
-RETURNS internal
-AS 'MODULE_PATHNAME'
+CREATE FUNCTION soundex_hash (text) RETURNS int4
+AS 'MODULE_PATHNAME', 'soundex_hash'
 LANGUAGE C IMMUTABLE STRICT;
 
-CREATE FUNCTION gin_extract_query_token(internal, internal, int2, internal, internal, internal, internal)
-RETURNS internal
-AS 'MODULE_PATHNAME'
+CREATE OPERATOR CLASS soundex_ops
+FOR TYPE text USING hash
+AS
+    OPERATOR    1   ~*~,
+    FUNCTION    1   soundex_hash(text);
+
+-- a ~*~ b is planned as soundex_code(a) = soundex_code(b) (PostgreSQL 12+)
+CREATE FUNCTION soundex_support (internal) RETURNS internal
+AS 'MODULE_PATHNAME', 'soundex_support'
 LANGUAGE C IMMUTABLE STRICT;
 
-CREATE FUNCTION gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal)
-RETURNS bool
-AS 'MODULE_PATHNAME'
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		ALTER FUNCTION soundex_op(text, text) SUPPORT soundex_support;
+	END IF;
+END
+$$;
+
+-- Winnowing fingerprints of long documents (GIN array_ops: &&, @>)
+CREATE FUNCTION winnow (text, int4, int4) RETURNS int4[]
+AS 'MODULE_PATHNAME', 'winnow'
+LANGUAGE C IMMUTABLE STRICT COST 100;
+
+CREATE FUNCTION winnow (text) RETURNS int4[]
+AS 'MODULE_PATHNAME', 'winnow_default'
+LANGUAGE C IMMUTABLE STRICT COST 100;
+
+CREATE FUNCTION fingerprint_jaccard (int4[], int4[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'fingerprint_jaccard'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION fingerprint_containment (int4[], int4[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'fingerprint_containment'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+-- Token multisets (tokenize once, compare many times); the measures only merge
+-- two sorted hash arrays, so they cost as much as soundex rather than 50
+CREATE TYPE pgs_tokens;
+
+CREATE FUNCTION pgs_tokens_in (cstring) RETURNS pgs_tokens
+AS 'MODULE_PATHNAME', 'pgs_tokens_in'
 LANGUAGE C IMMUTABLE STRICT;
 
-CREATE OPERATOR CLASS gin_similarity_ops
-FOR TYPE text USING gin
-AS
-    OPERATOR    1   ~++,		-- block
-    OPERATOR    2   ~##,		-- cosine
-    OPERATOR    3   ~-~,		-- dice
-    OPERATOR    4   ~!!,		-- euclidean
-    OPERATOR    5   ~??,		-- jaccard
---    OPERATOR    6   ~%%,		-- jaro
---    OPERATOR    7   ~@@,		-- jarowinkler
---    OPERATOR    8   ~==,		-- lev
-    OPERATOR    9   ~^^,		-- matchingcoefficient
---    OPERATOR    10  ~||,		-- mongeelkan
---    OPERATOR    11  ~#~,		-- needlemanwunsch
-    OPERATOR    12  ~**,		-- overlapcoefficient
-    OPERATOR    13  ~~~,		-- qgram
---    OPERATOR    14  ~=~,		-- smithwaterman
---    OPERATOR    15  ~!~,		-- smithwatermangotoh
---    OPERATOR    16  ~*~,		-- soundex
-    FUNCTION    1   bttextcmp(text, text),
-    FUNCTION    2   gin_extract_value_token(internal, internal, internal),
-    FUNCTION    3   gin_extract_query_token(internal, internal, int2, internal, internal, internal, internal),
-    FUNCTION    4   gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
-    STORAGE text;
+CREATE FUNCTION pgs_tokens_out (pgs_tokens) RETURNS cstring
+AS 'MODULE_PATHNAME', 'pgs_tokens_out'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pgs_tokens_recv (internal) RETURNS pgs_tokens
+AS 'MODULE_PATHNAME', 'pgs_tokens_recv'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pgs_tokens_send (pgs_tokens) RETURNS bytea
+AS 'MODULE_PATHNAME', 'pgs_tokens_send'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE pgs_tokens (
+	INPUT = pgs_tokens_in,
+	OUTPUT = pgs_tokens_out,
+	RECEIVE = pgs_tokens_recv,
+	SEND = pgs_tokens_send,
+	INTERNALLENGTH = VARIABLE,
+	ALIGNMENT = int4,
+	STORAGE = external
+);
+
+CREATE FUNCTION pgs_tokens (text, text) RETURNS pgs_tokens
+AS 'MODULE_PATHNAME', 'pgs_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION pgs_tokens (text, text, int4) RETURNS pgs_tokens
+AS 'MODULE_PATHNAME', 'pgs_tokens_gram'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION block (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'block_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION block_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'block_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~++ (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = block_op,
+	COMMUTATOR = '~++',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION cosine (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'cosine_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION cosine_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'cosine_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~## (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = cosine_op,
+	COMMUTATOR = '~##',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION dice (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'dice_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION dice_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'dice_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~-~ (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = dice_op,
+	COMMUTATOR = '~-~',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION euclidean (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'euclidean_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION euclidean_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'euclidean_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~!! (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = euclidean_op,
+	COMMUTATOR = '~!!',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION jaccard (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'jaccard_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION jaccard_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'jaccard_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~?? (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = jaccard_op,
+	COMMUTATOR = '~??',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION matchingcoefficient (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'matchingcoefficient_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION matchingcoefficient_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'matchingcoefficient_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~^^ (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = matchingcoefficient_op,
+	COMMUTATOR = '~^^',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION overlapcoefficient (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'overlapcoefficient_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION overlapcoefficient_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'overlapcoefficient_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~** (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = overlapcoefficient_op,
+	COMMUTATOR = '~**',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION qgram (pgs_tokens, pgs_tokens) RETURNS float8
+AS 'MODULE_PATHNAME', 'qgram_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION qgram_op (pgs_tokens, pgs_tokens) RETURNS bool
+AS 'MODULE_PATHNAME', 'qgram_tokens_op'
+LANGUAGE C STABLE STRICT COST 5;
+
+CREATE OPERATOR ~~~ (
+	LEFTARG = pgs_tokens,
+	RIGHTARG = pgs_tokens,
+	PROCEDURE = qgram_op,
+	COMMUTATOR = '~~~',
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+-- the tokens as a text[] and the measures of two token arrays
+CREATE FUNCTION pgs_tokenize (text, text) RETURNS text[]
+AS 'MODULE_PATHNAME', 'pgs_tokenize_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION pgs_tokenize (text, text, int4) RETURNS text[]
+AS 'MODULE_PATHNAME', 'pgs_tokenize_array_gram'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION block (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'block_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION cosine (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'cosine_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION dice (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'dice_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION jaccard (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'jaccard_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION matchingcoefficient (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'matchingcoefficient_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION overlapcoefficient (text[], text[]) RETURNS float8
+AS 'MODULE_PATHNAME', 'overlapcoefficient_array'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+-- Term-frequency vectors (weighted cosine, L1, L2, Jensen-Shannon, Hellinger)
+CREATE TYPE tfvector;
+
+CREATE FUNCTION tfvector_in (cstring) RETURNS tfvector
+AS 'MODULE_PATHNAME', 'tfvector_in'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION tfvector_out (tfvector) RETURNS cstring
+AS 'MODULE_PATHNAME', 'tfvector_out'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION tfvector_recv (internal) RETURNS tfvector
+AS 'MODULE_PATHNAME', 'tfvector_recv'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION tfvector_send (tfvector) RETURNS bytea
+AS 'MODULE_PATHNAME', 'tfvector_send'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE tfvector (
+	INPUT = tfvector_in,
+	OUTPUT = tfvector_out,
+	RECEIVE = tfvector_recv,
+	SEND = tfvector_send,
+	INTERNALLENGTH = VARIABLE,
+	ALIGNMENT = int4,
+	STORAGE = external
+);
+
+CREATE FUNCTION tfvector (text, text) RETURNS tfvector
+AS 'MODULE_PATHNAME', 'tfvector'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION tfvector (text, text, int4) RETURNS tfvector
+AS 'MODULE_PATHNAME', 'tfvector_gram'
+LANGUAGE C IMMUTABLE STRICT COST 50;
+
+CREATE FUNCTION tfvector (pgs_tokens) RETURNS tfvector
+AS 'MODULE_PATHNAME', 'tfvector_tokens'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION tfvector_dot (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'tfvector_dot'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION tfvector_cosine (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'tfvector_cosine'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION tfvector_l1 (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'tfvector_l1'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION tfvector_l2 (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'tfvector_l2'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION jensenshannon (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'jensenshannon'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+CREATE FUNCTION hellinger (tfvector, tfvector) RETURNS float8
+AS 'MODULE_PATHNAME', 'hellinger'
+LANGUAGE C IMMUTABLE STRICT COST 5;
+
+--
+-- Threshold queries: a ~?? ROW(b, 0.7)::pgs_query is jaccard(a, b) >= 0.7
+--
+
+CREATE TYPE pgs_query AS (query text, threshold float8);
+
+CREATE FUNCTION block_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'block_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~++ (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = block_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION cosine_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'cosine_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~## (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = cosine_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION dice_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'dice_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~-~ (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = dice_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION jaccard_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'jaccard_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~?? (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = jaccard_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION minhash_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'jaccard_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~?~ (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = minhash_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION matchingcoefficient_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'matchingcoefficient_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~^^ (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = matchingcoefficient_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION overlapcoefficient_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'overlapcoefficient_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~** (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = overlapcoefficient_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION qgram_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'qgram_query_op'
+LANGUAGE C STABLE STRICT COST 50;
+
+CREATE OPERATOR ~~~ (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = qgram_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+CREATE FUNCTION lev_op (text, pgs_query) RETURNS bool
+AS 'MODULE_PATHNAME', 'lev_query_op'
+LANGUAGE C STABLE STRICT COST 100;
+
+CREATE OPERATOR ~== (
+	LEFTARG = text,
+	RIGHTARG = pgs_query,
+	PROCEDURE = lev_op,
+	RESTRICT = pgs_similarity_sel,
+	JOIN = pgs_similarity_joinsel
+);
+
+-- measure(a, b) >= c and the *_op functions can use the similarity indexes
+-- (PostgreSQL 12+)
+CREATE FUNCTION pgs_index_support (internal) RETURNS internal
+AS 'MODULE_PATHNAME', 'pgs_index_support'
+LANGUAGE C IMMUTABLE STRICT;
+
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		ALTER FUNCTION block_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION block_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION cosine_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION cosine_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION dice_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION dice_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION jaccard_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION jaccard_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION matchingcoefficient_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION matchingcoefficient_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION overlapcoefficient_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION overlapcoefficient_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION qgram_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION qgram_op(text, pgs_query) SUPPORT pgs_index_support;
+		ALTER FUNCTION lev_op(text, text) SUPPORT pgs_index_support;
+		ALTER FUNCTION lev_op(text, pgs_query) SUPPORT pgs_index_support;
+	END IF;
+END
+$$;
+
+-- the cost of the dynamic programming measures grows with the string widths;
+-- their COST is the cost of two 32-byte strings (PostgreSQL 12+); lev_op gets
+-- its cost from pgs_index_support
+CREATE FUNCTION pgs_cost_support (internal) RETURNS internal
+AS 'MODULE_PATHNAME', 'pgs_cost_support'
+LANGUAGE C IMMUTABLE STRICT;
+
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		ALTER FUNCTION lev(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION lev_distance(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION mongeelkan(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION mongeelkan_op(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION needlemanwunsch(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION needlemanwunsch_op(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION needlemanwunsch_align(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION smithwaterman(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION smithwaterman_op(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION smithwaterman_locate(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION smithwatermangotoh(text, text) SUPPORT pgs_cost_support;
+		ALTER FUNCTION smithwatermangotoh_op(text, text) SUPPORT pgs_cost_support;
+	END IF;
+END
+$$;
+
+--
+-- GIN support
+--
+
+CREATE FUNCTION gin_extract_value_token(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_extract_query_token(internal, internal, int2, internal, internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_extract_value_token_hash(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_extract_query_token_hash(internal, internal, int2, internal, internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_token_triconsistent(internal, int2, internal, int4, internal, internal, internal)
+RETURNS char
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_similarity_options(internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE;
+
+CREATE OPERATOR CLASS gin_similarity_ops
+FOR TYPE text USING gin
+AS
+    OPERATOR    1   ~++,		-- block
+    OPERATOR    2   ~##,		-- cosine
+    OPERATOR    3   ~-~,		-- dice
+    OPERATOR    4   ~!!,		-- euclidean
+    OPERATOR    5   ~??,		-- jaccard
+--    OPERATOR    6   ~%%,		-- jaro
+--    OPERATOR    7   ~@@,		-- jarowinkler
+    OPERATOR    8   ~==,		-- lev (q-grams and length)
+    OPERATOR    9   ~^^,		-- matchingcoefficient
+--    OPERATOR    10  ~||,		-- mongeelkan
+--    OPERATOR    11  ~#~,		-- needlemanwunsch
+    OPERATOR    12  ~**,		-- overlapcoefficient
+    OPERATOR    13  ~~~,		-- qgram
+--    OPERATOR    14  ~=~,		-- smithwaterman
+--    OPERATOR    15  ~!~,		-- smithwatermangotoh
+--    OPERATOR    16  ~*~,		-- soundex
+    OPERATOR    41  ~++ (text, pgs_query),
+    OPERATOR    42  ~## (text, pgs_query),
+    OPERATOR    43  ~-~ (text, pgs_query),
+    OPERATOR    45  ~?? (text, pgs_query),
+    OPERATOR    48  ~== (text, pgs_query),
+    OPERATOR    49  ~^^ (text, pgs_query),
+    OPERATOR    52  ~** (text, pgs_query),
+    OPERATOR    53  ~~~ (text, pgs_query),
+    FUNCTION    1   bttextcmp(text, text),
+    FUNCTION    2   gin_extract_value_token(internal, internal, internal),
+    FUNCTION    3   gin_extract_query_token(internal, internal, int2, internal, internal, internal, internal),
+    FUNCTION    4   gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    FUNCTION    6   gin_token_triconsistent(internal, int2, internal, int4, internal, internal, internal),
+    STORAGE text;
+
+-- same as gin_similarity_ops but the keys are 32-bit hashes of the tokens
+CREATE OPERATOR CLASS gin_similarity_hash_ops
+FOR TYPE text USING gin
+AS
+    OPERATOR    1   ~++,		-- block
+    OPERATOR    2   ~##,		-- cosine
+    OPERATOR    3   ~-~,		-- dice
+    OPERATOR    4   ~!!,		-- euclidean
+    OPERATOR    5   ~??,		-- jaccard
+    OPERATOR    8   ~==,		-- lev (q-grams and length)
+    OPERATOR    9   ~^^,		-- matchingcoefficient
+    OPERATOR    12  ~**,		-- overlapcoefficient
+    OPERATOR    13  ~~~,		-- qgram
+    OPERATOR    41  ~++ (text, pgs_query),
+    OPERATOR    42  ~## (text, pgs_query),
+    OPERATOR    43  ~-~ (text, pgs_query),
+    OPERATOR    45  ~?? (text, pgs_query),
+    OPERATOR    48  ~== (text, pgs_query),
+    OPERATOR    49  ~^^ (text, pgs_query),
+    OPERATOR    52  ~** (text, pgs_query),
+    OPERATOR    53  ~~~ (text, pgs_query),
+    FUNCTION    1   btint4cmp(int4, int4),
+    FUNCTION    2   gin_extract_value_token_hash(internal, internal, internal),
+    FUNCTION    3   gin_extract_query_token_hash(internal, internal, int2, internal, internal, internal, internal),
+    FUNCTION    4   gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    FUNCTION    6   gin_token_triconsistent(internal, int2, internal, int4, internal, internal, internal),
+    STORAGE int4;
+
+-- opclass options (tokenizer, gram_length, casefold)
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 130000 THEN
+		ALTER OPERATOR FAMILY gin_similarity_ops USING gin
+			ADD FUNCTION 7 (text) gin_similarity_options(internal);
+		ALTER OPERATOR FAMILY gin_similarity_hash_ops USING gin
+			ADD FUNCTION 7 (text) gin_similarity_options(internal);
+	END IF;
+END
+$$;
+
+-- ~?~ through MinHash LSH band keys (approximate: candidates share a band)
+CREATE FUNCTION gin_extract_value_minhash(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_extract_query_minhash(internal, internal, int2, internal, internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_minhash_consistent(internal, int2, internal, int4, internal, internal, internal, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_minhash_options(internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE;
+
+CREATE OPERATOR CLASS gin_minhash_ops
+FOR TYPE text USING gin
+AS
+    OPERATOR    5   ~?~,		-- jaccard (approximate)
+    OPERATOR    45  ~?~ (text, pgs_query),
+    FUNCTION    1   btint4cmp(int4, int4),
+    FUNCTION    2   gin_extract_value_minhash(internal, internal, internal),
+    FUNCTION    3   gin_extract_query_minhash(internal, internal, int2, internal, internal, internal, internal),
+    FUNCTION    4   gin_minhash_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    STORAGE int4;
+
+-- opclass options (tokenizer, gram_length, casefold, bands, rows)
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 130000 THEN
+		ALTER OPERATOR FAMILY gin_minhash_ops USING gin
+			ADD FUNCTION 7 (text) gin_minhash_options(internal);
+	END IF;
+END
+$$;
+
+-- pgs_tokens values: the keys are the token hashes (as gin_similarity_hash_ops)
+CREATE FUNCTION gin_extract_value_tokens(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gin_extract_query_tokens(internal, internal, int2, internal, internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS gin_pgs_tokens_ops
+DEFAULT FOR TYPE pgs_tokens USING gin
+AS
+    OPERATOR    1   ~++,		-- block
+    OPERATOR    2   ~##,		-- cosine
+    OPERATOR    3   ~-~,		-- dice
+    OPERATOR    5   ~??,		-- jaccard
+    OPERATOR    9   ~^^,		-- matchingcoefficient
+    OPERATOR    12  ~**,		-- overlapcoefficient
+    OPERATOR    13  ~~~,		-- qgram
+    FUNCTION    1   btint4cmp(int4, int4),
+    FUNCTION    2   gin_extract_value_tokens(internal, internal, internal),
+    FUNCTION    3   gin_extract_query_tokens(internal, internal, int2, internal, internal, internal, internal),
+    FUNCTION    4   gin_token_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    FUNCTION    6   gin_token_triconsistent(internal, int2, internal, int4, internal, internal, internal),
+    STORAGE int4;
+
+--
+-- GiST support
+--
+
+CREATE FUNCTION gist_hamming_consistent(internal, varbit, int2, oid, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_distance(internal, varbit, int2, oid, internal)
+RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_compress(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_decompress(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_penalty(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_picksplit(internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_union(internal, internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_hamming_same(bytea, bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS gist_hamming_ops
+FOR TYPE varbit USING gist
+AS
+    OPERATOR    1   ~@~,		-- hamming
+    OPERATOR    2   <~@~> FOR ORDER BY pg_catalog.float_ops,
+    FUNCTION    1   gist_hamming_consistent(internal, varbit, int2, oid, internal),
+    FUNCTION    2   gist_hamming_union(internal, internal),
+    FUNCTION    3   gist_hamming_compress(internal),
+    FUNCTION    4   gist_hamming_decompress(internal),
+    FUNCTION    5   gist_hamming_penalty(internal, internal, internal),
+    FUNCTION    6   gist_hamming_picksplit(internal, internal),
+    FUNCTION    7   gist_hamming_same(bytea, bytea, internal),
+    FUNCTION    8   gist_hamming_distance(internal, varbit, int2, oid, internal),
+    STORAGE bytea;
+
+CREATE FUNCTION gist_similarity_consistent(internal, text, int2, oid, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_distance(internal, text, int2, oid, internal)
+RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_compress(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_decompress(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_penalty(internal, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_picksplit(internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_union(internal, internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_same(bytea, bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION gist_similarity_options(internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE;
+
+CREATE OPERATOR CLASS gist_similarity_ops
+FOR TYPE text USING gist
+AS
+    OPERATOR    2   ~##,		-- cosine
+    OPERATOR    3   ~-~,		-- dice
+    OPERATOR    5   ~??,		-- jaccard
+    OPERATOR    13  ~~~,		-- qgram
+    OPERATOR    22  <##> FOR ORDER BY pg_catalog.float_ops,
+    OPERATOR    23  <-~> FOR ORDER BY pg_catalog.float_ops,
+    OPERATOR    25  <??> FOR ORDER BY pg_catalog.float_ops,
+    OPERATOR    33  <~~> FOR ORDER BY pg_catalog.float_ops,
+    OPERATOR    42  ~## (text, pgs_query),
+    OPERATOR    43  ~-~ (text, pgs_query),
+    OPERATOR    45  ~?? (text, pgs_query),
+    OPERATOR    53  ~~~ (text, pgs_query),
+    FUNCTION    1   gist_similarity_consistent(internal, text, int2, oid, internal),
+    FUNCTION    2   gist_similarity_union(internal, internal),
+    FUNCTION    3   gist_similarity_compress(internal),
+    FUNCTION    4   gist_similarity_decompress(internal),
+    FUNCTION    5   gist_similarity_penalty(internal, internal, internal),
+    FUNCTION    6   gist_similarity_picksplit(internal, internal),
+    FUNCTION    7   gist_similarity_same(bytea, bytea, internal),
+    FUNCTION    8   gist_similarity_distance(internal, text, int2, oid, internal),
+    STORAGE bytea;
+
+-- opclass options (tokenizer, gram_length, casefold, siglen)
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 130000 THEN
+		ALTER OPERATOR FAMILY gist_similarity_ops USING gist
+			ADD FUNCTION 10 (text) gist_similarity_options(internal);
+	END IF;
+END
+$$;
+
+--
+-- SP-GiST support
+--
+
+CREATE FUNCTION spgist_similarity_config(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_similarity_choose(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_similarity_picksplit(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_similarity_inner_consistent(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_similarity_leaf_consistent(internal, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- radix tree searched with the Levenshtein matrix (PostgreSQL 10+)
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 100000 THEN
+		CREATE OPERATOR CLASS spgist_similarity_ops
+		FOR TYPE text USING spgist
+		AS
+			OPERATOR    8   ~==,		-- lev
+			OPERATOR    48  ~== (text, pgs_query),
+			FUNCTION    1   spgist_similarity_config(internal, internal),
+			FUNCTION    2   spgist_similarity_choose(internal, internal),
+			FUNCTION    3   spgist_similarity_picksplit(internal, internal),
+			FUNCTION    4   spgist_similarity_inner_consistent(internal, internal),
+			FUNCTION    5   spgist_similarity_leaf_consistent(internal, internal);
+	END IF;
+END
+$$;
+
+--
+-- Vantage-point trees (SP-GiST)
+--
+
+CREATE FUNCTION spgist_vptree_config(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_choose(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_picksplit_block(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_picksplit_euclidean(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_picksplit_lev(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_inner_consistent(internal, internal)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION spgist_vptree_leaf_consistent(internal, internal)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- metric trees: threshold operators and ORDER BY distance (PostgreSQL 12+)
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		CREATE OPERATOR CLASS vptree_block_ops
+		FOR TYPE text USING spgist
+		AS
+			OPERATOR    1   ~++,		-- block
+			OPERATOR    21  <++> FOR ORDER BY pg_catalog.float_ops,
+			OPERATOR    41  ~++ (text, pgs_query),
+			FUNCTION    1   spgist_vptree_config(internal, internal),
+			FUNCTION    2   spgist_vptree_choose(internal, internal),
+			FUNCTION    3   spgist_vptree_picksplit_block(internal, internal),
+			FUNCTION    4   spgist_vptree_inner_consistent(internal, internal),
+			FUNCTION    5   spgist_vptree_leaf_consistent(internal, internal);
+
+		CREATE OPERATOR CLASS vptree_euclidean_ops
+		FOR TYPE text USING spgist
+		AS
+			OPERATOR    24  <!!> FOR ORDER BY pg_catalog.float_ops,
+			FUNCTION    1   spgist_vptree_config(internal, internal),
+			FUNCTION    2   spgist_vptree_choose(internal, internal),
+			FUNCTION    3   spgist_vptree_picksplit_euclidean(internal, internal),
+			FUNCTION    4   spgist_vptree_inner_consistent(internal, internal),
+			FUNCTION    5   spgist_vptree_leaf_consistent(internal, internal);
+
+		CREATE OPERATOR CLASS vptree_lev_ops
+		FOR TYPE text USING spgist
+		AS
+			OPERATOR    8   ~==,		-- lev
+			OPERATOR    28  <==> FOR ORDER BY pg_catalog.float_ops,
+			OPERATOR    48  ~== (text, pgs_query),
+			FUNCTION    1   spgist_vptree_config(internal, internal),
+			FUNCTION    2   spgist_vptree_choose(internal, internal),
+			FUNCTION    3   spgist_vptree_picksplit_lev(internal, internal),
+			FUNCTION    4   spgist_vptree_inner_consistent(internal, internal),
+			FUNCTION    5   spgist_vptree_leaf_consistent(internal, internal);
+	END IF;
+END
+$$;
+
+--
+-- HNSW index access method: approximate ORDER BY distance (PostgreSQL 13+)
+--
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 130000 THEN
+		CREATE FUNCTION hnsw_similarity_handler(internal)
+		RETURNS index_am_handler
+		AS 'MODULE_PATHNAME'
+		LANGUAGE C;
+
+		CREATE FUNCTION hnsw_similarity_options(internal)
+		RETURNS void
+		AS 'MODULE_PATHNAME'
+		LANGUAGE C IMMUTABLE;
+
+		CREATE ACCESS METHOD pgs_hnsw TYPE INDEX HANDLER hnsw_similarity_handler;
+
+		CREATE OPERATOR CLASS hnsw_jaccard_ops
+		FOR TYPE text USING pgs_hnsw
+		AS
+			OPERATOR    1   <??> FOR ORDER BY pg_catalog.float_ops,
+			FUNCTION    1   jaccard_distance(text, text),
+			FUNCTION    2   hnsw_similarity_options(internal);
+
+		CREATE OPERATOR CLASS hnsw_cosine_ops
+		FOR TYPE text USING pgs_hnsw
+		AS
+			OPERATOR    1   <##> FOR ORDER BY pg_catalog.float_ops,
+			FUNCTION    1   cosine_distance(text, text),
+			FUNCTION    2   hnsw_similarity_options(internal);
+	END IF;
+END
+$$;
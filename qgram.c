@@ -29,6 +29,8 @@
 #include "similarity.h"
 #include "tokenizer.h"
 
+#include <math.h>
+
 
 /* GUC variables */
 int		pgs_qgram_tokenizer = PGS_UNIT_GRAM;
@@ -93,3 +95,55 @@ Datum qgram_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_qgram_threshold);
 }
+
+PG_FUNCTION_INFO_V1(qgram_query_op);
+
+/*
+ * a ~~~ ROW(b, c)::pgs_query is qgram(a, b) >= c; the measure is
+ * not normalized if pgs_qgram_is_normalized is off.
+ */
+Datum qgram_query_op(PG_FUNCTION_ARGS)
+{
+	text	*query;
+	float8	threshold;
+	float8	res;
+
+	if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+		PG_RETURN_NULL();
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 qgram,
+							 PG_GETARG_DATUM(0),
+							 PointerGetDatum(query)));
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+PG_FUNCTION_INFO_V1(qgram_distance);
+
+/*
+ * 1 - normalized qgram(a, b); distance operator <~~> (see
+ * gist_similarity_ops)
+ */
+Datum qgram_distance(PG_FUNCTION_ARGS)
+{
+	float8	res;
+
+	/* the distance is always normalized */
+	bool	tmp = pgs_qgram_is_normalized;
+	pgs_qgram_is_normalized = true;
+
+	res = DatumGetFloat8(DirectFunctionCall2(
+							 qgram,
+							 PG_GETARG_DATUM(0),
+							 PG_GETARG_DATUM(1)));
+
+	/* we're done; back to the previous value */
+	pgs_qgram_is_normalized = tmp;
+
+	/* no tokens at all: nothing in common */
+	if (isnan(res))
+		res = 0.0;
+
+	PG_RETURN_FLOAT8(1.0 - res);
+}
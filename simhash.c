@@ -0,0 +1,198 @@
+/*----------------------------------------------------------------------------
+ *
+ * simhash.c
+ *
+ * SimHash (Charikar, "Similarity Estimation Techniques from Rounding
+ * Algorithms") maps the tokens of a string to a short binary code such that
+ * the fraction of different bits of two codes estimates the angle between
+ * their token vectors:
+ *
+ *     cosine ~ cos(pi * hamming_distance / bits)
+ *
+ * Every token is hashed to a 64- or 128-bit value; each bit adds the token
+ * frequency to a per-bit counter if it is set and subtracts it otherwise.
+ * Bit i of the code is set if counter i ends up positive.
+ *
+ * The 64-bit code is a hash64, so hamming() and <~@~> are one popcount; the
+ * 128-bit code is a bit varying (gist_hamming_ops and the word-at-a-time
+ * hamming kernels). Precompute the code of each row, filter the candidates
+ * with the Hamming distance and call cosine() on the few that are left.
+ *
+ * The tokens are those of cosine() (pg_similarity.cosine_tokenizer).
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+#include "utils/varbit.h"
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <math.h>
+
+/* longest code (bits) */
+#define	PGS_SIMHASH_MAX_WORDS	2
+
+PG_FUNCTION_INFO_V1(simhash);
+PG_FUNCTION_INFO_V1(simhash_bits);
+PG_FUNCTION_INFO_V1(simhash_cosine);
+PG_FUNCTION_INFO_V1(simhash_cosine_hash64);
+
+/* splitmix64 finalizer */
+static uint64
+simhash_mix(uint64 x)
+{
+	x += UINT64CONST(0x9e3779b97f4a7c15);
+	x = (x ^ (x >> 30)) * UINT64CONST(0xbf58476d1ce4e5b9);
+	x = (x ^ (x >> 27)) * UINT64CONST(0x94d049bb133111eb);
+
+	return x ^ (x >> 31);
+}
+
+/*
+ * nwords 64-bit words of the code of t
+ */
+static void
+simhash_words(text *t, int nwords, uint64 *res)
+{
+	PgsTokenOptions	opts;
+	TokenList	*tlist;
+	Token		*tok;
+	int32		v[PGS_SIMHASH_MAX_WORDS * 64];
+	char		*buf = text_to_cstring(t);
+	int			w, i;
+
+	if (strlen(buf) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	/* the tokens cosine() sees */
+	opts.tokenizer = pgs_cosine_tokenizer;
+	opts.gramlen = PGS_GRAM_LEN;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	tlist = pgs_tokenize(&opts, buf);
+
+	memset(v, 0, sizeof(v));
+
+	for (tok = tlist->head; tok != NULL; tok = tok->next)
+	{
+		uint32	h = DatumGetUInt32(hash_any((const unsigned char *) tok->data,
+											strlen(tok->data)));
+
+		for (w = 0; w < nwords; w++)
+		{
+			uint64	x = simhash_mix(((uint64) w << 32) | h);
+
+			for (i = 0; i < 64; i++)
+				v[w * 64 + i] += ((x >> i) & 1) ? tok->freq : -tok->freq;
+		}
+	}
+
+	destroyTokenList(tlist);
+
+	for (w = 0; w < nwords; w++)
+	{
+		res[w] = 0;
+		for (i = 0; i < 64; i++)
+		{
+			if (v[w * 64 + i] > 0)
+				res[w] |= UINT64CONST(1) << i;
+		}
+	}
+}
+
+static float8
+simhash_estimate(uint64 ndiff, int nbits)
+{
+	return cos(M_PI * (float8) ndiff / nbits);
+}
+
+Datum
+simhash(PG_FUNCTION_ARGS)
+{
+	uint64	res;
+
+	simhash_words(PG_GETARG_TEXT_PP(0), 1, &res);
+
+	PG_RETURN_HASH64((hash64) res);
+}
+
+/*
+ * The code as a bit string; the first bit is the most significant bit of the
+ * first word, so simhash(t, 64)::hash64 = simhash(t).
+ */
+Datum
+simhash_bits(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	int32	nbits = PG_GETARG_INT32(1);
+	uint64	words[PGS_SIMHASH_MAX_WORDS];
+	VarBit	*res;
+	int		len;
+	int		w, i;
+
+	if (nbits != 64 && nbits != 128)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("simhash length must be 64 or 128 bits")));
+
+	simhash_words(t, nbits / 64, words);
+
+	len = VARBITTOTALLEN(nbits);
+	res = (VarBit *) palloc0(len);
+	SET_VARSIZE(res, len);
+	VARBITLEN(res) = nbits;
+
+	for (w = 0; w < nbits / 64; w++)
+	{
+		for (i = 0; i < sizeof(uint64); i++)
+			VARBITS(res)[w * sizeof(uint64) + i] =
+				(bits8) (words[w] >> (BITS_PER_BYTE * (sizeof(uint64) - 1 - i)));
+	}
+
+	PG_RETURN_VARBIT_P(res);
+}
+
+/*
+ * Estimated cosine of the strings of two codes
+ */
+Datum
+simhash_cosine(PG_FUNCTION_ARGS)
+{
+	VarBit	*a = PG_GETARG_VARBIT_P(0);
+	VarBit	*b = PG_GETARG_VARBIT_P(1);
+
+	if (VARBITLEN(a) != VARBITLEN(b))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bit strings must have the same length")));
+
+	if (VARBITLEN(a) == 0)
+		PG_RETURN_FLOAT8(1.0);
+
+	PG_RETURN_FLOAT8(simhash_estimate(_hamming_bits(VARBITS(a), VARBITS(b), VARBITBYTES(a)),
+									  VARBITLEN(a)));
+}
+
+Datum
+simhash_cosine_hash64(PG_FUNCTION_ARGS)
+{
+	hash64	a = PG_GETARG_HASH64(0);
+	hash64	b = PG_GETARG_HASH64(1);
+
+	PG_RETURN_FLOAT8(simhash_estimate(pgs_popcount64(a ^ b), 64));
+}
@@ -9,6 +9,8 @@
 
 #include "similarity.h"
 
+#include "executor/executor.h"
+
 #include <limits.h>
 
 PG_MODULE_MAGIC;
@@ -124,6 +126,29 @@ float megapcost(char *a, char *b, int i, int j)
 	return -3.0;
 }
 
+/*
+ * Query text and threshold of a pgs_query value (see the threshold
+ * operators). Returns false if any of them is NULL.
+ */
+bool
+pgs_query_args(HeapTupleHeader q, text **query, float8 *threshold)
+{
+	Datum	d;
+	bool	isnull;
+
+	d = GetAttributeByNum(q, 1, &isnull);
+	if (isnull)
+		return false;
+	*query = DatumGetTextPP(d);
+
+	d = GetAttributeByNum(q, 2, &isnull);
+	if (isnull)
+		return false;
+	*threshold = DatumGetFloat8(d);
+
+	return true;
+}
+
 /*
  * Module load callback
  *
@@ -726,5 +751,42 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	/* character sketches */
+	DefineCustomBoolVariable("pg_similarity.prefilter",
+							 "Skips the character-level measures when their character counts decide.",
+							 "Applies to the lev, jaro, jarowinkler and needlemanwunsch operators.",
+							 &pgs_prefilter,
+							 true,
+							 PGC_USERSET,
+							 0,
+#if	PG_VERSION_NUM >= 90100
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	/* planner support of the GIN operator classes */
+	gin_similarity_init();
+
+	/* measure(a, b) >= c as an index condition */
+	pgs_support_init();
+
+	/* pgs_hnsw index access method */
+	DefineCustomIntVariable("pg_similarity.hnsw_ef_search",
+							"Sets the number of candidates kept by a pgs_hnsw index search.",
+							"It is also the maximum number of rows the scan returns.",
+							&pgs_hnsw_ef_search,
+							40,
+							1,
+							1000,
+							PGC_USERSET,
+							0,
+#if	PG_VERSION_NUM >= 90100
+							NULL,
+#endif
+							NULL,
+							NULL);
+	hnsw_similarity_init();
+
 	EmitWarningsOnPlaceholders("pg_similarity");
 }
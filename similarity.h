@@ -13,9 +13,16 @@
 #include "postgres.h"
 
 #include "fmgr.h"
+#include "access/htup.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 
+#if PG_VERSION_NUM >= 130000
+#include "access/reloptions.h"
+#endif
+
 
 /* case insensitive ? */
 #define		PGS_IGNORE_CASE			1
@@ -41,6 +48,11 @@
 /* minimum score for a string that gets boosted */
 #define	PGS_JARO_BOOST_THRESHOLD	0.7
 
+/*
+ * rounding slack of the upper bound of Jaro from the sketches
+ */
+#define	PGS_JARO_BOUND_SLACK		1e-9
+
 /*
  * Levenshtein
  */
@@ -69,6 +81,100 @@ XXX simmetrics uses these values
  */
 #define		PGS_SWG_WINDOW_SIZE		100
 
+/*
+ * one-vs-many (batch) alignment of batch.c
+ */
+
+/* number of candidates computed at once */
+#define		PGS_BATCH_LANES			16
+
+/*
+ * hash64: 64-bit binary code passed by value (like int8)
+ */
+typedef uint64 hash64;
+
+#define		DatumGetHash64(X)		((hash64) DatumGetInt64(X))
+#define		Hash64GetDatum(X)		Int64GetDatum((int64) (X))
+#define		PG_GETARG_HASH64(n)		DatumGetHash64(PG_GETARG_DATUM(n))
+#define		PG_RETURN_HASH64(x)		return Hash64GetDatum(x)
+
+/*
+ * minhash: MinHash signature, one uint32 per permutation (varlena)
+ */
+typedef struct MinHash
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	uint32	h[FLEXIBLE_ARRAY_MEMBER];
+} MinHash;
+
+#define		PGS_MINHASH_MAX_PERMS	1024
+
+#define		MINHASH_SIZE(n)			(offsetof(MinHash, h) + sizeof(uint32) * (n))
+#define		MINHASH_NPERMS(m)		((VARSIZE(m) - offsetof(MinHash, h)) / sizeof(uint32))
+#define		DatumGetMinHashP(X)		((MinHash *) PG_DETOAST_DATUM(X))
+#define		PG_GETARG_MINHASH_P(n)	DatumGetMinHashP(PG_GETARG_DATUM(n))
+#define		PG_RETURN_MINHASH_P(x)	PG_RETURN_POINTER(x)
+
+/*
+ * sketch: character classes of a string and their counts (prefilter)
+ */
+#define		PGS_SKETCH_CLASSES		64
+#define		PGS_SKETCH_MAX_COUNT	255
+#define		PGS_SKETCH_LEN			(sizeof(uint64) + PGS_SKETCH_CLASSES)
+
+typedef struct PgsSketch
+{
+	uint64	mask;							/* classes that occur */
+	uint8	count[PGS_SKETCH_CLASSES];		/* occurrences (saturated) */
+} PgsSketch;
+
+/*
+ * pgs_tokens: hashed token multiset of a string, sorted by hash (varlena)
+ */
+typedef struct PgsTokenEntry
+{
+	uint32	hash;			/* hash_any() of the token */
+	int32	freq;			/* occurrences */
+} PgsTokenEntry;
+
+typedef struct PgsTokens
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	uint8	tokenizer;		/* PGS_UNIT_* */
+	uint8	gramlen;		/* n-gram length (gram tokenizer) */
+	bool	casefold;		/* lower cased before tokenizing? */
+	uint8	unused;
+	PgsTokenEntry	e[FLEXIBLE_ARRAY_MEMBER];
+} PgsTokens;
+
+#define		PGS_TOKENS_SIZE(n)		(offsetof(PgsTokens, e) + sizeof(PgsTokenEntry) * (n))
+#define		PGS_TOKENS_COUNT(t)		((VARSIZE(t) - offsetof(PgsTokens, e)) / sizeof(PgsTokenEntry))
+#define		DatumGetPgsTokensP(X)	((PgsTokens *) PG_DETOAST_DATUM(X))
+#define		PG_GETARG_PGS_TOKENS_P(n)	DatumGetPgsTokensP(PG_GETARG_DATUM(n))
+#define		PG_RETURN_PGS_TOKENS_P(x)	PG_RETURN_POINTER(x)
+
+/*
+ * tfvector: sparse term-frequency vector (varlena); the n token hashes,
+ * sorted, followed by their n weights
+ */
+typedef struct TfVector
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	uint8	tokenizer;		/* PGS_UNIT_* */
+	uint8	gramlen;		/* n-gram length (gram tokenizer) */
+	bool	casefold;		/* lower cased before tokenizing? */
+	uint8	unused;
+	uint32	data[FLEXIBLE_ARRAY_MEMBER];
+} TfVector;
+
+#define		TFVECTOR_SIZE(n)		(offsetof(TfVector, data) + (sizeof(uint32) + sizeof(float4)) * (n))
+#define		TFVECTOR_COUNT(v)		((VARSIZE(v) - offsetof(TfVector, data)) / (sizeof(uint32) + sizeof(float4)))
+#define		TFVECTOR_KEYS(v)		((v)->data)
+#define		TFVECTOR_WEIGHTS(v)		((float4 *) ((v)->data + TFVECTOR_COUNT(v)))
+#define		DatumGetTfVectorP(X)	((TfVector *) PG_DETOAST_DATUM(X))
+#define		PG_GETARG_TFVECTOR_P(n)	DatumGetTfVectorP(PG_GETARG_DATUM(n))
+#define		PG_RETURN_TFVECTOR_P(x)	PG_RETURN_POINTER(x)
+
 /*
  * Soundex
  */
@@ -84,6 +190,19 @@ XXX simmetrics uses these values
 #define		max3(a, b, c)		((a > b && a > c) ? a : ((b > c) ? b : c))
 #define		max4(a, b, c, d)	((a > b && a > c && a > d) ? a : ((b > c && b > d) ? b : ((c > d) ? c : d)))
 
+static inline int
+pgs_popcount64(uint64 x)
+{
+#ifdef HAVE__BUILTIN_POPCOUNT
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & UINT64CONST(0x5555555555555555));
+	x = (x & UINT64CONST(0x3333333333333333)) + ((x >> 2) & UINT64CONST(0x3333333333333333));
+	x = (x + (x >> 4)) & UINT64CONST(0x0f0f0f0f0f0f0f0f);
+	return (int) ((x * UINT64CONST(0x0101010101010101)) >> 56);
+#endif
+}
+
 /*
  * normalized results?
  */
@@ -153,12 +272,87 @@ extern float8	pgs_swg_threshold;
  */
 extern float8	pgs_nw_gap_penalty;
 
+/*
+ * candidates kept by a pgs_hnsw search
+ */
+extern int	pgs_hnsw_ef_search;
+
+/*
+ * skip the character-level measures when the sketches decide
+ */
+extern bool	pgs_prefilter;
+
+/*
+ * hamming.c
+ */
+uint64 _hamming_bits(const bits8 *a, const bits8 *b, int nbytes);
+
 /*
  * levenshtein.c
  */
 int _lev(char *a, char *b, int icost, int dcost);
 int _lev_slow(char *a, char *b, int icost, int dcost);
 
+/*
+ * sketch.c
+ */
+void pgs_sketch_build(const char *s, int len, PgsSketch *sk);
+bool pgs_sketch_args(text *a, text *b, PgsSketch *sa, int *alen, PgsSketch *sb, int *blen);
+int pgs_sketch_lev_bound(const PgsSketch *a, const PgsSketch *b);
+int pgs_sketch_common_bound(const PgsSketch *a, int alen, const PgsSketch *b, int blen);
+int pgs_sketch_nw_bound(const PgsSketch *a, int alen, const PgsSketch *b, int blen, int gap);
+
+/*
+ * batch.c
+ */
+void _lev_batch(char *q, char **c, int n, int icost, int dcost, int *res);
+void _nwunsch_batch(char *q, char **c, int n, int gap, int *res);
+void _smithwaterman_batch(char *q, char **c, int n, double *res);
+char **batchcandidates(ArrayType *arr, int *nelems, bool **nulls, int *ncand);
+ArrayType *batchresult(ArrayType *arr, Datum *values, bool *nulls, int nelems);
+
+/*
+ * similarity_gin.c
+ */
+
+/* how an index tokenizes (opclass options) */
+typedef struct PgsTokenOptions
+{
+	int		tokenizer;		/* PGS_UNIT_* */
+	int		gramlen;		/* n-gram length (gram tokenizer) */
+	bool	casefold;		/* lower case before tokenizing? */
+} PgsTokenOptions;
+
+#define	PGS_MAX_GRAM_LEN	16
+
+struct TokenList *pgs_tokenize(const PgsTokenOptions *opts, char *buf);
+bool pgs_token_compatible(const PgsTokenOptions *opts, int tokenizer);
+#if PG_VERSION_NUM >= 130000
+void pgs_add_token_reloptions(local_relopts *relopts, int offset, int tokenizer);
+#endif
+void gin_similarity_init(void);
+
+/*
+ * tokens.c
+ */
+int pgs_tokens_tokenizer(const char *name);
+const char *pgs_tokens_tokenizer_name(int tokenizer);
+void pgs_tokens_check_header(int tokenizer, int gramlen);
+void pgs_tokens_syntax_error(const char *typname, const char *str);
+char *pgs_tokens_read_header(const char *typname, char *str, PgsTokenOptions *opts);
+void pgs_tokens_write_header(struct StringInfoData *buf, const PgsTokenOptions *opts);
+PgsTokens *pgs_tokens_make(text *t, int tokenizer, int gramlen);
+
+/*
+ * similarity_support.c
+ */
+void pgs_support_init(void);
+
+/*
+ * similarity_hnsw.c
+ */
+void hnsw_similarity_init(void);
+
 /*
  * similarity.c
  */
@@ -167,6 +361,7 @@ int nwcost(char a, char b);
 float swcost(char *a, char *b, int i, int j);
 float swggapcost(int i, int j);
 float megapcost(char *a, char *b, int i, int j);
+bool pgs_query_args(HeapTupleHeader q, text **query, float8 *threshold);
 void _PG_init(void);
 
 /*
@@ -174,45 +369,194 @@ void _PG_init(void);
  */
 extern Datum PGDLLEXPORT block(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT block_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT block_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT block_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT cosine(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT cosine_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT cosine_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT cosine_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT dice(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT dice_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT dice_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT dice_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT euclidean(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT euclidean_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT euclidean_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT hamming(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT hamming_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT hamming_text(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT hamming_text_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hamming_distance(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hamming_hash64(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hamming_hash64_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hamming_hash64_distance(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_in(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_out(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_recv(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_send(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_from_varbit(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_to_varbit(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_eq(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_ne(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_hash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_chunk(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hash64_mih_keys(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_in(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_out(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_recv(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_send(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_default(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_jaccard(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_bands(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT minhash_band(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_value_minhash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_query_minhash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_minhash_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_minhash_options(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT simhash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT simhash_bits(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT simhash_cosine(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT simhash_cosine_hash64(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jaccard(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jaccard_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jaccard_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jaccard_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jaro(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jaro_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jarowinkler(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT jarowinkler_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT lev(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT lev_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT lev_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT lev_distance(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT lev_batch(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT levslow(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT levslow_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT matchingcoefficient(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT matchingcoefficient_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT matchingcoefficient_query_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT mongeelkan(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT mongeelkan_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT needlemanwunsch(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT needlemanwunsch_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT needlemanwunsch_align(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT needlemanwunsch_batch(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT overlapcoefficient(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT overlapcoefficient_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT overlapcoefficient_query_op(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT qgram(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT qgram_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT qgram_query_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT qgram_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT smithwaterman(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT smithwaterman_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT smithwaterman_locate(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT smithwaterman_batch(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT smithwatermangotoh(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT smithwatermangotoh_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_sketch(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_sketch_distance(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT soundex(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT soundex_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT soundex_code(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT soundex_hash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT soundex_support(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_in(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_out(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_recv(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_send(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_gram(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_dot(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_cosine(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_l1(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT tfvector_l2(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jensenshannon(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hellinger(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens_in(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens_out(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens_recv(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens_send(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokens_gram(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT block_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT block_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT cosine_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT cosine_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT dice_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT dice_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT euclidean_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT euclidean_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jaccard_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jaccard_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT matchingcoefficient_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT matchingcoefficient_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT overlapcoefficient_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT overlapcoefficient_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT qgram_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT qgram_tokens_op(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokenize_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_tokenize_array_gram(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT block_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT cosine_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT dice_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT jaccard_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT matchingcoefficient_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT overlapcoefficient_array(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT winnow(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT winnow_default(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT fingerprint_jaccard(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT fingerprint_containment(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_index_support(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_similarity_sel(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_similarity_joinsel(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT pgs_cost_support(PG_FUNCTION_ARGS);
 
 extern Datum PGDLLEXPORT gin_extract_value_token(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT gin_extract_query_token(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_value_token_hash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_query_token_hash(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_value_tokens(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_extract_query_tokens(PG_FUNCTION_ARGS);
 extern Datum PGDLLEXPORT gin_token_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_similarity_options(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gin_token_triconsistent(PG_FUNCTION_ARGS);
+
+extern Datum PGDLLEXPORT gist_hamming_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_distance(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_compress(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_decompress(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_penalty(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_picksplit(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_union(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_hamming_same(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_distance(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_compress(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_decompress(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_penalty(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_picksplit(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_union(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_same(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT gist_similarity_options(PG_FUNCTION_ARGS);
+
+extern Datum PGDLLEXPORT spgist_similarity_config(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_similarity_choose(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_similarity_picksplit(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_similarity_inner_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_similarity_leaf_consistent(PG_FUNCTION_ARGS);
+
+extern Datum PGDLLEXPORT spgist_vptree_config(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_choose(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_picksplit_block(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_picksplit_euclidean(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_picksplit_lev(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_inner_consistent(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT spgist_vptree_leaf_consistent(PG_FUNCTION_ARGS);
+
+extern Datum PGDLLEXPORT hnsw_similarity_handler(PG_FUNCTION_ARGS);
+extern Datum PGDLLEXPORT hnsw_similarity_options(PG_FUNCTION_ARGS);
 
 #endif
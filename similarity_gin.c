@@ -13,15 +13,29 @@
 
 #include "access/gin.h"
 #include "access/skey.h"
-/*
-#include "access/reloptions.h"
-#include "utils/guc.h"
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+#if PG_VERSION_NUM >= 120000
+#include "access/htup_details.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_opfamily.h"
+#include "nodes/pathnodes.h"
+#include "optimizer/plancat.h"
+#include "utils/index_selfuncs.h"
+#include "utils/lsyscache.h"
 #include "utils/syscache.h"
-*/
+#endif
 
 #include "similarity.h"
 #include "tokenizer.h"
 
+#include <math.h>
+
 /* choose one of them */
 /*
 #define PGS_BY_WORD			1
@@ -32,24 +46,380 @@
 #define PGS_BY_CAMELCASE	1
 */
 
+#ifdef PGS_BY_WORD
+#define	PGS_GIN_TOKENIZER	PGS_UNIT_WORD
+#elif PGS_BY_ALNUM
+#define	PGS_GIN_TOKENIZER	PGS_UNIT_ALNUM
+#elif PGS_BY_GRAM
+#define	PGS_GIN_TOKENIZER	PGS_UNIT_GRAM
+#elif PGS_BY_CAMELCASE
+#define	PGS_GIN_TOKENIZER	PGS_UNIT_CAMELCASE
+#else
+#error "choose a supported tokenizer"
+#endif
+
+/* same as the planner's disable_cost */
+#define	PGS_GIN_DISABLE_COST	1.0e10
+
+/* strategy numbers (see gin_similarity_ops) */
+#define	PGS_GIN_BLOCK		1
+#define	PGS_GIN_COSINE		2
+#define	PGS_GIN_DICE		3
+#define	PGS_GIN_EUCLIDEAN	4
+#define	PGS_GIN_JACCARD		5
+#define	PGS_GIN_LEV			8
+#define	PGS_GIN_MATCHING	9
+#define	PGS_GIN_OVERLAP		12
+#define	PGS_GIN_QGRAM		13
+
+/*
+ * The same operators with a pgs_query argument (the threshold comes with
+ * the query) are numbered from here: ~?? (text, pgs_query) is 45.
+ */
+#define	PGS_GIN_QUERY_OFFSET	40
+
+/*
+ * ~== also needs the length of the strings: an index with the gram tokenizer
+ * has one more key per value, PGS_GIN_LENGTH_MARK followed by the length
+ * bucket (length in bytes / PGS_GIN_LENGTH_BUCKET).
+ */
+#define	PGS_GIN_LENGTH_BUCKET	4
+#define	PGS_GIN_LENGTH_MARK		'\x01'
+
+/*
+ * What gin_extract_query() hands to the consistent functions: the threshold
+ * and the number of occurrences of each query token. extra_data[i] points
+ * to freq[i].
+ *
+ * For ~==, the last nlengths keys are the length buckets firstbucket,
+ * firstbucket + 1, ... (their freq is 0).
+ */
+typedef struct GinTokenQuery
+{
+	float8	threshold;
+	int32	length;			/* query length in bytes (~==) */
+	int32	gramlen;		/* q of the index q-grams (~==) */
+	int32	firstbucket;
+	int32	nlengths;
+	int32	freq[FLEXIBLE_ARRAY_MEMBER];
+} GinTokenQuery;
+
+/*
+ * How gin_similarity_ops and gin_similarity_hash_ops tokenize index and
+ * query values. On PostgreSQL 13 or later it is chosen per index:
+ *
+ * CREATE INDEX ... USING gin (col gin_similarity_ops (tokenizer = gram));
+ *
+ * otherwise it is the compile-time choice above.
+ */
+typedef struct GinSimilarityOptions
+{
+	int32			vl_len_;	/* varlena header (do not touch directly!) */
+	PgsTokenOptions	tok;
+} GinSimilarityOptions;
+
+static const GinSimilarityOptions gin_similarity_default_options =
+{
+	0, {PGS_GIN_TOKENIZER, PGS_GRAM_LEN, false}
+};
+
+#if PG_VERSION_NUM >= 120000
+static get_relation_info_hook_type prev_get_relation_info_hook = NULL;
+#endif
+
 PG_FUNCTION_INFO_V1(gin_extract_value_token);
 Datum gin_extract_value_token(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(gin_extract_query_token);
 Datum gin_extract_query_token(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gin_extract_value_token_hash);
+Datum gin_extract_value_token_hash(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gin_extract_query_token_hash);
+Datum gin_extract_query_token_hash(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gin_extract_value_tokens);
+Datum gin_extract_value_tokens(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gin_extract_query_tokens);
+Datum gin_extract_query_tokens(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(gin_token_consistent);
 Datum gin_token_consistent(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gin_similarity_options);
+Datum gin_similarity_options(PG_FUNCTION_ARGS);
+
+#if PG_VERSION_NUM >= 130000
+static relopt_enum_elt_def pgs_tokenizer_values[] =
+{
+	{"alnum", PGS_UNIT_ALNUM},
+	{"gram", PGS_UNIT_GRAM},
+	{"word", PGS_UNIT_WORD},
+	{"camelcase", PGS_UNIT_CAMELCASE},
+	{(const char *) NULL}
+};
 
+/*
+ * Register the tokenizer, gram_length and casefold opclass options of a
+ * PgsTokenOptions stored at offset of the options struct. Also used by the
+ * GiST operator class.
+ */
+void
+pgs_add_token_reloptions(local_relopts *relopts, int offset, int tokenizer)
+{
+	add_local_enum_reloption(relopts, "tokenizer",
+							 "how the text is split into tokens",
+							 pgs_tokenizer_values, tokenizer,
+							 "Valid values are \"alnum\", \"gram\", \"word\" and \"camelcase\".",
+							 offset + offsetof(PgsTokenOptions, tokenizer));
+	add_local_int_reloption(relopts, "gram_length",
+							"n-gram length of the gram tokenizer",
+							PGS_GRAM_LEN, 1, PGS_MAX_GRAM_LEN,
+							offset + offsetof(PgsTokenOptions, gramlen));
+	add_local_bool_reloption(relopts, "casefold",
+							 "lower case the text before tokenizing",
+							 false,
+							 offset + offsetof(PgsTokenOptions, casefold));
+}
+#endif
+
+/*
+ * Opclass options (support function 7). Only called on PostgreSQL 13 or
+ * later.
+ */
 Datum
-gin_extract_value_token(PG_FUNCTION_ARGS)
+gin_similarity_options(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 130000
+	local_relopts	*relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+	init_local_reloptions(relopts, sizeof(GinSimilarityOptions));
+	pgs_add_token_reloptions(relopts, offsetof(GinSimilarityOptions, tok),
+							 PGS_GIN_TOKENIZER);
+#endif
+
+	PG_RETURN_VOID();
+}
+
+static const GinSimilarityOptions *
+gin_similarity_get_options(FunctionCallInfo fcinfo)
+{
+#if PG_VERSION_NUM >= 130000
+	if (PG_HAS_OPCLASS_OPTIONS())
+		return (const GinSimilarityOptions *) PG_GET_OPCLASS_OPTIONS();
+#endif
+
+	return &gin_similarity_default_options;
+}
+
+/*
+ * Tokenize buf (it is modified) as an index with these options does. The
+ * result is a set.
+ */
+TokenList *
+pgs_tokenize(const PgsTokenOptions *opts, char *buf)
+{
+	TokenList	*tlist;
+
+	tlist = initTokenList(1);
+
+	if (opts->casefold)
+	{
+		char	*p;
+
+		for (p = buf; *p != '\0'; p++)
+			*p = pg_tolower((unsigned char) *p);
+	}
+
+	switch (opts->tokenizer)
+	{
+		case PGS_UNIT_WORD:
+			tokenizeBySpace(tlist, buf);
+			break;
+		case PGS_UNIT_GRAM:
+			tokenizeByGramLen(tlist, buf, opts->gramlen);
+			break;
+		case PGS_UNIT_CAMELCASE:
+			tokenizeByCamelCase(tlist, buf);
+			break;
+		case PGS_UNIT_ALNUM:
+		default:
+			tokenizeByNonAlnum(tlist, buf);
+			break;
+	}
+
+	return tlist;
+}
+
+/*
+ * Are the index tokens the ones a measure that uses tokenizer sees?
+ */
+bool
+pgs_token_compatible(const PgsTokenOptions *opts, int tokenizer)
+{
+	if (opts->tokenizer != tokenizer)
+		return false;
+	if (tokenizer == PGS_UNIT_GRAM && opts->gramlen != PGS_GRAM_LEN)
+		return false;
+	/* folded keys only agree with measures that ignore case */
+	if (opts->casefold != pgs_tokenizer_casefold)
+		return false;
+
+	return true;
+}
+
+/*
+ * Measure of an operator (without the pgs_query offset)
+ */
+static StrategyNumber
+gin_token_strategy(StrategyNumber strategy)
+{
+	if (strategy > PGS_GIN_QUERY_OFFSET)
+		return strategy - PGS_GIN_QUERY_OFFSET;
+
+	return strategy;
+}
+
+static float8
+gin_token_guc_threshold(StrategyNumber strategy)
+{
+	switch (strategy)
+	{
+		case PGS_GIN_BLOCK:
+			return pgs_block_threshold;
+		case PGS_GIN_COSINE:
+			return pgs_cosine_threshold;
+		case PGS_GIN_DICE:
+			return pgs_dice_threshold;
+		case PGS_GIN_EUCLIDEAN:
+			return pgs_euclidean_threshold;
+		case PGS_GIN_JACCARD:
+			return pgs_jaccard_threshold;
+		case PGS_GIN_LEV:
+			return pgs_levenshtein_threshold;
+		case PGS_GIN_MATCHING:
+			return pgs_matching_threshold;
+		case PGS_GIN_OVERLAP:
+			return pgs_overlap_threshold;
+		case PGS_GIN_QGRAM:
+			return pgs_qgram_threshold;
+		default:
+			return 0.0;
+	}
+}
+
+/*
+ * Does the index hold the same tokens the operator's measure uses? If not,
+ * the index can only say "maybe" for every row.
+ */
+static bool
+gin_token_compatible(const GinSimilarityOptions *opts, StrategyNumber strategy)
+{
+	int		tokenizer;
+
+	switch (gin_token_strategy(strategy))
+	{
+		case PGS_GIN_BLOCK:
+			tokenizer = pgs_block_tokenizer;
+			break;
+		case PGS_GIN_COSINE:
+			tokenizer = pgs_cosine_tokenizer;
+			break;
+		case PGS_GIN_DICE:
+			tokenizer = pgs_dice_tokenizer;
+			break;
+		case PGS_GIN_EUCLIDEAN:
+			tokenizer = pgs_euclidean_tokenizer;
+			break;
+		case PGS_GIN_JACCARD:
+			tokenizer = pgs_jaccard_tokenizer;
+			break;
+		case PGS_GIN_LEV:
+			/*
+			 * The q-gram lemma holds for any q. lev() folds the strings
+			 * itself (PGS_IGNORE_CASE), so the keys must be folded too,
+			 * whatever the tokenizers do. Folded keys only count more
+			 * common q-grams, so they are fine for a case-sensitive lev().
+			 */
+			if (opts->tok.tokenizer != PGS_UNIT_GRAM)
+				return false;
+#ifdef PGS_IGNORE_CASE
+			return opts->tok.casefold;
+#else
+			return true;
+#endif
+		case PGS_GIN_MATCHING:
+			tokenizer = pgs_matching_tokenizer;
+			break;
+		case PGS_GIN_OVERLAP:
+			tokenizer = pgs_overlap_tokenizer;
+			break;
+		case PGS_GIN_QGRAM:
+			tokenizer = pgs_qgram_tokenizer;
+			break;
+		default:
+			return false;
+	}
+
+	return pgs_token_compatible(&opts->tok, tokenizer);
+}
+
+/*
+ * Can gin_token_may_match() rule out rows for this operator? Besides the
+ * tokens, the pgs_query operators of block, qgram and lev compare the
+ * threshold with a distance if the measure is not normalized: no bound there.
+ */
+static bool
+gin_token_prunable(const GinSimilarityOptions *opts, StrategyNumber strategy)
+{
+	if (!gin_token_compatible(opts, strategy))
+		return false;
+
+	if (strategy == PGS_GIN_QUERY_OFFSET + PGS_GIN_BLOCK)
+		return pgs_block_is_normalized;
+	if (strategy == PGS_GIN_QUERY_OFFSET + PGS_GIN_QGRAM)
+		return pgs_qgram_is_normalized;
+	if (strategy == PGS_GIN_QUERY_OFFSET + PGS_GIN_LEV)
+		return pgs_levenshtein_is_normalized;
+
+	return true;
+}
+
+/*
+ * Index key of a token: the token itself (gin_similarity_ops) or its 32-bit
+ * hash (gin_similarity_hash_ops). Hash collisions only add rows to recheck
+ * and make the counts of gin_token_may_match() larger, so the bounds hold.
+ */
+static Datum
+gin_token_key(const char *token, bool hashed)
+{
+	if (hashed)
+		return Int32GetDatum((int32) DatumGetUInt32(hash_any((const unsigned char *) token,
+															 strlen(token))));
+
+	return PointerGetDatum(cstring_to_text_with_len(token, strlen(token)));
+}
+
+/*
+ * Index key of a length bucket (see PGS_GIN_LENGTH_BUCKET)
+ */
+static Datum
+gin_length_key(int32 bucket, bool hashed)
+{
+	char	key[16];
+
+	snprintf(key, sizeof(key), "%c%d", PGS_GIN_LENGTH_MARK, bucket);
+
+	return gin_token_key(key, hashed);
+}
+
+static Datum
+gin_extract_value(FunctionCallInfo fcinfo, bool hashed)
 {
 	text	*value = (text *) PG_GETARG_TEXT_P(0);
 	int32	*ntokens = (int32 *) PG_GETARG_POINTER(1);
+	const GinSimilarityOptions	*opts = gin_similarity_get_options(fcinfo);
 
 	Datum	*tokens = NULL;
 	char	*buf;
 
 
-	elog(DEBUG3, "gin_extract_value_token() called");
+	elog(DEBUG3, "gin_extract_value() called (hashed: %d)", hashed);
 
 	buf = text_to_cstring(value);
 	*ntokens = 0;
@@ -58,46 +428,31 @@ gin_extract_value_token(PG_FUNCTION_ARGS)
 	{
 		TokenList	*tlist;
 		Token		*t;
+		int			length = strlen(buf);
+		/* only ~== needs the length and it needs q-grams */
+		bool		haslength = (opts->tok.tokenizer == PGS_UNIT_GRAM);
 
-		tlist = initTokenList(1);
-
-		/*
-		 * TODO we want to index according to out GUCs
-		 * TODO we need to store the tokenized-by information
-		 * TODO so we can decide to use or not the index for a
-		 * TODO given query
-		 */
-#ifdef PGS_BY_WORD
-		tokenizeBySpace(tlist, buf);
-#elif PGS_BY_ALNUM
-		tokenizeByNonAlnum(tlist, buf);
-#elif PGS_BY_GRAM
-		tokenizeByGram(tlist, buf);
-#elif PGS_BY_CAMELCASE
-		tokenizeByCamelCase(tlist, buf);
-#else
-		elog(ERROR, "choose a supported tokenizer");
-#endif
+		tlist = pgs_tokenize(&opts->tok, buf);
 
-		*ntokens = tlist->size;
+		*ntokens = tlist->size + (haslength ? 1 : 0);
 
-		if (tlist->size > 0)
+		if (*ntokens > 0)
 		{
 			int		i;
 
-			tokens = (Datum *) palloc(sizeof(Datum) * tlist->size);
+			tokens = (Datum *) palloc(sizeof(Datum) * (*ntokens));
 
 			t = tlist->head;
 
 			for (i = 0; i < tlist->size; i++)
 			{
-				text	*td;
-
-				td = cstring_to_text_with_len(t->data, strlen(t->data));
-				tokens[i] = PointerGetDatum(td);
+				tokens[i] = gin_token_key(t->data, hashed);
 
 				t = t->next;
 			}
+
+			if (haslength)
+				tokens[tlist->size] = gin_length_key(length / PGS_GIN_LENGTH_BUCKET, hashed);
 		}
 
 		destroyTokenList(tlist);
@@ -108,17 +463,15 @@ gin_extract_value_token(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(tokens);
 }
 
-Datum
-gin_extract_query_token(PG_FUNCTION_ARGS)
+static Datum
+gin_extract_query(FunctionCallInfo fcinfo, bool hashed)
 {
-	text			*value = (text *) PG_GETARG_TEXT_P(0);
 	int32			*ntokens = (int32 *) PG_GETARG_POINTER(1);
-
+	StrategyNumber	strategy = PG_GETARG_UINT16(2);
 	/*
-		StrategyNumber	strategy = PG_GETARG_UINT16(2);
 		bool			**pmatch = (bool **) PG_GETARG_POINTER(3);
-		Pointer			**extra_data = (Pointer *) PG_GETARG_POINTER(4);
 	*/
+	Pointer			**extra_data = (Pointer **) PG_GETARG_POINTER(4);
 
 #if	PG_VERSION_NUM >= 90100
 	/*
@@ -127,59 +480,122 @@ gin_extract_query_token(PG_FUNCTION_ARGS)
 	int32			*search_mode = (int32 *) PG_GETARG_POINTER(6);
 #endif
 
+	const GinSimilarityOptions	*opts = gin_similarity_get_options(fcinfo);
+	text			*value;
+	float8			threshold;
 	Datum			*tokens = NULL;
 	char			*buf;
 
 
-	elog(DEBUG3, "gin_extract_query_token() called");
+	elog(DEBUG3, "gin_extract_query() called (hashed: %d)", hashed);
 
-	buf = text_to_cstring(value);
 	*ntokens = 0;
 
+	if (strategy > PGS_GIN_QUERY_OFFSET)
+	{
+		/* a NULL query or threshold matches nothing */
+		if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(0), &value, &threshold))
+			PG_RETURN_POINTER(tokens);
+	}
+	else
+	{
+		value = PG_GETARG_TEXT_PP(0);
+		threshold = gin_token_guc_threshold(strategy);
+	}
+
+#if	PG_VERSION_NUM >= 90100
+	/*
+	 * The index tokens don't tell anything about this operator or every row
+	 * might satisfy it (even the ones without a common token); scan the
+	 * whole index and let the recheck decide. A query that lev() rejects
+	 * has to reach the recheck too, so it raises its error.
+	 */
+	if (!gin_token_prunable(opts, strategy) || !(threshold > 0.0) ||
+		(gin_token_strategy(strategy) == PGS_GIN_LEV &&
+		 VARSIZE_ANY_EXHDR(value) > PGS_MAX_STR_LEN))
+	{
+		elog(DEBUG1, "index can't prune strategy %d (threshold: %.3f)",
+			 strategy, threshold);
+		*search_mode = GIN_SEARCH_MODE_ALL;
+		PG_RETURN_POINTER(tokens);
+	}
+#endif
+
+	buf = text_to_cstring(value);
+
 	if (buf != NULL)
 	{
 		TokenList	*tlist;
 		Token		*t;
-
-		tlist = initTokenList(1);
+		int			length = strlen(buf);
+		int			firstbucket = 0;
+		int			nlengths = 0;
 
 		/*
-		 * TODO we want to index according to out GUCs
-		 * TODO we need to store the tokenized-by information
-		 * TODO so we can decide to use or not the index for a
-		 * TODO given query
+		 * lev(a, b) >= threshold needs a distance of at most (1 - threshold)
+		 * * max(length(a), length(b)) and the distance is at least the
+		 * difference of the lengths, so only values of length threshold *
+		 * length .. length / threshold can match. A value has the key of
+		 * its length bucket, so asking for the keys of these buckets visits
+		 * every such value (even the ones without a common q-gram).
 		 */
-#ifdef PGS_BY_WORD
-		tokenizeBySpace(tlist, buf);
-#elif PGS_BY_ALNUM
-		tokenizeByNonAlnum(tlist, buf);
-#elif PGS_BY_GRAM
-		tokenizeByGram(tlist, buf);
-#elif PGS_BY_CAMELCASE
-		tokenizeByCamelCase(tlist, buf);
-#else
-		elog(ERROR, "choose a supported tokenizer");
-#endif
+		if (gin_token_strategy(strategy) == PGS_GIN_LEV)
+		{
+			int		minlen = (int) floor(threshold * length);
+			int		maxlen = (int) Min(ceil(length / threshold), (double) PGS_MAX_STR_LEN);
 
-		*ntokens = tlist->size;
+			if (minlen <= maxlen)
+			{
+				firstbucket = minlen / PGS_GIN_LENGTH_BUCKET;
+				nlengths = maxlen / PGS_GIN_LENGTH_BUCKET - firstbucket + 1;
+			}
+		}
 
-		if (tlist->size > 0)
+		tlist = pgs_tokenize(&opts->tok, buf);
+
+		*ntokens = tlist->size + nlengths;
+
+		if (*ntokens > 0)
 		{
-			int		i;
+			int				i;
+			GinTokenQuery	*q;
 
-			tokens = (Datum *) palloc(sizeof(Datum) * tlist->size);
+			tokens = (Datum *) palloc(sizeof(Datum) * (*ntokens));
+
+			/*
+			 * number of occurrences of each token in the query; the
+			 * consistent functions need them to bound the block distance
+			 */
+			q = (GinTokenQuery *) palloc(offsetof(GinTokenQuery, freq) +
+										 sizeof(int32) * (*ntokens));
+			q->threshold = threshold;
+			q->length = length;
+			q->gramlen = opts->tok.gramlen;
+			q->firstbucket = firstbucket;
+			q->nlengths = nlengths;
+			*extra_data = (Pointer *) palloc(sizeof(Pointer) * (*ntokens));
 
 			t = tlist->head;
 
 			for (i = 0; i < tlist->size; i++)
 			{
-				text	*td;
+				tokens[i] = gin_token_key(t->data, hashed);
 
-				td = cstring_to_text_with_len(t->data, strlen(t->data));
-				tokens[i] = PointerGetDatum(td);
+				q->freq[i] = t->freq;
+				(*extra_data)[i] = (Pointer) &q->freq[i];
 
 				t = t->next;
 			}
+
+			for (i = 0; i < nlengths; i++)
+			{
+				int		k = tlist->size + i;
+
+				tokens[k] = gin_length_key(firstbucket + i, hashed);
+
+				q->freq[k] = 0;
+				(*extra_data)[k] = (Pointer) &q->freq[k];
+			}
 		}
 
 		destroyTokenList(tlist);
@@ -190,22 +606,244 @@ gin_extract_query_token(PG_FUNCTION_ARGS)
 		*search_mode = GIN_SEARCH_MODE_ALL;
 #endif
 
-	PG_FREE_IF_COPY(value, 0);
+	PG_RETURN_POINTER(tokens);
+}
+
+Datum
+gin_extract_value_token(PG_FUNCTION_ARGS)
+{
+	return gin_extract_value(fcinfo, false);
+}
+
+Datum
+gin_extract_query_token(PG_FUNCTION_ARGS)
+{
+	return gin_extract_query(fcinfo, false);
+}
+
+Datum
+gin_extract_value_token_hash(PG_FUNCTION_ARGS)
+{
+	return gin_extract_value(fcinfo, true);
+}
+
+Datum
+gin_extract_query_token_hash(PG_FUNCTION_ARGS)
+{
+	return gin_extract_query(fcinfo, true);
+}
+
+/*
+ * gin_pgs_tokens_ops: the keys of a pgs_tokens value are its token hashes,
+ * the keys gin_similarity_hash_ops builds from the same tokens.
+ */
+Datum
+gin_extract_value_tokens(PG_FUNCTION_ARGS)
+{
+	PgsTokens	*value = PG_GETARG_PGS_TOKENS_P(0);
+	int32		*ntokens = (int32 *) PG_GETARG_POINTER(1);
+	Datum		*tokens = NULL;
+	int			i;
+
+	elog(DEBUG3, "gin_extract_value_tokens() called");
+
+	*ntokens = PGS_TOKENS_COUNT(value);
+
+	if (*ntokens > 0)
+	{
+		tokens = (Datum *) palloc(sizeof(Datum) * (*ntokens));
+
+		for (i = 0; i < *ntokens; i++)
+			tokens[i] = Int32GetDatum((int32) value->e[i].hash);
+	}
 
 	PG_RETURN_POINTER(tokens);
 }
 
+/*
+ * The pgs_tokens operators compare both values as they are, so the bounds
+ * of gin_token_may_match() always hold.
+ */
+Datum
+gin_extract_query_tokens(PG_FUNCTION_ARGS)
+{
+	PgsTokens		*value = PG_GETARG_PGS_TOKENS_P(0);
+	int32			*ntokens = (int32 *) PG_GETARG_POINTER(1);
+	StrategyNumber	strategy = PG_GETARG_UINT16(2);
+	Pointer			**extra_data = (Pointer **) PG_GETARG_POINTER(4);
+
+#if	PG_VERSION_NUM >= 90100
+	int32			*search_mode = (int32 *) PG_GETARG_POINTER(6);
+#endif
+
+	float8			threshold = gin_token_guc_threshold(strategy);
+	Datum			*tokens = NULL;
+	int				i;
+
+	elog(DEBUG3, "gin_extract_query_tokens() called");
+
+	*ntokens = 0;
+
+#if	PG_VERSION_NUM >= 90100
+	/* every row might satisfy the operator */
+	if (!(threshold > 0.0) || PGS_TOKENS_COUNT(value) == 0)
+	{
+		elog(DEBUG1, "index can't prune strategy %d (threshold: %.3f)",
+			 strategy, threshold);
+		*search_mode = GIN_SEARCH_MODE_ALL;
+		PG_RETURN_POINTER(tokens);
+	}
+#endif
+
+	*ntokens = PGS_TOKENS_COUNT(value);
+
+	if (*ntokens > 0)
+	{
+		GinTokenQuery	*q;
+
+		tokens = (Datum *) palloc(sizeof(Datum) * (*ntokens));
+
+		q = (GinTokenQuery *) palloc0(offsetof(GinTokenQuery, freq) +
+									  sizeof(int32) * (*ntokens));
+		q->threshold = threshold;
+		*extra_data = (Pointer *) palloc(sizeof(Pointer) * (*ntokens));
+
+		for (i = 0; i < *ntokens; i++)
+		{
+			tokens[i] = Int32GetDatum((int32) value->e[i].hash);
+
+			q->freq[i] = value->e[i].freq;
+			(*extra_data)[i] = (Pointer) &q->freq[i];
+		}
+	}
+
+	PG_RETURN_POINTER(tokens);
+}
+
+/*
+ * Could an indexed value that contains nmatch of the nkeys query tokens
+ * satisfy the operator? Measures are upper bounded assuming the indexed
+ * value has no tokens other than the matching ones (every other token only
+ * lowers the similarity). bmatch and btotal are the number of query token
+ * occurrences (with duplicates) that match and in total.
+ *
+ * The bounds only hold if the index and the measure use the same tokens
+ * (see gin_token_prunable); otherwise the query has no keys at all.
+ */
+static bool
+gin_token_may_match(StrategyNumber strategy, float8 threshold, int32 nkeys,
+					int nmatch, int bmatch, int btotal)
+{
+	float8	res;
+
+	if (nkeys == 0)
+		return true;
+
+	switch (gin_token_strategy(strategy))
+	{
+		case PGS_GIN_BLOCK:
+			/* (totpossible - totdistance) / totpossible */
+			res = (float8) ((bmatch + btotal) - (btotal - bmatch)) / (bmatch + btotal);
+			return (res >= threshold);
+		case PGS_GIN_COSINE:
+			if (nmatch == 0)
+				return (0.0 >= threshold);
+			res = (float8) nmatch / (sqrt(nmatch) * sqrt(nkeys));
+			return (res >= threshold);
+		case PGS_GIN_DICE:
+			res = (float8) (2.0 * nmatch) / (nmatch + nkeys);
+			return (res >= threshold);
+		case PGS_GIN_JACCARD:
+			res = (float8) nmatch / nkeys;
+			return (res >= threshold);
+		case PGS_GIN_QGRAM:
+			res = (float8) ((bmatch + btotal) - (btotal - bmatch)) / (bmatch + btotal);
+			return (res >= threshold);
+		/*
+		 * Overlap and matching coefficients can reach 1.0 with only one
+		 * common token; euclidean has no simple bound.
+		 */
+		case PGS_GIN_MATCHING:
+			return (nmatch > 0 || 0.0 >= threshold);
+		case PGS_GIN_OVERLAP:
+			return (nmatch > 0 || 0.0 >= threshold);
+		case PGS_GIN_EUCLIDEAN:
+		default:
+			return true;
+	}
+}
+
+/*
+ * Could an indexed value of length bucket minbucket .. maxbucket (a single
+ * one unless hashed keys collide) that has nmatch of the ngrams query
+ * q-grams satisfy ~==? By the q-gram lemma, each edit destroys at most q of
+ * the q-grams of a string, so a value within edit distance k still has all
+ * but k * q of the query q-grams.
+ */
+static bool
+gin_lev_may_match(const GinTokenQuery *q, int ngrams, int nmatch,
+				  int minbucket, int maxbucket)
+{
+	int		maxlen;
+	int		k;
+
+	/* the length is out of range */
+	if (maxbucket < 0)
+		return false;
+
+	/* strings shorter than q don't have proper q-grams */
+	if (q->length < q->gramlen || minbucket * PGS_GIN_LENGTH_BUCKET < q->gramlen)
+		return true;
+
+	maxlen = Max(q->length, (maxbucket + 1) * PGS_GIN_LENGTH_BUCKET - 1);
+
+	/* largest distance that reaches the threshold (rounding errors aside) */
+	k = (int) floor((1.0 - q->threshold) * maxlen + 1.0e-9);
+
+	return (nmatch >= ngrams - k * q->gramlen);
+}
+
+static GinTokenQuery *
+gin_token_query(Pointer *extra_data)
+{
+	/* no keys or extra data from an older gin_extract_query_token() */
+	if (extra_data == NULL || extra_data[0] == NULL)
+		return NULL;
+
+	return (GinTokenQuery *) ((char *) extra_data[0] - offsetof(GinTokenQuery, freq));
+}
+
+static float8
+gin_token_threshold(StrategyNumber strategy, Pointer *extra_data)
+{
+	GinTokenQuery	*q = gin_token_query(extra_data);
+
+	if (q == NULL)
+		return gin_token_guc_threshold(gin_token_strategy(strategy));
+
+	return q->threshold;
+}
+
+static int
+gin_token_freq(Pointer *extra_data, int i)
+{
+	/* no extra data from an older gin_extract_query_token() */
+	if (extra_data == NULL || extra_data[i] == NULL)
+		return 1;
+
+	return *((int32 *) extra_data[i]);
+}
+
 Datum
 gin_token_consistent(PG_FUNCTION_ARGS)
 {
+	bool			*check = (bool *) PG_GETARG_POINTER(0);
+	StrategyNumber	strategy = PG_GETARG_UINT16(1);
 	/*
-		bool			*check = (bool *) PG_GETARG_POINTER(0);
-		StrategyNumber	strategy = PG_GETARG_UINT16(1);
 		text			*query = PG_GETARG_TEXT_P(2);
-		int32			ntokens = PG_GETARG_INT32(3);
-		Pointer			*extra_data = (Pointer *) PG_GETARG_POINTER(4);
 	*/
-
+	int32			nkeys = PG_GETARG_INT32(3);
+	Pointer			*extra_data = (Pointer *) PG_GETARG_POINTER(4);
 	bool			*recheck = (bool *) PG_GETARG_POINTER(5);
 
 	/*
@@ -215,13 +853,232 @@ gin_token_consistent(PG_FUNCTION_ARGS)
 	#endif
 	*/
 
+	GinTokenQuery	*q = gin_token_query(extra_data);
+	int				ntokens = nkeys - ((q != NULL) ? q->nlengths : 0);
+	int				nmatch = 0;
+	int				bmatch = 0;
+	int				btotal = 0;
+	int				minbucket = -1;
+	int				maxbucket = -1;
+	int				i;
+
 	elog(DEBUG3, "gin_token_consistent() called");
 
+	for (i = 0; i < ntokens; i++)
+	{
+		int		freq = gin_token_freq(extra_data, i);
+
+		btotal += freq;
+		if (check[i])
+		{
+			nmatch++;
+			bmatch += freq;
+		}
+	}
+
+	for (i = ntokens; i < nkeys; i++)
+	{
+		if (check[i])
+		{
+			if (minbucket < 0)
+				minbucket = q->firstbucket + (i - ntokens);
+			maxbucket = q->firstbucket + (i - ntokens);
+		}
+	}
+
 	/*
 	 * Heap tuple might match the query. Evaluating the query operator directly
 	 * against the originally indexed item.
 	 */
 	*recheck = true;
 
-	PG_RETURN_BOOL(true);
+	if (gin_token_strategy(strategy) == PGS_GIN_LEV && q != NULL)
+		PG_RETURN_BOOL(gin_lev_may_match(q, ntokens, nmatch, minbucket, maxbucket));
+
+	PG_RETURN_BOOL(gin_token_may_match(strategy,
+									   gin_token_threshold(strategy, extra_data),
+									   ntokens, nmatch, bmatch, btotal));
+}
+
+#if PG_VERSION_NUM >= 90400
+PG_FUNCTION_INFO_V1(gin_token_triconsistent);
+Datum gin_token_triconsistent(PG_FUNCTION_ARGS);
+
+/*
+ * Same as gin_token_consistent() counting GIN_MAYBE keys as matches.
+ */
+Datum
+gin_token_triconsistent(PG_FUNCTION_ARGS)
+{
+	GinTernaryValue	*check = (GinTernaryValue *) PG_GETARG_POINTER(0);
+	StrategyNumber	strategy = PG_GETARG_UINT16(1);
+	/*
+		text			*query = PG_GETARG_TEXT_P(2);
+	*/
+	int32			nkeys = PG_GETARG_INT32(3);
+	Pointer			*extra_data = (Pointer *) PG_GETARG_POINTER(4);
+	GinTokenQuery	*q = gin_token_query(extra_data);
+	int				ntokens = nkeys - ((q != NULL) ? q->nlengths : 0);
+	int				nmatch = 0;
+	int				bmatch = 0;
+	int				btotal = 0;
+	int				minbucket = -1;
+	int				maxbucket = -1;
+	bool			res;
+	int				i;
+
+	elog(DEBUG3, "gin_token_triconsistent() called");
+
+	for (i = 0; i < ntokens; i++)
+	{
+		int		freq = gin_token_freq(extra_data, i);
+
+		btotal += freq;
+		if (check[i] != GIN_FALSE)
+		{
+			nmatch++;
+			bmatch += freq;
+		}
+	}
+
+	for (i = ntokens; i < nkeys; i++)
+	{
+		if (check[i] != GIN_FALSE)
+		{
+			if (minbucket < 0)
+				minbucket = q->firstbucket + (i - ntokens);
+			maxbucket = q->firstbucket + (i - ntokens);
+		}
+	}
+
+	if (gin_token_strategy(strategy) == PGS_GIN_LEV && q != NULL)
+		res = gin_lev_may_match(q, ntokens, nmatch, minbucket, maxbucket);
+	else
+		res = gin_token_may_match(strategy, gin_token_threshold(strategy, extra_data),
+								  ntokens, nmatch, bmatch, btotal);
+
+	if (!res)
+		PG_RETURN_GIN_TERNARY_VALUE(GIN_FALSE);
+
+	/* the operator has to be rechecked anyway */
+	PG_RETURN_GIN_TERNARY_VALUE(GIN_MAYBE);
+}
+#endif
+
+#if PG_VERSION_NUM >= 120000
+static bool
+gin_similarity_opfamily(Oid opfamily)
+{
+	HeapTuple	tp;
+	bool		result = false;
+
+	tp = SearchSysCache1(OPFAMILYOID, ObjectIdGetDatum(opfamily));
+	if (HeapTupleIsValid(tp))
+	{
+		Form_pg_opfamily	fam = (Form_pg_opfamily) GETSTRUCT(tp);
+
+		result = (fam->opfmethod == GIN_AM_OID &&
+				  (strcmp(NameStr(fam->opfname), "gin_similarity_ops") == 0 ||
+				   strcmp(NameStr(fam->opfname), "gin_similarity_hash_ops") == 0));
+		ReleaseSysCache(tp);
+	}
+
+	return result;
+}
+
+/*
+ * gincostestimate() plus a huge penalty if a clause uses a measure whose
+ * tokens are not the index tokens (or that the index can't bound at all):
+ * such a scan reads the whole index and rechecks every row, so any other
+ * plan is better.
+ */
+static void
+gin_similarity_costestimate(PlannerInfo *root, IndexPath *path, double loop_count,
+							Cost *indexStartupCost, Cost *indexTotalCost,
+							Selectivity *indexSelectivity, double *indexCorrelation,
+							double *indexPages)
+{
+	IndexOptInfo	*index = path->indexinfo;
+	ListCell		*lc;
+
+	gincostestimate(root, path, loop_count, indexStartupCost, indexTotalCost,
+					indexSelectivity, indexCorrelation, indexPages);
+
+	foreach(lc, path->indexclauses)
+	{
+		IndexClause	*iclause = lfirst_node(IndexClause, lc);
+		int			col = iclause->indexcol;
+		Oid			opfamily = index->opfamily[col];
+		const GinSimilarityOptions	*opts = &gin_similarity_default_options;
+		ListCell	*lc2;
+
+		if (!gin_similarity_opfamily(opfamily))
+			continue;
+
+#if PG_VERSION_NUM >= 130000
+		if (index->opclassoptions != NULL && index->opclassoptions[col] != NULL)
+			opts = (const GinSimilarityOptions *) index->opclassoptions[col];
+#endif
+
+		foreach(lc2, iclause->indexquals)
+		{
+			RestrictInfo	*rinfo = lfirst_node(RestrictInfo, lc2);
+			int				strategy;
+
+			if (!IsA(rinfo->clause, OpExpr))
+				continue;
+
+			strategy = get_op_opfamily_strategy(((OpExpr *) rinfo->clause)->opno, opfamily);
+
+			if (!gin_token_prunable(opts, strategy))
+			{
+				elog(DEBUG1, "index %u: can't prune strategy %d",
+					 index->indexoid, strategy);
+				*indexStartupCost += PGS_GIN_DISABLE_COST;
+				*indexTotalCost += PGS_GIN_DISABLE_COST;
+				return;
+			}
+		}
+	}
+}
+
+static void
+gin_similarity_relation_info(PlannerInfo *root, Oid relationObjectId,
+							 bool inhparent, RelOptInfo *rel)
+{
+	ListCell	*lc;
+
+	if (prev_get_relation_info_hook)
+		prev_get_relation_info_hook(root, relationObjectId, inhparent, rel);
+
+	foreach(lc, rel->indexlist)
+	{
+		IndexOptInfo	*index = (IndexOptInfo *) lfirst(lc);
+		int				i;
+
+		if (index->relam != GIN_AM_OID)
+			continue;
+
+		for (i = 0; i < index->nkeycolumns; i++)
+		{
+			if (gin_similarity_opfamily(index->opfamily[i]))
+			{
+				index->amcostestimate = gin_similarity_costestimate;
+				break;
+			}
+		}
+	}
+}
+#endif
+
+/*
+ * Called from _PG_init()
+ */
+void
+gin_similarity_init(void)
+{
+#if PG_VERSION_NUM >= 120000
+	prev_get_relation_info_hook = get_relation_info_hook;
+	get_relation_info_hook = gin_similarity_relation_info;
+#endif
 }
@@ -0,0 +1,1253 @@
+/*----------------------------------------------------------------------------
+ *
+ * similarity_gist.c
+ *
+ * GiST support routines
+ *
+ * gist_hamming_ops indexes bit strings (e.g. perceptual hashes) for the ~@~
+ * operator and for nearest-neighbour searches using the <~@~> distance
+ * operator. Leaf keys are the bit strings themselves. Internal keys store
+ * two signatures: the OR of every bit string below it (a bit is set in at
+ * least one of them) and the AND (a bit is set in all of them). Where the
+ * query has a bit that is clear in the OR signature, or lacks a bit that is
+ * set in the AND signature, every bit string below differs from the query;
+ * counting those bits gives a lower bound of the Hamming distance to the
+ * whole subtree. A column may hold bit strings of different lengths: keys
+ * keep the length, an internal key over several lengths has no signatures,
+ * and bit strings of another length than the query never match it.
+ *
+ * gist_similarity_ops indexes text for nearest-neighbour searches by the
+ * token based measures (see below).
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/gist.h"
+#include "access/skey.h"
+#if PG_VERSION_NUM >= 120000
+#include "utils/float.h"
+#endif
+#include "utils/varbit.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <math.h>
+
+/* strategy numbers */
+#define	PGS_GIST_HAMMING_STRATEGY		1		/* ~@~ */
+#define	PGS_GIST_HAMMING_DIST_STRATEGY	2		/* <~@~> */
+
+typedef struct
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	int32	bitlen;			/* length of the indexed bit strings */
+	int32	flag;
+	bits8	data[FLEXIBLE_ARRAY_MEMBER];	/* OR signature, AND signature */
+} HammingKey;
+
+/* leaf keys store only one signature (OR == AND) */
+#define	HKEY_LEAF			0x01
+/*
+ * internal key over bit strings of different lengths: no signature, it
+ * can't rule anything out (bitlen is 0)
+ */
+#define	HKEY_MIXED			0x02
+
+#define	HKEY_HDRSZ			offsetof(HammingKey, data)
+#define	HKEY_ISLEAF(k)		(((k)->flag & HKEY_LEAF) != 0)
+#define	HKEY_ISMIXED(k)		(((k)->flag & HKEY_MIXED) != 0)
+#define	HKEY_NBYTES(k)		(((k)->bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE)
+#define	HKEY_OR(k)			((k)->data)
+#define	HKEY_AND(k)			(HKEY_ISLEAF(k) ? (k)->data : (k)->data + HKEY_NBYTES(k))
+
+#define	GETENTRY(vec, pos)	((HammingKey *) DatumGetPointer((vec)->vector[(pos)].key))
+
+PG_FUNCTION_INFO_V1(gist_hamming_consistent);
+PG_FUNCTION_INFO_V1(gist_hamming_distance);
+PG_FUNCTION_INFO_V1(gist_hamming_compress);
+PG_FUNCTION_INFO_V1(gist_hamming_decompress);
+PG_FUNCTION_INFO_V1(gist_hamming_penalty);
+PG_FUNCTION_INFO_V1(gist_hamming_picksplit);
+PG_FUNCTION_INFO_V1(gist_hamming_union);
+PG_FUNCTION_INFO_V1(gist_hamming_same);
+
+/*
+ * Do the bit strings below k have length bitlen? Bit strings of another
+ * length are never similar to the query (hamming() rejects them), so the
+ * index doesn't return them.
+ */
+static bool
+hkey_has_len(HammingKey *k, int bitlen)
+{
+	return (!HKEY_ISMIXED(k) && k->bitlen == bitlen);
+}
+
+/* 8 bytes of a signature starting at i; bytes past the end read as zero */
+static inline uint64
+hkey_word(const bits8 *p, int i, int nbytes)
+{
+	uint64	w = 0;
+
+	memcpy(&w, p + i, Min(sizeof(uint64), (Size) (nbytes - i)));
+
+	return w;
+}
+
+static HammingKey *
+hkey_leaf(VarBit *v)
+{
+	HammingKey	*key;
+	int			nbytes = VARBITBYTES(v);
+
+	key = (HammingKey *) palloc0(HKEY_HDRSZ + nbytes);
+	SET_VARSIZE(key, HKEY_HDRSZ + nbytes);
+	key->bitlen = VARBITLEN(v);
+	key->flag = HKEY_LEAF;
+	memcpy(key->data, VARBITS(v), nbytes);
+
+	return key;
+}
+
+static HammingKey *
+hkey_mixed(void)
+{
+	HammingKey	*key;
+
+	key = (HammingKey *) palloc0(HKEY_HDRSZ);
+	SET_VARSIZE(key, HKEY_HDRSZ);
+	key->bitlen = 0;
+	key->flag = HKEY_MIXED;
+
+	return key;
+}
+
+/* internal key that covers k */
+static HammingKey *
+hkey_inner(HammingKey *k)
+{
+	HammingKey	*key;
+	int			nbytes = HKEY_NBYTES(k);
+
+	if (HKEY_ISMIXED(k))
+		return hkey_mixed();
+
+	key = (HammingKey *) palloc0(HKEY_HDRSZ + 2 * nbytes);
+	SET_VARSIZE(key, HKEY_HDRSZ + 2 * nbytes);
+	key->bitlen = k->bitlen;
+	key->flag = 0;
+	memcpy(HKEY_OR(key), HKEY_OR(k), nbytes);
+	memcpy(HKEY_AND(key), HKEY_AND(k), nbytes);
+
+	return key;
+}
+
+/*
+ * Extend internal key u to cover k. Returns u, or a new mixed key if k has
+ * another length.
+ */
+static HammingKey *
+hkey_merge(HammingKey *u, HammingKey *k)
+{
+	bits8	*uor = HKEY_OR(u),
+			*uand = HKEY_AND(u),
+			*kor = HKEY_OR(k),
+			*kand = HKEY_AND(k);
+	int		nbytes = HKEY_NBYTES(u);
+	int		i;
+
+	if (HKEY_ISMIXED(u))
+		return u;
+	if (!hkey_has_len(k, u->bitlen))
+		return hkey_mixed();
+
+	for (i = 0; i < nbytes; i++)
+	{
+		uor[i] |= kor[i];
+		uand[i] &= kand[i];
+	}
+
+	return u;
+}
+
+/*
+ * Lower bound of the Hamming distance between q and any bit string covered
+ * by key; exact for leaf keys.
+ */
+static int
+hkey_mindist(HammingKey *key, const bits8 *q)
+{
+	const bits8	*kor = HKEY_OR(key),
+				*kand = HKEY_AND(key);
+	int			nbytes = HKEY_NBYTES(key);
+	int			res = 0;
+	int			i;
+
+	if (HKEY_ISLEAF(key))
+		return (int) _hamming_bits(q, kor, nbytes);
+
+	for (i = 0; i < nbytes; i += sizeof(uint64))
+	{
+		uint64	wq = hkey_word(q, i, nbytes);
+
+		res += pgs_popcount64((wq & ~hkey_word(kor, i, nbytes)) |
+							  (~wq & hkey_word(kand, i, nbytes)));
+	}
+
+	return res;
+}
+
+/*
+ * How many bits become uncertain (set in OR but not in AND) if u is
+ * extended to cover k. That is the penalty of inserting k below u. Mixing
+ * lengths costs more than any growth, so that bit strings of the same
+ * length stay together.
+ */
+static int
+hkey_growth(HammingKey *u, HammingKey *k)
+{
+	const bits8	*uor = HKEY_OR(u),
+				*uand = HKEY_AND(u),
+				*kor = HKEY_OR(k),
+				*kand = HKEY_AND(k);
+	int			nbytes = HKEY_NBYTES(u);
+	int			res = 0;
+	int			i;
+
+	if (HKEY_ISMIXED(u) || !hkey_has_len(k, u->bitlen))
+		return Max(u->bitlen, k->bitlen) + 1;
+
+	for (i = 0; i < nbytes; i += sizeof(uint64))
+	{
+		uint64	wor = hkey_word(uor, i, nbytes);
+		uint64	wand = hkey_word(uand, i, nbytes);
+
+		res += pgs_popcount64((wor | hkey_word(kor, i, nbytes)) ^
+							  (wand & hkey_word(kand, i, nbytes)));
+		res -= pgs_popcount64(wor ^ wand);
+	}
+
+	return res;
+}
+
+/*
+ * How far apart two keys are; used to pick the seeds of a split. Keys of
+ * different lengths are farther apart than any keys of the same length.
+ */
+static int
+hkey_spread(HammingKey *a, HammingKey *b)
+{
+	int		nbytes = HKEY_NBYTES(a);
+
+	if (HKEY_ISMIXED(a) || !hkey_has_len(b, a->bitlen))
+		return 2 * Max(a->bitlen, b->bitlen) + 1;
+
+	return (int) (_hamming_bits(HKEY_OR(a), HKEY_OR(b), nbytes) +
+				  _hamming_bits(HKEY_AND(a), HKEY_AND(b), nbytes));
+}
+
+Datum
+gist_hamming_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY		*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	VarBit			*query = PG_GETARG_VARBIT_P(1);
+	StrategyNumber	strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	/* Oid			subtype = PG_GETARG_OID(3); */
+	bool			*recheck = (bool *) PG_GETARG_POINTER(4);
+	HammingKey		*key = (HammingKey *) DatumGetPointer(entry->key);
+	float8			res;
+
+	elog(DEBUG3, "gist_hamming_consistent() called");
+
+	if (strategy != PGS_GIST_HAMMING_STRATEGY)
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+
+	*recheck = false;
+
+	if (HKEY_ISMIXED(key))
+		PG_RETURN_BOOL(true);
+	if (!hkey_has_len(key, VARBITLEN(query)))
+		PG_RETURN_BOOL(false);
+
+	/*
+	 * Same formula as hamming(). It is exact for leaf keys; for internal keys
+	 * it is an upper bound of the similarity of the whole subtree.
+	 */
+	if (key->bitlen == 0)
+		res = 1.0;
+	else
+		res = 1.0 - ((float8) hkey_mindist(key, VARBITS(query)) / key->bitlen);
+
+	PG_RETURN_BOOL(res >= pgs_hamming_threshold);
+}
+
+Datum
+gist_hamming_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY		*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	VarBit			*query = PG_GETARG_VARBIT_P(1);
+	StrategyNumber	strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	/* Oid			subtype = PG_GETARG_OID(3); */
+#if PG_VERSION_NUM >= 90500
+	bool			*recheck = (bool *) PG_GETARG_POINTER(4);
+#endif
+	HammingKey		*key = (HammingKey *) DatumGetPointer(entry->key);
+
+	elog(DEBUG3, "gist_hamming_distance() called");
+
+	if (strategy != PGS_GIST_HAMMING_DIST_STRATEGY)
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+
+#if PG_VERSION_NUM >= 90500
+	*recheck = false;
+#endif
+
+	/* bit strings of other lengths come last */
+	if (HKEY_ISMIXED(key))
+		PG_RETURN_FLOAT8(0.0);
+	if (!hkey_has_len(key, VARBITLEN(query)))
+		PG_RETURN_FLOAT8(get_float8_infinity());
+
+	PG_RETURN_FLOAT8((float8) hkey_mindist(key, VARBITS(query)));
+}
+
+Datum
+gist_hamming_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY	*retval;
+
+	if (!entry->leafkey)
+		PG_RETURN_POINTER(entry);
+
+	retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+	gistentryinit(*retval, PointerGetDatum(hkey_leaf(DatumGetVarBitP(entry->key))),
+				  entry->rel, entry->page, entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gist_hamming_decompress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY	*retval;
+	struct varlena	*key;
+
+	key = PG_DETOAST_DATUM(entry->key);
+
+	if (key == (struct varlena *) DatumGetPointer(entry->key))
+		PG_RETURN_POINTER(entry);
+
+	retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+	gistentryinit(*retval, PointerGetDatum(key),
+				  entry->rel, entry->page, entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gist_hamming_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY	*newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+	float		*penalty = (float *) PG_GETARG_POINTER(2);
+
+	*penalty = (float) hkey_growth((HammingKey *) DatumGetPointer(origentry->key),
+								   (HammingKey *) DatumGetPointer(newentry->key));
+
+	PG_RETURN_POINTER(penalty);
+}
+
+Datum
+gist_hamming_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int				*size = (int *) PG_GETARG_POINTER(1);
+	HammingKey		*res;
+	int				i;
+
+	res = hkey_inner(GETENTRY(entryvec, 0));
+	for (i = 1; i < entryvec->n; i++)
+		res = hkey_merge(res, GETENTRY(entryvec, i));
+
+	*size = VARSIZE(res);
+
+	PG_RETURN_POINTER(res);
+}
+
+Datum
+gist_hamming_same(PG_FUNCTION_ARGS)
+{
+	HammingKey	*a = (HammingKey *) PG_GETARG_POINTER(0);
+	HammingKey	*b = (HammingKey *) PG_GETARG_POINTER(1);
+	bool		*result = (bool *) PG_GETARG_POINTER(2);
+
+	*result = (VARSIZE(a) == VARSIZE(b) && memcmp(a, b, VARSIZE(a)) == 0);
+
+	PG_RETURN_POINTER(result);
+}
+
+typedef struct
+{
+	OffsetNumber	pos;
+	int				cost;		/* preference for one side over the other */
+} SplitCost;
+
+static int
+split_cost_cmp(const void *a, const void *b)
+{
+	int		ca = ((const SplitCost *) a)->cost;
+	int		cb = ((const SplitCost *) b)->cost;
+
+	return (ca > cb) ? -1 : (ca < cb) ? 1 : 0;
+}
+
+/*
+ * Guttman's quadratic split: the two keys that are farthest apart are the
+ * seeds and the remaining keys go to the side that grows less, those with
+ * the strongest preference first.
+ */
+Datum
+gist_hamming_picksplit(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	GIST_SPLITVEC	*v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+	OffsetNumber	maxoff = entryvec->n - 1;
+	OffsetNumber	i, j;
+	OffsetNumber	seed_1 = FirstOffsetNumber,
+					seed_2 = OffsetNumberNext(FirstOffsetNumber);
+	HammingKey		*unionl, *unionr;
+	SplitCost		*costs;
+	int				ncosts = 0;
+	int				maxspread = -1;
+	int				k;
+
+	v->spl_left = (OffsetNumber *) palloc((maxoff + 1) * sizeof(OffsetNumber));
+	v->spl_right = (OffsetNumber *) palloc((maxoff + 1) * sizeof(OffsetNumber));
+	v->spl_nleft = 0;
+	v->spl_nright = 0;
+
+	for (i = FirstOffsetNumber; i < maxoff; i = OffsetNumberNext(i))
+	{
+		for (j = OffsetNumberNext(i); j <= maxoff; j = OffsetNumberNext(j))
+		{
+			int		spread = hkey_spread(GETENTRY(entryvec, i), GETENTRY(entryvec, j));
+
+			if (spread > maxspread)
+			{
+				maxspread = spread;
+				seed_1 = i;
+				seed_2 = j;
+			}
+		}
+	}
+
+	elog(DEBUG2, "seeds: %d, %d; spread: %d", seed_1, seed_2, maxspread);
+
+	unionl = hkey_inner(GETENTRY(entryvec, seed_1));
+	unionr = hkey_inner(GETENTRY(entryvec, seed_2));
+	v->spl_left[v->spl_nleft++] = seed_1;
+	v->spl_right[v->spl_nright++] = seed_2;
+
+	costs = (SplitCost *) palloc(maxoff * sizeof(SplitCost));
+	for (i = FirstOffsetNumber; i <= maxoff; i = OffsetNumberNext(i))
+	{
+		if (i == seed_1 || i == seed_2)
+			continue;
+
+		costs[ncosts].pos = i;
+		costs[ncosts].cost = abs(hkey_growth(unionl, GETENTRY(entryvec, i)) -
+								 hkey_growth(unionr, GETENTRY(entryvec, i)));
+		ncosts++;
+	}
+	qsort(costs, ncosts, sizeof(SplitCost), split_cost_cmp);
+
+	for (k = 0; k < ncosts; k++)
+	{
+		HammingKey	*key = GETENTRY(entryvec, costs[k].pos);
+		int			costl = hkey_growth(unionl, key);
+		int			costr = hkey_growth(unionr, key);
+
+		/* ties go to the smaller side */
+		if (costl < costr || (costl == costr && v->spl_nleft <= v->spl_nright))
+		{
+			unionl = hkey_merge(unionl, key);
+			v->spl_left[v->spl_nleft++] = costs[k].pos;
+		}
+		else
+		{
+			unionr = hkey_merge(unionr, key);
+			v->spl_right[v->spl_nright++] = costs[k].pos;
+		}
+	}
+
+	pfree(costs);
+
+	v->spl_ldatum = PointerGetDatum(unionl);
+	v->spl_rdatum = PointerGetDatum(unionr);
+
+	PG_RETURN_POINTER(v);
+}
+
+/*
+ * gist_similarity_ops indexes text for the token based measures (cosine,
+ * dice, jaccard and qgram): the ~##, ~-~, ~?? and ~~~ operators and the
+ * <##>, <-~>, <??> and <~~> distance operators (1 - similarity) used by
+ * nearest-neighbour searches.
+ *
+ * Leaf keys store the sorted 32-bit hashes of the distinct tokens of a
+ * value and how many times each one occurs. Internal keys are bloom-style
+ * signatures (a bit per hash modulo the signature length) plus the fewest
+ * and the most distinct tokens of any value below. A query token whose bit
+ * is clear is in no value below, so the number of query tokens with their
+ * bit set bounds the common tokens and therefore the similarity of the
+ * whole subtree.
+ *
+ * Hashes can collide, so every match and distance is rechecked.
+ */
+
+/* strategy numbers; the operators are numbered as in gin_similarity_ops */
+#define	PGS_GIST_COSINE			2		/* ~## */
+#define	PGS_GIST_DICE			3		/* ~-~ */
+#define	PGS_GIST_JACCARD		5		/* ~?? */
+#define	PGS_GIST_QGRAM			13		/* ~~~ */
+#define	PGS_GIST_DIST_OFFSET	20
+#define	PGS_GIST_COSINE_DIST	(PGS_GIST_DIST_OFFSET + PGS_GIST_COSINE)	/* <##> */
+#define	PGS_GIST_DICE_DIST		(PGS_GIST_DIST_OFFSET + PGS_GIST_DICE)		/* <-~> */
+#define	PGS_GIST_JACCARD_DIST	(PGS_GIST_DIST_OFFSET + PGS_GIST_JACCARD)	/* <??> */
+#define	PGS_GIST_QGRAM_DIST		(PGS_GIST_DIST_OFFSET + PGS_GIST_QGRAM)		/* <~~> */
+/* the operators with a pgs_query argument (threshold in the query) */
+#define	PGS_GIST_QUERY_OFFSET	40
+
+/* signature length in bytes */
+#define	PGS_GIST_SIGLEN_DEFAULT	32
+#define	PGS_GIST_SIGLEN_MAX		2024
+
+/* leaves with more tokens than that store a signature */
+#define	PGS_GIST_MAX_TOKENS		256
+
+typedef struct
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	int32	flag;
+	int32	mincount;		/* fewest distinct tokens of a value below */
+	int32	maxcount;		/* most distinct tokens of a value below */
+	char	data[FLEXIBLE_ARRAY_MEMBER];	/* token array or signature */
+} TokenKey;
+
+/* data is uint32 hash[count] (ascending) followed by uint16 freq[count] */
+#define	TKEY_ARRAY			0x01
+
+#define	TKEY_HDRSZ			offsetof(TokenKey, data)
+#define	TKEY_ISARRAY(k)		(((k)->flag & TKEY_ARRAY) != 0)
+#define	TKEY_HASH(k)		((uint32 *) (k)->data)
+#define	TKEY_FREQ(k)		((uint16 *) ((k)->data + (k)->mincount * sizeof(uint32)))
+#define	TKEY_SIGN(k)		((bits8 *) (k)->data)
+#define	TKEY_SIGLEN(k)		((int) (VARSIZE(k) - TKEY_HDRSZ))
+#define	TKEY_HASHBIT(h, siglen)	((h) % ((uint32) (siglen) * BITS_PER_BYTE))
+#define	TKEY_GETBIT(s, b)	(((s)[(b) / BITS_PER_BYTE] >> ((b) % BITS_PER_BYTE)) & 0x01)
+#define	TKEY_SETBIT(s, b)	((s)[(b) / BITS_PER_BYTE] |= (1 << ((b) % BITS_PER_BYTE)))
+
+#define	GETTKEY(vec, pos)	((TokenKey *) DatumGetPointer((vec)->vector[(pos)].key))
+
+/*
+ * Opclass options (support function 10 on PostgreSQL 13 or later): the
+ * tokenizer options of gin_similarity_ops plus siglen.
+ */
+typedef struct
+{
+	int32			vl_len_;	/* varlena header (do not touch directly!) */
+	PgsTokenOptions	tok;
+	int				siglen;		/* signature length in bytes */
+} GistSimilarityOptions;
+
+static const GistSimilarityOptions gist_similarity_default_options =
+{
+	0, {PGS_UNIT_ALNUM, PGS_GRAM_LEN, false}, PGS_GIST_SIGLEN_DEFAULT
+};
+
+/* tokenized query; cached in fn_extra */
+typedef struct
+{
+	text	*query;
+	int		count;			/* distinct tokens */
+	int		total;			/* tokens with duplicates */
+	uint32	*hash;			/* ascending */
+	uint16	*freq;
+} TokenQuery;
+
+PG_FUNCTION_INFO_V1(gist_similarity_consistent);
+PG_FUNCTION_INFO_V1(gist_similarity_distance);
+PG_FUNCTION_INFO_V1(gist_similarity_compress);
+PG_FUNCTION_INFO_V1(gist_similarity_decompress);
+PG_FUNCTION_INFO_V1(gist_similarity_penalty);
+PG_FUNCTION_INFO_V1(gist_similarity_picksplit);
+PG_FUNCTION_INFO_V1(gist_similarity_union);
+PG_FUNCTION_INFO_V1(gist_similarity_same);
+PG_FUNCTION_INFO_V1(gist_similarity_options);
+
+static const GistSimilarityOptions *
+gist_similarity_get_options(FunctionCallInfo fcinfo)
+{
+#if PG_VERSION_NUM >= 130000
+	if (PG_HAS_OPCLASS_OPTIONS())
+		return (const GistSimilarityOptions *) PG_GET_OPCLASS_OPTIONS();
+#endif
+
+	return &gist_similarity_default_options;
+}
+
+typedef struct
+{
+	uint32	hash;
+	int		freq;
+} TokenHash;
+
+static int
+token_hash_cmp(const void *a, const void *b)
+{
+	uint32	ha = ((const TokenHash *) a)->hash;
+	uint32	hb = ((const TokenHash *) b)->hash;
+
+	return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+/*
+ * Distinct token hashes of t (ascending) and their frequencies. Returns the
+ * number of hashes; colliding tokens are merged.
+ */
+static int
+token_hashes(text *t, const PgsTokenOptions *opts, TokenHash **res)
+{
+	char		*buf = text_to_cstring(t);
+	TokenList	*tlist;
+	Token		*tok;
+	TokenHash	*h;
+	int			n = 0;
+	int			i;
+
+	tlist = pgs_tokenize(opts, buf);
+
+	h = (TokenHash *) palloc(Max(tlist->size, 1) * sizeof(TokenHash));
+	for (tok = tlist->head; tok != NULL; tok = tok->next)
+	{
+		h[n].hash = DatumGetUInt32(hash_any((const unsigned char *) tok->data,
+											strlen(tok->data)));
+		h[n].freq = tok->freq;
+		n++;
+	}
+
+	destroyTokenList(tlist);
+	pfree(buf);
+
+	qsort(h, n, sizeof(TokenHash), token_hash_cmp);
+
+	/* merge collisions */
+	if (n > 1)
+	{
+		int		j = 0;
+
+		for (i = 1; i < n; i++)
+		{
+			if (h[i].hash == h[j].hash)
+				h[j].freq += h[i].freq;
+			else
+				h[++j] = h[i];
+		}
+		n = j + 1;
+	}
+
+	*res = h;
+
+	return n;
+}
+
+static TokenKey *
+tkey_array(TokenHash *h, int n)
+{
+	TokenKey	*key;
+	int			size = TKEY_HDRSZ + n * (sizeof(uint32) + sizeof(uint16));
+	uint32		*hash;
+	uint16		*freq;
+	int			i;
+
+	key = (TokenKey *) palloc0(size);
+	SET_VARSIZE(key, size);
+	key->flag = TKEY_ARRAY;
+	key->mincount = key->maxcount = n;
+
+	hash = TKEY_HASH(key);
+	freq = TKEY_FREQ(key);
+	for (i = 0; i < n; i++)
+	{
+		hash[i] = h[i].hash;
+		freq[i] = (uint16) Min(h[i].freq, PG_UINT16_MAX);
+	}
+
+	return key;
+}
+
+static TokenKey *
+tkey_sign(int siglen)
+{
+	TokenKey	*key;
+
+	key = (TokenKey *) palloc0(TKEY_HDRSZ + siglen);
+	SET_VARSIZE(key, TKEY_HDRSZ + siglen);
+	key->flag = 0;
+	key->mincount = PG_INT32_MAX;
+	key->maxcount = 0;
+
+	return key;
+}
+
+/* extend signature key u to cover k */
+static void
+tkey_merge(TokenKey *u, TokenKey *k)
+{
+	bits8	*sign = TKEY_SIGN(u);
+	int		siglen = TKEY_SIGLEN(u);
+	int		i;
+
+	if (TKEY_ISARRAY(k))
+	{
+		uint32	*hash = TKEY_HASH(k);
+
+		for (i = 0; i < k->mincount; i++)
+			TKEY_SETBIT(sign, TKEY_HASHBIT(hash[i], siglen));
+	}
+	else
+	{
+		bits8	*ksign = TKEY_SIGN(k);
+
+		if (TKEY_SIGLEN(k) != siglen)
+			elog(ERROR, "signature lengths don't match: %d, %d",
+				 TKEY_SIGLEN(k), siglen);
+
+		for (i = 0; i < siglen; i++)
+			sign[i] |= ksign[i];
+	}
+
+	u->mincount = Min(u->mincount, k->mincount);
+	u->maxcount = Max(u->maxcount, k->maxcount);
+}
+
+static TokenKey *
+tkey_copy_sign(TokenKey *k, int siglen)
+{
+	TokenKey	*key = tkey_sign(siglen);
+
+	tkey_merge(key, k);
+
+	return key;
+}
+
+/* how many bits covering k adds to signature key u */
+static int
+tkey_growth(TokenKey *u, TokenKey *k)
+{
+	bits8	*sign = TKEY_SIGN(u);
+	int		siglen = TKEY_SIGLEN(u);
+	int		res = 0;
+	int		i;
+
+	if (TKEY_ISARRAY(k))
+	{
+		uint32	*hash = TKEY_HASH(k);
+
+		for (i = 0; i < k->mincount; i++)
+		{
+			if (!TKEY_GETBIT(sign, TKEY_HASHBIT(hash[i], siglen)))
+				res++;
+		}
+	}
+	else
+	{
+		bits8	*ksign = TKEY_SIGN(k);
+
+		for (i = 0; i < siglen; i += sizeof(uint64))
+			res += pgs_popcount64(hkey_word(ksign, i, siglen) &
+								  ~hkey_word(sign, i, siglen));
+	}
+
+	return res;
+}
+
+/* Hamming distance between two signatures of the same length */
+static int
+tkey_spread(TokenKey *a, TokenKey *b)
+{
+	return (int) _hamming_bits(TKEY_SIGN(a), TKEY_SIGN(b), TKEY_SIGLEN(a));
+}
+
+static TokenQuery *
+token_query(FunctionCallInfo fcinfo, text *query, const PgsTokenOptions *opts)
+{
+	TokenQuery	*q = (TokenQuery *) fcinfo->flinfo->fn_extra;
+	MemoryContext	oldcxt;
+	TokenHash	*h;
+	int			i;
+
+	if (q != NULL && VARSIZE_ANY(q->query) == VARSIZE_ANY(query) &&
+		memcmp(q->query, query, VARSIZE_ANY(query)) == 0)
+		return q;
+
+	oldcxt = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	if (q != NULL)
+	{
+		pfree(q->query);
+		pfree(q->hash);
+		pfree(q->freq);
+		pfree(q);
+	}
+
+	q = (TokenQuery *) palloc(sizeof(TokenQuery));
+	q->query = (text *) palloc(VARSIZE_ANY(query));
+	memcpy(q->query, query, VARSIZE_ANY(query));
+
+	q->count = token_hashes(query, opts, &h);
+	q->hash = (uint32 *) palloc(Max(q->count, 1) * sizeof(uint32));
+	q->freq = (uint16 *) palloc(Max(q->count, 1) * sizeof(uint16));
+	q->total = 0;
+	for (i = 0; i < q->count; i++)
+	{
+		q->hash[i] = h[i].hash;
+		q->freq[i] = (uint16) Min(h[i].freq, PG_UINT16_MAX);
+		q->total += q->freq[i];
+	}
+	pfree(h);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	fcinfo->flinfo->fn_extra = (void *) q;
+
+	return q;
+}
+
+/*
+ * Upper bound of the similarity between the query and any value covered by
+ * key, using the measure of strategy (the same formulas as cosine(),
+ * dice(), jaccard() and qgram()). It is exact for token arrays, up to hash
+ * collisions.
+ */
+static float8
+tkey_max_similarity(TokenKey *key, TokenQuery *q, StrategyNumber strategy)
+{
+	int		m = 0;			/* common distinct tokens */
+	int		bm = 0;			/* common tokens with duplicates */
+	int		a;				/* distinct tokens of the value */
+	int		atotal;			/* tokens of the value with duplicates */
+	int		i;
+
+	if (q->count == 0)
+		return 1.0;
+
+	if (TKEY_ISARRAY(key))
+	{
+		uint32	*hash = TKEY_HASH(key);
+		uint16	*freq = TKEY_FREQ(key);
+		int		j = 0;
+
+		a = key->mincount;
+		atotal = 0;
+		for (i = 0; i < a; i++)
+			atotal += freq[i];
+
+		i = 0;
+		while (i < a && j < q->count)
+		{
+			if (hash[i] < q->hash[j])
+				i++;
+			else if (hash[i] > q->hash[j])
+				j++;
+			else
+			{
+				m++;
+				bm += Min(freq[i], q->freq[j]);
+				i++;
+				j++;
+			}
+		}
+	}
+	else
+	{
+		bits8	*sign = TKEY_SIGN(key);
+		int		siglen = TKEY_SIGLEN(key);
+
+		for (i = 0; i < q->count; i++)
+		{
+			if (TKEY_GETBIT(sign, TKEY_HASHBIT(q->hash[i], siglen)))
+			{
+				m++;
+				bm += q->freq[i];
+			}
+		}
+
+		/*
+		 * A value below has at least mincount tokens; the bounds grow with
+		 * the common tokens and shrink with the value tokens.
+		 */
+		m = Min(m, key->maxcount);
+		a = Max(m, key->mincount);
+		atotal = Max(bm, key->mincount);
+	}
+
+	if (m == 0)
+		return 0.0;
+
+	switch (strategy)
+	{
+		case PGS_GIST_COSINE:
+			return (float8) m / (sqrt(a) * sqrt(q->count));
+		case PGS_GIST_DICE:
+			return (float8) (2.0 * m) / (a + q->count);
+		case PGS_GIST_JACCARD:
+			return (float8) m / (a + q->count - m);
+		case PGS_GIST_QGRAM:
+			/* (totpossible - totdistance) / totpossible */
+			return (float8) (2.0 * bm) / (atotal + q->total);
+		default:
+			elog(ERROR, "unrecognized strategy number: %d", strategy);
+	}
+
+	return 1.0;				/* keep compiler quiet */
+}
+
+/*
+ * Upper bound of the similarity or, if the index tokens are not the ones
+ * the measure uses, 1.0.
+ */
+static float8
+gist_similarity_bound(FunctionCallInfo fcinfo, TokenKey *key, text *query,
+					  StrategyNumber strategy)
+{
+	const GistSimilarityOptions	*opts = gist_similarity_get_options(fcinfo);
+	int		tokenizer;
+
+	switch (strategy)
+	{
+		case PGS_GIST_COSINE:
+			tokenizer = pgs_cosine_tokenizer;
+			break;
+		case PGS_GIST_DICE:
+			tokenizer = pgs_dice_tokenizer;
+			break;
+		case PGS_GIST_JACCARD:
+			tokenizer = pgs_jaccard_tokenizer;
+			break;
+		case PGS_GIST_QGRAM:
+			tokenizer = pgs_qgram_tokenizer;
+			break;
+		default:
+			elog(ERROR, "unrecognized strategy number: %d", strategy);
+			return 1.0;		/* keep compiler quiet */
+	}
+
+	if (!pgs_token_compatible(&opts->tok, tokenizer))
+		return 1.0;
+
+	return tkey_max_similarity(key, token_query(fcinfo, query, &opts->tok), strategy);
+}
+
+Datum
+gist_similarity_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY		*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	StrategyNumber	strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	/* Oid			subtype = PG_GETARG_OID(3); */
+	bool			*recheck = (bool *) PG_GETARG_POINTER(4);
+	TokenKey		*key = (TokenKey *) DatumGetPointer(entry->key);
+	text			*query;
+	float8			res;
+	float8			threshold;
+
+	elog(DEBUG3, "gist_similarity_consistent() called");
+
+	*recheck = true;
+
+	if (strategy > PGS_GIST_QUERY_OFFSET)
+	{
+		/* a NULL query or threshold matches nothing */
+		if (!pgs_query_args(PG_GETARG_HEAPTUPLEHEADER(1), &query, &threshold))
+			PG_RETURN_BOOL(false);
+
+		strategy -= PGS_GIST_QUERY_OFFSET;
+
+		/* an unnormalized qgram is a distance: no bound */
+		if (strategy == PGS_GIST_QGRAM && !pgs_qgram_is_normalized)
+			PG_RETURN_BOOL(true);
+	}
+	else
+	{
+		query = PG_GETARG_TEXT_PP(1);
+
+		switch (strategy)
+		{
+			case PGS_GIST_COSINE:
+				threshold = pgs_cosine_threshold;
+				break;
+			case PGS_GIST_DICE:
+				threshold = pgs_dice_threshold;
+				break;
+			case PGS_GIST_JACCARD:
+				threshold = pgs_jaccard_threshold;
+				break;
+			case PGS_GIST_QGRAM:
+				threshold = pgs_qgram_threshold;
+				break;
+			default:
+				elog(ERROR, "unrecognized strategy number: %d", strategy);
+				threshold = 0.0;	/* keep compiler quiet */
+		}
+	}
+
+	res = gist_similarity_bound(fcinfo, key, query, strategy);
+
+	PG_RETURN_BOOL(res >= threshold);
+}
+
+Datum
+gist_similarity_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY		*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	text			*query = PG_GETARG_TEXT_PP(1);
+	StrategyNumber	strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	/* Oid			subtype = PG_GETARG_OID(3); */
+#if PG_VERSION_NUM >= 90500
+	bool			*recheck = (bool *) PG_GETARG_POINTER(4);
+#endif
+	TokenKey		*key = (TokenKey *) DatumGetPointer(entry->key);
+	float8			res;
+
+	elog(DEBUG3, "gist_similarity_distance() called");
+
+	res = gist_similarity_bound(fcinfo, key, query, strategy - PGS_GIST_DIST_OFFSET);
+
+#if PG_VERSION_NUM >= 90500
+	*recheck = true;
+#endif
+
+	PG_RETURN_FLOAT8(1.0 - res);
+}
+
+Datum
+gist_similarity_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	const GistSimilarityOptions	*opts = gist_similarity_get_options(fcinfo);
+	GISTENTRY	*retval;
+	TokenKey	*key;
+	TokenHash	*h;
+	int			n;
+
+	if (!entry->leafkey)
+		PG_RETURN_POINTER(entry);
+
+	n = token_hashes(DatumGetTextPP(entry->key), &opts->tok, &h);
+	key = tkey_array(h, n);
+	pfree(h);
+
+	/* too big for an index tuple? */
+	if (n > PGS_GIST_MAX_TOKENS)
+		key = tkey_copy_sign(key, opts->siglen);
+
+	retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+	gistentryinit(*retval, PointerGetDatum(key),
+				  entry->rel, entry->page, entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gist_similarity_decompress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY	*retval;
+	struct varlena	*key;
+
+	key = PG_DETOAST_DATUM(entry->key);
+
+	if (key == (struct varlena *) DatumGetPointer(entry->key))
+		PG_RETURN_POINTER(entry);
+
+	retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+	gistentryinit(*retval, PointerGetDatum(key),
+				  entry->rel, entry->page, entry->offset, false);
+
+	PG_RETURN_POINTER(retval);
+}
+
+Datum
+gist_similarity_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY	*origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY	*newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+	float		*penalty = (float *) PG_GETARG_POINTER(2);
+	const GistSimilarityOptions	*opts = gist_similarity_get_options(fcinfo);
+	TokenKey	*orig = (TokenKey *) DatumGetPointer(origentry->key);
+
+	if (TKEY_ISARRAY(orig))
+		orig = tkey_copy_sign(orig, opts->siglen);
+
+	*penalty = (float) tkey_growth(orig, (TokenKey *) DatumGetPointer(newentry->key));
+
+	PG_RETURN_POINTER(penalty);
+}
+
+Datum
+gist_similarity_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int				*size = (int *) PG_GETARG_POINTER(1);
+	const GistSimilarityOptions	*opts = gist_similarity_get_options(fcinfo);
+	TokenKey		*res;
+	int				i;
+
+	res = tkey_sign(opts->siglen);
+	for (i = 0; i < entryvec->n; i++)
+		tkey_merge(res, GETTKEY(entryvec, i));
+
+	*size = VARSIZE(res);
+
+	PG_RETURN_POINTER(res);
+}
+
+Datum
+gist_similarity_same(PG_FUNCTION_ARGS)
+{
+	TokenKey	*a = (TokenKey *) PG_GETARG_POINTER(0);
+	TokenKey	*b = (TokenKey *) PG_GETARG_POINTER(1);
+	bool		*result = (bool *) PG_GETARG_POINTER(2);
+
+	*result = (VARSIZE(a) == VARSIZE(b) && memcmp(a, b, VARSIZE(a)) == 0);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Same quadratic split as gist_hamming_picksplit(), on the signatures of
+ * the keys.
+ */
+Datum
+gist_similarity_picksplit(PG_FUNCTION_ARGS)
+{
+	GistEntryVector	*entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	GIST_SPLITVEC	*v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+	const GistSimilarityOptions	*opts = gist_similarity_get_options(fcinfo);
+	OffsetNumber	maxoff = entryvec->n - 1;
+	OffsetNumber	i, j;
+	OffsetNumber	seed_1 = FirstOffsetNumber,
+					seed_2 = OffsetNumberNext(FirstOffsetNumber);
+	TokenKey		**signs;
+	TokenKey		*unionl, *unionr;
+	SplitCost		*costs;
+	int				ncosts = 0;
+	int				maxspread = -1;
+	int				k;
+
+	v->spl_left = (OffsetNumber *) palloc((maxoff + 1) * sizeof(OffsetNumber));
+	v->spl_right = (OffsetNumber *) palloc((maxoff + 1) * sizeof(OffsetNumber));
+	v->spl_nleft = 0;
+	v->spl_nright = 0;
+
+	signs = (TokenKey **) palloc((maxoff + 1) * sizeof(TokenKey *));
+	for (i = FirstOffsetNumber; i <= maxoff; i = OffsetNumberNext(i))
+		signs[i] = tkey_copy_sign(GETTKEY(entryvec, i), opts->siglen);
+
+	for (i = FirstOffsetNumber; i < maxoff; i = OffsetNumberNext(i))
+	{
+		for (j = OffsetNumberNext(i); j <= maxoff; j = OffsetNumberNext(j))
+		{
+			int		spread = tkey_spread(signs[i], signs[j]);
+
+			if (spread > maxspread)
+			{
+				maxspread = spread;
+				seed_1 = i;
+				seed_2 = j;
+			}
+		}
+	}
+
+	elog(DEBUG2, "seeds: %d, %d; spread: %d", seed_1, seed_2, maxspread);
+
+	unionl = signs[seed_1];
+	unionr = signs[seed_2];
+	v->spl_left[v->spl_nleft++] = seed_1;
+	v->spl_right[v->spl_nright++] = seed_2;
+
+	costs = (SplitCost *) palloc(maxoff * sizeof(SplitCost));
+	for (i = FirstOffsetNumber; i <= maxoff; i = OffsetNumberNext(i))
+	{
+		if (i == seed_1 || i == seed_2)
+			continue;
+
+		costs[ncosts].pos = i;
+		costs[ncosts].cost = abs(tkey_growth(unionl, signs[i]) -
+								 tkey_growth(unionr, signs[i]));
+		ncosts++;
+	}
+	qsort(costs, ncosts, sizeof(SplitCost), split_cost_cmp);
+
+	for (k = 0; k < ncosts; k++)
+	{
+		TokenKey	*key = signs[costs[k].pos];
+		int			costl = tkey_growth(unionl, key);
+		int			costr = tkey_growth(unionr, key);
+
+		/* ties go to the smaller side */
+		if (costl < costr || (costl == costr && v->spl_nleft <= v->spl_nright))
+		{
+			tkey_merge(unionl, key);
+			v->spl_left[v->spl_nleft++] = costs[k].pos;
+		}
+		else
+		{
+			tkey_merge(unionr, key);
+			v->spl_right[v->spl_nright++] = costs[k].pos;
+		}
+	}
+
+	pfree(costs);
+
+	v->spl_ldatum = PointerGetDatum(unionl);
+	v->spl_rdatum = PointerGetDatum(unionr);
+
+	PG_RETURN_POINTER(v);
+}
+
+/*
+ * Opclass options (support function 10). Only called on PostgreSQL 13 or
+ * later.
+ */
+Datum
+gist_similarity_options(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 130000
+	local_relopts	*relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+	init_local_reloptions(relopts, sizeof(GistSimilarityOptions));
+	pgs_add_token_reloptions(relopts, offsetof(GistSimilarityOptions, tok),
+							 PGS_UNIT_ALNUM);
+	add_local_int_reloption(relopts, "siglen",
+							"signature length in bytes",
+							PGS_GIST_SIGLEN_DEFAULT, 1, PGS_GIST_SIGLEN_MAX,
+							offsetof(GistSimilarityOptions, siglen));
+#endif
+
+	PG_RETURN_VOID();
+}
@@ -0,0 +1,1579 @@
+/*----------------------------------------------------------------------------
+ *
+ * similarity_hnsw.c
+ *
+ * HNSW index access method (pgs_hnsw)
+ *
+ * A hierarchical navigable small world graph of the token sets for
+ * approximate ORDER BY <??> (jaccard) and <##> (cosine) ... LIMIT k. Every
+ * value is an element of layer 0 and, with probability 1 / m^l, of layers
+ * 1 .. l too; an element links to its m (2 * m at layer 0) nearest elements
+ * of each of its layers that were in the index when it was added. A search
+ * walks greedily from the entry point (the element of the top layer) down
+ * to layer 0 and keeps the ef_search closest elements it meets there; they
+ * are the result, so the scan returns at most ef_search rows and may miss
+ * some of the true nearest neighbours.
+ *
+ * The index stores the sorted, distinct 32-bit hashes of the tokens of each
+ * value (tokenized as the opclass parameters say; see gin_similarity_ops),
+ * so no distance needs the heap. Block 0 is the metapage; elements are
+ * appended to the other pages and never move, so a neighbour is the item
+ * pointer of its element. Insertions are serialized by a lock on the
+ * metapage (searches don't wait for it). VACUUM only marks the elements of
+ * dead rows: they still route searches but are not returned.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "access/amapi.h"
+#include "access/amvalidate.h"
+#include "access/generic_xlog.h"
+#include "access/htup_details.h"
+#include "access/reloptions.h"
+#include "access/relscan.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_amop.h"
+#include "catalog/pg_amproc.h"
+#include "catalog/pg_opclass.h"
+#include "catalog/pg_opfamily.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/float.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/regproc.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
+#endif
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <math.h>
+
+/* support functions */
+#define	HNSW_DISTANCE_PROC		1	/* jaccard_distance or cosine_distance */
+#define	HNSW_OPTIONS_PROC		2
+
+/* measures */
+#define	HNSW_JACCARD			1
+#define	HNSW_COSINE				2
+
+#define	HNSW_METAPAGE_BLKNO		0
+#define	HNSW_MAGIC_NUMBER		0x504753E1
+#define	HNSW_VERSION			1
+
+#define	HNSW_PAGE_META			1
+#define	HNSW_PAGE_ELEMENT		2
+
+#define	HNSW_DEFAULT_M			16
+#define	HNSW_DEFAULT_EF_CONSTRUCTION	64
+#define	HNSW_MAX_LEVEL			16
+
+/* GUC variable */
+int		pgs_hnsw_ef_search = 40;
+
+PG_FUNCTION_INFO_V1(hnsw_similarity_handler);
+PG_FUNCTION_INFO_V1(hnsw_similarity_options);
+
+#if PG_VERSION_NUM >= 130000
+typedef struct HnswPageOpaqueData
+{
+	uint16		flags;			/* HNSW_PAGE_* */
+	uint16		unused;
+} HnswPageOpaqueData;
+
+typedef HnswPageOpaqueData *HnswPageOpaque;
+
+#define	HnswPageGetOpaque(page)	((HnswPageOpaque) PageGetSpecialPointer(page))
+
+typedef struct HnswMetaPageData
+{
+	uint32		magic;
+	uint32		version;
+	int32		m;				/* links per element and layer (2 * m at 0) */
+	int32		measure;		/* HNSW_JACCARD or HNSW_COSINE */
+	ItemPointerData	entry;		/* element of the top layer (invalid: empty) */
+	int32		entrylevel;
+	BlockNumber	insertblkno;	/* page new elements are appended to */
+} HnswMetaPageData;
+
+#define	HnswPageGetMeta(page)	((HnswMetaPageData *) PageGetContents(page))
+
+/*
+ * An element on disk: the header, the token hashes (sorted) and the links
+ * of layers 0 .. level (invalid item pointers are free slots).
+ */
+typedef struct HnswElementTupleData
+{
+	ItemPointerData	heaptid;
+	uint8		level;
+	uint8		deleted;
+	uint16		nhashes;
+} HnswElementTupleData;
+
+typedef HnswElementTupleData *HnswElementTuple;
+
+#define	HNSW_ELEMENT_HDRSZ		INTALIGN(sizeof(HnswElementTupleData))
+#define	HnswElementHashes(tup)	((uint32 *) ((char *) (tup) + HNSW_ELEMENT_HDRSZ))
+#define	HnswElementLinks(tup)	((ItemPointer) (HnswElementHashes(tup) + (tup)->nhashes))
+
+/* the largest element that fits on a page */
+#define	HNSW_MAX_ELEMENT_SIZE	(BLCKSZ - MAXALIGN(SizeOfPageHeaderData + sizeof(ItemIdData)) - \
+								 MAXALIGN(sizeof(HnswPageOpaqueData)))
+
+/* reloptions */
+typedef struct HnswOptions
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int			m;
+	int			efConstruction;
+} HnswOptions;
+
+/* opclass options */
+typedef struct HnswSimilarityOptions
+{
+	int32			vl_len_;	/* varlena header (do not touch directly!) */
+	PgsTokenOptions	tok;
+} HnswSimilarityOptions;
+
+static const HnswSimilarityOptions hnsw_similarity_default_options =
+{
+	0,
+	{PGS_UNIT_ALNUM, PGS_GRAM_LEN, false}
+};
+
+static relopt_kind hnsw_relopt_kind;
+
+/*
+ * An element in memory
+ */
+typedef struct HnswElement
+{
+	ItemPointerData	tid;		/* of the element */
+	ItemPointerData	heaptid;
+	int			level;
+	bool		deleted;
+	int			nhashes;
+	uint32		*hashes;
+	ItemPointer	links;
+} HnswElement;
+
+/* elements read by a search (the key is the element tid) */
+typedef struct HnswCacheEntry
+{
+	ItemPointerData	tid;
+	HnswElement	*element;
+	uint32		visited;		/* number of the last layer search */
+} HnswCacheEntry;
+
+typedef struct HnswCandidate
+{
+	HnswElement	*element;
+	float8		distance;
+} HnswCandidate;
+
+/*
+ * State of a search: a query against the graph
+ */
+typedef struct HnswSearch
+{
+	Relation	index;
+	int			m;
+	int			measure;
+	uint32		*hashes;		/* of the query */
+	int			nhashes;
+	HTAB		*cache;
+	uint32		visitmark;
+} HnswSearch;
+
+typedef struct HnswScanOpaqueData
+{
+	bool		searched;
+	HnswCandidate	*results;	/* ascending distance */
+	int			nresults;
+	int			next;
+	MemoryContext	scancxt;
+} HnswScanOpaqueData;
+
+typedef HnswScanOpaqueData *HnswScanOpaque;
+
+typedef struct HnswBuildState
+{
+	double		indtuples;
+	MemoryContext	tmpcxt;
+} HnswBuildState;
+
+static int
+hnsw_links_per_layer(int m, int layer)
+{
+	return (layer == 0) ? 2 * m : m;
+}
+
+/* first slot of a layer in the links of an element */
+static int
+hnsw_layer_offset(int m, int layer)
+{
+	return (layer == 0) ? 0 : 2 * m + (layer - 1) * m;
+}
+
+static int
+hnsw_nlinks(int m, int level)
+{
+	return 2 * m + level * m;
+}
+
+static int
+hnsw_get_m(Relation index)
+{
+	HnswOptions	*opts = (HnswOptions *) index->rd_options;
+
+	return opts ? opts->m : HNSW_DEFAULT_M;
+}
+
+static int
+hnsw_get_ef_construction(Relation index)
+{
+	HnswOptions	*opts = (HnswOptions *) index->rd_options;
+
+	return opts ? opts->efConstruction : HNSW_DEFAULT_EF_CONSTRUCTION;
+}
+
+static const PgsTokenOptions *
+hnsw_get_token_options(Relation index)
+{
+	bytea	**attoptions = RelationGetIndexAttOptions(index, false);
+
+	if (attoptions != NULL && attoptions[0] != NULL)
+		return &((HnswSimilarityOptions *) attoptions[0])->tok;
+
+	return &hnsw_similarity_default_options.tok;
+}
+
+/*
+ * HNSW_JACCARD or HNSW_COSINE if procoid is jaccard_distance(text, text) or
+ * cosine_distance(text, text) of the schema of amhandler (pg_similarity's);
+ * 0 if it is another function.
+ */
+static int
+hnsw_distance_measure(Oid procoid, Oid amhandler)
+{
+	char	*name;
+	Oid		*argtypes;
+	int		nargs;
+
+	name = get_func_name(procoid);
+	if (name == NULL)
+		return 0;
+
+	get_func_signature(procoid, &argtypes, &nargs);
+	if (nargs != 2 || argtypes[0] != TEXTOID || argtypes[1] != TEXTOID)
+		return 0;
+	if (get_func_namespace(procoid) != get_func_namespace(amhandler))
+		return 0;
+
+	if (strcmp(name, "jaccard_distance") == 0)
+		return HNSW_JACCARD;
+	if (strcmp(name, "cosine_distance") == 0)
+		return HNSW_COSINE;
+
+	return 0;
+}
+
+/*
+ * Measure of the index: its distance support function
+ */
+static int
+hnsw_get_measure(Relation index)
+{
+	Oid		procoid = index_getprocid(index, 1, HNSW_DISTANCE_PROC);
+	int		measure;
+
+	measure = hnsw_distance_measure(procoid, index->rd_amhandler);
+	if (measure == 0)
+		elog(ERROR, "unsupported distance function %s in pgs_hnsw index",
+			 format_procedure(procoid));
+
+	return measure;
+}
+
+static int
+hnsw_hash_cmp(const void *a, const void *b)
+{
+	uint32	ha = *(const uint32 *) a;
+	uint32	hb = *(const uint32 *) b;
+
+	return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+/*
+ * Sorted distinct hashes of the tokens of t. Returns their number.
+ */
+static int
+hnsw_hashes(text *t, const PgsTokenOptions *opts, uint32 **res)
+{
+	char		*buf = text_to_cstring(t);
+	TokenList	*tlist;
+	Token		*tok;
+	uint32		*h;
+	int			n = 0;
+	int			i;
+
+	if (strlen(buf) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	tlist = pgs_tokenize(opts, buf);
+
+	h = (uint32 *) palloc(sizeof(uint32) * Max(tlist->size, 1));
+	for (tok = tlist->head; tok != NULL; tok = tok->next)
+		h[n++] = DatumGetUInt32(hash_any((const unsigned char *) tok->data,
+										 strlen(tok->data)));
+
+	destroyTokenList(tlist);
+
+	qsort(h, n, sizeof(uint32), hnsw_hash_cmp);
+
+	/* colliding tokens are one */
+	for (i = 1; i < n; i++)
+	{
+		if (h[i] == h[i - 1])
+		{
+			memmove(&h[i], &h[i + 1], sizeof(uint32) * (n - i - 1));
+			n--;
+			i--;
+		}
+	}
+
+	*res = h;
+	return n;
+}
+
+/*
+ * jaccard_distance() or cosine_distance() of two token sets
+ */
+static float8
+hnsw_distance(int measure, const uint32 *a, int na, const uint32 *b, int nb)
+{
+	int		common = 0;
+	int		i = 0,
+			j = 0;
+
+	while (i < na && j < nb)
+	{
+		if (a[i] == b[j])
+		{
+			common++;
+			i++;
+			j++;
+		}
+		else if (a[i] < b[j])
+			i++;
+		else
+			j++;
+	}
+
+	/* no tokens at all: nothing in common */
+	if (measure == HNSW_JACCARD)
+		return (na + nb == 0) ? 1.0 : 1.0 - (float8) common / (na + nb - common);
+	else
+		return (na == 0 || nb == 0) ? 1.0 : 1.0 - common / (sqrt(na) * sqrt(nb));
+}
+
+/*
+ * Read an element (through the cache of the search)
+ */
+static HnswElement *
+hnsw_get_element(HnswSearch *s, ItemPointer tid)
+{
+	HnswCacheEntry	*entry;
+	bool		found;
+	Buffer		buf;
+	Page		page;
+	HnswElementTuple	tup;
+	HnswElement	*e;
+	int			nlinks;
+
+	entry = (HnswCacheEntry *) hash_search(s->cache, tid, HASH_ENTER, &found);
+	if (found)
+		return entry->element;
+
+	buf = ReadBuffer(s->index, ItemPointerGetBlockNumber(tid));
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	tup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(tid)));
+
+	e = (HnswElement *) palloc(sizeof(HnswElement));
+	e->tid = *tid;
+	e->heaptid = tup->heaptid;
+	e->level = tup->level;
+	e->deleted = (tup->deleted != 0);
+	e->nhashes = tup->nhashes;
+	e->hashes = (uint32 *) palloc(sizeof(uint32) * Max(tup->nhashes, 1));
+	memcpy(e->hashes, HnswElementHashes(tup), sizeof(uint32) * tup->nhashes);
+	nlinks = hnsw_nlinks(s->m, tup->level);
+	e->links = (ItemPointer) palloc(sizeof(ItemPointerData) * nlinks);
+	memcpy(e->links, HnswElementLinks(tup), sizeof(ItemPointerData) * nlinks);
+
+	UnlockReleaseBuffer(buf);
+
+	entry->element = e;
+	entry->visited = 0;
+
+	return e;
+}
+
+static void
+hnsw_init_search(HnswSearch *s, Relation index, int m, int measure)
+{
+	HASHCTL		ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(ItemPointerData);
+	ctl.entrysize = sizeof(HnswCacheEntry);
+	ctl.hcxt = CurrentMemoryContext;
+
+	s->index = index;
+	s->m = m;
+	s->measure = measure;
+	s->cache = hash_create("pgs_hnsw elements", 256, &ctl,
+						   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	s->visitmark = 0;
+}
+
+/*
+ * Insert c into the array of n candidates sorted by distance (capacity
+ * max); the farthest one falls off if it is full.
+ */
+static void
+hnsw_add_sorted(HnswCandidate *arr, int *n, int max, HnswCandidate c)
+{
+	int		i = *n;
+
+	if (i == max)
+	{
+		if (c.distance >= arr[max - 1].distance)
+			return;
+		i--;
+	}
+	else
+		(*n)++;
+
+	while (i > 0 && arr[i - 1].distance > c.distance)
+	{
+		arr[i] = arr[i - 1];
+		i--;
+	}
+	arr[i] = c;
+}
+
+/*
+ * The ef elements of layer that are closest to the query, starting from the
+ * entry points (ascending distance). Returns their number.
+ */
+static int
+hnsw_search_layer(HnswSearch *s, HnswCandidate *entries, int nentries,
+				  int ef, int layer, HnswCandidate *res)
+{
+	HnswCandidate	*cand;
+	int			ncand = 0;
+	int			maxcand = Max(nentries, 64);
+	int			nres = 0;
+	int			i;
+
+	s->visitmark++;
+
+	cand = (HnswCandidate *) palloc(sizeof(HnswCandidate) * maxcand);
+
+	for (i = 0; i < nentries; i++)
+	{
+		HnswCacheEntry	*entry;
+
+		entry = (HnswCacheEntry *) hash_search(s->cache, &entries[i].element->tid,
+											   HASH_FIND, NULL);
+		if (entry->visited == s->visitmark)
+			continue;
+		entry->visited = s->visitmark;
+
+		cand[ncand++] = entries[i];
+		hnsw_add_sorted(res, &nres, ef, entries[i]);
+	}
+
+	while (ncand > 0)
+	{
+		HnswCandidate	c;
+		HnswElement		*e;
+		int			first;
+		int			nlinks;
+		int			best = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* closest candidate */
+		for (i = 1; i < ncand; i++)
+		{
+			if (cand[i].distance < cand[best].distance)
+				best = i;
+		}
+		c = cand[best];
+		cand[best] = cand[--ncand];
+
+		/* nothing closer can be reached from here */
+		if (nres == ef && c.distance > res[nres - 1].distance)
+			break;
+
+		e = c.element;
+		if (layer > e->level)
+			continue;
+
+		first = hnsw_layer_offset(s->m, layer);
+		nlinks = hnsw_links_per_layer(s->m, layer);
+
+		for (i = first; i < first + nlinks; i++)
+		{
+			ItemPointer		tid = &e->links[i];
+			HnswCacheEntry	*entry;
+			HnswCandidate	n;
+
+			if (!ItemPointerIsValid(tid))
+				continue;
+
+			n.element = hnsw_get_element(s, tid);
+			entry = (HnswCacheEntry *) hash_search(s->cache, tid, HASH_FIND, NULL);
+			if (entry->visited == s->visitmark)
+				continue;
+			entry->visited = s->visitmark;
+
+			n.distance = hnsw_distance(s->measure, s->hashes, s->nhashes,
+									   n.element->hashes, n.element->nhashes);
+
+			if (nres < ef || n.distance < res[nres - 1].distance)
+			{
+				if (ncand == maxcand)
+				{
+					maxcand *= 2;
+					cand = (HnswCandidate *) repalloc(cand, sizeof(HnswCandidate) * maxcand);
+				}
+				cand[ncand++] = n;
+				hnsw_add_sorted(res, &nres, ef, n);
+			}
+		}
+	}
+
+	pfree(cand);
+
+	return nres;
+}
+
+/*
+ * The ef elements of layer `bottom' closest to the query (ascending
+ * distance), walking down from the entry point. Returns their number.
+ */
+static int
+hnsw_search(HnswSearch *s, HnswMetaPageData *meta, int ef, int bottom,
+			HnswCandidate *res)
+{
+	HnswCandidate	ep;
+	int			layer;
+
+	if (!ItemPointerIsValid(&meta->entry))
+		return 0;
+
+	ep.element = hnsw_get_element(s, &meta->entry);
+	ep.distance = hnsw_distance(s->measure, s->hashes, s->nhashes,
+								ep.element->hashes, ep.element->nhashes);
+
+	/* greedy walk through the upper layers */
+	for (layer = meta->entrylevel; layer > bottom; layer--)
+	{
+		HnswCandidate	best;
+
+		if (hnsw_search_layer(s, &ep, 1, 1, layer, &best) > 0)
+			ep = best;
+	}
+
+	return hnsw_search_layer(s, &ep, 1, ef, bottom, res);
+}
+
+static void
+hnsw_init_page(Page page, uint16 flags)
+{
+	PageInit(page, BLCKSZ, sizeof(HnswPageOpaqueData));
+	HnswPageGetOpaque(page)->flags = flags;
+}
+
+/*
+ * Metapage of an empty index
+ */
+static void
+hnsw_init_metapage(Relation index, ForkNumber forknum, int m, int measure)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState	*state;
+	HnswMetaPageData	*meta;
+
+	buf = ReadBufferExtended(index, forknum, P_NEW, RBM_NORMAL, NULL);
+	Assert(BufferGetBlockNumber(buf) == HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, GENERIC_XLOG_FULL_IMAGE);
+
+	hnsw_init_page(page, HNSW_PAGE_META);
+	meta = HnswPageGetMeta(page);
+	meta->magic = HNSW_MAGIC_NUMBER;
+	meta->version = HNSW_VERSION;
+	meta->m = m;
+	meta->measure = measure;
+	ItemPointerSetInvalid(&meta->entry);
+	meta->entrylevel = -1;
+	meta->insertblkno = InvalidBlockNumber;
+	((PageHeader) page)->pd_lower = ((char *) meta + sizeof(HnswMetaPageData)) - (char *) page;
+
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+}
+
+static void
+hnsw_read_metapage(Relation index, HnswMetaPageData *meta)
+{
+	Buffer		buf;
+	Page		page;
+
+	buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	memcpy(meta, HnswPageGetMeta(page), sizeof(HnswMetaPageData));
+	UnlockReleaseBuffer(buf);
+
+	if (meta->magic != HNSW_MAGIC_NUMBER)
+		ereport(ERROR,
+				(errcode(ERRCODE_INDEX_CORRUPTED),
+				 errmsg("index \"%s\" is not a pgs_hnsw index",
+						RelationGetRelationName(index))));
+}
+
+/*
+ * Update the entry point and the insert page (unchanged if invalid)
+ */
+static void
+hnsw_update_metapage(Relation index, ItemPointer entry, int entrylevel,
+					 BlockNumber insertblkno)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState	*state;
+	HnswMetaPageData	*meta;
+
+	buf = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+	meta = HnswPageGetMeta(page);
+
+	if (entry != NULL)
+	{
+		meta->entry = *entry;
+		meta->entrylevel = entrylevel;
+	}
+	if (BlockNumberIsValid(insertblkno))
+		meta->insertblkno = insertblkno;
+
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Append an element without links; returns its tid in *tid.
+ */
+static void
+hnsw_add_element(Relation index, HnswMetaPageData *meta, HnswElementTuple tup,
+				 Size size, ItemPointer tid)
+{
+	Buffer		buf = InvalidBuffer;
+	Page		page;
+	GenericXLogState	*state;
+	OffsetNumber	offno;
+	bool		newpage = false;
+
+	if (BlockNumberIsValid(meta->insertblkno))
+	{
+		buf = ReadBuffer(index, meta->insertblkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		if (PageGetFreeSpace(BufferGetPage(buf)) < MAXALIGN(size))
+		{
+			UnlockReleaseBuffer(buf);
+			buf = InvalidBuffer;
+		}
+	}
+
+	if (!BufferIsValid(buf))
+	{
+		LockRelationForExtension(index, ExclusiveLock);
+		buf = ReadBuffer(index, P_NEW);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		UnlockRelationForExtension(index, ExclusiveLock);
+		newpage = true;
+	}
+
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, newpage ? GENERIC_XLOG_FULL_IMAGE : 0);
+	if (newpage)
+		hnsw_init_page(page, HNSW_PAGE_ELEMENT);
+
+	offno = PageAddItem(page, (Item) tup, size, InvalidOffsetNumber, false, false);
+	if (offno == InvalidOffsetNumber)
+		elog(ERROR, "failed to add element to \"%s\"", RelationGetRelationName(index));
+
+	ItemPointerSet(tid, BufferGetBlockNumber(buf), offno);
+
+	GenericXLogFinish(state);
+
+	if (newpage)
+	{
+		meta->insertblkno = BufferGetBlockNumber(buf);
+		UnlockReleaseBuffer(buf);
+		hnsw_update_metapage(index, NULL, 0, meta->insertblkno);
+	}
+	else
+		UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Overwrite the links of an element at layer with links[0 .. n)
+ */
+static void
+hnsw_set_links(Relation index, HnswElement *e, int m, int layer,
+			   ItemPointer links, int n)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState	*state;
+	HnswElementTuple	tup;
+	ItemPointer	slots;
+	int			first = hnsw_layer_offset(m, layer);
+	int			i;
+
+	buf = ReadBuffer(index, ItemPointerGetBlockNumber(&e->tid));
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	tup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(&e->tid)));
+	slots = HnswElementLinks(tup);
+	for (i = 0; i < hnsw_links_per_layer(m, layer); i++)
+	{
+		if (i < n)
+			slots[first + i] = links[i];
+		else
+			ItemPointerSetInvalid(&slots[first + i]);
+		/* keep the copy of the search up to date */
+		e->links[first + i] = slots[first + i];
+	}
+
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Link neighbour n back to the new element q at layer: take a free slot or
+ * the slot of the farthest link if q is closer than it.
+ */
+static void
+hnsw_link_back(HnswSearch *s, HnswElement *n, HnswElement *q, float8 distance,
+			   int layer)
+{
+	int			first = hnsw_layer_offset(s->m, layer);
+	int			nlinks = hnsw_links_per_layer(s->m, layer);
+	ItemPointerData	*links;
+	int			worst = -1;
+	float8		worstdist = distance;
+	int			i;
+
+	links = (ItemPointerData *) palloc(sizeof(ItemPointerData) * nlinks);
+	memcpy(links, &n->links[first], sizeof(ItemPointerData) * nlinks);
+
+	for (i = 0; i < nlinks; i++)
+	{
+		HnswElement	*l;
+		float8		d;
+
+		if (!ItemPointerIsValid(&links[i]))
+		{
+			worst = i;
+			break;
+		}
+
+		l = hnsw_get_element(s, &links[i]);
+		d = hnsw_distance(s->measure, n->hashes, n->nhashes, l->hashes, l->nhashes);
+		if (d > worstdist)
+		{
+			worst = i;
+			worstdist = d;
+		}
+	}
+
+	if (worst < 0)
+		return;
+
+	links[worst] = q->tid;
+	hnsw_set_links(s->index, n, s->m, layer, links, nlinks);
+}
+
+static int
+hnsw_random_level(int m)
+{
+	double		r;
+	int			level;
+
+#if PG_VERSION_NUM >= 150000
+	r = pg_prng_double(&pg_global_prng_state);
+#else
+	r = (double) random() / ((double) MAX_RANDOM_VALUE + 1.0);
+#endif
+
+	/* P(level >= l) = 1 / m^l */
+	level = (int) floor(-log(1.0 - r) / log((double) m));
+
+	return Min(level, HNSW_MAX_LEVEL);
+}
+
+/*
+ * Add a value to the graph
+ */
+static void
+hnsw_insert_value(Relation index, Datum value, ItemPointer heaptid)
+{
+	HnswMetaPageData	meta;
+	HnswSearch	s;
+	HnswElementTuple	tup;
+	HnswElement	*q;
+	HnswCandidate	*w;
+	HnswCandidate	*ep;
+	int			nw = 0;
+	uint32		*hashes;
+	int			nhashes;
+	int			level;
+	int			ef = hnsw_get_ef_construction(index);
+	int			nlinks;
+	int			layer;
+	Size		size;
+	int			i;
+
+	/* one insertion at a time; searches go on */
+	LockPage(index, HNSW_METAPAGE_BLKNO, ExclusiveLock);
+
+	hnsw_read_metapage(index, &meta);
+
+	nhashes = hnsw_hashes(DatumGetTextPP(value), hnsw_get_token_options(index), &hashes);
+	level = hnsw_random_level(meta.m);
+	nlinks = hnsw_nlinks(meta.m, level);
+
+	size = HNSW_ELEMENT_HDRSZ + sizeof(uint32) * nhashes + sizeof(ItemPointerData) * nlinks;
+	if (size > HNSW_MAX_ELEMENT_SIZE)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("value has too many tokens for index \"%s\"",
+						RelationGetRelationName(index)),
+				 errdetail("%d tokens need %zu bytes, the maximum is %zu.",
+						   nhashes, size, (Size) HNSW_MAX_ELEMENT_SIZE)));
+
+	tup = (HnswElementTuple) palloc0(size);
+	tup->heaptid = *heaptid;
+	tup->level = level;
+	tup->deleted = 0;
+	tup->nhashes = nhashes;
+	memcpy(HnswElementHashes(tup), hashes, sizeof(uint32) * nhashes);
+	for (i = 0; i < nlinks; i++)
+		ItemPointerSetInvalid(&HnswElementLinks(tup)[i]);
+
+	hnsw_init_search(&s, index, meta.m, meta.measure);
+	s.hashes = hashes;
+	s.nhashes = nhashes;
+
+	q = (HnswElement *) palloc(sizeof(HnswElement));
+	hnsw_add_element(index, &meta, tup, size, &q->tid);
+	q->heaptid = *heaptid;
+	q->level = level;
+	q->deleted = false;
+	q->nhashes = nhashes;
+	q->hashes = hashes;
+	q->links = (ItemPointer) palloc(sizeof(ItemPointerData) * nlinks);
+	memcpy(q->links, HnswElementLinks(tup), sizeof(ItemPointerData) * nlinks);
+
+	/* the first element is the entry point */
+	if (!ItemPointerIsValid(&meta.entry))
+	{
+		hnsw_update_metapage(index, &q->tid, level, InvalidBlockNumber);
+		UnlockPage(index, HNSW_METAPAGE_BLKNO, ExclusiveLock);
+		return;
+	}
+
+	w = (HnswCandidate *) palloc(sizeof(HnswCandidate) * ef);
+	ep = (HnswCandidate *) palloc(sizeof(HnswCandidate) * ef);
+
+	for (layer = Min(level, meta.entrylevel); layer >= 0; layer--)
+	{
+		ItemPointerData	*links;
+		int			n;
+
+		/* entry points of this layer: the closest ones of the layer above */
+		if (layer == Min(level, meta.entrylevel))
+			nw = hnsw_search(&s, &meta, ef, layer, w);
+		else
+		{
+			memcpy(ep, w, sizeof(HnswCandidate) * nw);
+			nw = hnsw_search_layer(&s, ep, nw, ef, layer, w);
+		}
+
+		/* the nearest ones are the links of q */
+		n = Min(nw, hnsw_links_per_layer(meta.m, layer));
+		links = (ItemPointerData *) palloc(sizeof(ItemPointerData) * Max(n, 1));
+		for (i = 0; i < n; i++)
+			links[i] = w[i].element->tid;
+		hnsw_set_links(index, q, meta.m, layer, links, n);
+
+		for (i = 0; i < n; i++)
+			hnsw_link_back(&s, w[i].element, q, w[i].distance, layer);
+	}
+
+	if (level > meta.entrylevel)
+		hnsw_update_metapage(index, &q->tid, level, InvalidBlockNumber);
+
+	UnlockPage(index, HNSW_METAPAGE_BLKNO, ExclusiveLock);
+}
+
+static void
+hnsw_build_callback(Relation index, ItemPointer tid, Datum *values,
+					bool *isnull, bool tupleIsAlive, void *state)
+{
+	HnswBuildState	*buildstate = (HnswBuildState *) state;
+	MemoryContext	oldcxt;
+
+	if (isnull[0])
+		return;
+
+	oldcxt = MemoryContextSwitchTo(buildstate->tmpcxt);
+	hnsw_insert_value(index, values[0], tid);
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextReset(buildstate->tmpcxt);
+
+	buildstate->indtuples += 1;
+}
+
+static IndexBuildResult *
+hnsw_build(Relation heap, Relation index, IndexInfo *indexInfo)
+{
+	IndexBuildResult	*result;
+	HnswBuildState	buildstate;
+	double		reltuples;
+
+	if (RelationGetNumberOfBlocks(index) != 0)
+		elog(ERROR, "index \"%s\" already contains data",
+			 RelationGetRelationName(index));
+
+	hnsw_init_metapage(index, MAIN_FORKNUM, hnsw_get_m(index), hnsw_get_measure(index));
+
+	buildstate.indtuples = 0;
+	buildstate.tmpcxt = AllocSetContextCreate(CurrentMemoryContext,
+											  "pgs_hnsw build temporary context",
+											  ALLOCSET_DEFAULT_SIZES);
+
+	reltuples = table_index_build_scan(heap, index, indexInfo, true, true,
+									   hnsw_build_callback, (void *) &buildstate,
+									   NULL);
+
+	MemoryContextDelete(buildstate.tmpcxt);
+
+	result = (IndexBuildResult *) palloc(sizeof(IndexBuildResult));
+	result->heap_tuples = reltuples;
+	result->index_tuples = buildstate.indtuples;
+
+	return result;
+}
+
+static void
+hnsw_buildempty(Relation index)
+{
+	hnsw_init_metapage(index, INIT_FORKNUM, hnsw_get_m(index), hnsw_get_measure(index));
+}
+
+#if PG_VERSION_NUM >= 140000
+static bool
+hnsw_insert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid,
+			Relation heap, IndexUniqueCheck checkUnique, bool indexUnchanged,
+			IndexInfo *indexInfo)
+#else
+static bool
+hnsw_insert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid,
+			Relation heap, IndexUniqueCheck checkUnique, IndexInfo *indexInfo)
+#endif
+{
+	MemoryContext	tmpcxt;
+	MemoryContext	oldcxt;
+
+	if (isnull[0])
+		return false;
+
+	tmpcxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "pgs_hnsw insert temporary context",
+								   ALLOCSET_DEFAULT_SIZES);
+	oldcxt = MemoryContextSwitchTo(tmpcxt);
+
+	hnsw_insert_value(index, values[0], heap_tid);
+
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextDelete(tmpcxt);
+
+	return false;
+}
+
+/*
+ * Mark the elements of dead rows
+ */
+static IndexBulkDeleteResult *
+hnsw_bulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
+				IndexBulkDeleteCallback callback, void *callback_state)
+{
+	Relation	index = info->index;
+	BlockNumber	nblocks = RelationGetNumberOfBlocks(index);
+	BlockNumber	blkno;
+
+	if (stats == NULL)
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+	for (blkno = HNSW_METAPAGE_BLKNO + 1; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		GenericXLogState	*state;
+		OffsetNumber	offno;
+		OffsetNumber	maxoff;
+		bool		modified = false;
+
+		vacuum_delay_point();
+
+		buf = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, info->strategy);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		maxoff = PageGetMaxOffsetNumber(page);
+		for (offno = FirstOffsetNumber; offno <= maxoff; offno = OffsetNumberNext(offno))
+		{
+			HnswElementTuple	tup = (HnswElementTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (tup->deleted)
+				continue;
+
+			if (callback(&tup->heaptid, callback_state))
+			{
+				tup->deleted = 1;
+				modified = true;
+				stats->tuples_removed += 1;
+			}
+			else
+				stats->num_index_tuples += 1;
+		}
+
+		if (modified)
+			GenericXLogFinish(state);
+		else
+			GenericXLogAbort(state);
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	return stats;
+}
+
+static IndexBulkDeleteResult *
+hnsw_vacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
+{
+	if (info->analyze_only)
+		return stats;
+
+	if (stats == NULL)
+	{
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+		stats->num_index_tuples = info->num_heap_tuples;
+		stats->estimated_count = true;
+	}
+	stats->num_pages = RelationGetNumberOfBlocks(info->index);
+
+	return stats;
+}
+
+/*
+ * Only ORDER BY scans: every search costs about the same, and it is all done
+ * before the first row.
+ */
+static void
+hnsw_costestimate(PlannerInfo *root, IndexPath *path, double loop_count,
+				  Cost *indexStartupCost, Cost *indexTotalCost,
+				  Selectivity *indexSelectivity, double *indexCorrelation,
+				  double *indexPages)
+{
+	GenericCosts	costs;
+	Relation	index;
+	int			m;
+	bool		compatible;
+
+	if (path->indexorderbys == NIL)
+	{
+		*indexStartupCost = get_float8_infinity();
+		*indexTotalCost = get_float8_infinity();
+		*indexSelectivity = 0;
+		*indexCorrelation = 0;
+		*indexPages = 0;
+		return;
+	}
+
+	/* the index only answers for the tokens that the measure uses */
+	index = index_open(path->indexinfo->indexoid, NoLock);
+	m = hnsw_get_m(index);
+	compatible = pgs_token_compatible(hnsw_get_token_options(index),
+									  (hnsw_get_measure(index) == HNSW_JACCARD) ?
+									  pgs_jaccard_tokenizer : pgs_cosine_tokenizer);
+	index_close(index, NoLock);
+
+	MemSet(&costs, 0, sizeof(costs));
+	costs.numIndexTuples = Min(path->indexinfo->tuples,
+							   (double) pgs_hnsw_ef_search * 2 * m);
+
+	genericcostestimate(root, path, loop_count, &costs);
+
+	*indexStartupCost = costs.indexTotalCost;
+	*indexTotalCost = costs.indexTotalCost;
+	*indexSelectivity = costs.indexSelectivity;
+	*indexCorrelation = costs.indexCorrelation;
+	*indexPages = costs.numIndexPages;
+
+	if (!compatible)
+	{
+		*indexStartupCost = get_float8_infinity();
+		*indexTotalCost = get_float8_infinity();
+	}
+}
+
+static bytea *
+hnsw_options(Datum reloptions, bool validate)
+{
+	static const relopt_parse_elt tab[] = {
+		{"m", RELOPT_TYPE_INT, offsetof(HnswOptions, m)},
+		{"ef_construction", RELOPT_TYPE_INT, offsetof(HnswOptions, efConstruction)},
+	};
+
+	return (bytea *) build_reloptions(reloptions, validate, hnsw_relopt_kind,
+									  sizeof(HnswOptions), tab, lengthof(tab));
+}
+
+/*
+ * Validator for a pgs_hnsw opclass, as spgvalidate() does for SP-GiST: the
+ * support functions and the ORDER BY operators must have the right
+ * signatures, and the opclass needs a distance function and an operator.
+ */
+static bool
+hnsw_validate(Oid opclassoid)
+{
+	bool		result = true;
+	HeapTuple	classtup;
+	Form_pg_opclass	classform;
+	Oid			opfamilyoid;
+	Oid			opcintype;
+	char		*opclassname;
+	HeapTuple	amtup;
+	Oid			amhandler;
+	HeapTuple	familytup;
+	Form_pg_opfamily	familyform;
+	char		*opfamilyname;
+	CatCList	*proclist;
+	CatCList	*oprlist;
+	bool		hasdistance = false;
+	bool		hasoperator = false;
+	int			i;
+
+	classtup = SearchSysCache1(CLAOID, ObjectIdGetDatum(opclassoid));
+	if (!HeapTupleIsValid(classtup))
+		elog(ERROR, "cache lookup failed for operator class %u", opclassoid);
+	classform = (Form_pg_opclass) GETSTRUCT(classtup);
+
+	opfamilyoid = classform->opcfamily;
+	opcintype = classform->opcintype;
+	opclassname = NameStr(classform->opcname);
+
+	amtup = SearchSysCache1(AMOID, ObjectIdGetDatum(classform->opcmethod));
+	if (!HeapTupleIsValid(amtup))
+		elog(ERROR, "cache lookup failed for access method %u",
+			 classform->opcmethod);
+	amhandler = ((Form_pg_am) GETSTRUCT(amtup))->amhandler;
+	ReleaseSysCache(amtup);
+
+	familytup = SearchSysCache1(OPFAMILYOID, ObjectIdGetDatum(opfamilyoid));
+	if (!HeapTupleIsValid(familytup))
+		elog(ERROR, "cache lookup failed for operator family %u", opfamilyoid);
+	familyform = (Form_pg_opfamily) GETSTRUCT(familytup);
+
+	opfamilyname = NameStr(familyform->opfname);
+
+	oprlist = SearchSysCacheList1(AMOPSTRATEGY, ObjectIdGetDatum(opfamilyoid));
+	proclist = SearchSysCacheList1(AMPROCNUM, ObjectIdGetDatum(opfamilyoid));
+
+	for (i = 0; i < proclist->n_members; i++)
+	{
+		HeapTuple	proctup = &proclist->members[i]->tuple;
+		Form_pg_amproc	procform = (Form_pg_amproc) GETSTRUCT(proctup);
+		bool		ok;
+
+		if (procform->amproclefttype != procform->amprocrighttype)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains support function %s with different left and right input types",
+							opfamilyname, format_procedure(procform->amproc))));
+			result = false;
+			continue;
+		}
+
+		switch (procform->amprocnum)
+		{
+			case HNSW_DISTANCE_PROC:
+				ok = check_amproc_signature(procform->amproc, FLOAT8OID, true,
+											2, 2, procform->amproclefttype,
+											procform->amproclefttype);
+				if (ok && hnsw_distance_measure(procform->amproc, amhandler) == 0)
+				{
+					ereport(INFO,
+							(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+							 errmsg("pgs_hnsw operator family \"%s\" contains distance function %s, which is not pg_similarity's jaccard_distance(text, text) or cosine_distance(text, text)",
+									opfamilyname, format_procedure(procform->amproc))));
+					result = false;
+				}
+				if (procform->amproclefttype == opcintype)
+					hasdistance = true;
+				break;
+			case HNSW_OPTIONS_PROC:
+				ok = check_amoptsproc_signature(procform->amproc);
+				break;
+			default:
+				ereport(INFO,
+						(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+						 errmsg("pgs_hnsw operator family \"%s\" contains function %s with invalid support number %d",
+								opfamilyname, format_procedure(procform->amproc),
+								procform->amprocnum)));
+				result = false;
+				continue;
+		}
+
+		if (!ok)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains function %s with wrong signature for support number %d",
+							opfamilyname, format_procedure(procform->amproc),
+							procform->amprocnum)));
+			result = false;
+		}
+	}
+
+	for (i = 0; i < oprlist->n_members; i++)
+	{
+		HeapTuple	oprtup = &oprlist->members[i]->tuple;
+		Form_pg_amop	oprform = (Form_pg_amop) GETSTRUCT(oprtup);
+		Oid			op_rettype;
+
+		/* the distance operator is strategy 1 */
+		if (oprform->amopstrategy != 1)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains operator %s with invalid strategy number %d",
+							opfamilyname, format_operator(oprform->amopopr),
+							oprform->amopstrategy)));
+			result = false;
+		}
+
+		/* pgs_hnsw only answers ORDER BY */
+		if (oprform->amoppurpose != AMOP_ORDER)
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains operator %s for search, but only ORDER BY operators are supported",
+							opfamilyname, format_operator(oprform->amopopr))));
+			result = false;
+			continue;
+		}
+
+		/* the distances are float8 */
+		op_rettype = get_op_rettype(oprform->amopopr);
+		if (op_rettype != FLOAT8OID ||
+			!opfamily_can_sort_type(oprform->amopsortfamily, op_rettype))
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains invalid ORDER BY specification for operator %s",
+							opfamilyname, format_operator(oprform->amopopr))));
+			result = false;
+		}
+
+		if (!check_amop_signature(oprform->amopopr, op_rettype,
+								  oprform->amoplefttype, oprform->amoprighttype))
+		{
+			ereport(INFO,
+					(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+					 errmsg("pgs_hnsw operator family \"%s\" contains operator %s with wrong signature",
+							opfamilyname, format_operator(oprform->amopopr))));
+			result = false;
+		}
+
+		if (oprform->amoplefttype == opcintype && oprform->amoprighttype == opcintype)
+			hasoperator = true;
+	}
+
+	if (!hasdistance)
+	{
+		ereport(INFO,
+				(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+				 errmsg("pgs_hnsw operator class \"%s\" is missing support function %d",
+						opclassname, HNSW_DISTANCE_PROC)));
+		result = false;
+	}
+
+	if (!hasoperator)
+	{
+		ereport(INFO,
+				(errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+				 errmsg("pgs_hnsw operator class \"%s\" is missing its ORDER BY operator",
+						opclassname)));
+		result = false;
+	}
+
+	ReleaseCatCacheList(proclist);
+	ReleaseCatCacheList(oprlist);
+	ReleaseSysCache(familytup);
+	ReleaseSysCache(classtup);
+
+	return result;
+}
+
+static IndexScanDesc
+hnsw_beginscan(Relation index, int nkeys, int norderbys)
+{
+	IndexScanDesc	scan;
+	HnswScanOpaque	so;
+
+	scan = RelationGetIndexScan(index, nkeys, norderbys);
+
+	so = (HnswScanOpaque) palloc0(sizeof(HnswScanOpaqueData));
+	so->scancxt = AllocSetContextCreate(CurrentMemoryContext,
+										"pgs_hnsw scan context",
+										ALLOCSET_DEFAULT_SIZES);
+	scan->opaque = so;
+
+	scan->xs_orderbyvals = (Datum *) palloc0(sizeof(Datum) * Max(norderbys, 1));
+	scan->xs_orderbynulls = (bool *) palloc(sizeof(bool) * Max(norderbys, 1));
+	memset(scan->xs_orderbynulls, true, sizeof(bool) * Max(norderbys, 1));
+
+	return scan;
+}
+
+static void
+hnsw_rescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys,
+			int norderbys)
+{
+	HnswScanOpaque	so = (HnswScanOpaque) scan->opaque;
+
+	if (keys && scan->numberOfKeys > 0)
+		memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
+	if (orderbys && scan->numberOfOrderBys > 0)
+		memmove(scan->orderByData, orderbys, scan->numberOfOrderBys * sizeof(ScanKeyData));
+
+	MemoryContextReset(so->scancxt);
+	so->searched = false;
+	so->results = NULL;
+	so->nresults = 0;
+	so->next = 0;
+}
+
+static bool
+hnsw_gettuple(IndexScanDesc scan, ScanDirection dir)
+{
+	HnswScanOpaque	so = (HnswScanOpaque) scan->opaque;
+
+	if (scan->numberOfOrderBys == 0)
+		elog(ERROR, "pgs_hnsw index only supports ORDER BY scans");
+
+	if (!so->searched)
+	{
+		MemoryContext	oldcxt = MemoryContextSwitchTo(so->scancxt);
+		HnswMetaPageData	meta;
+		HnswSearch	s;
+		ScanKey		orderby = &scan->orderByData[0];
+		int			ef = pgs_hnsw_ef_search;
+
+		so->searched = true;
+
+		/* a NULL query orders nothing */
+		if (!(orderby->sk_flags & SK_ISNULL))
+		{
+			hnsw_read_metapage(scan->indexRelation, &meta);
+			hnsw_init_search(&s, scan->indexRelation, meta.m, meta.measure);
+			s.nhashes = hnsw_hashes(DatumGetTextPP(orderby->sk_argument),
+									hnsw_get_token_options(scan->indexRelation),
+									&s.hashes);
+
+			so->results = (HnswCandidate *) palloc(sizeof(HnswCandidate) * ef);
+			so->nresults = hnsw_search(&s, &meta, ef, 0, so->results);
+
+			elog(DEBUG1, "pgs_hnsw search: %d results, %ld elements read",
+				 so->nresults, (long) hash_get_num_entries(s.cache));
+		}
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	while (so->next < so->nresults)
+	{
+		HnswCandidate	*c = &so->results[so->next++];
+
+		if (c->element->deleted)
+			continue;
+
+		scan->xs_heaptid = c->element->heaptid;
+		scan->xs_recheck = false;
+		scan->xs_recheckorderby = false;
+		scan->xs_orderbyvals[0] = Float8GetDatum(c->distance);
+		scan->xs_orderbynulls[0] = false;
+
+		return true;
+	}
+
+	return false;
+}
+
+static void
+hnsw_endscan(IndexScanDesc scan)
+{
+	HnswScanOpaque	so = (HnswScanOpaque) scan->opaque;
+
+	MemoryContextDelete(so->scancxt);
+	pfree(so);
+	scan->opaque = NULL;
+}
+#endif
+
+/*
+ * Access method handler
+ */
+Datum
+hnsw_similarity_handler(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 130000
+	IndexAmRoutine	*amroutine = makeNode(IndexAmRoutine);
+
+	amroutine->amstrategies = 0;
+	amroutine->amsupport = HNSW_OPTIONS_PROC;
+	amroutine->amoptsprocnum = HNSW_OPTIONS_PROC;
+	amroutine->amcanorder = false;
+	amroutine->amcanorderbyop = true;
+	amroutine->amcanbackward = false;
+	amroutine->amcanunique = false;
+	amroutine->amcanmulticol = false;
+	amroutine->amoptionalkey = true;
+	amroutine->amsearcharray = false;
+	amroutine->amsearchnulls = false;
+	amroutine->amstorage = false;
+	amroutine->amclusterable = false;
+	amroutine->ampredlocks = false;
+	amroutine->amcanparallel = false;
+	amroutine->amcaninclude = false;
+	amroutine->amusemaintenanceworkmem = false;
+	amroutine->amparallelvacuumoptions = VACUUM_OPTION_PARALLEL_BULKDEL;
+	amroutine->amkeytype = InvalidOid;
+
+	amroutine->ambuild = hnsw_build;
+	amroutine->ambuildempty = hnsw_buildempty;
+	amroutine->aminsert = hnsw_insert;
+	amroutine->ambulkdelete = hnsw_bulkdelete;
+	amroutine->amvacuumcleanup = hnsw_vacuumcleanup;
+	amroutine->amcanreturn = NULL;
+	amroutine->amcostestimate = hnsw_costestimate;
+	amroutine->amoptions = hnsw_options;
+	amroutine->amproperty = NULL;
+	amroutine->ambuildphasename = NULL;
+	amroutine->amvalidate = hnsw_validate;
+#if PG_VERSION_NUM >= 140000
+	amroutine->amadjustmembers = NULL;
+#endif
+	amroutine->ambeginscan = hnsw_beginscan;
+	amroutine->amrescan = hnsw_rescan;
+	amroutine->amgettuple = hnsw_gettuple;
+	amroutine->amgetbitmap = NULL;
+	amroutine->amendscan = hnsw_endscan;
+	amroutine->ammarkpos = NULL;
+	amroutine->amrestrpos = NULL;
+	amroutine->amestimateparallelscan = NULL;
+	amroutine->aminitparallelscan = NULL;
+	amroutine->amparallelrescan = NULL;
+
+	PG_RETURN_POINTER(amroutine);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("pgs_hnsw requires PostgreSQL 13 or later")));
+	PG_RETURN_NULL();
+#endif
+}
+
+/*
+ * Opclass options (support function 2)
+ */
+Datum
+hnsw_similarity_options(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 130000
+	local_relopts	*relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+	init_local_reloptions(relopts, sizeof(HnswSimilarityOptions));
+	pgs_add_token_reloptions(relopts, offsetof(HnswSimilarityOptions, tok),
+							 PGS_UNIT_ALNUM);
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Called from _PG_init()
+ */
+void
+hnsw_similarity_init(void)
+{
+#if PG_VERSION_NUM >= 130000
+	hnsw_relopt_kind = add_reloption_kind();
+	add_int_reloption(hnsw_relopt_kind, "m",
+					  "links per element and layer",
+					  HNSW_DEFAULT_M, 2, 100, AccessExclusiveLock);
+	add_int_reloption(hnsw_relopt_kind, "ef_construction",
+					  "candidates considered when an element is linked",
+					  HNSW_DEFAULT_EF_CONSTRUCTION, 4, 1000, AccessExclusiveLock);
+#endif
+}
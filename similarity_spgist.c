@@ -0,0 +1,750 @@
+/*----------------------------------------------------------------------------
+ *
+ * similarity_spgist.c
+ *
+ * SP-GiST support routines
+ *
+ * spgist_similarity_ops is a radix tree of text (the same layout as the
+ * built-in text_ops: inner tuples hold a common prefix and one node per next
+ * byte) that answers ~== by walking the tree with a row of the Levenshtein
+ * dynamic programming matrix. The row of a node holds the distance from the
+ * bytes above it to every prefix of the query; no string below it can be
+ * closer to the query than the smallest value in the row, so the subtree is
+ * pruned as soon as that exceeds the largest distance the threshold allows.
+ * The row is carried down as the traversal value, so each inner tuple only
+ * costs a row per byte of its prefix and per child. Leaves finish the
+ * matrix and give the exact lev() result, so there is no recheck.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/spgist.h"
+#include "access/skey.h"
+#include "utils/datum.h"
+
+#include "similarity.h"
+
+#include <math.h>
+
+/* strategy numbers (see spgist_similarity_ops) */
+#define	PGS_SPGIST_LEV			8		/* ~== (text, text) */
+#define	PGS_SPGIST_LEV_QUERY	48		/* ~== (text, pgs_query) */
+
+/* same as the built-in text_ops: an inner tuple has to fit on a page */
+#define	PGS_SPGIST_MAX_PREFIX_LENGTH	Max((int) (BLCKSZ - 258 * 16 - 100), 32)
+
+PG_FUNCTION_INFO_V1(spgist_similarity_config);
+PG_FUNCTION_INFO_V1(spgist_similarity_choose);
+PG_FUNCTION_INFO_V1(spgist_similarity_picksplit);
+PG_FUNCTION_INFO_V1(spgist_similarity_inner_consistent);
+PG_FUNCTION_INFO_V1(spgist_similarity_leaf_consistent);
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * A ~== scan key
+ */
+typedef struct SpgLevQuery
+{
+	char	*str;			/* query (folded if lev() ignores case) */
+	int		len;
+	float8	threshold;
+	bool	normalized;		/* is lev() compared normalized? */
+	bool	prunable;		/* can a distance bound rule out subtrees? */
+	int		maxdist;		/* largest distance that may match (-1: none) */
+} SpgLevQuery;
+
+typedef struct SpgNodePtr
+{
+	Datum	d;
+	int		i;
+	int16	c;
+} SpgNodePtr;
+
+static Datum
+spg_text_datum(const char *data, int datalen)
+{
+	char	*p;
+
+	p = (char *) palloc(datalen + VARHDRSZ);
+
+	if (datalen + VARHDRSZ_SHORT <= VARATT_SHORT_MAX)
+	{
+		SET_VARSIZE_SHORT(p, datalen + VARHDRSZ_SHORT);
+		if (datalen)
+			memcpy(p + VARHDRSZ_SHORT, data, datalen);
+	}
+	else
+	{
+		SET_VARSIZE(p, datalen + VARHDRSZ);
+		memcpy(p + VARHDRSZ, data, datalen);
+	}
+
+	return PointerGetDatum(p);
+}
+
+static int
+spg_common_prefix(const char *a, const char *b, int lena, int lenb)
+{
+	int		i = 0;
+
+	while (i < lena && i < lenb && *a == *b)
+	{
+		a++;
+		b++;
+		i++;
+	}
+
+	return i;
+}
+
+/*
+ * Binary search of c in the (sorted) node labels; *i is where it is or
+ * where it should be inserted.
+ */
+static bool
+spg_search_char(Datum *nodeLabels, int nNodes, int16 c, int *i)
+{
+	int		StopLow = 0,
+			StopHigh = nNodes;
+
+	while (StopLow < StopHigh)
+	{
+		int		StopMiddle = (StopLow + StopHigh) >> 1;
+		int16	middle = DatumGetInt16(nodeLabels[StopMiddle]);
+
+		if (c < middle)
+			StopHigh = StopMiddle;
+		else if (c > middle)
+			StopLow = StopMiddle + 1;
+		else
+		{
+			*i = StopMiddle;
+			return true;
+		}
+	}
+
+	*i = StopHigh;
+	return false;
+}
+
+static int
+spg_cmp_node_ptr(const void *a, const void *b)
+{
+	const SpgNodePtr	*aa = (const SpgNodePtr *) a;
+	const SpgNodePtr	*bb = (const SpgNodePtr *) b;
+
+	return aa->c - bb->c;
+}
+
+static inline unsigned char
+spg_lev_fold(unsigned char c)
+{
+#ifdef PGS_IGNORE_CASE
+	/* as _lev() does */
+	return (unsigned char) tolower(c);
+#else
+	return c;
+#endif
+}
+
+/*
+ * Query of a ~== scan key. Returns false if the query is NULL (it matches
+ * nothing).
+ */
+static bool
+spg_lev_query(ScanKey key, SpgLevQuery *q)
+{
+	text	*query;
+	int		i;
+
+	if (key->sk_strategy == PGS_SPGIST_LEV_QUERY)
+	{
+		if (!pgs_query_args(DatumGetHeapTupleHeader(key->sk_argument), &query, &q->threshold))
+			return false;
+		q->normalized = pgs_levenshtein_is_normalized;
+	}
+	else
+	{
+		query = DatumGetTextPP(key->sk_argument);
+		q->threshold = pgs_levenshtein_threshold;
+		/* lev_op() always compares the normalized value */
+		q->normalized = true;
+	}
+
+	q->len = VARSIZE_ANY_EXHDR(query);
+	q->str = palloc(q->len + 1);
+	for (i = 0; i < q->len; i++)
+		q->str[i] = spg_lev_fold(((unsigned char *) VARDATA_ANY(query))[i]);
+	q->str[q->len] = '\0';
+
+	/*
+	 * 1 - d / max(n, m) >= t needs d <= (1 - t) * max(n, m) and, as d is at
+	 * least m - n, m <= n / t: d <= (1 - t) * n / t. A distance (not
+	 * normalized) is compared the other way around, and a query that lev()
+	 * rejects has to reach the operator to raise its error: no bound.
+	 */
+	q->prunable = (q->normalized && q->threshold > 0.0 && q->len <= PGS_MAX_STR_LEN);
+	q->maxdist = PGS_MAX_STR_LEN;
+	if (q->prunable)
+	{
+		if (q->threshold > 1.0)
+			q->maxdist = -1;
+		else
+			q->maxdist = (int) Min(floor((1.0 - q->threshold) * q->len / q->threshold + 1.0e-9),
+								   (double) PGS_MAX_STR_LEN);
+	}
+
+	return true;
+}
+
+/*
+ * Row of the distances from the empty string to each prefix of the query
+ */
+static int *
+spg_lev_first_row(const SpgLevQuery *q)
+{
+	int		*row = (int *) palloc(sizeof(int) * (q->len + 1));
+	int		j;
+
+	for (j = 0; j <= q->len; j++)
+		row[j] = j;
+
+	return row;
+}
+
+/*
+ * Next row of the matrix (one more byte c of the indexed string) into next;
+ * returns its smallest value.
+ */
+static int
+spg_lev_step(const SpgLevQuery *q, const int *prev, int *next, unsigned char c)
+{
+	int		rowmin;
+	int		j;
+
+	c = spg_lev_fold(c);
+
+	next[0] = prev[0] + 1;
+	rowmin = next[0];
+
+	for (j = 1; j <= q->len; j++)
+	{
+		int		sub = prev[j - 1] + (((unsigned char) q->str[j - 1] == c) ? 0 : 1);
+
+		next[j] = Min(Min(next[j - 1] + 1, prev[j] + 1), sub);
+		rowmin = Min(rowmin, next[j]);
+	}
+
+	return rowmin;
+}
+
+/*
+ * Row after the bytes s[0 .. len) starting at row (in place); returns its
+ * smallest value or, if it exceeds maxdist on the way, what it is then.
+ */
+static int
+spg_lev_advance(const SpgLevQuery *q, int *row, const char *s, int len, int maxdist)
+{
+	int		*tmp = (int *) palloc(sizeof(int) * (q->len + 1));
+	int		rowmin = row[0];
+	int		i, j;
+
+	for (j = 1; j <= q->len; j++)
+		rowmin = Min(rowmin, row[j]);
+
+	for (i = 0; i < len && rowmin <= maxdist; i++)
+	{
+		rowmin = spg_lev_step(q, row, tmp, (unsigned char) s[i]);
+		memcpy(row, tmp, sizeof(int) * (q->len + 1));
+	}
+
+	pfree(tmp);
+
+	return rowmin;
+}
+
+static SpgLevQuery *
+spg_lev_queries(ScanKey scankeys, int nkeys, bool *isnull)
+{
+	SpgLevQuery	*qs = (SpgLevQuery *) palloc(sizeof(SpgLevQuery) * Max(nkeys, 1));
+	int			i;
+
+	*isnull = false;
+	for (i = 0; i < nkeys; i++)
+	{
+		if (!spg_lev_query(&scankeys[i], &qs[i]))
+			*isnull = true;
+	}
+
+	return qs;
+}
+#endif
+
+Datum
+spgist_similarity_config(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	/* spgConfigIn *cfgin = (spgConfigIn *) PG_GETARG_POINTER(0); */
+	spgConfigOut	*cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+	cfg->prefixType = TEXTOID;
+	cfg->labelType = INT2OID;
+	cfg->canReturnData = true;
+	cfg->longValuesOK = true;	/* suffixing will shorten long values */
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Same as spg_text_choose(): descend by the next byte of the value (-1 at
+ * its end), splitting the prefix where the value differs from it.
+ */
+Datum
+spgist_similarity_choose(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	spgChooseIn		*in = (spgChooseIn *) PG_GETARG_POINTER(0);
+	spgChooseOut	*out = (spgChooseOut *) PG_GETARG_POINTER(1);
+	text			*inText = DatumGetTextPP(in->datum);
+	char			*inStr = VARDATA_ANY(inText);
+	int				inSize = VARSIZE_ANY_EXHDR(inText);
+	char			*prefixStr = NULL;
+	int				prefixSize = 0;
+	int				commonLen = 0;
+	int16			nodeChar = 0;
+	int				i = 0;
+
+	/* check for prefix match, set nodeChar to the first byte after prefix */
+	if (in->hasPrefix)
+	{
+		text	*prefixText = DatumGetTextPP(in->prefixDatum);
+
+		prefixStr = VARDATA_ANY(prefixText);
+		prefixSize = VARSIZE_ANY_EXHDR(prefixText);
+
+		commonLen = spg_common_prefix(inStr + in->level, prefixStr,
+									  inSize - in->level, prefixSize);
+
+		if (commonLen == prefixSize)
+		{
+			if (inSize - in->level > commonLen)
+				nodeChar = *(unsigned char *) (inStr + in->level + commonLen);
+			else
+				nodeChar = -1;
+		}
+		else
+		{
+			/* the value doesn't match the prefix: split the tuple */
+			out->resultType = spgSplitTuple;
+
+			if (commonLen == 0)
+				out->result.splitTuple.prefixHasPrefix = false;
+			else
+			{
+				out->result.splitTuple.prefixHasPrefix = true;
+				out->result.splitTuple.prefixPrefixDatum = spg_text_datum(prefixStr, commonLen);
+			}
+			out->result.splitTuple.prefixNNodes = 1;
+			out->result.splitTuple.prefixNodeLabels = (Datum *) palloc(sizeof(Datum));
+			out->result.splitTuple.prefixNodeLabels[0] =
+				Int16GetDatum(*(unsigned char *) (prefixStr + commonLen));
+
+			out->result.splitTuple.childNodeN = 0;
+
+			if (prefixSize - commonLen == 1)
+				out->result.splitTuple.postfixHasPrefix = false;
+			else
+			{
+				out->result.splitTuple.postfixHasPrefix = true;
+				out->result.splitTuple.postfixPrefixDatum =
+					spg_text_datum(prefixStr + commonLen + 1, prefixSize - commonLen - 1);
+			}
+
+			PG_RETURN_VOID();
+		}
+	}
+	else if (inSize > in->level)
+		nodeChar = *(unsigned char *) (inStr + in->level);
+	else
+		nodeChar = -1;
+
+	if (spg_search_char(in->nodeLabels, in->nNodes, nodeChar, &i))
+	{
+		/*
+		 * Descend to the existing node. If in->allTheSame, the core ignores
+		 * nodeN but levelAdd and restDatum are the same for any node.
+		 */
+		int		levelAdd;
+
+		out->resultType = spgMatchNode;
+		out->result.matchNode.nodeN = i;
+		levelAdd = commonLen;
+		if (nodeChar >= 0)
+			levelAdd++;
+		out->result.matchNode.levelAdd = levelAdd;
+		if (inSize - in->level - levelAdd > 0)
+			out->result.matchNode.restDatum =
+				spg_text_datum(inStr + in->level + levelAdd, inSize - in->level - levelAdd);
+		else
+			out->result.matchNode.restDatum = spg_text_datum(NULL, 0);
+	}
+	else if (in->allTheSame)
+	{
+		/*
+		 * Can't add a node: the upper tuple keeps the prefix and gets a
+		 * dummy label (-2) for a lower tuple with the original nodes.
+		 */
+		out->resultType = spgSplitTuple;
+		out->result.splitTuple.prefixHasPrefix = in->hasPrefix;
+		out->result.splitTuple.prefixPrefixDatum = in->prefixDatum;
+		out->result.splitTuple.prefixNNodes = 1;
+		out->result.splitTuple.prefixNodeLabels = (Datum *) palloc(sizeof(Datum));
+		out->result.splitTuple.prefixNodeLabels[0] = Int16GetDatum(-2);
+		out->result.splitTuple.childNodeN = 0;
+		out->result.splitTuple.postfixHasPrefix = false;
+	}
+	else
+	{
+		/* add a node for the new nodeChar */
+		out->resultType = spgAddNode;
+		out->result.addNode.nodeLabel = Int16GetDatum(nodeChar);
+		out->result.addNode.nodeN = i;
+	}
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Same as spg_text_picksplit(): the longest common prefix of the values and
+ * one node per next byte.
+ */
+Datum
+spgist_similarity_picksplit(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	spgPickSplitIn	*in = (spgPickSplitIn *) PG_GETARG_POINTER(0);
+	spgPickSplitOut	*out = (spgPickSplitOut *) PG_GETARG_POINTER(1);
+	text			*text0 = DatumGetTextPP(in->datums[0]);
+	SpgNodePtr		*nodes;
+	int				commonLen;
+	int				i;
+
+	commonLen = VARSIZE_ANY_EXHDR(text0);
+	for (i = 1; i < in->nTuples && commonLen > 0; i++)
+	{
+		text	*texti = DatumGetTextPP(in->datums[i]);
+		int		tmp = spg_common_prefix(VARDATA_ANY(text0), VARDATA_ANY(texti),
+										VARSIZE_ANY_EXHDR(text0),
+										VARSIZE_ANY_EXHDR(texti));
+
+		if (tmp < commonLen)
+			commonLen = tmp;
+	}
+
+	commonLen = Min(commonLen, PGS_SPGIST_MAX_PREFIX_LENGTH);
+
+	if (commonLen == 0)
+		out->hasPrefix = false;
+	else
+	{
+		out->hasPrefix = true;
+		out->prefixDatum = spg_text_datum(VARDATA_ANY(text0), commonLen);
+	}
+
+	/* the label of each value is its first byte after the prefix (-1: none) */
+	nodes = (SpgNodePtr *) palloc(sizeof(SpgNodePtr) * in->nTuples);
+
+	for (i = 0; i < in->nTuples; i++)
+	{
+		text	*texti = DatumGetTextPP(in->datums[i]);
+
+		if (commonLen < VARSIZE_ANY_EXHDR(texti))
+			nodes[i].c = *(unsigned char *) (VARDATA_ANY(texti) + commonLen);
+		else
+			nodes[i].c = -1;
+		nodes[i].i = i;
+		nodes[i].d = in->datums[i];
+	}
+
+	/* node labels have to be sorted for spg_search_char() */
+	qsort(nodes, in->nTuples, sizeof(*nodes), spg_cmp_node_ptr);
+
+	out->nNodes = 0;
+	out->nodeLabels = (Datum *) palloc(sizeof(Datum) * in->nTuples);
+	out->mapTuplesToNodes = (int *) palloc(sizeof(int) * in->nTuples);
+	out->leafTupleDatums = (Datum *) palloc(sizeof(Datum) * in->nTuples);
+
+	for (i = 0; i < in->nTuples; i++)
+	{
+		text	*texti = DatumGetTextPP(nodes[i].d);
+		Datum	leafD;
+
+		if (i == 0 || nodes[i].c != nodes[i - 1].c)
+		{
+			out->nodeLabels[out->nNodes] = Int16GetDatum(nodes[i].c);
+			out->nNodes++;
+		}
+
+		if (commonLen < VARSIZE_ANY_EXHDR(texti))
+			leafD = spg_text_datum(VARDATA_ANY(texti) + commonLen + 1,
+								   VARSIZE_ANY_EXHDR(texti) - commonLen - 1);
+		else
+			leafD = spg_text_datum(NULL, 0);
+
+		out->leafTupleDatums[nodes[i].i] = leafD;
+		out->mapTuplesToNodes[nodes[i].i] = out->nNodes - 1;
+	}
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Children whose strings can still be within reach of every ~== query.
+ * The traversal value is an array with the matrix row of each scan key at
+ * the reconstructed value (NULL for keys without a distance bound).
+ */
+Datum
+spgist_similarity_inner_consistent(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	spgInnerConsistentIn	*in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+	spgInnerConsistentOut	*out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+	text		*reconstructedValue;
+	text		*reconstrText;
+	int			maxReconstrLen;
+	text		*prefixText = NULL;
+	int			prefixSize = 0;
+	SpgLevQuery	*qs;
+	int			**rows;
+	int			**parent = (int **) in->traversalValue;
+	bool		isnull;
+	int			i, k;
+
+	out->nNodes = 0;
+
+	qs = spg_lev_queries(in->scankeys, in->nkeys, &isnull);
+	if (isnull)
+		PG_RETURN_VOID();
+
+	/*
+	 * Reconstruct the value of this tuple as spg_text_inner_consistent()
+	 * does: parent value, prefix and the node label (if it isn't a dummy).
+	 */
+	reconstructedValue = (text *) DatumGetPointer(in->reconstructedValue);
+	Assert(reconstructedValue == NULL ? in->level == 0 :
+		   VARSIZE_ANY_EXHDR(reconstructedValue) == in->level);
+
+	maxReconstrLen = in->level + 1;
+	if (in->hasPrefix)
+	{
+		prefixText = DatumGetTextPP(in->prefixDatum);
+		prefixSize = VARSIZE_ANY_EXHDR(prefixText);
+		maxReconstrLen += prefixSize;
+	}
+
+	reconstrText = palloc(VARHDRSZ + maxReconstrLen);
+	SET_VARSIZE(reconstrText, VARHDRSZ + maxReconstrLen);
+
+	if (in->level)
+		memcpy(VARDATA(reconstrText), VARDATA(reconstructedValue), in->level);
+	if (prefixSize)
+		memcpy(((char *) VARDATA(reconstrText)) + in->level,
+			   VARDATA_ANY(prefixText), prefixSize);
+
+	/* rows at the end of the prefix */
+	rows = (int **) palloc(sizeof(int *) * Max(in->nkeys, 1));
+	for (k = 0; k < in->nkeys; k++)
+	{
+		rows[k] = NULL;
+		if (!qs[k].prunable)
+			continue;
+
+		if (parent != NULL && parent[k] != NULL)
+		{
+			rows[k] = (int *) palloc(sizeof(int) * (qs[k].len + 1));
+			memcpy(rows[k], parent[k], sizeof(int) * (qs[k].len + 1));
+		}
+		else
+		{
+			/* root: nothing consumed yet */
+			Assert(in->level == 0);
+			rows[k] = spg_lev_first_row(&qs[k]);
+		}
+
+		if (spg_lev_advance(&qs[k], rows[k], prefixSize ? VARDATA_ANY(prefixText) : NULL,
+							prefixSize, qs[k].maxdist) > qs[k].maxdist)
+		{
+			elog(DEBUG2, "prefix of level %d out of reach", in->level);
+			PG_RETURN_VOID();
+		}
+	}
+
+	out->nodeNumbers = (int *) palloc(sizeof(int) * in->nNodes);
+	out->levelAdds = (int *) palloc(sizeof(int) * in->nNodes);
+	out->reconstructedValues = (Datum *) palloc(sizeof(Datum) * in->nNodes);
+	out->traversalValues = (void **) palloc(sizeof(void *) * in->nNodes);
+
+	for (i = 0; i < in->nNodes; i++)
+	{
+		int16			nodeChar = DatumGetInt16(in->nodeLabels[i]);
+		int				thisLen;
+		int				**childrows;
+		bool			res = true;
+		MemoryContext	oldcxt;
+
+		oldcxt = MemoryContextSwitchTo(in->traversalMemoryContext);
+		childrows = (int **) palloc(sizeof(int *) * Max(in->nkeys, 1));
+		for (k = 0; k < in->nkeys; k++)
+			childrows[k] = (rows[k] != NULL) ?
+				(int *) palloc(sizeof(int) * (qs[k].len + 1)) : NULL;
+		MemoryContextSwitchTo(oldcxt);
+
+		/* a dummy label (-2) or the end of the string (-1) adds no byte */
+		if (nodeChar <= 0)
+		{
+			thisLen = maxReconstrLen - 1;
+
+			for (k = 0; k < in->nkeys; k++)
+			{
+				if (rows[k] != NULL)
+					memcpy(childrows[k], rows[k], sizeof(int) * (qs[k].len + 1));
+			}
+		}
+		else
+		{
+			((unsigned char *) VARDATA(reconstrText))[maxReconstrLen - 1] = nodeChar;
+			thisLen = maxReconstrLen;
+
+			for (k = 0; k < in->nkeys && res; k++)
+			{
+				if (rows[k] != NULL &&
+					spg_lev_step(&qs[k], rows[k], childrows[k], nodeChar) > qs[k].maxdist)
+					res = false;
+			}
+		}
+
+		if (res)
+		{
+			out->nodeNumbers[out->nNodes] = i;
+			out->levelAdds[out->nNodes] = thisLen - in->level;
+			SET_VARSIZE(reconstrText, VARHDRSZ + thisLen);
+			out->reconstructedValues[out->nNodes] =
+				datumCopy(PointerGetDatum(reconstrText), false, -1);
+			out->traversalValues[out->nNodes] = childrows;
+			out->nNodes++;
+		}
+	}
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * lev() of the whole value against each query, from the row of the
+ * reconstructed value on.
+ */
+Datum
+spgist_similarity_leaf_consistent(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	spgLeafConsistentIn		*in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+	spgLeafConsistentOut	*out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+	int			level = in->level;
+	text		*leafValue,
+				*reconstrValue = NULL;
+	char		*fullValue;
+	int			fullLen;
+	SpgLevQuery	*qs;
+	int			**parent = (int **) in->traversalValue;
+	bool		isnull;
+	int			k;
+
+	leafValue = DatumGetTextPP(in->leafDatum);
+
+	if (DatumGetPointer(in->reconstructedValue))
+		reconstrValue = DatumGetTextP(in->reconstructedValue);
+
+	Assert(reconstrValue == NULL ? level == 0 :
+		   VARSIZE_ANY_EXHDR(reconstrValue) == level);
+
+	/* reconstruct the full string represented by this leaf tuple */
+	fullLen = level + VARSIZE_ANY_EXHDR(leafValue);
+	if (VARSIZE_ANY_EXHDR(leafValue) == 0 && level > 0)
+	{
+		fullValue = VARDATA(reconstrValue);
+		out->leafValue = PointerGetDatum(reconstrValue);
+	}
+	else
+	{
+		text	*fullText = palloc(VARHDRSZ + fullLen);
+
+		SET_VARSIZE(fullText, VARHDRSZ + fullLen);
+		fullValue = VARDATA(fullText);
+		if (level)
+			memcpy(fullValue, VARDATA(reconstrValue), level);
+		if (VARSIZE_ANY_EXHDR(leafValue) > 0)
+			memcpy(fullValue + level, VARDATA_ANY(leafValue),
+				   VARSIZE_ANY_EXHDR(leafValue));
+		out->leafValue = PointerGetDatum(fullText);
+	}
+
+	out->recheck = false;
+
+	qs = spg_lev_queries(in->scankeys, in->nkeys, &isnull);
+	if (isnull)
+		PG_RETURN_BOOL(false);
+
+	for (k = 0; k < in->nkeys; k++)
+	{
+		SpgLevQuery	*q = &qs[k];
+		int			*row;
+		int			maxlen;
+		int			maxdist = q->prunable ? q->maxdist : PGS_MAX_STR_LEN;
+		float8		res;
+
+		/* lev() raises an error here; let the operator do it */
+		if (fullLen > PGS_MAX_STR_LEN || q->len > PGS_MAX_STR_LEN)
+		{
+			out->recheck = true;
+			continue;
+		}
+
+		if (parent != NULL && parent[k] != NULL)
+		{
+			/* the row is shared with the other leaves of the node */
+			row = (int *) palloc(sizeof(int) * (q->len + 1));
+			memcpy(row, parent[k], sizeof(int) * (q->len + 1));
+			if (spg_lev_advance(q, row, fullValue + level, fullLen - level, maxdist) > maxdist)
+				PG_RETURN_BOOL(false);
+		}
+		else
+		{
+			row = spg_lev_first_row(q);
+			if (spg_lev_advance(q, row, fullValue, fullLen, maxdist) > maxdist)
+				PG_RETURN_BOOL(false);
+		}
+
+		/* the same computation as lev() */
+		maxlen = Max(fullLen, q->len);
+		res = (float8) row[q->len];
+		if (maxlen == 0)
+			res = 1.0;
+		else if (q->normalized)
+			res = 1.0 - (res / maxlen);
+
+		if (!(res >= q->threshold))
+			PG_RETURN_BOOL(false);
+	}
+
+	PG_RETURN_BOOL(true);
+#else
+	PG_RETURN_BOOL(false);
+#endif
+}
@@ -0,0 +1,1102 @@
+/*----------------------------------------------------------------------------
+ *
+ * similarity_support.c
+ *
+ * Planner support: selectivity estimators of the similarity operators, cost
+ * of the dynamic programming measures and similarity function calls that can
+ * use the token indexes (gin_similarity_ops, gin_similarity_hash_ops and
+ * gist_similarity_ops).
+ *
+ * Index scans are planned for operators only, so WHERE jaccard(a, b) >= 0.7
+ * never looks at an index. The planner asks the support function of the
+ * top-level operator (float8ge) only, hence a set_rel_pathlist hook: it
+ * rewrites each such clause as the threshold operator
+ *
+ * a ~?? ROW(b, 0.7)::pgs_query
+ *
+ * and builds the index paths of the relation again with them. The rewritten
+ * clauses are only index conditions; the original clauses still filter the
+ * rows.
+ *
+ * The *_op functions have a support function too, so jaccard_op(a, b) is
+ * an index condition just like a ~?? b.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "nodes/nodeFuncs.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/typcache.h"
+#include "utils/varbit.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+#if PG_VERSION_NUM >= 120000
+#include "catalog/namespace.h"
+#include "nodes/makefuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#include "utils/fmgroids.h"
+#include "utils/syscache.h"
+#endif
+
+#include <math.h>
+
+/* selectivity if nothing better is known (contsel's) */
+#define	PGS_DEFAULT_SEL		0.001
+
+/* fraction of the rows that contain a given token, if the statistics don't tell */
+#define	PGS_SEL_TOKEN_FREQ	0.01
+
+/*
+ * Histograms with fewer bounds than PGS_SEL_MIN_HIST are not used; up to
+ * PGS_SEL_FULL_HIST they are blended with the token model.
+ */
+#define	PGS_SEL_MIN_HIST	10
+#define	PGS_SEL_FULL_HIST	100
+
+/* values of one side of a join that are scored against the other side */
+#define	PGS_JOINSEL_SAMPLE	20
+
+/*
+ * Measures that the similarity indexes support
+ */
+typedef struct PgsIndexableMeasure
+{
+	const char	*measure;		/* float8 function */
+	const char	*opfunc;		/* (text, text) and (text, pgs_query) bool function */
+	const char	*opname;		/* operator of opfunc */
+	int			*tokenizer;		/* NULL if not a token measure */
+	float8		*threshold;
+	bool		*is_normalized;	/* NULL if the measure is always normalized */
+	bool		anyempty;		/* 0/0 (NaN) if either side has no tokens? */
+} PgsIndexableMeasure;
+
+static const PgsIndexableMeasure pgs_indexable_measures[] =
+{
+	{"block", "block_op", "~++", &pgs_block_tokenizer, &pgs_block_threshold, &pgs_block_is_normalized, false},
+	{"cosine", "cosine_op", "~##", &pgs_cosine_tokenizer, &pgs_cosine_threshold, NULL, true},
+	{"dice", "dice_op", "~-~", &pgs_dice_tokenizer, &pgs_dice_threshold, NULL, false},
+	{"jaccard", "jaccard_op", "~??", &pgs_jaccard_tokenizer, &pgs_jaccard_threshold, NULL, false},
+	{"matchingcoefficient", "matchingcoefficient_op", "~^^", &pgs_matching_tokenizer, &pgs_matching_threshold, &pgs_matching_is_normalized, false},
+	{"overlapcoefficient", "overlapcoefficient_op", "~**", &pgs_overlap_tokenizer, &pgs_overlap_threshold, NULL, true},
+	{"qgram", "qgram_op", "~~~", &pgs_qgram_tokenizer, &pgs_qgram_threshold, &pgs_qgram_is_normalized, false},
+	{"lev", "lev_op", "~==", NULL, &pgs_levenshtein_threshold, &pgs_levenshtein_is_normalized, false},
+	{NULL, NULL, NULL, NULL, NULL, NULL, false}
+};
+
+/*
+ * Which measure is funcid (a measure function or, if opfunc, one of the bool
+ * functions)? NULL if it is none of them. The pgs_tokens and text[] overloads
+ * have the same names but aren't indexable.
+ */
+static const PgsIndexableMeasure *
+pgs_indexable_measure(Oid funcid, bool opfunc)
+{
+	const PgsIndexableMeasure	*m;
+	char	*name;
+	Oid		*argtypes;
+	int		nargs;
+
+	name = get_func_name(funcid);
+	if (name == NULL)
+		return NULL;
+
+	get_func_signature(funcid, &argtypes, &nargs);
+	if (nargs != 2 || argtypes[0] != TEXTOID)
+		return NULL;
+
+	for (m = pgs_indexable_measures; m->measure != NULL; m++)
+	{
+		if (strcmp(name, opfunc ? m->opfunc : m->measure) == 0)
+			return m;
+	}
+
+	return NULL;
+}
+
+#if PG_VERSION_NUM >= 120000
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+/*
+ * Operator opname (text, righttype) of the namespace the extension lives in
+ */
+static Oid
+pgs_measure_operator(Oid nspid, const char *opname, Oid righttype)
+{
+	List	*name;
+
+	name = list_make2(makeString(get_namespace_name(nspid)),
+					  makeString(pstrdup(opname)));
+
+	return OpernameGetOprid(name, TEXTOID, righttype);
+}
+
+/*
+ * Can't measure(x, query) be NaN? The token measures are 0/0 if both sides
+ * have no tokens (cosine and overlap if either has). float8ge says NaN >= c
+ * but the threshold operators and the indexes don't return those rows, so
+ * the rewrite needs a query with tokens and a measure that is then never
+ * NaN.
+ */
+static bool
+pgs_threshold_nan_free(const PgsIndexableMeasure *m, Node *query)
+{
+	PgsTokenOptions	opts;
+	TokenList	*qtok;
+	bool		res;
+
+	if (m->tokenizer == NULL)
+		return true;
+	if (m->anyempty || !IsA(query, Const) || ((Const *) query)->constisnull)
+		return false;
+
+	opts.tokenizer = *m->tokenizer;
+	opts.gramlen = PGS_GRAM_LEN;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	qtok = pgs_tokenize(&opts, TextDatumGetCString(((Const *) query)->constvalue));
+	res = (qtok->size > 0);
+	destroyTokenList(qtok);
+
+	return res;
+}
+
+/*
+ * measure(a, b) >= c, measure(a, b) > c or the commuted forms as
+ * a <op> ROW(b, c)::pgs_query, a being the side that has Vars of the
+ * relation. NULL if the clause is none of them.
+ */
+static Expr *
+pgs_threshold_clause(Expr *clause)
+{
+	const PgsIndexableMeasure	*m;
+	OpExpr		*opexpr;
+	FuncExpr	*fexpr;
+	Node		*fnode;
+	Node		*threshold;
+	Node		*a, *b;
+	Oid			opfunc;
+	Oid			nspid;
+	Oid			typid;
+	Oid			opno;
+	RowExpr		*row;
+	Expr		*res;
+
+	if (!is_opclause(clause) || list_length(((OpExpr *) clause)->args) != 2)
+		return NULL;
+
+	opexpr = (OpExpr *) clause;
+	opfunc = get_opcode(opexpr->opno);
+
+	/* > is a superset of >= and the original clause is still checked */
+	if (opfunc == F_FLOAT8GE || opfunc == F_FLOAT8GT)
+	{
+		fnode = linitial(opexpr->args);
+		threshold = lsecond(opexpr->args);
+	}
+	else if (opfunc == F_FLOAT8LE || opfunc == F_FLOAT8LT)
+	{
+		fnode = lsecond(opexpr->args);
+		threshold = linitial(opexpr->args);
+	}
+	else
+		return NULL;
+
+	if (!is_funcclause(fnode))
+		return NULL;
+
+	fexpr = (FuncExpr *) fnode;
+	if (fexpr->funcresulttype != FLOAT8OID || list_length(fexpr->args) != 2)
+		return NULL;
+
+	m = pgs_indexable_measure(fexpr->funcid, false);
+	if (m == NULL)
+		return NULL;
+
+	/* the measures are symmetric: the indexed side goes on the left */
+	a = linitial(fexpr->args);
+	b = lsecond(fexpr->args);
+	if (contain_var_clause(b))
+	{
+		Node	*tmp = a;
+
+		a = b;
+		b = tmp;
+	}
+
+	if (!contain_var_clause(a) || contain_var_clause(b) ||
+		contain_var_clause(threshold))
+		return NULL;
+	if (contain_volatile_functions(b) || contain_volatile_functions(threshold))
+		return NULL;
+	if (exprType(a) != TEXTOID || exprType(b) != TEXTOID)
+		return NULL;
+	if (!pgs_threshold_nan_free(m, b))
+		return NULL;
+
+	nspid = get_func_namespace(fexpr->funcid);
+	typid = GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid,
+							CStringGetDatum("pgs_query"),
+							ObjectIdGetDatum(nspid));
+	if (!OidIsValid(typid))
+		return NULL;
+
+	opno = pgs_measure_operator(nspid, m->opname, typid);
+	if (!OidIsValid(opno))
+		return NULL;
+
+	row = makeNode(RowExpr);
+	row->args = list_make2(b, threshold);
+	row->row_typeid = typid;
+	row->row_format = COERCE_EXPLICIT_CAST;
+	row->colnames = list_make2(makeString(pstrdup("query")),
+							   makeString(pstrdup("threshold")));
+	row->location = -1;
+
+	res = make_opclause(opno, BOOLOID, false, (Expr *) a, (Expr *) row,
+						InvalidOid, fexpr->inputcollid);
+	set_opfuncid((OpExpr *) res);
+
+	elog(DEBUG1, "%s() threshold clause as operator %s", m->measure, m->opname);
+
+	return res;
+}
+
+static void
+pgs_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
+					 RangeTblEntry *rte)
+{
+	List		*quals = NIL;
+	List		*saved;
+	ListCell	*lc;
+
+	if (prev_set_rel_pathlist_hook)
+		prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+	/* plain relations only: no index paths for the others */
+	if (rte->rtekind != RTE_RELATION || rte->inh || rte->tablesample != NULL ||
+		rel->indexlist == NIL)
+		return;
+
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo	*rinfo = lfirst_node(RestrictInfo, lc);
+		RestrictInfo	*newrinfo;
+		Expr			*clause;
+
+		if (rinfo->pseudoconstant)
+			continue;
+
+		clause = pgs_threshold_clause(rinfo->clause);
+		if (clause == NULL)
+			continue;
+
+#if PG_VERSION_NUM >= 140000
+		newrinfo = make_simple_restrictinfo(root, clause);
+#else
+		newrinfo = make_simple_restrictinfo(clause);
+#endif
+		/* don't let it run ahead of the security barrier quals */
+		newrinfo->security_level = rinfo->security_level;
+
+		quals = lappend(quals, newrinfo);
+	}
+
+	if (quals == NIL)
+		return;
+
+	/*
+	 * create_index_paths() matches the index columns against
+	 * baserestrictinfo. The threshold clauses are only there while it runs:
+	 * they are implied by the original clauses that stay in the plan.
+	 */
+	saved = rel->baserestrictinfo;
+	rel->baserestrictinfo = list_concat(list_copy(saved), quals);
+
+	create_index_paths(root, rel);
+
+	rel->baserestrictinfo = saved;
+}
+
+static bool pgs_dp_cost(SupportRequestCost *req);
+#endif
+
+PG_FUNCTION_INFO_V1(pgs_index_support);
+
+/*
+ * Planner support function of the *_op functions: *_op(a, b) is an index
+ * condition as the operator a <op> b. A function has a single support
+ * function, so this one also answers the cost of lev_op.
+ */
+Datum
+pgs_index_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	Node	*rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestIndexCondition))
+	{
+		SupportRequestIndexCondition	*req = (SupportRequestIndexCondition *) rawreq;
+		const PgsIndexableMeasure		*m;
+		FuncExpr	*fexpr;
+		Node		*a, *b;
+		Oid			righttype;
+		Oid			opno;
+		Expr		*clause;
+
+		if (!is_funcclause(req->node))
+			PG_RETURN_POINTER(NULL);
+
+		fexpr = (FuncExpr *) req->node;
+		if (list_length(fexpr->args) != 2)
+			PG_RETURN_POINTER(NULL);
+
+		m = pgs_indexable_measure(fexpr->funcid, true);
+		if (m == NULL)
+			PG_RETURN_POINTER(NULL);
+
+		a = linitial(fexpr->args);
+		b = lsecond(fexpr->args);
+		righttype = exprType(b);
+
+		/* the index column has to be the left argument */
+		if (req->indexarg != 0)
+		{
+			Node	*tmp = a;
+
+			/* only *_op(text, text) is symmetric */
+			if (righttype != TEXTOID)
+				PG_RETURN_POINTER(NULL);
+
+			a = b;
+			b = tmp;
+		}
+
+#if PG_VERSION_NUM >= 130000
+		if (!is_pseudo_constant_for_index(req->root, b, req->index))
+#else
+		if (!is_pseudo_constant_for_index(b, req->index))
+#endif
+			PG_RETURN_POINTER(NULL);
+
+		opno = pgs_measure_operator(get_func_namespace(fexpr->funcid),
+									m->opname, righttype);
+		if (!OidIsValid(opno) || !op_in_opfamily(opno, req->opfamily))
+			PG_RETURN_POINTER(NULL);
+
+		clause = make_opclause(opno, BOOLOID, false, (Expr *) a, (Expr *) b,
+							   InvalidOid, fexpr->inputcollid);
+		set_opfuncid((OpExpr *) clause);
+
+		/* the operator is the function */
+		req->lossy = false;
+
+		PG_RETURN_POINTER(list_make1(clause));
+	}
+	else if (IsA(rawreq, SupportRequestCost))
+	{
+		if (pgs_dp_cost((SupportRequestCost *) rawreq))
+			PG_RETURN_POINTER(rawreq);
+	}
+#endif
+
+	PG_RETURN_POINTER(NULL);
+}
+
+/*
+ * Selectivity estimation
+ *
+ * The operators are applied to the column statistics: MCVs and histogram
+ * bounds are a sample of the column, so the estimate follows the data and
+ * the current threshold. Without a usable histogram, a token model fills
+ * in: a value matches if it has enough tokens in common with the query,
+ * each query token being found in a row with its frequency in the sample
+ * (or PGS_SEL_TOKEN_FREQ).
+ *
+ * The hamming operators raise an error for arguments of different lengths;
+ * a statistics value of another length than the query doesn't match and
+ * the operator is not called for it.
+ */
+
+/* arguments that the operator requires to have the same length */
+#define	PGS_SAMELEN_NONE	0
+#define	PGS_SAMELEN_BITS	1		/* hamming_op (varbit) */
+#define	PGS_SAMELEN_BYTES	2		/* hamming_text_op */
+
+/* an operator being estimated */
+typedef struct PgsOperator
+{
+	FmgrInfo	proc;
+	Oid			collation;
+	const PgsIndexableMeasure	*measure;	/* NULL if not a token measure */
+	bool		isquery;					/* right argument is a pgs_query? */
+	int			samelen;					/* PGS_SAMELEN_* */
+} PgsOperator;
+
+/*
+ * MCVs and histogram bounds of a column as a weighted sample of its non-null
+ * values: values[0 .. nmcv) are the MCVs (the weight is their frequency),
+ * the others are histogram bounds that share the remaining rows equally.
+ */
+typedef struct PgsSample
+{
+	int			nvalues;
+	int			nmcv;
+	Datum		*values;
+	float8		*weights;
+	float8		nullfrac;
+	float8		mcvfrac;
+#if PG_VERSION_NUM >= 100000
+	AttStatsSlot	mcv;
+	AttStatsSlot	hist;
+#endif
+} PgsSample;
+
+static void
+pgs_operator_init(PgsOperator *op, Oid oprid, Oid collation)
+{
+	Oid		opfunc = get_opcode(oprid);
+	Oid		lefttype;
+	Oid		righttype;
+
+	fmgr_info(opfunc, &op->proc);
+	op->collation = collation;
+
+	op_input_types(oprid, &lefttype, &righttype);
+	op->measure = NULL;
+	op->isquery = false;
+	op->samelen = PGS_SAMELEN_NONE;
+	if (lefttype == TEXTOID)
+	{
+		char	*name = get_func_name(opfunc);
+
+		op->measure = pgs_indexable_measure(opfunc, true);
+		op->isquery = (righttype != TEXTOID);
+		if (righttype == TEXTOID && name != NULL && strcmp(name, "hamming_text_op") == 0)
+			op->samelen = PGS_SAMELEN_BYTES;
+	}
+	else if (lefttype == VARBITOID && righttype == VARBITOID)
+		op->samelen = PGS_SAMELEN_BITS;
+}
+
+static bool
+pgs_operator_matches(PgsOperator *op, Datum a, Datum b)
+{
+	switch (op->samelen)
+	{
+		case PGS_SAMELEN_BITS:
+			if (VARBITLEN(DatumGetVarBitP(a)) != VARBITLEN(DatumGetVarBitP(b)))
+				return false;
+			break;
+		case PGS_SAMELEN_BYTES:
+			if (toast_raw_datum_size(a) != toast_raw_datum_size(b))
+				return false;
+			break;
+		default:
+			break;
+	}
+
+	return DatumGetBool(FunctionCall2Coll(&op->proc, op->collation, a, b));
+}
+
+static void
+pgs_sample_init(PgsSample *s, VariableStatData *vardata, PgsOperator *op)
+{
+	memset(s, 0, sizeof(PgsSample));
+
+#if PG_VERSION_NUM >= 100000
+	if (HeapTupleIsValid(vardata->statsTuple) &&
+		statistic_proc_security_check(vardata, op->proc.fn_oid))
+	{
+		Form_pg_statistic	stats = (Form_pg_statistic) GETSTRUCT(vardata->statsTuple);
+		int		nhist;
+		int		i;
+
+		s->nullfrac = stats->stanullfrac;
+
+		get_attstatsslot(&s->mcv, vardata->statsTuple, STATISTIC_KIND_MCV,
+						 InvalidOid, ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS);
+		get_attstatsslot(&s->hist, vardata->statsTuple, STATISTIC_KIND_HISTOGRAM,
+						 InvalidOid, ATTSTATSSLOT_VALUES);
+
+		s->nmcv = s->mcv.nvalues;
+		nhist = s->hist.nvalues;
+		s->nvalues = s->nmcv + nhist;
+		s->values = (Datum *) palloc(Max(s->nvalues, 1) * sizeof(Datum));
+		s->weights = (float8 *) palloc(Max(s->nvalues, 1) * sizeof(float8));
+
+		for (i = 0; i < s->nmcv; i++)
+		{
+			s->values[i] = s->mcv.values[i];
+			s->weights[i] = s->mcv.numbers[i];
+			s->mcvfrac += s->mcv.numbers[i];
+		}
+		for (i = 0; i < nhist; i++)
+		{
+			s->values[s->nmcv + i] = s->hist.values[i];
+			s->weights[s->nmcv + i] = (1.0 - s->nullfrac - s->mcvfrac) / nhist;
+		}
+	}
+#endif
+}
+
+static void
+pgs_sample_free(PgsSample *s)
+{
+#if PG_VERSION_NUM >= 100000
+	free_attstatsslot(&s->mcv);
+	free_attstatsslot(&s->hist);
+#endif
+	if (s->values != NULL)
+		pfree(s->values);
+	if (s->weights != NULL)
+		pfree(s->weights);
+}
+
+/*
+ * Common tokens that a value needs to reach threshold t with a query of n
+ * tokens, assuming both have the same number of tokens. -1 if the threshold
+ * is compared with a distance (block and qgram not normalized).
+ */
+static int
+pgs_required_tokens(PgsOperator *op, int n, float8 t)
+{
+	const PgsIndexableMeasure	*m = op->measure;
+	float8	r;
+
+	/* only the pgs_query operators see the *_is_normalized setting */
+	if (op->isquery && m->is_normalized != NULL && !*m->is_normalized)
+	{
+		/* the number of common tokens */
+		if (strcmp(m->measure, "matchingcoefficient") != 0)
+			return -1;
+		r = t;
+	}
+	else if (strcmp(m->measure, "jaccard") == 0)
+		r = n * 2.0 * t / (1.0 + t);	/* m / (2n - m) >= t */
+	else
+		r = n * t;						/* m / n >= t */
+
+	if (r <= 0.0)
+		return 0;
+	if (r > n)
+		return n + 1;
+
+	return (int) ceil(r - 1.0e-9);
+}
+
+/*
+ * Fraction of the rows that have at least the required common tokens with
+ * the query: each query token is in a row with its frequency in the sample
+ * (independently), so the number of common tokens is a Poisson binomial.
+ */
+static float8
+pgs_token_sel(PgsOperator *op, PgsSample *s, Datum value)
+{
+	PgsTokenOptions	opts;
+	TokenList	*qtok;
+	Token		*t;
+	text		*query;
+	float8		threshold;
+	float8		*freq;
+	float8		*dist;
+	float8		total = 0.0;
+	float8		res = 0.0;
+	int			n;
+	int			k;
+	int			i, j;
+
+	if (op->measure == NULL || op->measure->tokenizer == NULL)
+		return PGS_DEFAULT_SEL;
+
+	if (op->isquery)
+	{
+		if (!pgs_query_args(DatumGetHeapTupleHeader(value), &query, &threshold))
+			return 0.0;
+	}
+	else
+	{
+		query = DatumGetTextPP(value);
+		threshold = *op->measure->threshold;
+	}
+
+	opts.tokenizer = *op->measure->tokenizer;
+	opts.gramlen = PGS_GRAM_LEN;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	qtok = pgs_tokenize(&opts, text_to_cstring(query));
+	n = qtok->size;
+	k = pgs_required_tokens(op, n, threshold);
+
+	if (n == 0 || k < 0)
+	{
+		destroyTokenList(qtok);
+		return PGS_DEFAULT_SEL;
+	}
+
+	/* token frequencies in the sample */
+	freq = (float8 *) palloc0(n * sizeof(float8));
+	for (i = 0; i < s->nvalues; i++)
+	{
+		TokenList	*vtok;
+
+		vtok = pgs_tokenize(&opts, text_to_cstring(DatumGetTextPP(s->values[i])));
+		for (t = qtok->head, j = 0; t != NULL; t = t->next, j++)
+		{
+			if (searchToken(vtok, t->data) != NULL)
+				freq[j] += s->weights[i];
+		}
+		total += s->weights[i];
+		destroyTokenList(vtok);
+	}
+
+	for (j = 0; j < n; j++)
+	{
+		if (total > 0.0 && freq[j] > 0.0)
+			freq[j] /= total;
+		else if (s->nvalues > 0)
+			freq[j] = Min(PGS_SEL_TOKEN_FREQ, 0.5 / s->nvalues);
+		else
+			freq[j] = PGS_SEL_TOKEN_FREQ;
+	}
+
+	/* dist[j]: probability of j common tokens */
+	dist = (float8 *) palloc0((n + 1) * sizeof(float8));
+	dist[0] = 1.0;
+	for (i = 0; i < n; i++)
+	{
+		for (j = i + 1; j > 0; j--)
+			dist[j] = dist[j] * (1.0 - freq[i]) + dist[j - 1] * freq[i];
+		dist[0] *= (1.0 - freq[i]);
+	}
+
+	for (j = k; j <= n; j++)
+		res += dist[j];
+
+	elog(DEBUG2, "token model: %d tokens, %d required: %.6f", n, k, res);
+
+	pfree(freq);
+	pfree(dist);
+	destroyTokenList(qtok);
+
+	return res;
+}
+
+/*
+ * Selectivity of "var op value" (or "value op var" if !varonleft) for a
+ * column whose statistics are in s. Same as generic_restriction_selectivity()
+ * with the token model as the default.
+ */
+static float8
+pgs_restriction_sel(PgsOperator *op, PgsSample *s, Datum value, bool varonleft)
+{
+	float8	mcvsel = 0.0;
+	float8	histsel;
+	int		nhist = s->nvalues - s->nmcv;
+	int		nmatch = 0;
+	int		i;
+
+	/* a NULL query or threshold matches nothing */
+	if (op->isquery)
+	{
+		text	*query;
+		float8	threshold;
+
+		if (!pgs_query_args(DatumGetHeapTupleHeader(value), &query, &threshold))
+			return 0.0;
+	}
+
+	for (i = 0; i < s->nvalues; i++)
+	{
+		bool	match;
+
+		if (varonleft)
+			match = pgs_operator_matches(op, s->values[i], value);
+		else
+			match = pgs_operator_matches(op, value, s->values[i]);
+
+		if (!match)
+			continue;
+
+		if (i < s->nmcv)
+			mcvsel += s->weights[i];
+		else
+			nmatch++;
+	}
+
+	if (nhist >= PGS_SEL_FULL_HIST)
+		histsel = (float8) nmatch / nhist;
+	else
+	{
+		histsel = pgs_token_sel(op, s, value);
+
+		if (nhist >= PGS_SEL_MIN_HIST)
+		{
+			float8	w = (float8) nhist / PGS_SEL_FULL_HIST;
+
+			histsel = w * nmatch / nhist + (1.0 - w) * histsel;
+		}
+	}
+
+	/* don't believe extremely small or large estimates */
+	if (histsel < 0.0001)
+		histsel = 0.0001;
+	else if (histsel > 0.9999)
+		histsel = 0.9999;
+
+	return mcvsel + histsel * (1.0 - s->nullfrac - s->mcvfrac);
+}
+
+/*
+ * A constant: a Const or a ROW() of Consts (a pgs_query that was not
+ * folded).
+ */
+static bool
+pgs_const_value(Node *node, Datum *value, bool *isnull)
+{
+	if (IsA(node, Const))
+	{
+		*value = ((Const *) node)->constvalue;
+		*isnull = ((Const *) node)->constisnull;
+		return true;
+	}
+
+	if (IsA(node, RowExpr))
+	{
+		RowExpr		*row = (RowExpr *) node;
+		TupleDesc	tupdesc;
+		Datum		*values;
+		bool		*nulls;
+		ListCell	*lc;
+		int			i = 0;
+
+		tupdesc = lookup_rowtype_tupdesc(row->row_typeid, -1);
+		if (list_length(row->args) != tupdesc->natts)
+		{
+			ReleaseTupleDesc(tupdesc);
+			return false;
+		}
+
+		values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+		nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+		foreach(lc, row->args)
+		{
+			Node	*arg = (Node *) lfirst(lc);
+
+			if (!IsA(arg, Const))
+			{
+				ReleaseTupleDesc(tupdesc);
+				return false;
+			}
+			values[i] = ((Const *) arg)->constvalue;
+			nulls[i] = ((Const *) arg)->constisnull;
+			i++;
+		}
+
+		*value = HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+		*isnull = false;
+		ReleaseTupleDesc(tupdesc);
+
+		return true;
+	}
+
+	return false;
+}
+
+PG_FUNCTION_INFO_V1(pgs_similarity_sel);
+
+/*
+ * Restriction selectivity of the similarity operators
+ */
+Datum
+pgs_similarity_sel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo		*root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	Oid				oprid = PG_GETARG_OID(1);
+	List			*args = (List *) PG_GETARG_POINTER(2);
+	int				varRelid = PG_GETARG_INT32(3);
+	VariableStatData	vardata;
+	Node			*other;
+	bool			varonleft;
+	Datum			value;
+	bool			isnull;
+	PgsOperator		op;
+	PgsSample		s;
+	float8			sel;
+
+	if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft))
+		PG_RETURN_FLOAT8(PGS_DEFAULT_SEL);
+
+	if (!pgs_const_value(other, &value, &isnull))
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(PGS_DEFAULT_SEL);
+	}
+
+	/* the operators are strict */
+	if (isnull)
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(0.0);
+	}
+
+	/* the measures reject longer strings; leave that error to the executor */
+	if (exprType(other) == TEXTOID &&
+		toast_raw_datum_size(value) - VARHDRSZ > PGS_MAX_STR_LEN)
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(PGS_DEFAULT_SEL);
+	}
+
+	pgs_operator_init(&op, oprid, PG_GET_COLLATION());
+	pgs_sample_init(&s, &vardata, &op);
+
+	sel = pgs_restriction_sel(&op, &s, value, varonleft);
+
+	elog(DEBUG1, "selectivity of operator %u: %.6f (MCVs: %d, histogram: %d)",
+		 oprid, sel, s.nmcv, s.nvalues - s.nmcv);
+
+	pgs_sample_free(&s);
+	ReleaseVariableStats(vardata);
+
+	CLAMP_PROBABILITY(sel);
+
+	PG_RETURN_FLOAT8(sel);
+}
+
+PG_FUNCTION_INFO_V1(pgs_similarity_joinsel);
+
+/*
+ * Join selectivity of the similarity operators: the restriction selectivity
+ * of up to PGS_JOINSEL_SAMPLE values of one side (from its statistics)
+ * against the other side, weighted by their frequencies.
+ */
+Datum
+pgs_similarity_joinsel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo		*root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	Oid				oprid = PG_GETARG_OID(1);
+	List			*args = (List *) PG_GETARG_POINTER(2);
+	/* JoinType		jointype = (JoinType) PG_GETARG_INT16(3); */
+	SpecialJoinInfo	*sjinfo = (SpecialJoinInfo *) PG_GETARG_POINTER(4);
+	VariableStatData	vardata1;
+	VariableStatData	vardata2;
+	bool			join_is_reversed;
+	PgsOperator		op;
+	PgsSample		s1;
+	PgsSample		s2;
+	PgsSample		*outer;
+	PgsSample		*inner;
+	float8			sel = PGS_DEFAULT_SEL;
+
+	get_join_variables(root, args, sjinfo, &vardata1, &vardata2, &join_is_reversed);
+
+	pgs_operator_init(&op, oprid, PG_GET_COLLATION());
+	pgs_sample_init(&s1, &vardata1, &op);
+	pgs_sample_init(&s2, &vardata2, &op);
+
+	/*
+	 * Score the left values against the right column or, if the left
+	 * column has no statistics, the other way around. The pgs_query side
+	 * can't be tokenized as a text.
+	 */
+	outer = (s1.nvalues > 0 || op.isquery) ? &s1 : &s2;
+	inner = (outer == &s1) ? &s2 : &s1;
+
+	if (outer->nvalues > 0 && !op.isquery)
+	{
+		int		step = Max(outer->nvalues / PGS_JOINSEL_SAMPLE, 1);
+		float8	total = 0.0;
+		float8	res = 0.0;
+		int		i;
+
+		for (i = 0; i < outer->nvalues; i += step)
+		{
+			res += outer->weights[i] *
+				pgs_restriction_sel(&op, inner, outer->values[i], outer != &s1);
+			total += outer->weights[i];
+		}
+
+		if (total > 0.0)
+			sel = (res / total) * (1.0 - outer->nullfrac);
+	}
+
+	elog(DEBUG1, "join selectivity of operator %u: %.6f", oprid, sel);
+
+	pgs_sample_free(&s1);
+	pgs_sample_free(&s2);
+	ReleaseVariableStats(vardata1);
+	ReleaseVariableStats(vardata2);
+
+	CLAMP_PROBABILITY(sel);
+
+	PG_RETURN_FLOAT8(sel);
+}
+
+/*
+ * Per-call cost of the dynamic programming measures. They fill a
+ * length(a) x length(b) matrix, so their cost grows with the product of the
+ * lengths; cellcost is the cost of a cell in cpu_operator_cost units. The
+ * COST declared in SQL is the cost of two 32-byte strings (the planner's
+ * default text width), the support function below scales it with the widths
+ * it can find out.
+ */
+typedef struct PgsDPCost
+{
+	const char	*func;
+	float8		cellcost;
+} PgsDPCost;
+
+static const PgsDPCost pgs_dp_costs[] =
+{
+	{"lev", 0.1},
+	{"lev_op", 0.1},
+	{"lev_distance", 0.1},
+	{"mongeelkan", 1.0},
+	{"mongeelkan_op", 1.0},
+	{"needlemanwunsch", 0.2},
+	{"needlemanwunsch_op", 0.2},
+	{"needlemanwunsch_align", 0.4},
+	{"smithwaterman", 0.2},
+	{"smithwaterman_op", 0.2},
+	{"smithwaterman_locate", 0.4},
+	{"smithwatermangotoh", 1.0},
+	{"smithwatermangotoh_op", 1.0},
+	{NULL, 0.0}
+};
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Average width of a string argument: the value of a constant, the
+ * statistics of a column or expression index, or the type's default.
+ */
+static int32
+pgs_arg_width(PlannerInfo *root, Node *arg)
+{
+	int32	width = 0;
+
+	if (IsA(arg, Const))
+	{
+		Const	*c = (Const *) arg;
+
+		if (c->constisnull)
+			return 0;
+		if (c->constlen == -1)
+			return toast_raw_datum_size(c->constvalue) - VARHDRSZ;
+	}
+	else if (root != NULL)
+	{
+		VariableStatData	vardata;
+
+		examine_variable(root, arg, 0, &vardata);
+		if (HeapTupleIsValid(vardata.statsTuple))
+			width = ((Form_pg_statistic) GETSTRUCT(vardata.statsTuple))->stawidth;
+		ReleaseVariableStats(vardata);
+	}
+
+	if (width <= 0)
+		width = get_typavgwidth(exprType(arg), exprTypmod(arg));
+
+	return width;
+}
+#endif
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Answer a SupportRequestCost for the dynamic programming measures: the cost
+ * of a call from the average widths of its arguments. false if req->funcid
+ * is not one of them.
+ */
+static bool
+pgs_dp_cost(SupportRequestCost *req)
+{
+	const PgsDPCost		*c;
+	List	*args;
+	char	*name;
+	int32	wa, wb;
+
+	if (req->node == NULL)
+		return false;
+
+	if (is_funcclause(req->node))
+		args = ((FuncExpr *) req->node)->args;
+	else if (is_opclause(req->node))
+		args = ((OpExpr *) req->node)->args;
+	else
+		return false;
+
+	if (list_length(args) < 2)
+		return false;
+
+	name = get_func_name(req->funcid);
+	if (name == NULL)
+		return false;
+
+	for (c = pgs_dp_costs; c->func != NULL; c++)
+	{
+		if (strcmp(name, c->func) == 0)
+			break;
+	}
+	if (c->func == NULL)
+		return false;
+
+	/* longer strings are rejected before the matrix is built */
+	wa = Min(pgs_arg_width(req->root, linitial(args)), PGS_MAX_STR_LEN);
+	wb = Min(pgs_arg_width(req->root, lsecond(args)), PGS_MAX_STR_LEN);
+
+	req->startup = 0;
+	req->per_tuple = (1.0 + c->cellcost * wa * wb) * cpu_operator_cost;
+
+	elog(DEBUG1, "cost of %s: widths %d and %d, %.4f per call",
+		 name, wa, wb, req->per_tuple);
+
+	return true;
+}
+#endif
+
+PG_FUNCTION_INFO_V1(pgs_cost_support);
+
+/*
+ * Planner support function of the dynamic programming measures.
+ */
+Datum
+pgs_cost_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	Node	*rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestCost) &&
+		pgs_dp_cost((SupportRequestCost *) rawreq))
+		PG_RETURN_POINTER(rawreq);
+#endif
+
+	PG_RETURN_POINTER(NULL);
+}
+
+/*
+ * Called from _PG_init()
+ */
+void
+pgs_support_init(void)
+{
+#if PG_VERSION_NUM >= 120000
+	prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+	set_rel_pathlist_hook = pgs_set_rel_pathlist;
+#endif
+}
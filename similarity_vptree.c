@@ -0,0 +1,641 @@
+/*----------------------------------------------------------------------------
+ *
+ * similarity_vptree.c
+ *
+ * Vantage-point tree support routines (SP-GiST)
+ *
+ * The edit distance (lev), the L1 distance of the token counts (block) and
+ * the L2 distance of the token sets (euclidean) are metrics, so for any
+ * strings q, v and x the triangle inequality gives
+ *
+ *     d(q, x) >= |d(q, v) - d(v, x)|
+ *
+ * Each inner tuple holds a vantage point v as its prefix and splits the
+ * strings below it into bands of their distance to v; a node label is the
+ * lower bound of its band (the bands are [label(i), label(i + 1)) and the
+ * last one is open). A search computes d(q, v) once per inner tuple and
+ * skips the bands whose strings are all farther than the threshold allows;
+ * the same bound is the distance of a band in ORDER BY distance scans.
+ * Leaves store the whole string and give the exact result, so there is no
+ * recheck.
+ *
+ * The prefix also records the metric and the tokenizer (block, euclidean)
+ * that the distances below it were computed with. If the tokenizer
+ * parameter changes, the tree can't prune that operator anymore but it is
+ * still searched (and extended) with its own tokenizer.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/spgist.h"
+#include "access/skey.h"
+#if PG_VERSION_NUM >= 120000
+#include "utils/float.h"
+#endif
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <math.h>
+
+/* metrics: strategy numbers of their threshold operators */
+#define	PGS_VPTREE_BLOCK		1		/* ~++ */
+#define	PGS_VPTREE_EUCLIDEAN	4		/* ~!! */
+#define	PGS_VPTREE_LEV			8		/* ~== */
+
+/* strategy offsets of the (text, pgs_query) and the distance operators */
+#define	PGS_VPTREE_QUERY_OFFSET	40
+#define	PGS_VPTREE_DIST_OFFSET	20
+
+/* bands (nodes) of an inner tuple */
+#define	PGS_VPTREE_FANOUT		4
+
+/* vantage point candidates and how many values each one is tried on */
+#define	PGS_VPTREE_CANDIDATES	5
+#define	PGS_VPTREE_SAMPLE		32
+
+/* metric and tokenizer bytes in front of the vantage point */
+#define	PGS_VPTREE_PREFIX_HDRSZ	2
+
+PG_FUNCTION_INFO_V1(spgist_vptree_config);
+PG_FUNCTION_INFO_V1(spgist_vptree_choose);
+PG_FUNCTION_INFO_V1(spgist_vptree_picksplit_block);
+PG_FUNCTION_INFO_V1(spgist_vptree_picksplit_euclidean);
+PG_FUNCTION_INFO_V1(spgist_vptree_picksplit_lev);
+PG_FUNCTION_INFO_V1(spgist_vptree_inner_consistent);
+PG_FUNCTION_INFO_V1(spgist_vptree_leaf_consistent);
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Prefix of an inner tuple
+ */
+typedef struct VptPrefix
+{
+	int		metric;
+	int		tokenizer;		/* PGS_UNIT_* (block and euclidean) */
+	text	*vp;			/* vantage point */
+} VptPrefix;
+
+/*
+ * A threshold operator scan key
+ */
+typedef struct VptQuery
+{
+	text	*query;
+	float8	maxdist;		/* largest distance that may match (< 0: none) */
+} VptQuery;
+
+typedef struct VptDist
+{
+	float8	dist;
+	int		i;
+} VptDist;
+
+static Datum
+vpt_make_prefix(int metric, int tokenizer, text *vp)
+{
+	int		len = VARSIZE_ANY_EXHDR(vp);
+	bytea	*res;
+
+	res = (bytea *) palloc(VARHDRSZ + PGS_VPTREE_PREFIX_HDRSZ + len);
+	SET_VARSIZE(res, VARHDRSZ + PGS_VPTREE_PREFIX_HDRSZ + len);
+	VARDATA(res)[0] = (char) metric;
+	VARDATA(res)[1] = (char) tokenizer;
+	memcpy(VARDATA(res) + PGS_VPTREE_PREFIX_HDRSZ, VARDATA_ANY(vp), len);
+
+	return PointerGetDatum(res);
+}
+
+static void
+vpt_get_prefix(Datum d, VptPrefix *p)
+{
+	bytea	*b = DatumGetByteaPP(d);
+	char	*data = VARDATA_ANY(b);
+
+	p->metric = data[0];
+	p->tokenizer = data[1];
+	p->vp = cstring_to_text_with_len(data + PGS_VPTREE_PREFIX_HDRSZ,
+									 VARSIZE_ANY_EXHDR(b) - PGS_VPTREE_PREFIX_HDRSZ);
+}
+
+/*
+ * Tokenizer parameter of a metric (lev has none)
+ */
+static int
+vpt_tokenizer(int metric)
+{
+	switch (metric)
+	{
+		case PGS_VPTREE_BLOCK:
+			return pgs_block_tokenizer;
+		case PGS_VPTREE_EUCLIDEAN:
+			return pgs_euclidean_tokenizer;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Distance of a and b, tokenized with tokenizer instead of the parameter
+ */
+static float8
+vpt_distance(int metric, int tokenizer, text *a, text *b)
+{
+	PGFunction	distfn;
+	int			*guc;
+	int			saved;
+	volatile float8	res;
+
+	switch (metric)
+	{
+		case PGS_VPTREE_LEV:
+			return DatumGetFloat8(DirectFunctionCall2(lev_distance,
+													  PointerGetDatum(a),
+													  PointerGetDatum(b)));
+		case PGS_VPTREE_BLOCK:
+			distfn = block_distance;
+			guc = &pgs_block_tokenizer;
+			break;
+		case PGS_VPTREE_EUCLIDEAN:
+			distfn = euclidean_distance;
+			guc = &pgs_euclidean_tokenizer;
+			break;
+		default:
+			elog(ERROR, "unrecognized metric: %d", metric);
+			return 0.0;			/* keep compiler quiet */
+	}
+
+	saved = *guc;
+	*guc = tokenizer;
+	PG_TRY();
+	{
+		res = DatumGetFloat8(DirectFunctionCall2(distfn,
+												 PointerGetDatum(a),
+												 PointerGetDatum(b)));
+	}
+	PG_CATCH();
+	{
+		*guc = saved;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	*guc = saved;
+
+	return res;
+}
+
+/*
+ * Node of the band that a value at distance dist of the vantage point
+ * belongs to: the last one whose lower bound is not above it.
+ */
+static int
+vpt_band(Datum *labels, int nNodes, float8 dist)
+{
+	int		i;
+
+	for (i = nNodes - 1; i > 0; i--)
+	{
+		if (dist >= DatumGetFloat8(labels[i]))
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * Smallest distance from a query at distance dq of the vantage point to a
+ * value of the band [lo, hi).
+ */
+static float8
+vpt_band_bound(float8 dq, float8 lo, float8 hi)
+{
+	return Max(Max(lo - dq, dq - hi), 0.0);
+}
+
+static int
+vpt_dist_cmp(const void *a, const void *b)
+{
+	float8	da = ((const VptDist *) a)->dist;
+	float8	db = ((const VptDist *) b)->dist;
+
+	return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+/*
+ * Number of tokens (with repetitions) of str as block() counts them
+ */
+static int
+vpt_block_tokens(text *str)
+{
+	PgsTokenOptions	opts;
+	TokenList	*tlist;
+	Token		*t;
+	int			n = 0;
+
+	opts.tokenizer = pgs_block_tokenizer;
+	opts.gramlen = PGS_GRAM_LEN;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	tlist = pgs_tokenize(&opts, text_to_cstring(str));
+	for (t = tlist->head; t != NULL; t = t->next)
+		n += t->freq;
+	destroyTokenList(tlist);
+
+	return n;
+}
+
+/*
+ * Query and distance bound of a threshold scan key. Returns false if the
+ * query is NULL (it matches nothing).
+ *
+ * A normalized lev(a, b) >= t needs d <= (1 - t) * max(n, m) for a query of
+ * n bytes and, as d >= m - n, m <= n / t: d <= (1 - t) * n / t. A
+ * normalized block(a, b) >= t needs d <= (1 - t) * (n + m) for n and m
+ * tokens and, as m <= n + d, d <= 2 * (1 - t) * n / t. Measures that are
+ * not normalized compare a distance the other way around: no bound.
+ */
+static bool
+vpt_scan_query(ScanKey key, VptQuery *q)
+{
+	StrategyNumber	strategy = key->sk_strategy;
+	int			metric;
+	float8		threshold;
+	bool		normalized;
+	float8		n;
+
+	if (strategy > PGS_VPTREE_QUERY_OFFSET)
+	{
+		metric = strategy - PGS_VPTREE_QUERY_OFFSET;
+		if (!pgs_query_args(DatumGetHeapTupleHeader(key->sk_argument),
+							&q->query, &threshold))
+			return false;
+		normalized = (metric == PGS_VPTREE_LEV) ?
+			pgs_levenshtein_is_normalized : pgs_block_is_normalized;
+	}
+	else
+	{
+		metric = strategy;
+		q->query = DatumGetTextPP(key->sk_argument);
+		threshold = (metric == PGS_VPTREE_LEV) ?
+			pgs_levenshtein_threshold : pgs_block_threshold;
+		/* lev_op() and block_op() always compare the normalized value */
+		normalized = true;
+	}
+
+	q->maxdist = get_float8_infinity();
+	if (!normalized || !(threshold > 0.0))
+		return true;
+
+	if (threshold > 1.0)
+	{
+		q->maxdist = -1.0;
+		return true;
+	}
+
+	if (metric == PGS_VPTREE_LEV)
+		n = VARSIZE_ANY_EXHDR(q->query);
+	else
+		n = 2.0 * vpt_block_tokens(q->query);
+
+	q->maxdist = (1.0 - threshold) * n / threshold;
+
+	return true;
+}
+
+/*
+ * Vantage point and bands of the values in->datums
+ */
+static void
+vpt_picksplit(int metric, spgPickSplitIn *in, spgPickSplitOut *out)
+{
+	int			tokenizer = vpt_tokenizer(metric);
+	int			ncand = Min(in->nTuples, PGS_VPTREE_CANDIDATES);
+	int			nsample = Min(in->nTuples, PGS_VPTREE_SAMPLE);
+	int			best = 0;
+	float8		bestspread = -1.0;
+	text		*vp;
+	VptDist		*dists;
+	int			i, j;
+
+	/*
+	 * The candidate whose distances to a sample of the values spread the
+	 * most splits them into the most selective bands.
+	 */
+	for (i = 0; i < ncand; i++)
+	{
+		int		c = i * in->nTuples / ncand;
+		text	*cand = DatumGetTextPP(in->datums[c]);
+		float8	sum = 0.0;
+		float8	sum2 = 0.0;
+		float8	spread;
+
+		for (j = 0; j < nsample; j++)
+		{
+			text	*x = DatumGetTextPP(in->datums[j * in->nTuples / nsample]);
+			float8	d = vpt_distance(metric, tokenizer, cand, x);
+
+			sum += d;
+			sum2 += d * d;
+		}
+
+		spread = sum2 / nsample - (sum / nsample) * (sum / nsample);
+		if (spread > bestspread)
+		{
+			bestspread = spread;
+			best = c;
+		}
+	}
+
+	vp = DatumGetTextPP(in->datums[best]);
+
+	dists = (VptDist *) palloc(sizeof(VptDist) * in->nTuples);
+	for (i = 0; i < in->nTuples; i++)
+	{
+		dists[i].dist = vpt_distance(metric, tokenizer, vp,
+									 DatumGetTextPP(in->datums[i]));
+		dists[i].i = i;
+	}
+	qsort(dists, in->nTuples, sizeof(VptDist), vpt_dist_cmp);
+
+	/*
+	 * Bands of about the same number of values; values at the same
+	 * distance are never split (a band starts at a distance).
+	 */
+	out->hasPrefix = true;
+	out->prefixDatum = vpt_make_prefix(metric, tokenizer, vp);
+	out->nNodes = 0;
+	out->nodeLabels = (Datum *) palloc(sizeof(Datum) * PGS_VPTREE_FANOUT);
+
+	for (i = 0; i < PGS_VPTREE_FANOUT; i++)
+	{
+		float8	lo = (i == 0) ? 0.0 : dists[i * in->nTuples / PGS_VPTREE_FANOUT].dist;
+
+		if (out->nNodes > 0 &&
+			lo <= DatumGetFloat8(out->nodeLabels[out->nNodes - 1]))
+			continue;
+
+		out->nodeLabels[out->nNodes++] = Float8GetDatum(lo);
+	}
+
+	out->mapTuplesToNodes = (int *) palloc(sizeof(int) * in->nTuples);
+	out->leafTupleDatums = (Datum *) palloc(sizeof(Datum) * in->nTuples);
+
+	for (i = 0; i < in->nTuples; i++)
+	{
+		int		k = dists[i].i;
+
+		out->mapTuplesToNodes[k] = vpt_band(out->nodeLabels, out->nNodes,
+											dists[i].dist);
+		out->leafTupleDatums[k] = in->datums[k];
+	}
+
+	elog(DEBUG2, "vantage point of %d values: %d bands (spread: %.3f)",
+		 in->nTuples, out->nNodes, bestspread);
+}
+#endif
+
+Datum
+spgist_vptree_config(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	/* spgConfigIn *cfgin = (spgConfigIn *) PG_GETARG_POINTER(0); */
+	spgConfigOut	*cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+	cfg->prefixType = BYTEAOID;
+	cfg->labelType = FLOAT8OID;
+	cfg->canReturnData = true;
+	cfg->longValuesOK = false;
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * A new value goes down the band of its distance to the vantage point
+ */
+Datum
+spgist_vptree_choose(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	spgChooseIn		*in = (spgChooseIn *) PG_GETARG_POINTER(0);
+	spgChooseOut	*out = (spgChooseOut *) PG_GETARG_POINTER(1);
+
+	out->resultType = spgMatchNode;
+	out->result.matchNode.nodeN = 0;
+	out->result.matchNode.levelAdd = 0;
+	out->result.matchNode.restDatum = in->datum;
+
+	/* all the nodes of an allTheSame tuple are alike; SP-GiST picks one */
+	if (!in->allTheSame)
+	{
+		VptPrefix	p;
+		float8		d;
+
+		Assert(in->hasPrefix);
+		vpt_get_prefix(in->prefixDatum, &p);
+		d = vpt_distance(p.metric, p.tokenizer, p.vp, DatumGetTextPP(in->datum));
+		out->result.matchNode.nodeN = vpt_band(in->nodeLabels, in->nNodes, d);
+	}
+#endif
+
+	PG_RETURN_VOID();
+}
+
+Datum
+spgist_vptree_picksplit_block(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	vpt_picksplit(PGS_VPTREE_BLOCK,
+				  (spgPickSplitIn *) PG_GETARG_POINTER(0),
+				  (spgPickSplitOut *) PG_GETARG_POINTER(1));
+#endif
+
+	PG_RETURN_VOID();
+}
+
+Datum
+spgist_vptree_picksplit_euclidean(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	vpt_picksplit(PGS_VPTREE_EUCLIDEAN,
+				  (spgPickSplitIn *) PG_GETARG_POINTER(0),
+				  (spgPickSplitOut *) PG_GETARG_POINTER(1));
+#endif
+
+	PG_RETURN_VOID();
+}
+
+Datum
+spgist_vptree_picksplit_lev(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	vpt_picksplit(PGS_VPTREE_LEV,
+				  (spgPickSplitIn *) PG_GETARG_POINTER(0),
+				  (spgPickSplitOut *) PG_GETARG_POINTER(1));
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Bands that can hold a value within reach of every threshold scan key, and
+ * the smallest distance of each of them for the ORDER BY keys.
+ */
+Datum
+spgist_vptree_inner_consistent(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	spgInnerConsistentIn	*in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+	spgInnerConsistentOut	*out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+	VptPrefix	p;
+	VptQuery	*qs;
+	float8		*dk;
+	float8		*dord;
+	bool		prunable;
+	float8		inf = get_float8_infinity();
+	int			i, k;
+
+	out->nNodes = 0;
+
+	Assert(in->hasPrefix);
+	vpt_get_prefix(in->prefixDatum, &p);
+
+	/* the bands only bound the metric they were computed with */
+	prunable = (p.metric == PGS_VPTREE_LEV || p.tokenizer == vpt_tokenizer(p.metric));
+
+	qs = (VptQuery *) palloc(sizeof(VptQuery) * Max(in->nkeys, 1));
+	dk = (float8 *) palloc(sizeof(float8) * Max(in->nkeys, 1));
+	for (k = 0; k < in->nkeys; k++)
+	{
+		if (!vpt_scan_query(&in->scankeys[k], &qs[k]) || qs[k].maxdist < 0.0)
+			PG_RETURN_VOID();
+
+		/* negative: no bound */
+		dk[k] = -1.0;
+		if (prunable && !isinf(qs[k].maxdist))
+			dk[k] = vpt_distance(p.metric, p.tokenizer, p.vp, qs[k].query);
+	}
+
+	dord = (float8 *) palloc(sizeof(float8) * Max(in->norderbys, 1));
+	for (k = 0; k < in->norderbys; k++)
+	{
+		dord[k] = -1.0;
+		if (prunable)
+			dord[k] = vpt_distance(p.metric, p.tokenizer, p.vp,
+								   DatumGetTextPP(in->orderbys[k].sk_argument));
+	}
+
+	out->nodeNumbers = (int *) palloc(sizeof(int) * in->nNodes);
+	if (in->norderbys > 0)
+		out->distances = (double **) palloc(sizeof(double *) * in->nNodes);
+
+	for (i = 0; i < in->nNodes; i++)
+	{
+		float8	lo = DatumGetFloat8(in->nodeLabels[i]);
+		float8	hi = inf;
+		bool	res = true;
+
+		/* an allTheSame tuple splits nothing: each node may hold anything */
+		if (!in->allTheSame && i + 1 < in->nNodes)
+			hi = DatumGetFloat8(in->nodeLabels[i + 1]);
+
+		for (k = 0; k < in->nkeys && res; k++)
+		{
+			if (dk[k] >= 0.0 && vpt_band_bound(dk[k], lo, hi) > qs[k].maxdist + 1.0e-9)
+				res = false;
+		}
+
+		if (!res)
+			continue;
+
+		if (in->norderbys > 0)
+		{
+			double	*distances = (double *) palloc(sizeof(double) * in->norderbys);
+
+			for (k = 0; k < in->norderbys; k++)
+				distances[k] = (dord[k] >= 0.0) ? vpt_band_bound(dord[k], lo, hi) : 0.0;
+
+			out->distances[out->nNodes] = distances;
+		}
+
+		out->nodeNumbers[out->nNodes] = i;
+		out->nNodes++;
+	}
+
+	elog(DEBUG2, "%d of %d bands within reach", out->nNodes, in->nNodes);
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * The threshold operators and the distances of the value
+ */
+Datum
+spgist_vptree_leaf_consistent(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	spgLeafConsistentIn		*in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+	spgLeafConsistentOut	*out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+	int			k;
+
+	out->leafValue = in->leafDatum;
+	out->recheck = false;
+	out->recheckDistances = false;
+
+	for (k = 0; k < in->nkeys; k++)
+	{
+		ScanKey		key = &in->scankeys[k];
+		VptQuery	q;
+		PGFunction	opfn;
+
+		if (!vpt_scan_query(key, &q))
+			PG_RETURN_BOOL(false);
+
+		switch (key->sk_strategy)
+		{
+			case PGS_VPTREE_BLOCK:
+				opfn = block_op;
+				break;
+			case PGS_VPTREE_QUERY_OFFSET + PGS_VPTREE_BLOCK:
+				opfn = block_query_op;
+				break;
+			case PGS_VPTREE_LEV:
+				opfn = lev_op;
+				break;
+			case PGS_VPTREE_QUERY_OFFSET + PGS_VPTREE_LEV:
+				opfn = lev_query_op;
+				break;
+			default:
+				elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+				PG_RETURN_BOOL(false);		/* keep compiler quiet */
+		}
+
+		if (!DatumGetBool(DirectFunctionCall2(opfn, in->leafDatum, key->sk_argument)))
+			PG_RETURN_BOOL(false);
+	}
+
+	if (in->norderbys > 0)
+	{
+		out->distances = (double *) palloc(sizeof(double) * in->norderbys);
+
+		/* the distance operators use the tokenizer parameter */
+		for (k = 0; k < in->norderbys; k++)
+		{
+			int		metric = in->orderbys[k].sk_strategy - PGS_VPTREE_DIST_OFFSET;
+
+			out->distances[k] = vpt_distance(metric, vpt_tokenizer(metric),
+											 DatumGetTextPP(in->leafDatum),
+											 DatumGetTextPP(in->orderbys[k].sk_argument));
+		}
+	}
+
+	PG_RETURN_BOOL(true);
+#else
+	PG_RETURN_BOOL(false);
+#endif
+}
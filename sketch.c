@@ -0,0 +1,243 @@
+/*----------------------------------------------------------------------------
+ *
+ * sketch.c
+ *
+ * Character sketches: cheap bounds for the character-level measures
+ *
+ * A sketch is a 64-bit mask of the character classes that occur in a string
+ * plus the number of times each class occurs (saturated at 255). Letters
+ * (either case), digits and the other bytes (28 classes) are the 64 classes.
+ * Characters are folded like the measures fold them (PGS_IGNORE_CASE), so
+ * two characters a measure considers equal are always in the same class.
+ *
+ * Comparing two sketches takes a few vector instructions (the loops below run
+ * over fixed-size byte arrays and are auto-vectorized; this file is built
+ * with CFLAGS_VECTORIZE) and bounds the measures:
+ *
+ * - every character of a class that occurs more often in a than in b must be
+ *   deleted or substituted, so the edit distance is at least
+ *   max(sum(a - b), sum(b - a)) over the classes where a > b (resp. b > a);
+ * - two strings have at most sum(min(a, b)) common characters (Jaro);
+ * - only equal nucleotides score more than 0 in nwcost(), so the
+ *   Needleman-Wunsch score is at most sum(min(a, b) * nwcost(x, x)) over the
+ *   letters plus a gap for every character of difference in length.
+ *
+ * lev_op, jaro_op, jarowinkler_op and needlemanwunsch_op use them to answer
+ * without filling the dynamic programming matrix when the bound decides
+ * (pg_similarity.prefilter). pgs_sketch() returns the sketch of a string so
+ * that it can be stored next to it.
+ *
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "similarity.h"
+
+#include <ctype.h>
+
+/* GUC variables */
+bool	pgs_prefilter = true;
+
+PG_FUNCTION_INFO_V1(pgs_sketch);
+PG_FUNCTION_INFO_V1(pgs_sketch_distance);
+
+static inline int
+sketch_class(unsigned char c)
+{
+	if (c >= 'a' && c <= 'z')
+		return c - 'a';
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= '0' && c <= '9')
+		return 26 + (c - '0');
+	return 36 + (c % 28);
+}
+
+void
+pgs_sketch_build(const char *s, int len, PgsSketch *sk)
+{
+	int		i;
+
+	memset(sk, 0, sizeof(PgsSketch));
+
+	for (i = 0; i < len; i++)
+	{
+		char	c = s[i];
+		int		k;
+
+#ifdef PGS_IGNORE_CASE
+		c = tolower(c);
+#endif
+		k = sketch_class((unsigned char) c);
+
+		if (sk->count[k] < PGS_SKETCH_MAX_COUNT)
+			sk->count[k]++;
+		sk->mask |= UINT64CONST(1) << k;
+	}
+}
+
+/*
+ * Sketches of a and b if the prefilter applies to them; strings that are too
+ * long are left to the measure (it reports them).
+ */
+bool
+pgs_sketch_args(text *a, text *b, PgsSketch *sa, int *alen, PgsSketch *sb, int *blen)
+{
+	if (!pgs_prefilter)
+		return false;
+
+	*alen = VARSIZE_ANY_EXHDR(a);
+	*blen = VARSIZE_ANY_EXHDR(b);
+
+	if (*alen > PGS_MAX_STR_LEN || *blen > PGS_MAX_STR_LEN)
+		return false;
+
+	pgs_sketch_build(VARDATA_ANY(a), *alen, sa);
+	pgs_sketch_build(VARDATA_ANY(b), *blen, sb);
+
+	return true;
+}
+
+/*
+ * Lower bound of the edit distance (unit costs)
+ */
+int
+pgs_sketch_lev_bound(const PgsSketch *a, const PgsSketch *b)
+{
+	int		pos = 0;
+	int		neg = 0;
+	int		i;
+
+	/* a saturated count only makes the bound smaller */
+	for (i = 0; i < PGS_SKETCH_CLASSES; i++)
+	{
+		int		d = (int) a->count[i] - (int) b->count[i];
+
+		pos += (d > 0) ? d : 0;
+		neg += (d < 0) ? -d : 0;
+	}
+
+	return Max(pos, neg);
+}
+
+/*
+ * Upper bound of the number of common characters in class i
+ */
+static inline int
+sketch_common(const PgsSketch *a, const PgsSketch *b, int i)
+{
+	int		ca = a->count[i];
+	int		cb = b->count[i];
+
+	/* both saturated: the real counts are unknown */
+	if (ca == PGS_SKETCH_MAX_COUNT && cb == PGS_SKETCH_MAX_COUNT)
+		return PGS_MAX_STR_LEN;
+
+	return Min(ca, cb);
+}
+
+/*
+ * Upper bound of the number of common characters of two strings
+ */
+int
+pgs_sketch_common_bound(const PgsSketch *a, int alen, const PgsSketch *b, int blen)
+{
+	int		res = 0;
+	int		i;
+
+	if ((a->mask & b->mask) == 0)
+		return 0;
+
+	for (i = 0; i < PGS_SKETCH_CLASSES; i++)
+		res += sketch_common(a, b, i);
+
+	return Min(res, Min(alen, blen));
+}
+
+/*
+ * Upper bound of the Needleman-Wunsch score of two nonempty strings; gap must
+ * not be positive.
+ */
+int
+pgs_sketch_nw_bound(const PgsSketch *a, int alen, const PgsSketch *b, int blen, int gap)
+{
+	int		res = 0;
+	int		i;
+
+	/* only the letter classes can hold characters that score */
+	for (i = 0; i < 26; i++)
+	{
+		int		common = sketch_common(a, b, i);
+
+		if (common > 0)
+		{
+			int		cost = nwcost('a' + i, 'a' + i);
+
+			if (cost > 0)
+				res += common * cost;
+		}
+	}
+
+	/* there is at least one gap per character of difference */
+	return res + gap * abs(alen - blen);
+}
+
+/*
+ * Sketch as a bytea: the mask (8 bytes, most significant first) and the
+ * counts
+ */
+Datum
+pgs_sketch(PG_FUNCTION_ARGS)
+{
+	text		*t = PG_GETARG_TEXT_PP(0);
+	PgsSketch	sk;
+	bytea		*res;
+	char		*p;
+	int			i;
+
+	pgs_sketch_build(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t), &sk);
+
+	res = (bytea *) palloc(VARHDRSZ + PGS_SKETCH_LEN);
+	SET_VARSIZE(res, VARHDRSZ + PGS_SKETCH_LEN);
+	p = VARDATA(res);
+
+	for (i = 0; i < sizeof(uint64); i++)
+		*p++ = (char) (sk.mask >> (BITS_PER_BYTE * (sizeof(uint64) - 1 - i)));
+	memcpy(p, sk.count, PGS_SKETCH_CLASSES);
+
+	PG_RETURN_BYTEA_P(res);
+}
+
+static void
+sketch_from_bytea(bytea *b, PgsSketch *sk)
+{
+	const char	*p = VARDATA_ANY(b);
+	int			i;
+
+	if (VARSIZE_ANY_EXHDR(b) != PGS_SKETCH_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid sketch"),
+				 errdetail("A sketch has %d bytes.", (int) PGS_SKETCH_LEN)));
+
+	sk->mask = 0;
+	for (i = 0; i < sizeof(uint64); i++)
+		sk->mask = (sk->mask << BITS_PER_BYTE) | (unsigned char) *p++;
+	memcpy(sk->count, p, PGS_SKETCH_CLASSES);
+}
+
+/*
+ * Lower bound of the edit distance of the strings of two sketches
+ */
+Datum
+pgs_sketch_distance(PG_FUNCTION_ARGS)
+{
+	PgsSketch	a, b;
+
+	sketch_from_bytea(PG_GETARG_BYTEA_PP(0), &a);
+	sketch_from_bytea(PG_GETARG_BYTEA_PP(1), &b);
+
+	PG_RETURN_INT32(pgs_sketch_lev_bound(&a, &b));
+}
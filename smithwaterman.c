@@ -64,6 +64,11 @@
 
 #include "similarity.h"
 
+#include "funcapi.h"
+#if	PG_VERSION_NUM >= 90300
+#include "access/htup_details.h"
+#endif
+
 
 /* GUC variables */
 double	pgs_sw_threshold = 0.7f;
@@ -183,6 +188,30 @@ static double _smithwaterman(char *a, char *b)
 	return maxvalue;
 }
 
+/*
+ * normalize a Smith-Waterman score; maxvalue is the shortest string length
+ */
+static float8 _swnormalize(float8 res, double maxvalue)
+{
+	if (maxvalue == 0.0)
+		res = 1.0;
+	if (pgs_sw_is_normalized)
+	{
+		if (PGS_SW_MAX_COST > (-1 * PGS_SW_GAP_COST))
+			maxvalue *= PGS_SW_MAX_COST;
+		else
+			maxvalue *= -1 * PGS_SW_GAP_COST;
+
+		/* paranoia ? */
+		if (maxvalue == 0.0)
+			res = 1.0;
+		else
+			res = (res / maxvalue);
+	}
+
+	return res;
+}
+
 PG_FUNCTION_INFO_V1(smithwaterman);
 
 Datum
@@ -211,27 +240,68 @@ smithwaterman(PG_FUNCTION_ARGS)
 	elog(DEBUG1, "maximum length: %.3f", maxvalue);
 	elog(DEBUG1, "swdistance(%s, %s) = %.3f", a, b, res);
 
-	if (maxvalue == 0.0)
-		res = 1.0;
-	if (pgs_sw_is_normalized)
-	{
-		if (PGS_SW_MAX_COST > (-1 * PGS_SW_GAP_COST))
-			maxvalue *= PGS_SW_MAX_COST;
-		else
-			maxvalue *= -1 * PGS_SW_GAP_COST;
-
-		/* paranoia ? */
-		if (maxvalue == 0.0)
-			res = 1.0;
-		else
-			res = (res / maxvalue);
-	}
+	res = _swnormalize(res, maxvalue);
 
 	elog(DEBUG1, "sw(%s, %s) = %.3f", a, b, res);
 
 	PG_RETURN_FLOAT8(res);
 }
 
+PG_FUNCTION_INFO_V1(smithwaterman_batch);
+
+Datum
+smithwaterman_batch(PG_FUNCTION_ARGS)
+{
+	char		*a;
+	char		**b;
+	bool		*nulls;
+	int			nelems, ncand;
+	double		*score;
+	Datum		*values;
+	int			alen;
+	int			i, k;
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+
+	alen = strlen(a);
+
+	if (alen > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	b = batchcandidates(PG_GETARG_ARRAYTYPE_P(1), &nelems, &nulls, &ncand);
+
+	score = (double *) palloc((ncand + 1) * sizeof(double));
+	_smithwaterman_batch(a, b, ncand, score);
+
+	elog(DEBUG1, "is normalized: %d", pgs_sw_is_normalized);
+
+	values = (Datum *) palloc((nelems + 1) * sizeof(Datum));
+	for (i = 0, k = 0; i < nelems; i++)
+	{
+		float8	res;
+
+		if (nulls[i])
+		{
+			values[i] = (Datum) 0;
+			continue;
+		}
+
+		elog(DEBUG1, "swdistance(%s, %s) = %.3f", a, b[k], score[k]);
+
+		res = _swnormalize(score[k], (double) min2(alen, (int) strlen(b[k])));
+
+		values[i] = Float8GetDatum(res);
+		k++;
+	}
+
+	PG_RETURN_ARRAYTYPE_P(batchresult(PG_GETARG_ARRAYTYPE_P(1), values, nulls,
+									  nelems));
+}
+
 PG_FUNCTION_INFO_V1(smithwaterman_op);
 
 Datum smithwaterman_op(PG_FUNCTION_ARGS)
@@ -255,3 +325,185 @@ Datum smithwaterman_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res >= pgs_sw_threshold);
 }
+
+/*
+ * Find the boundaries of the best local alignment using two linear-space
+ * score passes (Hirschberg-style). The forward pass keeps only two rows and
+ * records where the best score ends; the reverse pass runs an anchored
+ * (no zero floor) alignment backwards from that end until it reaches the
+ * same score, which gives us where the alignment starts. Memory is O(blen)
+ * instead of the O(alen * blen) matrix that _smithwaterman() keeps.
+ *
+ * Positions are 0-based; [*astart, *aend) and [*bstart, *bend).
+ */
+static double _smithwaterman_locate(char *a, char *b, int *astart, int *aend,
+									int *bstart, int *bend)
+{
+	float		*arow, *brow, *trow;	/* above, below, and temp row */
+	int		alen, blen;
+	int		i, j;
+	int		iend = 0, jend = 0;
+	double		maxvalue;
+
+	alen = strlen(a);
+	blen = strlen(b);
+
+	elog(DEBUG2, "alen: %d; blen: %d", alen, blen);
+
+	*astart = *aend = *bstart = *bend = 0;
+
+	if (alen == 0 || blen == 0)
+		return 0.0;
+
+	arow = (float *) palloc((blen + 1) * sizeof(float));
+	brow = (float *) palloc((blen + 1) * sizeof(float));
+
+#ifdef PGS_IGNORE_CASE
+	elog(DEBUG2, "case-sensitive turns off");
+	for (i = 0; i < alen; i++)
+		a[i] = tolower(a[i]);
+	for (j = 0; j < blen; j++)
+		b[j] = tolower(b[j]);
+#endif
+
+	maxvalue = 0.0;
+
+	/* forward pass: same recurrence as _smithwaterman() */
+	for (j = 0; j <= blen; j++)
+		arow[j] = 0.0;
+
+	for (i = 1; i <= alen; i++)
+	{
+		brow[0] = 0.0;
+
+		for (j = 1; j <= blen; j++)
+		{
+			float c = (a[i - 1] == b[j - 1]) ? PGS_SW_MAX_COST : PGS_SW_MIN_COST;
+
+			brow[j] = max4(0.0,
+						   arow[j] + PGS_SW_GAP_COST,
+						   brow[j - 1] + PGS_SW_GAP_COST,
+						   arow[j - 1] + c);
+
+			if (brow[j] > maxvalue)
+			{
+				maxvalue = brow[j];
+				iend = i;
+				jend = j;
+			}
+		}
+
+		trow = arow;
+		arow = brow;
+		brow = trow;
+	}
+
+	elog(DEBUG1, "best local score %.3f ends at (%d, %d)", maxvalue, iend, jend);
+
+	/* no positive score means there is no local alignment at all */
+	if (maxvalue <= 0.0)
+	{
+		pfree(arow);
+		pfree(brow);
+		return 0.0;
+	}
+
+	/*
+	 * reverse pass: align a[iend-1..0] against b[jend-1..0] anchored at
+	 * (iend, jend). The first cell that reaches the best score is the start
+	 * of an optimal local alignment.
+	 */
+	for (j = 0; j <= jend; j++)
+		arow[j] = j * PGS_SW_GAP_COST;
+
+	for (i = 1; i <= iend; i++)
+	{
+		brow[0] = i * PGS_SW_GAP_COST;
+
+		for (j = 1; j <= jend; j++)
+		{
+			float c = (a[iend - i] == b[jend - j]) ? PGS_SW_MAX_COST : PGS_SW_MIN_COST;
+
+			brow[j] = max3(arow[j] + PGS_SW_GAP_COST,
+						   brow[j - 1] + PGS_SW_GAP_COST,
+						   arow[j - 1] + c);
+
+			if (brow[j] >= maxvalue)
+			{
+				*astart = iend - i;
+				*aend = iend;
+				*bstart = jend - j;
+				*bend = jend;
+
+				elog(DEBUG1, "best local alignment: a[%d, %d); b[%d, %d)",
+					 *astart, *aend, *bstart, *bend);
+
+				pfree(arow);
+				pfree(brow);
+
+				return maxvalue;
+			}
+		}
+
+		trow = arow;
+		arow = brow;
+		brow = trow;
+	}
+
+	/* shouldn't happen: the forward alignment is always reachable */
+	elog(ERROR, "could not locate the start of the local alignment");
+
+	return maxvalue;
+}
+
+PG_FUNCTION_INFO_V1(smithwaterman_locate);
+
+Datum
+smithwaterman_locate(PG_FUNCTION_ARGS)
+{
+	char		*a, *b;
+	int			astart, aend, bstart, bend;
+	double		score;
+	TupleDesc	tupdesc;
+	Datum		values[5];
+	bool		nulls[5];
+
+	a = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(0))));
+	b = DatumGetPointer(DirectFunctionCall1(textout,
+											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+
+	if (strlen(a) > PGS_MAX_STR_LEN || strlen(b) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	score = _smithwaterman_locate(a, b, &astart, &aend, &bstart, &bend);
+
+	memset(nulls, 0, sizeof(nulls));
+
+	/* there is no local alignment; report only the score */
+	if (score <= 0.0)
+	{
+		nulls[0] = nulls[1] = nulls[2] = nulls[3] = true;
+		values[0] = values[1] = values[2] = values[3] = (Datum) 0;
+	}
+	else
+	{
+		/* 1-based and inclusive, like substr() */
+		values[0] = Int32GetDatum(astart + 1);
+		values[1] = Int32GetDatum(aend);
+		values[2] = Int32GetDatum(bstart + 1);
+		values[3] = Int32GetDatum(bend);
+	}
+	values[4] = Float8GetDatum(score);
+
+	elog(DEBUG1, "swlocate(%s, %s) = %.3f", a, b, score);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -9,6 +9,34 @@
 
 #include "similarity.h"
 
+#include "catalog/pg_operator.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "parser/parse_func.h"
+#include "utils/lsyscache.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "access/tuptoaster.h"
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#include "access/tuptoaster.h"
+#endif
+
+#if PG_VERSION_NUM >= 120000
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#endif
+
+
+/*
+ * The code only depends on the first letters of the string, so that is all
+ * we detoast. If the code isn't complete by then, we fetch the whole string.
+ */
+#define	PGS_SOUNDEX_SLICE	32
 
 static const char *stable =
 	/*		 ABCDEFGHIJKLMNOPQRSTUVWXYZ */
@@ -27,51 +55,46 @@ static char convert_soundex(char a)
 		return a;
 }
 
-static char *_soundex(char *a)
+/*
+ * Soundex code of a[0..alen) into scode (PGS_SOUNDEX_LEN + 1 bytes). The
+ * input is not modified. It reads only until the code is complete; returns
+ * false if it reached the end of the input first (the code is then padded
+ * with zeros or, if there is no alpha character at all, scode is empty).
+ */
+static bool _soundex(const char *a, int alen, char *scode)
 {
-	int		alen;
-	int		i;
+	const char	*end = a + alen;
 	int		len;
-	char	*scode;
 	int		lastcode = PGS_SOUNDEX_INV_CODE;
 
-	alen = strlen(a);
-
 	elog(DEBUG2, "alen: %d", alen);
 
-	if (alen == 0)
-		return NULL;
-
-#ifdef PGS_IGNORE_CASE
-	elog(DEBUG2, "case-sensitive turns off");
-	for (i = 0; i < alen; i++)
-		a[i] = toupper(a[i]);
-#endif
-
-	scode = palloc(PGS_SOUNDEX_LEN + 1);
-
-	scode[PGS_SOUNDEX_LEN] = '\0';
+	scode[0] = '\0';
 
 	/* ignoring non-alpha characters */
-	while (!isalpha(*a) && *a != '\0')
+	while (a < end && !isalpha((unsigned char) *a))
 		a++;
 
-	if (*a == '\0')
-		elog(ERROR, "string doesn't contain non-alpha character(s)");
+	if (a == end)
+		return false;
 
 	/* get the first letter */
+#ifdef PGS_IGNORE_CASE
+	scode[0] = toupper((unsigned char) *a++);
+#else
 	scode[0] = *a++;
+#endif
 	len = 1;
 
 	elog(DEBUG2, "The first letter is: %c", scode[0]);
 
-	while (*a && len < PGS_SOUNDEX_LEN)
+	while (a < end && len < PGS_SOUNDEX_LEN)
 	{
 		int curcode = convert_soundex(*a);
 
 		elog(DEBUG3, "The code for '%c' is: %d", *a, curcode);
 
-		if (isalpha(*a) && (curcode != lastcode) && curcode != '0')
+		if (isalpha((unsigned char) *a) && (curcode != lastcode) && curcode != '0')
 		{
 			scode[len] = curcode;
 			elog(DEBUG2, "scode[%d] = %d", len, curcode);
@@ -81,6 +104,11 @@ static char *_soundex(char *a)
 		a++;
 	}
 
+	scode[PGS_SOUNDEX_LEN] = '\0';
+
+	if (len == PGS_SOUNDEX_LEN)
+		return true;
+
 	/* fill with zeros (if necessary) */
 	while (len < PGS_SOUNDEX_LEN)
 	{
@@ -89,43 +117,69 @@ static char *_soundex(char *a)
 		len++;
 	}
 
-	return scode;
+	return false;
 }
 
-PG_FUNCTION_INFO_V1(soundex);
-
-Datum
-soundex(PG_FUNCTION_ARGS)
+/*
+ * Soundex code of a text datum. Returns false for an empty string (that has
+ * no code).
+ */
+static bool soundex_code_datum(Datum d, char *scode)
 {
-	char	*a, *b;
-	char	*resa;
-	char	*resb;
-	float8	res;
+	int		alen;
+	text	*t;
 
-	a = DatumGetPointer(DirectFunctionCall1(textout,
-											PointerGetDatum(PG_GETARG_TEXT_P(0))));
-	b = DatumGetPointer(DirectFunctionCall1(textout,
-											PointerGetDatum(PG_GETARG_TEXT_P(1))));
+	alen = toast_raw_datum_size(d) - VARHDRSZ;
 
-	if (strlen(a) > PGS_MAX_STR_LEN || strlen(b) > PGS_MAX_STR_LEN)
+	if (alen > PGS_MAX_STR_LEN)
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("argument exceeds the maximum length of %d bytes",
 						PGS_MAX_STR_LEN)));
 
-	resa = _soundex(a);
-	resb = _soundex(b);
+	if (alen == 0)
+		return false;
+
+	t = (text *) PG_DETOAST_DATUM_SLICE(d, 0, PGS_SOUNDEX_SLICE);
+
+	if (!_soundex(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t), scode) &&
+		alen > VARSIZE_ANY_EXHDR(t))
+	{
+		elog(DEBUG2, "code is not complete after %d bytes", PGS_SOUNDEX_SLICE);
+
+		t = (text *) PG_DETOAST_DATUM_PACKED(d);
+		_soundex(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t), scode);
+	}
+
+	if (scode[0] == '\0')
+		elog(ERROR, "string doesn't contain non-alpha character(s)");
+
+	return true;
+}
+
+PG_FUNCTION_INFO_V1(soundex);
+
+Datum
+soundex(PG_FUNCTION_ARGS)
+{
+	char	resa[PGS_SOUNDEX_LEN + 1];
+	char	resb[PGS_SOUNDEX_LEN + 1];
+	bool	hasa, hasb;
+	float8	res;
+
+	hasa = soundex_code_datum(PG_GETARG_DATUM(0), resa);
+	hasb = soundex_code_datum(PG_GETARG_DATUM(1), resb);
 
-	elog(DEBUG1, "soundex(%s) = %s", a, (resa) ? resa : "NULL");
-	elog(DEBUG1, "soundex(%s) = %s", b, (resb) ? resb : "NULL");
+	elog(DEBUG1, "soundex(a) = %s", (hasa) ? resa : "NULL");
+	elog(DEBUG1, "soundex(b) = %s", (hasb) ? resb : "NULL");
 
 	/*
 	 * we don't have threshold in soundex algorithm, instead same code means strings
 	 * are similar (i.e. threshold is 1.0) or it is not (i.e. threshold is 0.0).
 	 */
-	if (resa != NULL && resb != NULL && strncmp(resa, resb, PGS_SOUNDEX_LEN) == 0)
+	if (hasa && hasb && strncmp(resa, resb, PGS_SOUNDEX_LEN) == 0)
 		res = 1.0;
-	else if (resa == NULL && resb == NULL)
+	else if (!hasa && !hasb)
 		res = 1.0;
 	else
 		res = 0.0;
@@ -146,3 +200,87 @@ Datum soundex_op(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(res == 1.0);
 }
+
+/*
+ * a ~*~ b is the same as soundex_code(a) = soundex_code(b); an empty string
+ * has an empty code.
+ */
+PG_FUNCTION_INFO_V1(soundex_code);
+
+Datum
+soundex_code(PG_FUNCTION_ARGS)
+{
+	char	res[PGS_SOUNDEX_LEN + 1];
+
+	if (!soundex_code_datum(PG_GETARG_DATUM(0), res))
+		res[0] = '\0';
+
+	PG_RETURN_TEXT_P(cstring_to_text(res));
+}
+
+/*
+ * hash support function of soundex_ops (makes ~*~ hash joinable)
+ */
+PG_FUNCTION_INFO_V1(soundex_hash);
+
+Datum
+soundex_hash(PG_FUNCTION_ARGS)
+{
+	char	res[PGS_SOUNDEX_LEN + 1];
+
+	if (!soundex_code_datum(PG_GETARG_DATUM(0), res))
+		res[0] = '\0';
+
+	return hash_any((unsigned char *) res, strlen(res));
+}
+
+/*
+ * Planner support function of soundex_op(). It replaces a ~*~ b with
+ * soundex_code(a) = soundex_code(b), so an expression index on
+ * soundex_code(col) can be used and the join is hash or merge joinable
+ * like any text equality.
+ */
+PG_FUNCTION_INFO_V1(soundex_support);
+
+Datum
+soundex_support(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	Node	*rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestSimplify))
+	{
+		SupportRequestSimplify	*req = (SupportRequestSimplify *) rawreq;
+		FuncExpr	*fexpr = req->fcall;
+		Oid			collid = fexpr->inputcollid;
+		Oid			argtypes[1] = {TEXTOID};
+		Oid			codefn;
+		List		*name;
+		Expr		*a, *b;
+		OpExpr		*eq;
+
+		if (list_length(fexpr->args) != 2)
+			PG_RETURN_POINTER(NULL);
+
+		/* soundex_code() lives in the same schema as soundex_op() */
+		name = list_make2(makeString(get_namespace_name(get_func_namespace(fexpr->funcid))),
+						  makeString("soundex_code"));
+		codefn = LookupFuncName(name, 1, argtypes, true);
+		if (!OidIsValid(codefn))
+			PG_RETURN_POINTER(NULL);
+
+		a = (Expr *) makeFuncExpr(codefn, TEXTOID, list_make1(linitial(fexpr->args)),
+								  collid, collid, COERCE_EXPLICIT_CALL);
+		b = (Expr *) makeFuncExpr(codefn, TEXTOID, list_make1(lsecond(fexpr->args)),
+								  collid, collid, COERCE_EXPLICIT_CALL);
+
+		eq = (OpExpr *) make_opclause(TextEqualOperator, BOOLOID, false,
+									  a, b, InvalidOid, collid);
+		set_opfuncid(eq);
+
+		PG_RETURN_POINTER(eq);
+	}
+#endif
+
+	PG_RETURN_POINTER(NULL);
+}
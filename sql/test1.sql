@@ -25,3 +25,22 @@ select qgram(:a, :b), qgram_op(:a, :b), :a ~~~ :b as operator;
 --select smithwaterman(:a, :b), smithwaterman_op(:a, :b), :a ~=~ :b as operator;
 --select smithwatermangotoh(:a, :b), smithwatermangotoh_op(:a, :b), :a ~!~ :b as operator;
 select soundex(:a, :b), soundex_op(:a, :b), :a ~*~ :b as operator;
+select * from smithwaterman_locate(:a, :b);
+select * from needlemanwunsch_align('GACTAG', 'ACCTGAA');
+select lev_batch(:a, ARRAY[:b, NULL, 'Euler', '', :c]);
+select hamming_distance(B'101100', B'100110'), B'101100' <~@~> B'100110' as distance, B'101100' ~@~ B'101110' as operator;
+select hamming(h, g), h <~@~> g as distance, h ~@~ g as operator from (values ('00000000000000ff'::hash64, '000000000000000f'::hash64)) as t(h, g);
+select hash64_chunk('00000000ffffffff', 2, 0), hash64_mih_keys('0', 8, 8, 0), B'1000000000000000000000000000000000000000000000000000000000000001'::hash64;
+select minhash_jaccard(minhash(:a), minhash(:a)), minhash_jaccard(minhash(:a, 4), minhash('', 4)), length(minhash(:a, 4)::text), minhash_band(minhash(:a, 100), 20, 3) = (minhash_bands(minhash(:a, 100), 20))[4] as band, '0000000a0000000B'::minhash;
+select simhash(:a) = simhash(:a, 64)::hash64 as same, simhash(''), length(simhash(:a, 128)), simhash_cosine(simhash(:a), simhash(:a)), simhash_cosine(simhash(:a, 128), simhash(:a, 128));
+select length(pgs_sketch(:a)), pgs_sketch_distance(pgs_sketch(:a), pgs_sketch(:b)), pgs_sketch_distance(pgs_sketch('abc'), pgs_sketch('CBA')), lev_distance(:a, :b), jaro_op('abc', 'xyz') as jaro, lev_op('abc', 'ABC') as lev;
+select soundex_code(:a), soundex_code(''), soundex_code('aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab');
+select winnow(:a), winnow(''), fingerprint_containment(winnow(:a), winnow(repeat(:a, 3))), fingerprint_jaccard(winnow(:a), winnow(:a)), fingerprint_jaccard('{1,2,2,3}', '{3,4,5}');
+select jaccard(pgs_tokens(:a, 'alnum'), pgs_tokens(:b, 'alnum')), block(pgs_tokens(:a, 'alnum'), pgs_tokens(:b, 'alnum')), qgram(pgs_tokens(:a, 'gram'), pgs_tokens(:b, 'gram')), pgs_tokens(:a, 'gram') ~~~ pgs_tokens(:b, 'gram') as operator, pgs_tokens('', 'word'), '(gram,3,f){00000002:1,00000001:2,00000001:1}'::pgs_tokens;
+select pgs_tokenize(:a, 'alnum'), pgs_tokenize('abcd', 'gram', 2), jaccard(pgs_tokenize(:a, 'alnum'), pgs_tokenize(:b, 'alnum')), block(pgs_tokenize(:a, 'alnum'), pgs_tokenize(:b, 'alnum')), matchingcoefficient('{a,b,a}'::text[], '{a,c}');
+select tfvector_cosine(tfvector(:a, 'alnum'), tfvector(:b, 'alnum')), jensenshannon(tfvector(:a, 'alnum'), tfvector(:a, 'alnum')), hellinger(tfvector(:a, 'alnum'), tfvector(:a, 'alnum')), '(word,3,f){00000002:1,00000001:2,00000001:1,00000003:0}'::tfvector;
+select tfvector_dot(u, v), tfvector_l1(u, v), round(tfvector_l2(u, v)::numeric, 6) as l2, round(jensenshannon(u, v)::numeric, 6) as js, round(hellinger(u, v)::numeric, 6) as hellinger from (values ('(word,3,f){1:3,2:1}'::tfvector, '(word,3,f){1:1,3:1}'::tfvector)) as t(u, v);
+select proname, procost from pg_proc where proname in ('soundex', 'jaccard', 'lev', 'needlemanwunsch', 'smithwatermangotoh') and pg_get_function_identity_arguments(oid) = 'text, text' order by procost, proname;
+select pg_get_function_identity_arguments(oid) as args, procost from pg_proc where proname = 'jaccard' order by procost, args COLLATE "C";
+select proname, pg_get_function_identity_arguments(oid) as args, procost from pg_proc where proname in ('winnow', 'fingerprint_jaccard', 'fingerprint_containment') order by procost, proname COLLATE "C", args COLLATE "C";
+select proname, procost from pg_proc where proname in ('hamming', 'hamming_op', 'hamming_distance') and pg_get_function_identity_arguments(oid) = 'bit varying, bit varying' order by proname COLLATE "C";
@@ -29,5 +29,152 @@ SET enable_bitmapscan TO OFF;
 SELECT a, block(a, :a) FROM simtst WHERE a ~++ :a;
 SET enable_bitmapscan TO ON;
 SELECT a, cosine(a, :a) FROM simtst WHERE a ~## :a;
+SELECT a, lev(a, :a) FROM simtst WHERE a ~== :a;
+
+DROP INDEX simtsti;
+CREATE INDEX simtstqi ON simtst USING gin (a gin_similarity_ops (tokenizer = gram));
+
+SET enable_seqscan TO OFF;
+SELECT a, lev(a, :a) FROM simtst WHERE a ~== :a ORDER BY 2 DESC, a COLLATE "C";
+RESET enable_seqscan;
+
+DROP INDEX simtstqi;
+CREATE INDEX simtstqi ON simtst USING gin (a gin_similarity_ops (tokenizer = gram, casefold = true));
+
+SET enable_seqscan TO OFF;
+SELECT a, lev(a, :a) FROM simtst WHERE a ~== :a ORDER BY 2 DESC, a COLLATE "C";
+RESET enable_seqscan;
+
+DROP INDEX simtstqi;
+CREATE INDEX simtsthi ON simtst USING gin (a gin_similarity_hash_ops);
+
+SELECT a, block(a, :a) FROM simtst WHERE a ~++ :a;
+SELECT a, cosine(a, :a) FROM simtst WHERE a ~## :a;
+
+DROP INDEX simtsthi;
+CREATE INDEX simtstgi ON simtst USING gist (a gist_similarity_ops);
+
+SELECT a, jaccard(a, :a) FROM simtst WHERE a ~?? :a;
+SELECT a, round(jaccard_distance(a, :a)::numeric, 3) AS dist FROM simtst ORDER BY a <??> :a LIMIT 2;
+
+ANALYZE simtst;
+SELECT count(*) FROM simtst x JOIN simtst y ON x.a ~?? y.a WHERE x.a ~## :a;
+-- the estimates are not contjoinsel's and contsel's defaults (0.001)
+CREATE FUNCTION simtst_rows(q text) RETURNS float8 AS $$ DECLARE p json; BEGIN EXECUTE 'EXPLAIN (COSTS ON, FORMAT JSON) ' || q INTO p; RETURN p->0->'Plan'->>'Plan Rows'; END $$ LANGUAGE plpgsql;
+SELECT simtst_rows('SELECT * FROM simtst x JOIN simtst y ON x.a ~?? y.a') > 0.001 * reltuples * reltuples AS joinsel FROM pg_class WHERE relname = 'simtst';
+SELECT simtst_rows('SELECT * FROM simtst WHERE a ~?? ''qqqq zzzz''') < 0.001 * reltuples AS restrictsel FROM pg_class WHERE relname = 'simtst';
+DROP FUNCTION simtst_rows(text);
+
+SET enable_seqscan TO OFF;
+SELECT a, round(jaccard(a, :a)::numeric, 3) AS jaccard FROM simtst WHERE jaccard(a, :a) >= 0.5 ORDER BY 2 DESC, 1;
+SELECT a FROM simtst WHERE 0.5 < jaccard(:a, a) ORDER BY a;
+SELECT a FROM simtst WHERE a ~?? ROW(:a, 0.5)::pgs_query ORDER BY a;
+RESET enable_seqscan;
+
+-- NaN >= c is true: measures that can be NaN (no tokens) keep the sequential scan
+CREATE TABLE simtstnan (a text);
+INSERT INTO simtstnan VALUES ('Euler Taveira'), ('!!!');
+CREATE INDEX simtstnani ON simtstnan USING gin (a gin_similarity_ops);
+SELECT a FROM simtstnan WHERE cosine(a, 'Euler Taveira') >= 0.5 ORDER BY a COLLATE "C";
+SELECT a FROM simtstnan WHERE jaccard(a, '!!!') >= 0.5 ORDER BY a COLLATE "C";
+SELECT a FROM simtstnan WHERE jaccard(a, 'Euler') >= 0.5 ORDER BY a COLLATE "C";
+SET enable_seqscan TO OFF;
+SELECT a FROM simtstnan WHERE cosine(a, 'Euler Taveira') >= 0.5 ORDER BY a COLLATE "C";
+SELECT a FROM simtstnan WHERE jaccard(a, '!!!') >= 0.5 ORDER BY a COLLATE "C";
+SELECT a FROM simtstnan WHERE jaccard(a, 'Euler') >= 0.5 ORDER BY a COLLATE "C";
+RESET enable_seqscan;
+DROP TABLE simtstnan;
+
+CREATE INDEX simtstsi ON simtst USING spgist (a spgist_similarity_ops);
+
+SET enable_seqscan TO OFF;
+SELECT a, lev(a, :a) FROM simtst WHERE a ~== :a ORDER BY 2 DESC, a COLLATE "C";
+SELECT a FROM simtst WHERE lev(a, :a) >= 0.5 ORDER BY a COLLATE "C";
+SELECT a FROM simtst WHERE a ~== ROW(:a, 0.8)::pgs_query ORDER BY a COLLATE "C";
+RESET enable_seqscan;
+
+DROP INDEX simtstsi;
+CREATE INDEX simtstvi ON simtst USING spgist (a vptree_lev_ops);
+CREATE INDEX simtstvbi ON simtst USING spgist (a vptree_block_ops);
+
+SET enable_seqscan TO OFF;
+SELECT a, lev(a, :a) FROM simtst WHERE a ~== :a ORDER BY 2 DESC, a COLLATE "C";
+SELECT * FROM (SELECT a, a <==> :a AS dist FROM simtst ORDER BY a <==> :a LIMIT 4) s ORDER BY dist, a COLLATE "C";
+SELECT a, block(a, :a) FROM simtst WHERE a ~++ :a ORDER BY a COLLATE "C";
+SELECT * FROM (SELECT a, a <++> :a AS dist FROM simtst ORDER BY a <++> :a LIMIT 5) s ORDER BY dist, a COLLATE "C";
+RESET enable_seqscan;
+
+CREATE TABLE simtsth AS SELECT a FROM simtst LIMIT 10;
+CREATE INDEX simtsthnsw ON simtsth USING pgs_hnsw (a hnsw_jaccard_ops);
+SELECT opcname, amvalidate(oid) FROM pg_opclass WHERE opcmethod = (SELECT oid FROM pg_am WHERE amname = 'pgs_hnsw') ORDER BY opcname COLLATE "C";
+-- a jaccard_distance of another schema is not the measure
+CREATE SCHEMA simtstnsp;
+CREATE FUNCTION simtstnsp.jaccard_distance(text, text) RETURNS float8 AS 'SELECT 0::float8' LANGUAGE sql IMMUTABLE;
+CREATE OPERATOR CLASS simtstnsp.hnsw_other_ops FOR TYPE text USING pgs_hnsw AS OPERATOR 1 <??> FOR ORDER BY pg_catalog.float_ops, FUNCTION 1 simtstnsp.jaccard_distance(text, text), FUNCTION 2 hnsw_similarity_options(internal);
+SELECT amvalidate(oid) FROM pg_opclass WHERE opcname = 'hnsw_other_ops';
+DROP OPERATOR FAMILY simtstnsp.hnsw_other_ops USING pgs_hnsw;
+DROP FUNCTION simtstnsp.jaccard_distance(text, text);
+DROP SCHEMA simtstnsp;
+
+SET enable_seqscan TO OFF;
+SELECT * FROM (SELECT a, round((a <??> :a)::numeric, 3) AS dist FROM simtsth ORDER BY a <??> :a LIMIT 5) s ORDER BY dist, a COLLATE "C";
+RESET enable_seqscan;
+
+DROP TABLE simtsth;
+
+DROP INDEX simtstgi;
+CREATE INDEX simtstmi ON simtst USING gin (a gin_minhash_ops);
+
+SET enable_seqscan TO OFF;
+SELECT a, jaccard(a, :a) FROM simtst WHERE a ~?~ :a ORDER BY a;
+-- exact: gin_minhash_ops doesn't answer ~??
+SELECT a, jaccard(a, :a) FROM simtst WHERE a ~?? :a ORDER BY a;
+RESET enable_seqscan;
+
+CREATE TABLE simtstt (a text, t pgs_tokens GENERATED ALWAYS AS (pgs_tokens(a, 'alnum')) STORED);
+INSERT INTO simtstt (a) SELECT a FROM simtst;
+CREATE INDEX simtstti ON simtstt USING gin (t);
+
+SET enable_seqscan TO OFF;
+SELECT a, cosine(t, pgs_tokens(:a, 'alnum')) FROM simtstt WHERE t ~## pgs_tokens(:a, 'alnum') ORDER BY 2 DESC, a COLLATE "C";
+SELECT a, block(t, pgs_tokens(:a, 'alnum')) FROM simtstt WHERE t ~++ pgs_tokens(:a, 'alnum') ORDER BY 2 DESC, a COLLATE "C";
+RESET enable_seqscan;
+
+DROP TABLE simtstt;
 
 DROP TABLE simtst;
+
+CREATE TABLE simtstdoc (id int, body text);
+ALTER TABLE simtstdoc ALTER COLUMN body SET STORAGE EXTERNAL;
+INSERT INTO simtstdoc SELECT i, repeat(md5(i::text), 20000) FROM generate_series(1, 3) i;
+INSERT INTO simtstdoc VALUES (4, :a);
+CREATE INDEX simtstdocwi ON simtstdoc USING gin (winnow(body));
+
+SET enable_seqscan TO OFF;
+SELECT id, fingerprint_jaccard(winnow(body), winnow(repeat(md5('2'), 20000))) FROM simtstdoc WHERE winnow(body) && winnow(md5('2') || md5('2')) ORDER BY id;
+RESET enable_seqscan;
+
+DROP TABLE simtstdoc;
+
+CREATE TABLE simtstbits (b varbit);
+INSERT INTO simtstbits VALUES (B'101100'), (B'101110'), (B'001100'), (B'10110011'), (B'1011');
+CREATE INDEX simtstbitsi ON simtstbits USING gist (b gist_hamming_ops);
+
+SET enable_seqscan TO OFF;
+SELECT b FROM simtstbits WHERE b ~@~ B'101100' ORDER BY b;
+SELECT * FROM (SELECT b FROM simtstbits ORDER BY b <~@~> B'101100' LIMIT 3) s ORDER BY b;
+RESET enable_seqscan;
+
+-- the estimators skip statistics values of another length than the query
+DROP INDEX simtstbitsi;
+ANALYZE simtstbits;
+EXPLAIN (COSTS OFF) SELECT b FROM simtstbits WHERE b ~@~ '101100'::varbit;
+
+CREATE TABLE simtsttxt (a text);
+INSERT INTO simtsttxt VALUES ('abcdef'), ('abcdeg'), ('abcdefg'), ('x');
+ANALYZE simtsttxt;
+EXPLAIN (COSTS OFF) SELECT a FROM simtsttxt WHERE length(a) = 6 AND a ~@~ 'abcdef';
+SELECT a FROM simtsttxt WHERE length(a) = 6 AND a ~@~ 'abcdef' ORDER BY a;
+DROP TABLE simtsttxt;
+
+DROP TABLE simtstbits;
@@ -0,0 +1,650 @@
+/*----------------------------------------------------------------------------
+ *
+ * tfvector.c
+ *
+ * tfvector is a sparse term-frequency vector: the 32-bit hashes of the tokens
+ * of a string (as in pgs_tokens) with a weight each, sorted by hash. The
+ * hashes and the weights are stored in two arrays.
+ *
+ * Unlike cosine(), which compares token sets, the functions below use the
+ * weights:
+ *
+ * - tfvector_dot: sum(a * b)
+ * - tfvector_cosine: dot / (|a| * |b|)
+ * - tfvector_l1: sum(|a - b|)
+ * - tfvector_l2: sqrt(sum((a - b)^2))
+ * - jensenshannon: Jensen-Shannon divergence (base 2, 0 .. 1) of the
+ *   distributions a / sum(a) and b / sum(b)
+ * - hellinger: Hellinger distance (0 .. 1) of the same distributions,
+ *   sqrt(1 - sum(sqrt(p * q)))
+ *
+ * Only the tokens in both vectors need a pairwise computation; the rest is
+ * known from the sums of each vector. The merge of the hashes has no
+ * branches and collects the weights of the common tokens into two arrays,
+ * then every measure is a reduction over contiguous arrays.
+ * The reductions keep TFVECTOR_LANES partial sums so that the compiler can
+ * vectorize them without reassociating floating point additions (this
+ * file is built with CFLAGS_VECTORIZE).
+ *
+ * Weights are not negative. The text representation is that of pgs_tokens
+ * with hash:weight pairs:
+ *
+ *     (alnum,3,f){01a2b3c4:1,8e2f0d11:2.5}
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+
+/* partial sums of the reductions */
+#define	TFVECTOR_LANES		8
+
+typedef struct TfVectorEntry
+{
+	uint32	key;
+	float4	weight;
+} TfVectorEntry;
+
+PG_FUNCTION_INFO_V1(tfvector_in);
+PG_FUNCTION_INFO_V1(tfvector_out);
+PG_FUNCTION_INFO_V1(tfvector_recv);
+PG_FUNCTION_INFO_V1(tfvector_send);
+PG_FUNCTION_INFO_V1(tfvector);
+PG_FUNCTION_INFO_V1(tfvector_gram);
+PG_FUNCTION_INFO_V1(tfvector_tokens);
+PG_FUNCTION_INFO_V1(tfvector_dot);
+PG_FUNCTION_INFO_V1(tfvector_cosine);
+PG_FUNCTION_INFO_V1(tfvector_l1);
+PG_FUNCTION_INFO_V1(tfvector_l2);
+PG_FUNCTION_INFO_V1(jensenshannon);
+PG_FUNCTION_INFO_V1(hellinger);
+
+static TfVector *
+tfvector_alloc(int n, const PgsTokenOptions *opts)
+{
+	TfVector	*res;
+	int			len = TFVECTOR_SIZE(n);
+
+	res = (TfVector *) palloc0(len);
+	SET_VARSIZE(res, len);
+	res->tokenizer = opts->tokenizer;
+	res->gramlen = opts->gramlen;
+	res->casefold = opts->casefold;
+
+	return res;
+}
+
+static int
+tfvector_entry_cmp(const void *a, const void *b)
+{
+	uint32	x = ((const TfVectorEntry *) a)->key;
+	uint32	y = ((const TfVectorEntry *) b)->key;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/*
+ * Vector of n (unsorted) entries: the weights of equal keys are added up and
+ * keys of weight 0 are left out
+ */
+static TfVector *
+tfvector_from_entries(TfVectorEntry *e, int n, const PgsTokenOptions *opts)
+{
+	TfVector	*res;
+	float4		*weights;
+	int			i, j;
+
+	if (n > 0)
+		qsort(e, n, sizeof(TfVectorEntry), tfvector_entry_cmp);
+
+	for (i = 0, j = 0; i < n; i++)
+	{
+		if (j > 0 && e[i].key == e[j - 1].key)
+		{
+			e[j - 1].weight += e[i].weight;
+			if (isinf(e[j - 1].weight))
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("tfvector weight out of range")));
+		}
+		else
+			e[j++] = e[i];
+	}
+	n = j;
+
+	for (i = 0, j = 0; i < n; i++)
+	{
+		if (e[i].weight > 0)
+			e[j++] = e[i];
+	}
+	n = j;
+
+	res = tfvector_alloc(n, opts);
+	weights = TFVECTOR_WEIGHTS(res);
+
+	for (i = 0; i < n; i++)
+	{
+		TFVECTOR_KEYS(res)[i] = e[i].key;
+		weights[i] = e[i].weight;
+	}
+
+	return res;
+}
+
+/*
+ * Term frequencies of a pgs_tokens value
+ */
+static TfVector *
+tfvector_from_tokens(const PgsTokens *t)
+{
+	PgsTokenOptions	opts;
+	TfVector		*res;
+	float4			*weights;
+	int				n = PGS_TOKENS_COUNT(t);
+	int				i;
+
+	opts.tokenizer = t->tokenizer;
+	opts.gramlen = t->gramlen;
+	opts.casefold = t->casefold;
+
+	/* the tokens are sorted and distinct already */
+	res = tfvector_alloc(n, &opts);
+	weights = TFVECTOR_WEIGHTS(res);
+
+	for (i = 0; i < n; i++)
+	{
+		TFVECTOR_KEYS(res)[i] = t->e[i].hash;
+		weights[i] = (float4) t->e[i].freq;
+	}
+
+	return res;
+}
+
+/*
+ * tfvector(text, tokenizer); q is PGS_GRAM_LEN, as for the measures
+ */
+Datum
+tfvector(PG_FUNCTION_ARGS)
+{
+	text		*t = PG_GETARG_TEXT_PP(0);
+	char		*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	PgsTokens	*tokens = pgs_tokens_make(t, pgs_tokens_tokenizer(name), PGS_GRAM_LEN);
+
+	PG_RETURN_TFVECTOR_P(tfvector_from_tokens(tokens));
+}
+
+/*
+ * tfvector(text, tokenizer, q)
+ */
+Datum
+tfvector_gram(PG_FUNCTION_ARGS)
+{
+	text		*t = PG_GETARG_TEXT_PP(0);
+	char		*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	PgsTokens	*tokens = pgs_tokens_make(t, pgs_tokens_tokenizer(name), PG_GETARG_INT32(2));
+
+	PG_RETURN_TFVECTOR_P(tfvector_from_tokens(tokens));
+}
+
+/*
+ * tfvector(pgs_tokens)
+ */
+Datum
+tfvector_tokens(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_TFVECTOR_P(tfvector_from_tokens(PG_GETARG_PGS_TOKENS_P(0)));
+}
+
+Datum
+tfvector_in(PG_FUNCTION_ARGS)
+{
+	char			*str = PG_GETARG_CSTRING(0);
+	char			*p;
+	PgsTokenOptions	opts;
+	TfVectorEntry	*e;
+	int				maxn = 8;
+	int				n = 0;
+
+	p = pgs_tokens_read_header("tfvector", str, &opts);
+
+	e = (TfVectorEntry *) palloc(maxn * sizeof(TfVectorEntry));
+
+	/* entries: hash:weight, ... */
+	while (*p != '}')
+	{
+		unsigned long	key;
+		double			weight;
+		char			*end;
+
+		if (n > 0 && *p++ != ',')
+			pgs_tokens_syntax_error("tfvector", str);
+
+		key = strtoul(p, &end, 16);
+		if (end == p || end - p > 2 * sizeof(uint32) || *end != ':')
+			pgs_tokens_syntax_error("tfvector", str);
+		p = end + 1;
+
+		weight = strtod(p, &end);
+		if (end == p)
+			pgs_tokens_syntax_error("tfvector", str);
+		if (!(weight >= 0.0 && weight <= FLT_MAX))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("tfvector weights must be finite and not negative")));
+		p = end;
+
+		if (n == maxn)
+		{
+			maxn *= 2;
+			e = (TfVectorEntry *) repalloc(e, maxn * sizeof(TfVectorEntry));
+		}
+		e[n].key = (uint32) key;
+		e[n].weight = (float4) weight;
+		n++;
+	}
+	p++;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	if (*p != '\0')
+		pgs_tokens_syntax_error("tfvector", str);
+
+	PG_RETURN_TFVECTOR_P(tfvector_from_entries(e, n, &opts));
+}
+
+Datum
+tfvector_out(PG_FUNCTION_ARGS)
+{
+	TfVector		*v = PG_GETARG_TFVECTOR_P(0);
+	int				n = TFVECTOR_COUNT(v);
+	float4			*weights = TFVECTOR_WEIGHTS(v);
+	StringInfoData	buf;
+	PgsTokenOptions	opts;
+	int				i;
+
+	opts.tokenizer = v->tokenizer;
+	opts.gramlen = v->gramlen;
+	opts.casefold = v->casefold;
+
+	initStringInfo(&buf);
+	pgs_tokens_write_header(&buf, &opts);
+
+	for (i = 0; i < n; i++)
+		appendStringInfo(&buf, "%s%08x:%.*g", (i > 0) ? "," : "", TFVECTOR_KEYS(v)[i],
+						 FLT_DIG, (double) weights[i]);
+
+	appendStringInfoChar(&buf, '}');
+
+	PG_RETURN_CSTRING(buf.data);
+}
+
+Datum
+tfvector_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo		buf = (StringInfo) PG_GETARG_POINTER(0);
+	PgsTokenOptions	opts;
+	TfVector		*res;
+	float4			*weights;
+	int				n;
+	int				i;
+
+	opts.tokenizer = pq_getmsgbyte(buf);
+	opts.gramlen = pq_getmsgbyte(buf);
+	opts.casefold = (pq_getmsgbyte(buf) != 0);
+	n = pq_getmsgint(buf, sizeof(int32));
+
+	pgs_tokens_check_header(opts.tokenizer, opts.gramlen);
+
+	if (n < 0 || n > (buf->len - buf->cursor) / (sizeof(uint32) + sizeof(float4)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid number of tokens in external tfvector value")));
+
+	res = tfvector_alloc(n, &opts);
+	weights = TFVECTOR_WEIGHTS(res);
+
+	for (i = 0; i < n; i++)
+	{
+		TFVECTOR_KEYS(res)[i] = (uint32) pq_getmsgint(buf, sizeof(uint32));
+		weights[i] = pq_getmsgfloat4(buf);
+
+		if (!(weights[i] > 0 && weights[i] <= FLT_MAX) ||
+			(i > 0 && TFVECTOR_KEYS(res)[i] <= TFVECTOR_KEYS(res)[i - 1]))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid token in external tfvector value")));
+	}
+
+	PG_RETURN_TFVECTOR_P(res);
+}
+
+Datum
+tfvector_send(PG_FUNCTION_ARGS)
+{
+	TfVector		*v = PG_GETARG_TFVECTOR_P(0);
+	int				n = TFVECTOR_COUNT(v);
+	float4			*weights = TFVECTOR_WEIGHTS(v);
+	StringInfoData	buf;
+	int				i;
+
+	pq_begintypsend(&buf);
+	pq_sendbyte(&buf, v->tokenizer);
+	pq_sendbyte(&buf, v->gramlen);
+	pq_sendbyte(&buf, v->casefold ? 1 : 0);
+	pq_sendint32(&buf, n);
+	for (i = 0; i < n; i++)
+	{
+		pq_sendint32(&buf, TFVECTOR_KEYS(v)[i]);
+		pq_sendfloat4(&buf, weights[i]);
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Weights of the tokens in both a and b: ca[i] and cb[i] are the weights of
+ * the i-th common token. Returns their number.
+ */
+static int
+tfvector_common(const TfVector *a, const TfVector *b, float8 **ca, float8 **cb)
+{
+	int				na = TFVECTOR_COUNT(a);
+	int				nb = TFVECTOR_COUNT(b);
+	const uint32	*ka = TFVECTOR_KEYS(a);
+	const uint32	*kb = TFVECTOR_KEYS(b);
+	const float4	*wa = TFVECTOR_WEIGHTS(a);
+	const float4	*wb = TFVECTOR_WEIGHTS(b);
+	int				i = 0,
+					j = 0,
+					m = 0;
+
+	if (a->tokenizer != b->tokenizer || a->casefold != b->casefold ||
+		(a->tokenizer == PGS_UNIT_GRAM && a->gramlen != b->gramlen))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("tfvector values were not tokenized the same way")));
+
+	/* one more: the loop stores before it knows whether keys are equal */
+	*ca = (float8 *) palloc((Min(na, nb) + 1) * sizeof(float8));
+	*cb = (float8 *) palloc((Min(na, nb) + 1) * sizeof(float8));
+
+	while (i < na && j < nb)
+	{
+		uint32	x = ka[i];
+		uint32	y = kb[j];
+
+		(*ca)[m] = wa[i];
+		(*cb)[m] = wb[j];
+		m += (x == y);
+		i += (x <= y);
+		j += (y <= x);
+	}
+
+	return m;
+}
+
+/*
+ * The reductions. Each lane l sums elements l, l + TFVECTOR_LANES, ...
+ */
+static float8
+tfvector_sum(const float4 *w, int n)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+		for (l = 0; l < TFVECTOR_LANES; l++)
+			acc[l] += w[i + l];
+	for (; i < n; i++)
+		res += w[i];
+	for (l = 0; l < TFVECTOR_LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+static float8
+tfvector_sumsq(const float4 *w, int n)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+		for (l = 0; l < TFVECTOR_LANES; l++)
+			acc[l] += (float8) w[i + l] * w[i + l];
+	for (; i < n; i++)
+		res += (float8) w[i] * w[i];
+	for (l = 0; l < TFVECTOR_LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+static float8
+tfvector_dot_kernel(const float8 *a, const float8 *b, int n)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+		for (l = 0; l < TFVECTOR_LANES; l++)
+			acc[l] += a[i + l] * b[i + l];
+	for (; i < n; i++)
+		res += a[i] * b[i];
+	for (l = 0; l < TFVECTOR_LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+static float8
+tfvector_min_kernel(const float8 *a, const float8 *b, int n)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+		for (l = 0; l < TFVECTOR_LANES; l++)
+			acc[l] += Min(a[i + l], b[i + l]);
+	for (; i < n; i++)
+		res += Min(a[i], b[i]);
+	for (l = 0; l < TFVECTOR_LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+static float8
+tfvector_sqrt_kernel(const float8 *a, const float8 *b, int n)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+		for (l = 0; l < TFVECTOR_LANES; l++)
+			acc[l] += sqrt(a[i + l] * b[i + l]);
+	for (; i < n; i++)
+		res += sqrt(a[i] * b[i]);
+	for (l = 0; l < TFVECTOR_LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+/*
+ * sum(p * log2(2p / (p + q)) + q * log2(2q / (p + q))) of the common tokens,
+ * p = a / sa and q = b / sb; also the sums of p and q
+ */
+static float8
+tfvector_js_kernel(const float8 *a, float8 sa, const float8 *b, float8 sb, int n,
+				   float8 *sump, float8 *sumq)
+{
+	float8	acc[TFVECTOR_LANES] = {0};
+	float8	accp[TFVECTOR_LANES] = {0};
+	float8	accq[TFVECTOR_LANES] = {0};
+	float8	res = 0.0;
+	int		i, l;
+
+	*sump = 0.0;
+	*sumq = 0.0;
+
+	for (i = 0; i + TFVECTOR_LANES <= n; i += TFVECTOR_LANES)
+	{
+		for (l = 0; l < TFVECTOR_LANES; l++)
+		{
+			float8	p = a[i + l] / sa;
+			float8	q = b[i + l] / sb;
+
+			acc[l] += p * log2(2.0 * p / (p + q)) + q * log2(2.0 * q / (p + q));
+			accp[l] += p;
+			accq[l] += q;
+		}
+	}
+	for (; i < n; i++)
+	{
+		float8	p = a[i] / sa;
+		float8	q = b[i] / sb;
+
+		res += p * log2(2.0 * p / (p + q)) + q * log2(2.0 * q / (p + q));
+		*sump += p;
+		*sumq += q;
+	}
+	for (l = 0; l < TFVECTOR_LANES; l++)
+	{
+		res += acc[l];
+		*sump += accp[l];
+		*sumq += accq[l];
+	}
+
+	return res;
+}
+
+Datum
+tfvector_dot(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+
+	PG_RETURN_FLOAT8(tfvector_dot_kernel(ca, cb, m));
+}
+
+/*
+ * Cosine of the weights; 0 if a vector has no tokens
+ */
+Datum
+tfvector_cosine(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+	float8		sqa = tfvector_sumsq(TFVECTOR_WEIGHTS(a), TFVECTOR_COUNT(a));
+	float8		sqb = tfvector_sumsq(TFVECTOR_WEIGHTS(b), TFVECTOR_COUNT(b));
+
+	if (sqa == 0.0 || sqb == 0.0)
+		PG_RETURN_FLOAT8(0.0);
+
+	PG_RETURN_FLOAT8(tfvector_dot_kernel(ca, cb, m) / (sqrt(sqa) * sqrt(sqb)));
+}
+
+/*
+ * sum(|a - b|) = sum(a) + sum(b) - 2 * sum(min(a, b))
+ */
+Datum
+tfvector_l1(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+	float8		sa = tfvector_sum(TFVECTOR_WEIGHTS(a), TFVECTOR_COUNT(a));
+	float8		sb = tfvector_sum(TFVECTOR_WEIGHTS(b), TFVECTOR_COUNT(b));
+
+	PG_RETURN_FLOAT8(Max(sa + sb - 2.0 * tfvector_min_kernel(ca, cb, m), 0.0));
+}
+
+/*
+ * sqrt(sum((a - b)^2)) = sqrt(sum(a^2) + sum(b^2) - 2 * dot)
+ */
+Datum
+tfvector_l2(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+	float8		sqa = tfvector_sumsq(TFVECTOR_WEIGHTS(a), TFVECTOR_COUNT(a));
+	float8		sqb = tfvector_sumsq(TFVECTOR_WEIGHTS(b), TFVECTOR_COUNT(b));
+
+	/* rounding errors can make the difference of equal vectors negative */
+	PG_RETURN_FLOAT8(sqrt(Max(sqa + sqb - 2.0 * tfvector_dot_kernel(ca, cb, m), 0.0)));
+}
+
+/*
+ * Jensen-Shannon divergence (base 2). A token only in a adds p / 2 (its
+ * share of M is p / 2); likewise for b. 0 for two empty vectors and 1 if
+ * only one of them is empty.
+ */
+Datum
+jensenshannon(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+	float8		sa = tfvector_sum(TFVECTOR_WEIGHTS(a), TFVECTOR_COUNT(a));
+	float8		sb = tfvector_sum(TFVECTOR_WEIGHTS(b), TFVECTOR_COUNT(b));
+	float8		sump, sumq;
+	float8		res;
+
+	if (sa == 0.0 || sb == 0.0)
+		PG_RETURN_FLOAT8((sa == sb) ? 0.0 : 1.0);
+
+	res = tfvector_js_kernel(ca, sa, cb, sb, m, &sump, &sumq);
+	res = 0.5 * res + 0.5 * ((1.0 - sump) + (1.0 - sumq));
+
+	PG_RETURN_FLOAT8(Min(Max(res, 0.0), 1.0));
+}
+
+/*
+ * Hellinger distance, sqrt(1 - BC) where BC = sum(sqrt(a * b)) /
+ * sqrt(sum(a) * sum(b)) is the Bhattacharyya coefficient. 0 for two empty
+ * vectors and 1 if only one of them is empty.
+ */
+Datum
+hellinger(PG_FUNCTION_ARGS)
+{
+	TfVector	*a = PG_GETARG_TFVECTOR_P(0);
+	TfVector	*b = PG_GETARG_TFVECTOR_P(1);
+	float8		*ca, *cb;
+	int			m = tfvector_common(a, b, &ca, &cb);
+	float8		sa = tfvector_sum(TFVECTOR_WEIGHTS(a), TFVECTOR_COUNT(a));
+	float8		sb = tfvector_sum(TFVECTOR_WEIGHTS(b), TFVECTOR_COUNT(b));
+	float8		bc;
+
+	if (sa == 0.0 || sb == 0.0)
+		PG_RETURN_FLOAT8((sa == sb) ? 0.0 : 1.0);
+
+	bc = tfvector_sqrt_kernel(ca, cb, m) / sqrt(sa * sb);
+
+	PG_RETURN_FLOAT8(sqrt(Max(1.0 - bc, 0.0)));
+}
@@ -18,6 +18,12 @@
 
 #include "tokenizer.h"
 
+/* do the tokenizers fold case? (see PGS_IGNORE_CASE) */
+#ifdef PGS_IGNORE_CASE
+const bool	pgs_tokenizer_casefold = true;
+#else
+const bool	pgs_tokenizer_casefold = false;
+#endif
 
 TokenList *initTokenList(int a)
 {
@@ -360,8 +366,10 @@ void tokenizeBySpace(TokenList *t, char *s)
  * our n-grams are letter level and we have:
  * (i) full n-gram: euler = {" e", eu, ul, le, er, "r "}
  * (ii) normal n-gram: euler = {eu, ul, le, er}
+ *
+ * n is the gram length; tokenizeByGram() uses PGS_GRAM_LEN.
  */
-void tokenizeByGram(TokenList *t, char *s)
+void tokenizeByGramLen(TokenList *t, char *s, int n)
 {
 	char	*p;
 	int		slen;
@@ -375,14 +383,14 @@ void tokenizeByGram(TokenList *t, char *s)
 	 * n-grams with starting character
 	 */
 #ifdef PGS_FULL_NGRAM
-	for (i = (PGS_GRAM_LEN - 1); i > 0; i--)
+	for (i = (n - 1); i > 0; i--)
 	{
 		int 	ret;
 		char	*buf;
-		buf = (char *) malloc((PGS_GRAM_LEN + 1) * sizeof(char));
+		buf = (char *) malloc((n + 1) * sizeof(char));
 		memset(buf, PGS_BLANK_CHAR, i);
-		strncpy((buf + i), s, PGS_GRAM_LEN - i);
-		buf[PGS_GRAM_LEN] = '\0';
+		strncpy((buf + i), s, n - i);
+		buf[n] = '\0';
 
 		ret = addToken(t, buf);
 
@@ -397,10 +405,10 @@ void tokenizeByGram(TokenList *t, char *s)
 	{
 		int 	ret;
 		char	*buf;
-		buf = (char *) malloc((PGS_GRAM_LEN + 1) * sizeof(char));
+		buf = (char *) malloc((n + 1) * sizeof(char));
 		memset(buf, PGS_BLANK_CHAR, 1);
-		strncpy((buf + 1), s, PGS_GRAM_LEN - 1);
-		buf[PGS_GRAM_LEN] = '\0';
+		strncpy((buf + 1), s, n - 1);
+		buf[n] = '\0';
 
 		ret = addToken(t, buf);
 
@@ -413,13 +421,13 @@ void tokenizeByGram(TokenList *t, char *s)
 	}
 #endif
 
-	for (i = 0; i <= (slen - PGS_GRAM_LEN); i++)
+	for (i = 0; i <= (slen - n); i++)
 	{
 		int 	ret;
 		char	*buf;
-		buf = (char *) malloc((PGS_GRAM_LEN + 1) * sizeof(char));
-		strncpy(buf, p, PGS_GRAM_LEN);
-		buf[PGS_GRAM_LEN] = '\0';
+		buf = (char *) malloc((n + 1) * sizeof(char));
+		strncpy(buf, p, n);
+		buf[n] = '\0';
 
 		ret = addToken(t, buf);
 
@@ -437,14 +445,14 @@ void tokenizeByGram(TokenList *t, char *s)
 	 * n-grams with ending character
 	 */
 #ifdef PGS_FULL_NGRAM
-	for (i = 1; i < PGS_GRAM_LEN; i++)
+	for (i = 1; i < n; i++)
 	{
 		int 	ret;
 		char	*buf;
-		buf = (char *) malloc((PGS_GRAM_LEN + 1) * sizeof(char));
-		strncpy(buf, p, PGS_GRAM_LEN - i);
-		memset((buf + (PGS_GRAM_LEN - i)), PGS_BLANK_CHAR, i);
-		buf[PGS_GRAM_LEN] = '\0';
+		buf = (char *) malloc((n + 1) * sizeof(char));
+		strncpy(buf, p, n - i);
+		memset((buf + (n - i)), PGS_BLANK_CHAR, i);
+		buf[n] = '\0';
 
 		ret = addToken(t, buf);
 
@@ -461,10 +469,10 @@ void tokenizeByGram(TokenList *t, char *s)
 	{
 		int 	ret;
 		char	*buf;
-		buf = (char *) malloc((PGS_GRAM_LEN + 1) * sizeof(char));
-		strncpy(buf, p, PGS_GRAM_LEN - 1);
-		memset((buf + (PGS_GRAM_LEN - 1)), PGS_BLANK_CHAR, 1);
-		buf[PGS_GRAM_LEN] = '\0';
+		buf = (char *) malloc((n + 1) * sizeof(char));
+		strncpy(buf, p, n - 1);
+		memset((buf + (n - 1)), PGS_BLANK_CHAR, 1);
+		buf[n] = '\0';
 
 		ret = addToken(t, buf);
 
@@ -478,6 +486,11 @@ void tokenizeByGram(TokenList *t, char *s)
 #endif
 }
 
+void tokenizeByGram(TokenList *t, char *s)
+{
+	tokenizeByGramLen(t, s, PGS_GRAM_LEN);
+}
+
 void tokenizeByCamelCase(TokenList *t, char *s)
 {
 	const char		*cptr,	/* current pointer */
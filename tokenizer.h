@@ -35,6 +35,8 @@ typedef struct TokenList
 	Token	*tail;	/* last token */
 } TokenList;
 
+extern const bool pgs_tokenizer_casefold;
+
 TokenList *initTokenList(int isset);
 void destroyTokenList(TokenList *t);
 int addToken(TokenList *t, char *s);
@@ -45,4 +47,5 @@ void printToken(TokenList *t);
 void tokenizeByNonAlnum(TokenList *t, char *s);
 void tokenizeBySpace(TokenList *t, char *s);
 void tokenizeByGram(TokenList *t, char *s);
+void tokenizeByGramLen(TokenList *t, char *s, int n);
 void tokenizeByCamelCase(TokenList *t, char *s);
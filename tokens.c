@@ -0,0 +1,861 @@
+/*----------------------------------------------------------------------------
+ *
+ * tokens.c
+ *
+ * pgs_tokens is the token multiset of a string, tokenized once: the 32-bit
+ * hash of every distinct token and its number of occurrences, sorted by hash,
+ * after a header that records how the string was tokenized (tokenizer, q of
+ * the gram tokenizer and case folding).
+ *
+ * The token measures (block, cosine, dice, euclidean, jaccard,
+ * matchingcoefficient, overlapcoefficient and qgram) and their operators
+ * take two pgs_tokens and compare them with a merge of the sorted hashes, so
+ * a column of them (e.g. GENERATED ALWAYS AS (pgs_tokens(col, 'gram'))
+ * STORED) is not tokenized again at every comparison. Both values must be
+ * tokenized the same way; the tokenizer parameters of the measures are not
+ * used. Two tokens with the same hash count as one token, as in
+ * gin_similarity_hash_ops.
+ *
+ * The text representation is the header followed by hash:count pairs:
+ *
+ *     (gram,3,f){01a2b3c4:1,8e2f0d11:2}
+ *
+ * pgs_tokenize() returns the tokens themselves as a text[] (duplicates
+ * included, in the order they occur). block, cosine, dice, jaccard,
+ * matchingcoefficient and overlapcoefficient also take two such arrays,
+ * whoever tokenized them: both are sorted and merged like two pgs_tokens.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+
+#include "similarity.h"
+#include "tokenizer.h"
+
+#include <math.h>
+
+/* distinct token of a text[] and its number of occurrences */
+typedef struct PgsArrayToken
+{
+	const char	*data;
+	int			len;
+	int			freq;
+} PgsArrayToken;
+
+/* measures of the pgs_tokens overloads */
+typedef enum PgsTokensMeasure
+{
+	PGS_TOKENS_BLOCK,
+	PGS_TOKENS_COSINE,
+	PGS_TOKENS_DICE,
+	PGS_TOKENS_EUCLIDEAN,
+	PGS_TOKENS_JACCARD,
+	PGS_TOKENS_MATCHING,
+	PGS_TOKENS_OVERLAP,
+	PGS_TOKENS_QGRAM
+} PgsTokensMeasure;
+
+/*
+ * What the measures need to know about two token multisets
+ */
+typedef struct PgsTokensCounts
+{
+	int		atok;		/* distinct tokens of a */
+	int		btok;		/* distinct tokens of b */
+	int		comtok;		/* distinct tokens in both */
+	int		asize;		/* tokens of a (with duplicates) */
+	int		bsize;		/* tokens of b (with duplicates) */
+	int		amatch;		/* tokens of a (with duplicates) that are in b */
+	int		distance;	/* L1 distance of the counts */
+} PgsTokensCounts;
+
+static const struct
+{
+	const char	*name;
+	int			tokenizer;
+} pgs_tokens_tokenizers[] =
+{
+	{"alnum", PGS_UNIT_ALNUM},
+	{"gram", PGS_UNIT_GRAM},
+	{"word", PGS_UNIT_WORD},
+	{"camelcase", PGS_UNIT_CAMELCASE},
+	{NULL, 0}
+};
+
+PG_FUNCTION_INFO_V1(pgs_tokens_in);
+PG_FUNCTION_INFO_V1(pgs_tokens_out);
+PG_FUNCTION_INFO_V1(pgs_tokens_recv);
+PG_FUNCTION_INFO_V1(pgs_tokens_send);
+PG_FUNCTION_INFO_V1(pgs_tokens);
+PG_FUNCTION_INFO_V1(pgs_tokens_gram);
+PG_FUNCTION_INFO_V1(block_tokens);
+PG_FUNCTION_INFO_V1(block_tokens_op);
+PG_FUNCTION_INFO_V1(cosine_tokens);
+PG_FUNCTION_INFO_V1(cosine_tokens_op);
+PG_FUNCTION_INFO_V1(dice_tokens);
+PG_FUNCTION_INFO_V1(dice_tokens_op);
+PG_FUNCTION_INFO_V1(euclidean_tokens);
+PG_FUNCTION_INFO_V1(euclidean_tokens_op);
+PG_FUNCTION_INFO_V1(jaccard_tokens);
+PG_FUNCTION_INFO_V1(jaccard_tokens_op);
+PG_FUNCTION_INFO_V1(matchingcoefficient_tokens);
+PG_FUNCTION_INFO_V1(matchingcoefficient_tokens_op);
+PG_FUNCTION_INFO_V1(overlapcoefficient_tokens);
+PG_FUNCTION_INFO_V1(overlapcoefficient_tokens_op);
+PG_FUNCTION_INFO_V1(qgram_tokens);
+PG_FUNCTION_INFO_V1(qgram_tokens_op);
+PG_FUNCTION_INFO_V1(pgs_tokenize_array);
+PG_FUNCTION_INFO_V1(pgs_tokenize_array_gram);
+PG_FUNCTION_INFO_V1(block_array);
+PG_FUNCTION_INFO_V1(cosine_array);
+PG_FUNCTION_INFO_V1(dice_array);
+PG_FUNCTION_INFO_V1(jaccard_array);
+PG_FUNCTION_INFO_V1(matchingcoefficient_array);
+PG_FUNCTION_INFO_V1(overlapcoefficient_array);
+
+int
+pgs_tokens_tokenizer(const char *name)
+{
+	int		i;
+
+	for (i = 0; pgs_tokens_tokenizers[i].name != NULL; i++)
+	{
+		if (pg_strcasecmp(name, pgs_tokens_tokenizers[i].name) == 0)
+			return pgs_tokens_tokenizers[i].tokenizer;
+	}
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid tokenizer: \"%s\"", name),
+			 errhint("Valid values are \"alnum\", \"gram\", \"word\" and \"camelcase\".")));
+
+	return PGS_UNIT_ALNUM;		/* keep compiler quiet */
+}
+
+const char *
+pgs_tokens_tokenizer_name(int tokenizer)
+{
+	int		i;
+
+	for (i = 0; pgs_tokens_tokenizers[i].name != NULL; i++)
+	{
+		if (pgs_tokens_tokenizers[i].tokenizer == tokenizer)
+			return pgs_tokens_tokenizers[i].name;
+	}
+
+	elog(ERROR, "unrecognized tokenizer: %d", tokenizer);
+
+	return NULL;				/* keep compiler quiet */
+}
+
+static PgsTokens *
+pgs_tokens_alloc(int n)
+{
+	PgsTokens	*res;
+	int			len = PGS_TOKENS_SIZE(n);
+
+	res = (PgsTokens *) palloc0(len);
+	SET_VARSIZE(res, len);
+
+	return res;
+}
+
+void
+pgs_tokens_check_header(int tokenizer, int gramlen)
+{
+	/* the name check reports unknown tokenizers */
+	(void) pgs_tokens_tokenizer_name(tokenizer);
+
+	if (gramlen < 1 || gramlen > PGS_MAX_GRAM_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("q must be between 1 and %d", PGS_MAX_GRAM_LEN)));
+}
+
+static int
+pgs_tokens_entry_cmp(const void *a, const void *b)
+{
+	uint32	x = ((const PgsTokenEntry *) a)->hash;
+	uint32	y = ((const PgsTokenEntry *) b)->hash;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/*
+ * Sort the entries by hash and merge the ones with the same hash; returns
+ * the new number of entries
+ */
+static int
+pgs_tokens_sort(PgsTokenEntry *e, int n)
+{
+	int		i, j;
+
+	if (n == 0)
+		return 0;
+
+	qsort(e, n, sizeof(PgsTokenEntry), pgs_tokens_entry_cmp);
+
+	for (i = 1, j = 0; i < n; i++)
+	{
+		if (e[i].hash == e[j].hash)
+			e[j].freq += e[i].freq;
+		else
+			e[++j] = e[i];
+	}
+
+	return j + 1;
+}
+
+/*
+ * Tokens of t as the measures see them (pgs_tokenizer_casefold)
+ */
+PgsTokens *
+pgs_tokens_make(text *t, int tokenizer, int gramlen)
+{
+	PgsTokenOptions	opts;
+	TokenList		*tlist;
+	Token			*tok;
+	PgsTokens		*res;
+	char			*buf = text_to_cstring(t);
+	int				n;
+
+	pgs_tokens_check_header(tokenizer, gramlen);
+
+	if (strlen(buf) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	opts.tokenizer = tokenizer;
+	opts.gramlen = gramlen;
+	opts.casefold = pgs_tokenizer_casefold;
+
+	tlist = pgs_tokenize(&opts, buf);
+
+	res = pgs_tokens_alloc(tlist->size);
+	res->tokenizer = tokenizer;
+	res->gramlen = gramlen;
+	res->casefold = opts.casefold;
+
+	for (tok = tlist->head, n = 0; tok != NULL; tok = tok->next, n++)
+	{
+		res->e[n].hash = DatumGetUInt32(hash_any((const unsigned char *) tok->data,
+												 strlen(tok->data)));
+		res->e[n].freq = tok->freq;
+	}
+
+	destroyTokenList(tlist);
+
+	n = pgs_tokens_sort(res->e, n);
+	SET_VARSIZE(res, PGS_TOKENS_SIZE(n));
+
+	return res;
+}
+
+/*
+ * pgs_tokens(text, tokenizer); q is PGS_GRAM_LEN, as for the measures
+ */
+Datum
+pgs_tokens(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	char	*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	PG_RETURN_PGS_TOKENS_P(pgs_tokens_make(t, pgs_tokens_tokenizer(name), PGS_GRAM_LEN));
+}
+
+/*
+ * pgs_tokens(text, tokenizer, q)
+ */
+Datum
+pgs_tokens_gram(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	char	*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	PG_RETURN_PGS_TOKENS_P(pgs_tokens_make(t, pgs_tokens_tokenizer(name), PG_GETARG_INT32(2)));
+}
+
+void
+pgs_tokens_syntax_error(const char *typname, const char *str)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for type %s: \"%s\"", typname, str)));
+}
+
+/*
+ * Read the header "(tokenizer,q,casefold){" of the text form of a typname
+ * value; returns where the entries start.
+ */
+char *
+pgs_tokens_read_header(const char *typname, char *str, PgsTokenOptions *opts)
+{
+	char	*p = str;
+	char	name[16];
+	int		namelen = 0;
+	long	gramlen;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	if (*p++ != '(')
+		pgs_tokens_syntax_error(typname, str);
+
+	while (*p != ',' && *p != '\0')
+	{
+		if (namelen == sizeof(name) - 1)
+			pgs_tokens_syntax_error(typname, str);
+		name[namelen++] = *p++;
+	}
+	name[namelen] = '\0';
+	if (*p++ != ',')
+		pgs_tokens_syntax_error(typname, str);
+
+	gramlen = strtol(p, &p, 10);
+	if (*p++ != ',')
+		pgs_tokens_syntax_error(typname, str);
+
+	if (*p == 't')
+		opts->casefold = true;
+	else if (*p == 'f')
+		opts->casefold = false;
+	else
+		pgs_tokens_syntax_error(typname, str);
+	p++;
+	if (*p++ != ')' || *p++ != '{')
+		pgs_tokens_syntax_error(typname, str);
+
+	opts->tokenizer = pgs_tokens_tokenizer(name);
+	opts->gramlen = (gramlen >= 1 && gramlen <= PGS_MAX_GRAM_LEN) ? gramlen : 0;
+	pgs_tokens_check_header(opts->tokenizer, opts->gramlen);
+
+	return p;
+}
+
+void
+pgs_tokens_write_header(struct StringInfoData *buf, const PgsTokenOptions *opts)
+{
+	appendStringInfo(buf, "(%s,%d,%c){", pgs_tokens_tokenizer_name(opts->tokenizer),
+					 opts->gramlen, opts->casefold ? 't' : 'f');
+}
+
+Datum
+pgs_tokens_in(PG_FUNCTION_ARGS)
+{
+	char			*str = PG_GETARG_CSTRING(0);
+	char			*p;
+	PgsTokenOptions	opts;
+	PgsTokens		*res;
+	int				maxn = 8;
+	int				n = 0;
+
+	p = pgs_tokens_read_header("pgs_tokens", str, &opts);
+
+	res = pgs_tokens_alloc(maxn);
+	res->tokenizer = opts.tokenizer;
+	res->gramlen = opts.gramlen;
+	res->casefold = opts.casefold;
+
+	/* entries: hash:count, ... */
+	while (*p != '}')
+	{
+		unsigned long	hash;
+		long			freq;
+		char			*end;
+
+		if (n > 0 && *p++ != ',')
+			pgs_tokens_syntax_error("pgs_tokens", str);
+
+		hash = strtoul(p, &end, 16);
+		if (end == p || end - p > 2 * sizeof(uint32) || *end != ':')
+			pgs_tokens_syntax_error("pgs_tokens", str);
+		p = end + 1;
+
+		freq = strtol(p, &end, 10);
+		if (end == p || freq < 1 || freq > PG_INT32_MAX)
+			pgs_tokens_syntax_error("pgs_tokens", str);
+		p = end;
+
+		if (n == maxn)
+		{
+			maxn *= 2;
+			res = (PgsTokens *) repalloc(res, PGS_TOKENS_SIZE(maxn));
+		}
+		res->e[n].hash = (uint32) hash;
+		res->e[n].freq = (int32) freq;
+		n++;
+	}
+	p++;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	if (*p != '\0')
+		pgs_tokens_syntax_error("pgs_tokens", str);
+
+	n = pgs_tokens_sort(res->e, n);
+	SET_VARSIZE(res, PGS_TOKENS_SIZE(n));
+
+	PG_RETURN_PGS_TOKENS_P(res);
+}
+
+Datum
+pgs_tokens_out(PG_FUNCTION_ARGS)
+{
+	PgsTokens		*t = PG_GETARG_PGS_TOKENS_P(0);
+	int				n = PGS_TOKENS_COUNT(t);
+	StringInfoData	buf;
+	PgsTokenOptions	opts;
+	int				i;
+
+	opts.tokenizer = t->tokenizer;
+	opts.gramlen = t->gramlen;
+	opts.casefold = t->casefold;
+
+	initStringInfo(&buf);
+	pgs_tokens_write_header(&buf, &opts);
+
+	for (i = 0; i < n; i++)
+		appendStringInfo(&buf, "%s%08x:%d", (i > 0) ? "," : "", t->e[i].hash,
+						 t->e[i].freq);
+
+	appendStringInfoChar(&buf, '}');
+
+	PG_RETURN_CSTRING(buf.data);
+}
+
+Datum
+pgs_tokens_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int			tokenizer = pq_getmsgbyte(buf);
+	int			gramlen = pq_getmsgbyte(buf);
+	bool		casefold = (pq_getmsgbyte(buf) != 0);
+	int			n = pq_getmsgint(buf, sizeof(int32));
+	PgsTokens	*res;
+	int			i;
+
+	pgs_tokens_check_header(tokenizer, gramlen);
+
+	if (n < 0 || n > (buf->len - buf->cursor) / (2 * sizeof(int32)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid number of tokens in external pgs_tokens value")));
+
+	res = pgs_tokens_alloc(n);
+	res->tokenizer = tokenizer;
+	res->gramlen = gramlen;
+	res->casefold = casefold;
+
+	for (i = 0; i < n; i++)
+	{
+		res->e[i].hash = (uint32) pq_getmsgint(buf, sizeof(uint32));
+		res->e[i].freq = pq_getmsgint(buf, sizeof(int32));
+
+		if (res->e[i].freq < 1 || (i > 0 && res->e[i].hash <= res->e[i - 1].hash))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid token in external pgs_tokens value")));
+	}
+
+	PG_RETURN_PGS_TOKENS_P(res);
+}
+
+Datum
+pgs_tokens_send(PG_FUNCTION_ARGS)
+{
+	PgsTokens		*t = PG_GETARG_PGS_TOKENS_P(0);
+	int				n = PGS_TOKENS_COUNT(t);
+	StringInfoData	buf;
+	int				i;
+
+	pq_begintypsend(&buf);
+	pq_sendbyte(&buf, t->tokenizer);
+	pq_sendbyte(&buf, t->gramlen);
+	pq_sendbyte(&buf, t->casefold ? 1 : 0);
+	pq_sendint32(&buf, n);
+	for (i = 0; i < n; i++)
+	{
+		pq_sendint32(&buf, t->e[i].hash);
+		pq_sendint32(&buf, t->e[i].freq);
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Merge the sorted tokens of a and b
+ */
+static void
+pgs_tokens_counts(const PgsTokens *a, const PgsTokens *b, PgsTokensCounts *c)
+{
+	int		na = PGS_TOKENS_COUNT(a);
+	int		nb = PGS_TOKENS_COUNT(b);
+	int		i = 0,
+			j = 0;
+
+	if (a->tokenizer != b->tokenizer || a->casefold != b->casefold ||
+		(a->tokenizer == PGS_UNIT_GRAM && a->gramlen != b->gramlen))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("pgs_tokens values were not tokenized the same way")));
+
+	memset(c, 0, sizeof(PgsTokensCounts));
+	c->atok = na;
+	c->btok = nb;
+
+	while (i < na || j < nb)
+	{
+		if (j == nb || (i < na && a->e[i].hash < b->e[j].hash))
+		{
+			c->asize += a->e[i].freq;
+			c->distance += a->e[i].freq;
+			i++;
+		}
+		else if (i == na || b->e[j].hash < a->e[i].hash)
+		{
+			c->bsize += b->e[j].freq;
+			c->distance += b->e[j].freq;
+			j++;
+		}
+		else
+		{
+			c->comtok++;
+			c->asize += a->e[i].freq;
+			c->bsize += b->e[j].freq;
+			c->amatch += a->e[i].freq;
+			c->distance += abs(a->e[i].freq - b->e[j].freq);
+			i++;
+			j++;
+		}
+	}
+}
+
+/*
+ * The measures of block.c, cosine.c, ... from the counts
+ */
+static float8
+pgs_counts_measure(PgsTokensMeasure measure, const PgsTokensCounts *counts,
+				   bool normalized)
+{
+	PgsTokensCounts	c = *counts;
+	int				alltok;
+	float8			totpossible;
+	float8			totdistance;
+
+	alltok = c.atok + c.btok - c.comtok;
+
+	elog(DEBUG1, "tokens: %d, %d; common tokens: %d; all tokens: %d",
+		 c.atok, c.btok, c.comtok, alltok);
+
+	switch (measure)
+	{
+		case PGS_TOKENS_BLOCK:
+		case PGS_TOKENS_QGRAM:
+			if (!normalized)
+				return c.distance;
+			totpossible = c.asize + c.bsize;
+			return (float8) (totpossible - c.distance) / totpossible;
+		case PGS_TOKENS_COSINE:
+			return (float8) c.comtok / (sqrt(c.atok) * sqrt(c.btok));
+		case PGS_TOKENS_DICE:
+			return (float8) (2.0 * c.comtok) / (c.atok + c.btok);
+		case PGS_TOKENS_EUCLIDEAN:
+			totpossible = sqrt(c.asize * c.asize + c.bsize * c.bsize);
+			totdistance = sqrt(alltok - c.comtok);
+			if (!normalized)
+				return totdistance;
+			return (totpossible - totdistance) / totpossible;
+		case PGS_TOKENS_JACCARD:
+			return (float8) c.comtok / alltok;
+		case PGS_TOKENS_MATCHING:
+			if (!normalized)
+				return c.amatch;
+			return (float8) c.amatch / max2(c.asize, c.bsize);
+		case PGS_TOKENS_OVERLAP:
+			return (float8) c.comtok / min2(c.atok, c.btok);
+	}
+
+	return 0.0;					/* keep compiler quiet */
+}
+
+static float8
+pgs_tokens_measure(PgsTokensMeasure measure, const PgsTokens *a, const PgsTokens *b,
+				   bool normalized)
+{
+	PgsTokensCounts	c;
+
+	pgs_tokens_counts(a, b, &c);
+
+	return pgs_counts_measure(measure, &c, normalized);
+}
+
+#define PGS_TOKENS_MEASURE(fn, measure, is_normalized, threshold) \
+Datum \
+fn(PG_FUNCTION_ARGS) \
+{ \
+	PG_RETURN_FLOAT8(pgs_tokens_measure(measure, PG_GETARG_PGS_TOKENS_P(0), \
+										PG_GETARG_PGS_TOKENS_P(1), \
+										is_normalized)); \
+} \
+\
+Datum \
+fn##_op(PG_FUNCTION_ARGS) \
+{ \
+	/* threshold (we're comparing against) is normalized */ \
+	PG_RETURN_BOOL(pgs_tokens_measure(measure, PG_GETARG_PGS_TOKENS_P(0), \
+									  PG_GETARG_PGS_TOKENS_P(1), \
+									  true) >= threshold); \
+}
+
+PGS_TOKENS_MEASURE(block_tokens, PGS_TOKENS_BLOCK, pgs_block_is_normalized,
+				   pgs_block_threshold)
+PGS_TOKENS_MEASURE(cosine_tokens, PGS_TOKENS_COSINE, pgs_cosine_is_normalized,
+				   pgs_cosine_threshold)
+PGS_TOKENS_MEASURE(dice_tokens, PGS_TOKENS_DICE, pgs_dice_is_normalized,
+				   pgs_dice_threshold)
+PGS_TOKENS_MEASURE(euclidean_tokens, PGS_TOKENS_EUCLIDEAN, pgs_euclidean_is_normalized,
+				   pgs_euclidean_threshold)
+PGS_TOKENS_MEASURE(jaccard_tokens, PGS_TOKENS_JACCARD, pgs_jaccard_is_normalized,
+				   pgs_jaccard_threshold)
+PGS_TOKENS_MEASURE(matchingcoefficient_tokens, PGS_TOKENS_MATCHING,
+				   pgs_matching_is_normalized, pgs_matching_threshold)
+PGS_TOKENS_MEASURE(overlapcoefficient_tokens, PGS_TOKENS_OVERLAP,
+				   pgs_overlap_is_normalized, pgs_overlap_threshold)
+PGS_TOKENS_MEASURE(qgram_tokens, PGS_TOKENS_QGRAM, pgs_qgram_is_normalized,
+				   pgs_qgram_threshold)
+
+/*
+ * Tokens of t in the order they occur, duplicates included
+ */
+static ArrayType *
+pgs_tokenize_text(text *t, int tokenizer, int gramlen)
+{
+	TokenList	*tlist;
+	Token		*tok;
+	Datum		*elems;
+	char		*buf = text_to_cstring(t);
+	int			n;
+
+	pgs_tokens_check_header(tokenizer, gramlen);
+
+	if (strlen(buf) > PGS_MAX_STR_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("argument exceeds the maximum length of %d bytes",
+						PGS_MAX_STR_LEN)));
+
+	if (pgs_tokenizer_casefold)
+	{
+		char	*p;
+
+		for (p = buf; *p != '\0'; p++)
+			*p = pg_tolower((unsigned char) *p);
+	}
+
+	/* not a set: keep the duplicates */
+	tlist = initTokenList(0);
+
+	switch (tokenizer)
+	{
+		case PGS_UNIT_WORD:
+			tokenizeBySpace(tlist, buf);
+			break;
+		case PGS_UNIT_GRAM:
+			tokenizeByGramLen(tlist, buf, gramlen);
+			break;
+		case PGS_UNIT_CAMELCASE:
+			tokenizeByCamelCase(tlist, buf);
+			break;
+		case PGS_UNIT_ALNUM:
+		default:
+			tokenizeByNonAlnum(tlist, buf);
+			break;
+	}
+
+	elems = (Datum *) palloc(Max(tlist->size, 1) * sizeof(Datum));
+
+	/* the list is in reverse order */
+	n = tlist->size;
+	for (tok = tlist->head; tok != NULL; tok = tok->next)
+		elems[--n] = PointerGetDatum(cstring_to_text(tok->data));
+
+	n = tlist->size;
+	destroyTokenList(tlist);
+
+	return construct_array(elems, n, TEXTOID, -1, false, 'i');
+}
+
+/*
+ * pgs_tokenize(text, tokenizer); q is PGS_GRAM_LEN, as for the measures
+ */
+Datum
+pgs_tokenize_array(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	char	*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	PG_RETURN_ARRAYTYPE_P(pgs_tokenize_text(t, pgs_tokens_tokenizer(name), PGS_GRAM_LEN));
+}
+
+/*
+ * pgs_tokenize(text, tokenizer, q)
+ */
+Datum
+pgs_tokenize_array_gram(PG_FUNCTION_ARGS)
+{
+	text	*t = PG_GETARG_TEXT_PP(0);
+	char	*name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	PG_RETURN_ARRAYTYPE_P(pgs_tokenize_text(t, pgs_tokens_tokenizer(name), PG_GETARG_INT32(2)));
+}
+
+/* byte order; the collation doesn't matter for equality */
+static int
+pgs_array_token_cmp(const void *a, const void *b)
+{
+	const PgsArrayToken	*x = (const PgsArrayToken *) a;
+	const PgsArrayToken	*y = (const PgsArrayToken *) b;
+	int		r = memcmp(x->data, y->data, Min(x->len, y->len));
+
+	if (r != 0)
+		return r;
+
+	return (x->len < y->len) ? -1 : (x->len > y->len) ? 1 : 0;
+}
+
+/*
+ * Distinct tokens of a text[], sorted
+ */
+static PgsArrayToken *
+pgs_array_tokens(ArrayType *arr, int *n)
+{
+	Datum			*elems;
+	bool			*nulls;
+	PgsArrayToken	*res;
+	int				nelems;
+	int				i, j;
+
+	if (ARR_NDIM(arr) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("tokens must be a one-dimensional array")));
+
+	deconstruct_array(arr, TEXTOID, -1, false, 'i', &elems, &nulls, &nelems);
+
+	res = (PgsArrayToken *) palloc(Max(nelems, 1) * sizeof(PgsArrayToken));
+	for (i = 0; i < nelems; i++)
+	{
+		text	*t;
+
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("tokens must not contain nulls")));
+
+		t = DatumGetTextPP(elems[i]);
+		res[i].data = VARDATA_ANY(t);
+		res[i].len = VARSIZE_ANY_EXHDR(t);
+		res[i].freq = 1;
+	}
+
+	*n = 0;
+	if (nelems == 0)
+		return res;
+
+	qsort(res, nelems, sizeof(PgsArrayToken), pgs_array_token_cmp);
+
+	for (i = 1, j = 0; i < nelems; i++)
+	{
+		if (pgs_array_token_cmp(&res[i], &res[j]) == 0)
+			res[j].freq++;
+		else
+			res[++j] = res[i];
+	}
+	*n = j + 1;
+
+	return res;
+}
+
+/*
+ * Merge the sorted tokens of two arrays (see pgs_tokens_counts)
+ */
+static void
+pgs_array_counts(ArrayType *x, ArrayType *y, PgsTokensCounts *c)
+{
+	int				na, nb;
+	PgsArrayToken	*a = pgs_array_tokens(x, &na);
+	PgsArrayToken	*b = pgs_array_tokens(y, &nb);
+	int				i = 0,
+					j = 0;
+
+	memset(c, 0, sizeof(PgsTokensCounts));
+	c->atok = na;
+	c->btok = nb;
+
+	while (i < na || j < nb)
+	{
+		int		r;
+
+		if (j == nb)
+			r = -1;
+		else if (i == na)
+			r = 1;
+		else
+			r = pgs_array_token_cmp(&a[i], &b[j]);
+
+		if (r < 0)
+		{
+			c->asize += a[i].freq;
+			c->distance += a[i].freq;
+			i++;
+		}
+		else if (r > 0)
+		{
+			c->bsize += b[j].freq;
+			c->distance += b[j].freq;
+			j++;
+		}
+		else
+		{
+			c->comtok++;
+			c->asize += a[i].freq;
+			c->bsize += b[j].freq;
+			c->amatch += a[i].freq;
+			c->distance += abs(a[i].freq - b[j].freq);
+			i++;
+			j++;
+		}
+	}
+}
+
+#define PGS_ARRAY_MEASURE(fn, measure, is_normalized) \
+Datum \
+fn(PG_FUNCTION_ARGS) \
+{ \
+	PgsTokensCounts	c; \
+\
+	pgs_array_counts(PG_GETARG_ARRAYTYPE_P(0), PG_GETARG_ARRAYTYPE_P(1), &c); \
+\
+	PG_RETURN_FLOAT8(pgs_counts_measure(measure, &c, is_normalized)); \
+}
+
+PGS_ARRAY_MEASURE(block_array, PGS_TOKENS_BLOCK, pgs_block_is_normalized)
+PGS_ARRAY_MEASURE(cosine_array, PGS_TOKENS_COSINE, pgs_cosine_is_normalized)
+PGS_ARRAY_MEASURE(dice_array, PGS_TOKENS_DICE, pgs_dice_is_normalized)
+PGS_ARRAY_MEASURE(jaccard_array, PGS_TOKENS_JACCARD, pgs_jaccard_is_normalized)
+PGS_ARRAY_MEASURE(matchingcoefficient_array, PGS_TOKENS_MATCHING, pgs_matching_is_normalized)
+PGS_ARRAY_MEASURE(overlapcoefficient_array, PGS_TOKENS_OVERLAP, pgs_overlap_is_normalized)
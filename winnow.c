@@ -0,0 +1,407 @@
+/*----------------------------------------------------------------------------
+ *
+ * winnow.c
+ *
+ * Winnowing fingerprints of long documents (Schleimer, Wilkerson and Aiken,
+ * "Winnowing: Local Algorithms for Document Fingerprinting")
+ *
+ * The text is normalized (only letters and digits, ASCII lower cased) and
+ * every k-gram of it is hashed. Of each window of w consecutive k-gram
+ * hashes, the smallest one (the rightmost, on ties) is a fingerprint. Two
+ * documents that share a passage of at least w + k - 1 normalized
+ * characters share at least one fingerprint, and a document of n
+ * characters has about 2n / (w + 1) of them.
+ *
+ * The fingerprints are returned as a sorted int4[] without duplicates, so
+ * they can be indexed with the GIN array_ops (&&, @>) and compared with
+ * fingerprint_jaccard() and fingerprint_containment().
+ *
+ * There is no length limit (unlike PGS_MAX_STR_LEN of the measures): the
+ * text is read in slices of PGS_WINNOW_SLICE bytes, so an uncompressed value
+ * stored out of line (STORAGE EXTERNAL) is never in memory as a whole. A
+ * compressed value is decompressed once.
+ *
+ * Copyright (c) 2008-2020, Euler Taveira de Oliveira
+ *
+ *----------------------------------------------------------------------------
+ */
+
+#include "similarity.h"
+
+#include "miscadmin.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+
+#include <ctype.h>
+
+/* bytes detoasted at a time */
+#define	PGS_WINNOW_SLICE		(256 * 1024)
+
+/* defaults of winnow(text) */
+#define	PGS_WINNOW_K			8
+#define	PGS_WINNOW_W			8
+
+#define	PGS_WINNOW_MAX_K		256
+#define	PGS_WINNOW_MAX_W		256
+
+/* base of the rolling k-gram hash (mod 2^32) */
+#define	PGS_WINNOW_BASE			257
+
+PG_FUNCTION_INFO_V1(winnow);
+PG_FUNCTION_INFO_V1(winnow_default);
+PG_FUNCTION_INFO_V1(fingerprint_jaccard);
+PG_FUNCTION_INFO_V1(fingerprint_containment);
+
+typedef struct WinnowState
+{
+	int		k;
+	int		w;
+	uint32	basek;			/* PGS_WINNOW_BASE^k */
+	uint32	h;				/* rolling hash of the last k characters */
+	unsigned char	*chars;	/* the last k characters (ring) */
+	int64	nchars;
+	uint32	*hashes;		/* the last w k-gram hashes (ring) */
+	int64	nhashes;
+	int64	selected;		/* k-gram of the last fingerprint (-1: none) */
+	uint32	*fp;			/* fingerprints */
+	int		nfp;
+	int		maxfp;
+} WinnowState;
+
+/* murmur3 finalizer: the rolling hash alone is poorly distributed */
+static uint32
+winnow_mix(uint32 h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static void
+winnow_emit(WinnowState *s, uint32 h)
+{
+	if (s->nfp == s->maxfp)
+	{
+		s->maxfp *= 2;
+		s->fp = (uint32 *) repalloc(s->fp, s->maxfp * sizeof(uint32));
+	}
+	s->fp[s->nfp++] = h;
+}
+
+/*
+ * Fingerprint of the window that ends at the last k-gram
+ */
+static void
+winnow_window(WinnowState *s)
+{
+	int64	first = s->nhashes - s->w;
+	int64	min = first;
+	int64	i;
+
+	for (i = first + 1; i < s->nhashes; i++)
+	{
+		if (s->hashes[i % s->w] <= s->hashes[min % s->w])
+			min = i;
+	}
+
+	if (min != s->selected)
+	{
+		winnow_emit(s, s->hashes[min % s->w]);
+		s->selected = min;
+	}
+}
+
+static void
+winnow_add_hash(WinnowState *s, uint32 h)
+{
+	s->hashes[s->nhashes % s->w] = h;
+	s->nhashes++;
+
+	if (s->nhashes >= s->w)
+		winnow_window(s);
+}
+
+static void
+winnow_add_chars(WinnowState *s, const char *p, int len)
+{
+	int		i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char	c = (unsigned char) p[i];
+		int		pos;
+
+		/* non-ASCII bytes are kept as they are */
+		if (c < 0x80)
+		{
+			if (!isalnum(c))
+				continue;
+			c = tolower(c);
+		}
+
+		pos = s->nchars % s->k;
+
+		s->h = s->h * PGS_WINNOW_BASE + c;
+		if (s->nchars >= s->k)
+			s->h -= s->basek * s->chars[pos];
+
+		s->chars[pos] = c;
+		s->nchars++;
+
+		if (s->nchars >= s->k)
+			winnow_add_hash(s, winnow_mix(s->h));
+	}
+}
+
+static void
+winnow_finish(WinnowState *s)
+{
+	/* a short text is one k-gram */
+	if (s->nchars > 0 && s->nchars < s->k)
+		winnow_add_hash(s, winnow_mix(s->h));
+
+	/* fewer k-grams than a window: their smallest hash */
+	if (s->nhashes > 0 && s->nhashes < s->w)
+	{
+		uint32	min = s->hashes[0];
+		int		i;
+
+		for (i = 1; i < s->nhashes; i++)
+			min = Min(min, s->hashes[i]);
+
+		winnow_emit(s, min);
+	}
+}
+
+static int
+winnow_cmp(const void *a, const void *b)
+{
+	int32	x = *(const int32 *) a;
+	int32	y = *(const int32 *) b;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/*
+ * Sort and remove duplicates; returns the new number of elements
+ */
+static int
+winnow_unique(int32 *a, int n)
+{
+	int		i, j;
+
+	if (n == 0)
+		return 0;
+
+	qsort(a, n, sizeof(int32), winnow_cmp);
+
+	for (i = 1, j = 1; i < n; i++)
+	{
+		if (a[i] != a[j - 1])
+			a[j++] = a[i];
+	}
+
+	return j;
+}
+
+/*
+ * Is the value compressed? Slices of it would be decompressed from the start
+ * every time.
+ */
+static bool
+winnow_is_compressed(Datum d)
+{
+	struct varlena	*v = (struct varlena *) DatumGetPointer(d);
+
+	if (VARATT_IS_COMPRESSED(v))
+		return true;
+
+	if (VARATT_IS_EXTERNAL_ONDISK(v))
+	{
+		struct varatt_external	toast;
+
+		VARATT_EXTERNAL_GET_POINTER(toast, v);
+
+		return VARATT_EXTERNAL_IS_COMPRESSED(toast);
+	}
+
+	return false;
+}
+
+static ArrayType *
+winnow_datum(Datum d, int k, int w)
+{
+	WinnowState	s;
+	Datum		*elems;
+	int64		len;
+	int			i;
+
+	if (k < 1 || k > PGS_WINNOW_MAX_K)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("k-gram length must be between 1 and %d", PGS_WINNOW_MAX_K)));
+	if (w < 1 || w > PGS_WINNOW_MAX_W)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("window size must be between 1 and %d", PGS_WINNOW_MAX_W)));
+
+	memset(&s, 0, sizeof(s));
+	s.k = k;
+	s.w = w;
+	s.basek = 1;
+	for (i = 0; i < k; i++)
+		s.basek *= PGS_WINNOW_BASE;
+	s.chars = (unsigned char *) palloc(k);
+	s.hashes = (uint32 *) palloc(w * sizeof(uint32));
+	s.selected = -1;
+	s.maxfp = 64;
+	s.fp = (uint32 *) palloc(s.maxfp * sizeof(uint32));
+
+	len = toast_raw_datum_size(d) - VARHDRSZ;
+
+	if (len <= PGS_WINNOW_SLICE || winnow_is_compressed(d))
+	{
+		text	*t = DatumGetTextPP(d);
+
+		winnow_add_chars(&s, VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+	}
+	else
+	{
+		int64	off;
+
+		for (off = 0; off < len; off += PGS_WINNOW_SLICE)
+		{
+			text	*t = (text *) PG_DETOAST_DATUM_SLICE(d, off, PGS_WINNOW_SLICE);
+
+			CHECK_FOR_INTERRUPTS();
+
+			winnow_add_chars(&s, VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+
+			if ((Pointer) t != DatumGetPointer(d))
+				pfree(t);
+		}
+	}
+
+	winnow_finish(&s);
+
+	s.nfp = winnow_unique((int32 *) s.fp, s.nfp);
+
+	elog(DEBUG1, "winnow: " INT64_FORMAT " characters, " INT64_FORMAT " k-grams, %d fingerprints",
+		 s.nchars, s.nhashes, s.nfp);
+
+	elems = (Datum *) palloc(Max(s.nfp, 1) * sizeof(Datum));
+	for (i = 0; i < s.nfp; i++)
+		elems[i] = Int32GetDatum((int32) s.fp[i]);
+
+	return construct_array(elems, s.nfp, INT4OID, sizeof(int32), true, 'i');
+}
+
+Datum
+winnow(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_ARRAYTYPE_P(winnow_datum(PG_GETARG_DATUM(0), PG_GETARG_INT32(1),
+									   PG_GETARG_INT32(2)));
+}
+
+Datum
+winnow_default(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_ARRAYTYPE_P(winnow_datum(PG_GETARG_DATUM(0), PGS_WINNOW_K, PGS_WINNOW_W));
+}
+
+/*
+ * Distinct elements of a fingerprint set, sorted
+ */
+static int32 *
+fingerprint_set(ArrayType *arr, int *n)
+{
+	Datum	*elems;
+	bool	*nulls;
+	int32	*res;
+	int		nelems;
+	int		i;
+
+	if (ARR_NDIM(arr) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("fingerprints must be a one-dimensional array")));
+
+	deconstruct_array(arr, INT4OID, sizeof(int32), true, 'i', &elems, &nulls, &nelems);
+
+	res = (int32 *) palloc(Max(nelems, 1) * sizeof(int32));
+	for (i = 0; i < nelems; i++)
+	{
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("fingerprints must not contain nulls")));
+		res[i] = DatumGetInt32(elems[i]);
+	}
+
+	*n = winnow_unique(res, nelems);
+
+	return res;
+}
+
+static int
+fingerprint_common(const int32 *a, int na, const int32 *b, int nb)
+{
+	int		i = 0,
+			j = 0,
+			res = 0;
+
+	while (i < na && j < nb)
+	{
+		if (a[i] == b[j])
+		{
+			res++;
+			i++;
+			j++;
+		}
+		else if (a[i] < b[j])
+			i++;
+		else
+			j++;
+	}
+
+	return res;
+}
+
+Datum
+fingerprint_jaccard(PG_FUNCTION_ARGS)
+{
+	int		na, nb, common;
+	int32	*a = fingerprint_set(PG_GETARG_ARRAYTYPE_P(0), &na);
+	int32	*b = fingerprint_set(PG_GETARG_ARRAYTYPE_P(1), &nb);
+
+	/* empty sets have nothing in common */
+	if (na + nb == 0)
+		PG_RETURN_FLOAT8(0.0);
+
+	common = fingerprint_common(a, na, b, nb);
+
+	PG_RETURN_FLOAT8((float8) common / (na + nb - common));
+}
+
+/*
+ * Fraction of the fingerprints of a that are in b (how much of a is in b)
+ */
+Datum
+fingerprint_containment(PG_FUNCTION_ARGS)
+{
+	int		na, nb;
+	int32	*a = fingerprint_set(PG_GETARG_ARRAYTYPE_P(0), &na);
+	int32	*b = fingerprint_set(PG_GETARG_ARRAYTYPE_P(1), &nb);
+
+	if (na == 0)
+		PG_RETURN_FLOAT8(0.0);
+
+	PG_RETURN_FLOAT8((float8) fingerprint_common(a, na, b, nb) / na);
+}